@@ -0,0 +1,42 @@
+# sai audio throughput: record into a spi ram ring while the interpreter drains it,
+# and keeps the spi ram busy with copies. Underruns and overruns should stay 0.
+# run on the board: mpremote run bench/audio.py
+
+import time
+import spiram
+
+RATE = 48000
+SECONDS = 10
+RING = 1024 * 1024
+
+ring = bytearray(RING)
+chunk = bytearray(16 * 1024)
+a = bytearray(256 * 1024)
+b = bytearray(256 * 1024)
+
+audio = spiram.Audio(ring, rate=RATE, mode=spiram.Audio.RECORD)
+audio.start()
+t = time.ticks_ms()
+drained = 0
+while time.ticks_diff(time.ticks_ms(), t) < SECONDS * 1000:
+    # load on the qspi bus
+    a[:] = b
+    n = audio.readinto(chunk)
+    if n:
+        drained += n
+audio.stop()
+ms = time.ticks_diff(time.ticks_ms(), t)
+bytes_, underruns, overruns, used = audio.stats()
+print("record %d Hz stereo 16 bit, %d ms" % (RATE, ms))
+print("dma     %8d byte %8.1f kbyte/s" % (bytes_, bytes_ / ms))
+print("drained %8d byte %8.1f kbyte/s" % (drained, drained / ms))
+print("expected %7.1f kbyte/s, overruns %d, in ring %d" % (RATE * 4 / 1000, overruns, used))
+
+# play back what is left in a ring of silence
+audio = spiram.Audio(ring, rate=RATE, mode=spiram.Audio.PLAY)
+for i in range(0, RING // len(chunk) - 1):
+    audio.write(bytes(len(chunk)))
+audio.start()
+time.sleep_ms(1000)
+audio.stop()
+print("play underruns %d" % audio.stats()[1])
@@ -0,0 +1,42 @@
+# fdcan logger: drain the spi ram ring in batches and count frames
+# run on the board: mpremote run bench/canlog.py
+
+import struct
+import time
+import spiram
+
+SECONDS = 10
+
+ring = bytearray(4 * 1024 * 1024)
+batch = bytearray(64 * 1024)
+log = spiram.CANLog(ring, bitrate=1000000, data_bitrate=5000000)
+
+
+def records(buf, n):
+    # yields (time_us, id, flags, data)
+    pos = 0
+    while pos < n:
+        t, ident, ln, flags = struct.unpack_from("<IIBB", buf, pos)
+        yield t, ident, flags, bytes(buf[pos + 10 : pos + 10 + ln])
+        pos += (10 + ln + 3) & ~3
+
+
+log.start()
+start = time.ticks_ms()
+frames = 0
+first = last = None
+while time.ticks_diff(time.ticks_ms(), start) < SECONDS * 1000:
+    n = log.readinto(batch)
+    if not n:
+        time.sleep_ms(10)
+        continue
+    for t, ident, flags, data in records(batch, n):
+        if first is None:
+            first = t
+        last = t
+        frames += 1
+log.stop()
+n, dropped, lost, used = log.stats()
+print("frames %d, dropped %d, lost %d" % (frames, dropped, lost))
+if first is not None and last != first:
+    print("%.0f frames/s" % (frames * 1000000 / time.ticks_diff(last, first)))
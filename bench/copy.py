@@ -0,0 +1,44 @@
+# mdma copy vs cpu memcpy
+# run on the board: mpremote run bench/copy.py
+
+import time
+import spiram
+
+SIZES = (1024, 16 * 1024, 256 * 1024, 1024 * 1024)
+
+
+def mbps(n, us):
+    return n / us if us else 0
+
+
+def bench(name, dst, src, n):
+    t = time.ticks_us()
+    dst[0:n] = src[0:n]
+    cpu = time.ticks_diff(time.ticks_us(), t)
+    d = memoryview(dst)[0:n]
+    s = memoryview(src)[0:n]
+    t = time.ticks_us()
+    spiram.copy(d, s)
+    dma = time.ticks_diff(time.ticks_us(), t)
+    print("%-16s %8d %8.1f %8.1f" % (name, n, mbps(n, cpu), mbps(n, dma)))
+
+
+print("%-16s %8s %8s %8s" % ("copy", "bytes", "cpu MB/s", "dma MB/s"))
+
+# heap is in spi ram
+a = bytearray(max(SIZES))
+b = bytearray(max(SIZES))
+for n in SIZES:
+    bench("psram->psram", a, b, n)
+
+# internal ram: axi sram above the static data, unused when the heap is in spi ram
+sram = memoryview(bytearray(0))
+try:
+    import uctypes
+    sram = uctypes.bytearray_at(0x24080000, 256 * 1024)
+except ImportError:
+    pass
+for n in SIZES:
+    if n <= len(sram):
+        bench("psram->sram", sram, a, n)
+        bench("sram->psram", a, sram, n)
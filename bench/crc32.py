@@ -0,0 +1,36 @@
+# crc32: Mbyte/s of binascii.crc32 on the crc peripheral and in software, 4 Mbyte in spi ram
+# run on the board: mpremote run bench/crc32.py
+
+import binascii
+import os
+import time
+import spiram
+
+SIZE = 4 * 1024 * 1024
+CHUNK = 64 * 1024
+
+buf = bytearray(SIZE)
+pattern = os.urandom(CHUNK)
+for i in range(0, SIZE, CHUNK):
+    buf[i:i + CHUNK] = pattern
+mv = memoryview(buf)
+
+
+def run(name, fn):
+    t = time.ticks_us()
+    crc = fn()
+    us = time.ticks_diff(time.ticks_us(), t)
+    print("%-20s %08x %8d us %6.1f MB/s" % (name, crc, us, SIZE / us))
+    return crc
+
+
+hw = run("binascii.crc32", lambda: binascii.crc32(buf))
+sw = run("software", lambda: spiram.crc32(buf, hw=False))
+# unaligned start and continued over two calls
+run("unaligned, 2 calls", lambda: spiram.crc32(mv[SIZE // 2 + 1:], spiram.crc32(mv[: SIZE // 2 + 1])))
+h = spiram.CRC32()
+for i in range(0, SIZE, CHUNK):
+    h.update(mv[i:i + CHUNK])
+print("CRC32 object, 64 kbyte updates: %s" % binascii.hexlify(h.digest()).decode())
+print("crc %s" % ("ok" if hw == sw and int.from_bytes(h.digest(), "big") == hw else "MISMATCH"))
+print("crc_stats: calls %d, software %d, cpu %d bytes, mdma %d bytes, errors %d" % spiram.crc_stats())
@@ -0,0 +1,101 @@
+# export: send a file from the sd card to the host over usb cdc, through a pipe in spi ram
+# run on the board, from the uart repl: mpremote connect /dev/ttyUSB0 run bench/export.py
+# on the host: cat /dev/ttyACM0 > export.bin
+# reads /sd/log.bin, e.g. written by bench/sdlog.py
+
+import os
+import time
+import pyb
+import spiram
+import uasyncio as asyncio
+from uasyncio import core
+
+PATH = "/sd/log.bin"
+CHUNK = 64 * 1024
+DEPTH = 3
+
+
+# wait until a stream is readable or writable, without copying like StreamReader does
+def readable(s):
+    yield core._io_queue.queue_read(s)
+
+
+def writable(s):
+    yield core._io_queue.queue_write(s)
+
+
+# sd card to pipe. File reads of whole clusters go by dma into the pipe buffer.
+async def source(f, pipe):
+    while True:
+        buf = pipe.get_free()
+        if buf is None:
+            await writable(pipe)
+            continue
+        n = f.readinto(buf)
+        if not n:
+            break
+        pipe.put(n)
+        # let the other tasks run between sd card reads
+        await asyncio.sleep_ms(0)
+    pipe.close()
+
+
+# pipe to usb. The cdc interrupt sends while the sd card reads the next buffer.
+async def sink(pipe, usb, process=None):
+    while True:
+        buf = pipe.get_full()
+        if buf is None:
+            await readable(pipe)
+            continue
+        if not buf:
+            break
+        if process:
+            process(buf)
+        off = 0
+        while off < len(buf):
+            await writable(usb)
+            n = usb.write(buf[off:])
+            if n:
+                off += n
+        pipe.release()
+
+
+def export(path, depth):
+    usb = pyb.USB_VCP()
+    usb.setinterrupt(-1)
+    pipe = spiram.Pipe(bytearray(depth * CHUNK + 32), depth=depth)
+    with open(path, "rb") as f:
+        asyncio.run(asyncio.gather(source(f, pipe), sink(pipe, usb)))
+    usb.setinterrupt(3)
+    return pipe.stats()
+
+
+# serial: read a chunk, then write it
+def export_serial(path):
+    usb = pyb.USB_VCP()
+    usb.setinterrupt(-1)
+    buf = bytearray(CHUNK)
+    total = 0
+    t = time.ticks_us()
+    with open(path, "rb") as f:
+        while True:
+            n = f.readinto(buf)
+            if not n:
+                break
+            usb.write(memoryview(buf)[:n])
+            total += n
+    usb.setinterrupt(3)
+    us = time.ticks_diff(time.ticks_us(), t)
+    return total, us
+
+
+os.mount(pyb.SDCard(), "/sd")
+
+total, us = export_serial(PATH)
+print("serial: %d bytes, %.2f MB/s" % (total, total / us))
+
+for depth in (2, DEPTH):
+    nin, nout, us, mbps, pwaits, cwaits = export(PATH, depth)
+    print("pipe depth %d: %d bytes, %.2f MB/s, %d sd waits, %d usb waits" % (depth, nout, mbps, pwaits, cwaits))
+
+os.umount("/sd")
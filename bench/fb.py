@@ -0,0 +1,65 @@
+# fb: frames/s of typical ui updates, dirty rectangles against sending the full 320x240 rgb565 frame
+# no display needed, only sck, mosi and the dc and cs pins are driven.
+# run on the board: mpremote run bench/fb.py
+
+import time
+import machine
+import spiram
+
+WIDTH = 320
+HEIGHT = 240
+FRAMES = 50
+
+spi = machine.SPI(1, baudrate=50000000, polarity=0, phase=0)
+dc = machine.Pin("A2", machine.Pin.OUT, value=1)  # any free pins
+cs = machine.Pin("A3", machine.Pin.OUT, value=1)
+
+fb = spiram.FrameBuffer(bytearray(WIDTH * HEIGHT * 2), WIDTH, HEIGHT)
+fb.fill(0)
+fb.flush(spi, dc, cs)
+
+
+def clock(i):
+    fb.fill_rect(240, 4, 72, 8, 0)
+    fb.text("%02d:%02d:%02d" % (i // 3600 % 24, i // 60 % 60, i % 60), 240, 4, 0xFFFF)
+
+
+def gauge(i):
+    clock(i)
+    v = i * 7 % 200
+    fb.fill_rect(20, 200, 200, 16, 0x0000)
+    fb.fill_rect(20, 200, v, 16, 0x07E0)
+    fb.text("%3d%%" % (v // 2), 230, 204, 0xFFFF)
+
+
+def plot(i):
+    gauge(i)
+    x = 20 + i % 280
+    fb.vline(x, 40, 140, 0)
+    fb.pixel(x, 110 + (i * 13) % 60 - 30, 0xF800)
+
+
+def cursor(i):
+    x = i * 5 % (WIDTH - 16)
+    y = i * 3 % (HEIGHT - 16)
+    fb.rect(x, y, 16, 16, 0xFFFF)
+
+
+def bench(name, draw, full):
+    fb.flush(spi, dc, cs)
+    t = time.ticks_us()
+    for i in range(FRAMES):
+        draw(i)
+        if full:
+            fb.invalidate()
+        fb.flush(spi, dc, cs)
+    us = time.ticks_diff(time.ticks_us(), t)
+    print("%-8s %-5s %7.1f fps" % (name, "full" if full else "dirty", FRAMES * 1000000 / us))
+
+
+for name, draw in (("clock", clock), ("gauge", gauge), ("plot", plot), ("cursor", cursor)):
+    bench(name, draw, True)
+    bench(name, draw, False)
+
+flushes, rects, nbytes, us = fb.stats()
+print("%d flushes, %d rectangles, %d kbyte, last flush %d us" % (flushes, rects, nbytes // 1024, us))
@@ -0,0 +1,37 @@
+# flash_rww: program flash bank 2 from spi ram while the interpreter runs
+# run on the board: mpremote run bench/flash_rww.py
+# overwrites the first 256 kbyte of flash bank 2
+
+import time
+import uctypes
+import spiram
+
+SIZE = 256 * 1024
+
+fw = spiram.FlashWriter()
+buf = bytearray(SIZE)
+for i in range(0, SIZE, 4):
+    buf[i] = i >> 2 & 0xFF
+
+
+# interpreter speed, idle; same loop body as below
+n = 0
+t = time.ticks_ms()
+while not fw.busy() and time.ticks_diff(time.ticks_ms(), t) < 100:
+    n += 1
+idle = n / 100
+
+# erase and program, counting loops meanwhile
+n = 0
+t = time.ticks_ms()
+fw.write(fw.BANK2, buf)
+while fw.busy() and time.ticks_diff(time.ticks_ms(), t) >= 0:
+    n += 1
+fw.wait()
+ms = time.ticks_diff(time.ticks_ms(), t)
+print("%d kbyte in %d ms, %.1f kbyte/s" % (SIZE // 1024, ms, SIZE / ms * 1000 / 1024))
+print("interpreter during write: %d%% of idle speed" % (100 * n / (idle * ms)))
+
+# verify through the memory map
+flash = uctypes.bytearray_at(fw.BANK2, SIZE)
+print("verify", "ok" if flash == buf else "FAILED")
@@ -0,0 +1,48 @@
+# gc_alloc: allocation latency in a fragmented heap, with and without the free space index
+# run on the board: mpremote run bench/gc_alloc.py
+
+import gc
+import time
+import spiram
+
+SMALL = 40000  # small objects; every other one is freed, leaving holes all over the heap
+SIZES = (256, 1024, 4096, 16384, 65536)
+COUNT = 20
+
+
+def fragment():
+    keep = [bytearray(40) for _ in range(SMALL)]
+    del keep[::2]
+    gc.collect()
+    return keep
+
+
+def bench(size):
+    gc.collect()
+    gc.disable()  # time gc_alloc, not gc.collect
+    big = []
+    worst = 0
+    total = 0
+    for i in range(COUNT):
+        t = time.ticks_us()
+        big.append(bytearray(size))
+        us = time.ticks_diff(time.ticks_us(), t)
+        total += us
+        worst = max(worst, us)
+    gc.enable()
+    del big
+    return total / COUNT, worst
+
+
+holes = fragment()
+print("%d kbyte free in holes and at the end" % (gc.mem_free() // 1024))
+print("  size    scan mean/max us   index mean/max us")
+for size in SIZES:
+    spiram.gc_index(False)
+    scan = bench(size)
+    spiram.gc_index(True)
+    index = bench(size)
+    print("%6d  %9.1f %7d   %9.1f %7d" % (size, scan[0], scan[1], index[0], index[1]))
+
+finds, scans, misses, leaves, leaf_blocks = spiram.gc_index_stats()
+print("%d allocations, %d leaves read back, %d misses; %d leaves of %d blocks" % (finds, scans, misses, leaves, leaf_blocks))
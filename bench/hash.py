@@ -0,0 +1,67 @@
+# hash: lookups/s and bytes per entry, spiram.HashTable against a dict
+# run on the board: mpremote run bench/hash.py
+
+import gc
+import time
+import spiram
+
+N = 100000  # a dict of this size takes a few Mbyte of heap
+LOOKUPS = 20000
+
+
+def keys(n):
+    # spread out keys, like sensor ids or addresses
+    return ((i * 2654435761) & 0x3FFFFFFF for i in range(n))
+
+
+def lookups(t, n):
+    start = time.ticks_us()
+    for k in keys(n):
+        t[k]
+    return n * 1000000 // time.ticks_diff(time.ticks_us(), start)
+
+
+# every key is found after each insert, also while the table grows
+t = spiram.HashTable(bytearray(64 * 1024), key_size=4, value_size=4)
+inserted = []
+checked = 0
+for k in keys(2000):
+    t[k] = k & 0xFFFF
+    inserted.append(k)
+    if t.stats()[4]:
+        for j in inserted:
+            if t[j] != j & 0xFFFF:
+                raise AssertionError("key %d lost during resize" % j)
+        checked += 1
+print("resize:    %d entries, all found after each of %d inserts while resizing" % (len(t), checked))
+del t, inserted
+gc.collect()
+
+# dict
+gc.collect()
+free = gc.mem_free()
+d = {}
+for k in keys(N):
+    d[k] = k & 0xFFFF
+gc.collect()
+used = free - gc.mem_free()
+print("dict:      %d entries, %d bytes/entry, %d lookups/s" % (len(d), used // N, lookups(d, LOOKUPS)))
+del d
+gc.collect()
+
+# hash table, same entries
+# a 4 Mbyte table and room for the 2 Mbyte table it grows from
+t = spiram.HashTable(bytearray(6 * 1024 * 1024 + 64), key_size=4, value_size=4)
+worst = 0
+for k in keys(N):
+    t0 = time.ticks_us()
+    t[k] = k & 0xFFFF
+    worst = max(worst, time.ticks_diff(time.ticks_us(), t0))
+entries, buckets, per_bucket, load, resizing, probe, bpe = t.stats()
+print("HashTable: %d entries, %.1f bytes/entry, %d lookups/s" % (entries, bpe, lookups(t, LOOKUPS)))
+print("           %d buckets of %d, load %.2f, longest probe %d, slowest insert %d us" % (buckets, per_bucket, load, probe, worst))
+
+# grow further than a dict fits
+for k in keys(350000):
+    t[k] = 1
+print("HashTable: %d entries, %.1f bytes/entry, %d lookups/s" % (len(t), t.stats()[6], lookups(t, LOOKUPS)))
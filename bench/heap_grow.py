@@ -0,0 +1,46 @@
+# heap_grow: time to test spi ram and add it to the heap, ahead of time and from an allocation
+# run on the board: mpremote run bench/heap_grow.py
+
+import gc
+import time
+import spiram
+
+STEP = 256 * 1024
+
+
+def info():
+    in_spiram, failed, heap, tested, size, grows = spiram.heap_info()
+    print("heap %d kbyte, %d of %d kbyte spi ram tested, %d steps%s" % (heap // 1024, tested // 1024, size // 1024, grows, ", failed" if failed else ""))
+    return in_spiram, tested, size
+
+
+in_spiram, tested, size = info()
+if not in_spiram:
+    print("heap in internal ram, spi ram failed at boot")
+    raise SystemExit
+
+# an allocation larger than the free heap grows it
+gc.collect()
+n = gc.mem_free() + STEP
+t = time.ticks_us()
+b = bytearray(n)
+us = time.ticks_diff(time.ticks_us(), t)
+print("bytearray(%d) with growing: %d us" % (n, us))
+del b
+info()
+
+# one step ahead of time
+t = time.ticks_us()
+added = spiram.heap_grow(STEP)
+us = time.ticks_diff(time.ticks_us(), t)
+if added:
+    print("heap_grow: %d kbyte in %d us, %.1f MB/s" % (added // 1024, us, added / us))
+
+# the rest
+t = time.ticks_us()
+added = spiram.heap_grow()
+us = time.ticks_diff(time.ticks_us(), t)
+if added:
+    print("heap_grow: %d kbyte in %d us, %.1f MB/s" % (added // 1024, us, added / us))
+info()
+print("gc.mem_free(): %d" % gc.mem_free())
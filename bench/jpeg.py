@@ -0,0 +1,51 @@
+# hardware jpeg encode and decode of a vga frame in spi ram
+# run on the board: mpremote run bench/jpeg.py
+
+import time
+import spiram
+
+W = 640
+H = 480
+FRAMES = 10
+
+frame = bytearray(W * H * 2)
+for y in range(H):
+    # color bars, rgb565
+    row = y * W * 2
+    for x in range(0, W, 80):
+        c = (0xF800, 0x07E0, 0x001F, 0xFFE0, 0xF81F, 0x07FF, 0xFFFF, 0x0000)[x // 80]
+        frame[row + 2 * x : row + 2 * x + 160] = bytes((c & 0xFF, c >> 8)) * 80
+jpg = bytearray(256 * 1024)
+out = bytearray(W * H * 2)
+
+
+def fps(us):
+    return FRAMES * 1000000 / us if us else 0
+
+
+print("%-12s %8s %8s" % ("vga", "bytes", "frame/s"))
+for sub in (420, 422, 444):
+    t = time.ticks_us()
+    for i in range(FRAMES):
+        n = spiram.jpeg_encode(frame, jpg, W, H, subsampling=sub)
+    us = time.ticks_diff(time.ticks_us(), t)
+    print("%-12s %8d %8.1f" % ("encode %d" % sub, n, fps(us)))
+
+    t = time.ticks_us()
+    for i in range(FRAMES):
+        spiram.jpeg_decode(memoryview(jpg)[0:n], out)
+    us = time.ticks_diff(time.ticks_us(), t)
+    print("%-12s %8d %8.1f" % ("decode %d" % sub, n, fps(us)))
+
+# software encoder, if the firmware has one
+try:
+    import image
+
+    img = image.Image(W, H, image.RGB565, buffer=frame)
+    t = time.ticks_us()
+    for i in range(FRAMES):
+        img.compressed(quality=80)
+    us = time.ticks_diff(time.ticks_us(), t)
+    print("%-12s %8s %8.1f" % ("software", "", fps(us)))
+except (ImportError, AttributeError):
+    print("no software encoder")
@@ -0,0 +1,33 @@
+# logic analyzer: capture the spi ram bus while the interpreter reads spi ram
+# nCS is PB6, the capture starts on its falling edge. Port B also has OSPI_CLK, PB2.
+# run on the board: mpremote run bench/logic.py
+
+import time
+import spiram
+
+RATE = 20000000
+
+buf = bytearray(4 * 1024 * 1024)
+la = spiram.Logic(buf, port="B", rate=RATE)
+load = bytearray(64 * 1024)
+
+t = time.ticks_us()
+n = la.capture(trigger=spiram.Logic.FALLING, mask=1 << 6, timeout_ms=2000)
+us = time.ticks_diff(time.ticks_us(), t)
+print("%d samples at %d Hz in %d us" % (n, la.samplerate(), us))
+
+s = la.samples()
+edges = 0
+for i in range(1, min(n, 100000)):
+    if (s[i] ^ s[i - 1]) & (1 << 6):
+        edges += 1
+print("nCS edges in first 100000 samples: %d" % edges)
+
+try:
+    with open("/sd/capture.bin", "wb") as f:
+        f.write(s)
+    with open("/sd/capture.vcd", "w") as f:
+        la.export_vcd(f, (1 << 2) | (1 << 6))
+    print("written /sd/capture.bin and /sd/capture.vcd")
+except OSError:
+    print("no sd card")
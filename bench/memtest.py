@@ -0,0 +1,11 @@
+# memtest: bandwidth of the passes of the boot memtest
+# run on the board: mpremote run bench/memtest.py
+
+import spiram
+
+print("%-12s %10s %10s %8s" % ("pass", "bytes", "us", "MB/s"))
+for name, nbytes, us, mbps in spiram.memtest_stats():
+    if nbytes:
+        print("%-12s %10d %10d %8.1f" % (name, nbytes, us, mbps))
+    else:
+        print("%-12s %10s %10d" % (name, "", us))
@@ -0,0 +1,45 @@
+# ospi_seq: scattered 32 byte reads and writes of spi ram, mdma sequencer against one command per call
+# run on the board: mpremote run bench/ospi_seq.py
+
+import array
+import random
+import uctypes
+import spiram
+
+SPIRAM_MAP_ADDR = 0x90000000
+SIZE = 32
+N = 1024
+AREA = 256 * 1024
+
+# the commands go to a buffer of our own, in the heap in spi ram
+area = bytearray(AREA)
+base = uctypes.addressof(area) - SPIRAM_MAP_ADDR
+if base < 0:
+    print("heap not in spi ram")
+    raise SystemExit
+base = (base + SIZE - 1) & ~(SIZE - 1)
+slots = (AREA - SIZE) // SIZE
+
+addrs = array.array("I", (base + random.getrandbits(16) % slots * SIZE for _ in range(N)))
+data = bytearray(random.getrandbits(8) for _ in range(N * SIZE))
+buf = bytearray(N * SIZE)
+
+
+def run(name, fn, percall):
+    fn(addrs, buf if fn is spiram.seq_read else data, SIZE, percall=percall)
+    us, ops_s = spiram.seq_stats()[3:]
+    print("%-5s %-9s %6d us %8d ops/s %6.1f MB/s" % (name, "percall" if percall else "sequencer", us, ops_s, N * SIZE / us))
+    return ops_s
+
+
+for percall in (True, False):
+    # later offsets overwrite earlier ones; read back what the last write left
+    run("write", spiram.seq_write, percall)
+    run("read", spiram.seq_read, percall)
+    last = {}
+    for i, a in enumerate(addrs):
+        last[a] = i
+    off = base - (uctypes.addressof(area) - SPIRAM_MAP_ADDR)
+    ok = all(buf[i * SIZE:(i + 1) * SIZE] == data[last[a] * SIZE:(last[a] + 1) * SIZE] for i, a in enumerate(addrs))
+    mapped = all(area[off + a - base:off + a - base + SIZE] == data[i * SIZE:(i + 1) * SIZE] for a, i in last.items())
+    print("read back %s, mapped %s" % ("ok" if ok else "FAILED", "ok" if mapped else "FAILED"))
@@ -0,0 +1,40 @@
+# queue: a timer interrupt produces messages, the interpreter consumes them
+# run on the board: mpremote run bench/queue.py
+
+import time
+import pyb
+import spiram
+
+MSG = 256
+RATE = 20000
+
+q = spiram.Queue(bytearray(1024 * 1024))
+msg = bytearray(MSG)
+rx = bytearray(MSG)
+dropped = 0
+
+
+def produce(t):
+    global dropped
+    if not q.put_from(msg):
+        dropped += 1
+
+
+# queue to queue in the interpreter
+n = 10000
+t = time.ticks_us()
+for i in range(n):
+    q.put_from(msg)
+    q.get_into(rx)
+us = time.ticks_diff(time.ticks_us(), t)
+print("put+get %d bytes: %.1f us, %.2f MB/s" % (MSG, us / n, n * MSG / us))
+
+# interrupt to interpreter
+tim = pyb.Timer(6, freq=RATE, callback=produce)
+count = 0
+t = time.ticks_ms()
+while time.ticks_diff(time.ticks_ms(), t) < 2000:
+    if q.get_into(rx, 10) is not None:
+        count += 1
+tim.deinit()
+print("%d messages from isr at %d Hz, %d dropped" % (count, RATE, dropped))
@@ -0,0 +1,85 @@
+# ramfs: temporary files in spi ram, spiram.RamFS against VfsFat on a ram disk block device
+# run on the board: mpremote run bench/ramfs.py
+
+import os
+import time
+import spiram
+
+SIZE = 2 * 1024 * 1024  # twice, for both filesystems, in an 8 Mbyte heap
+FILE = 1024 * 1024
+
+
+class RAMBlockDev:
+    def __init__(self, block_size, num_blocks):
+        self.block_size = block_size
+        self.data = bytearray(block_size * num_blocks)
+
+    def readblocks(self, block_num, buf, offset=0):
+        addr = block_num * self.block_size + offset
+        buf[:] = memoryview(self.data)[addr : addr + len(buf)]
+
+    def writeblocks(self, block_num, buf, offset=None):
+        if offset is None:
+            # do erase, then write
+            offset = 0
+        addr = block_num * self.block_size + offset
+        self.data[addr : addr + len(buf)] = buf
+
+    def ioctl(self, op, arg):
+        if op == 4:  # block count
+            return len(self.data) // self.block_size
+        if op == 5:  # block size
+            return self.block_size
+        if op == 6:  # block erase
+            return 0
+
+
+def mbps(nbytes, us):
+    return nbytes / us if us else 0
+
+
+def bench(name, path, piece):
+    buf = bytearray(piece)
+    for i in range(len(buf)):
+        buf[i] = i
+    t = time.ticks_us()
+    with open(path, "wb") as f:
+        for i in range(FILE // piece):
+            f.write(buf)
+    us_write = time.ticks_diff(time.ticks_us(), t)
+    t = time.ticks_us()
+    with open(path, "rb") as f:
+        while f.readinto(buf):
+            pass
+    us_read = time.ticks_diff(time.ticks_us(), t)
+    os.remove(path)
+    print("%-6s %6d  write %6.2f MB/s  readinto %6.2f MB/s" % (name, piece, mbps(FILE, us_write), mbps(FILE, us_read)))
+
+
+bdev = RAMBlockDev(512, SIZE // 512)
+os.VfsFat.mkfs(bdev)
+os.mount(os.VfsFat(bdev), "/fat")
+fs = spiram.RamFS(bytearray(SIZE))
+os.mount(fs, "/ram")
+
+for piece in (512, 4096, 32768):
+    bench("fat", "/fat/tmp.bin", piece)
+    bench("ramfs", "/ram/tmp.bin", piece)
+
+# zero-copy: the file contents as memoryviews, no read
+with open("/ram/tmp.bin", "wb") as f:
+    f.write(bytearray(FILE))
+t = time.ticks_us()
+n = 0
+with open("/ram/tmp.bin", "rb") as f:
+    while True:
+        v = f.read_view()
+        if not v:
+            break
+        n += len(v)
+us = time.ticks_diff(time.ticks_us(), t)
+print("ramfs  read_view: %d bytes in %d us" % (n, us))
+print("ramfs  stats:", fs.stats())
+
+os.umount("/fat")
+os.umount("/ram")
@@ -0,0 +1,43 @@
+# sdlog: data logging to sd card, direct and through write-behind staging in spi ram
+# run on the board: mpremote run bench/sdlog.py
+# erases nothing, writes /sd/log.bin
+
+import os
+import time
+import pyb
+import spiram
+
+RECORD = 100  # bytes per log record, a typical small write
+TOTAL = 4 * 1024 * 1024
+
+
+def log(path):
+    rec = bytearray(RECORD)
+    worst = 0
+    n = TOTAL // RECORD
+    t = time.ticks_us()
+    with open(path, "wb") as f:
+        for i in range(n):
+            t1 = time.ticks_us()
+            f.write(rec)
+            worst = max(worst, time.ticks_diff(time.ticks_us(), t1))
+    os.sync()
+    us = time.ticks_diff(time.ticks_us(), t)
+    return n * RECORD / us, worst
+
+
+# direct
+sd = pyb.SDCard()
+os.mount(sd, "/sd")
+mbps, worst = log("/sd/log.bin")
+os.umount("/sd")
+print("direct:  %.2f MB/s, worst write %d us" % (mbps, worst))
+
+# staged
+stage = spiram.SDStage(bytearray(4 * 1024 * 1024))
+os.mount(stage, "/sd")
+mbps, worst = log("/sd/log.bin")
+print("staged:  %.2f MB/s, worst write %d us" % (mbps, worst))
+w, blocks, cw, cblocks, err, max_us, staged = stage.stats()
+print("%d fs writes, %d blocks; %d card writes, %d blocks, %.1f blocks per write, %d errors" % (w, blocks, cw, cblocks, cblocks / max(cw, 1), err))
+os.umount("/sd")
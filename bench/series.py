@@ -0,0 +1,62 @@
+# series: sensor log queries, columnar store in spi ram against a python list of tuples
+# run on the board: mpremote run bench/series.py
+
+import array
+import gc
+import time
+import spiram
+
+ROWS = 50000  # a list of tuples of this many rows fills half the heap
+T0 = 3000000000  # uint32 timestamps in us, beyond a small int
+
+
+def timed(f, *args):
+    t = time.ticks_us()
+    r = f(*args)
+    return r, time.ticks_diff(time.ticks_us(), t)
+
+
+# python list of (timestamp, value)
+gc.collect()
+free = gc.mem_free()
+rows = []
+for i in range(ROWS):
+    rows.append((T0 + 1000 * i, (i % 1000) * 0.01))
+gc.collect()
+print("list:   %d rows, %d kbyte" % (ROWS, (free - gc.mem_free()) // 1024))
+
+
+def list_mean(lo, hi):
+    n = 0
+    s = 0.0
+    for t, v in rows:
+        if lo <= t <= hi:
+            n += 1
+            s += v
+    return n, s
+
+
+# columnar, same rows
+gc.collect()
+free = gc.mem_free()
+buf = bytearray(ROWS * 8 + 4096)
+s = spiram.Series(buf, "If", block=1024)
+for t, v in rows:
+    s.append(t, v)
+gc.collect()
+print("series: %d rows, %d kbyte" % (len(s), (free - gc.mem_free()) // 1024))
+
+# one second, ten seconds, everything
+for span in (1000, 10000, ROWS):
+    lo = T0 + 1000 * (ROWS // 3)
+    hi = lo + 1000 * (span - 1)
+    (n1, s1), us1 = timed(list_mean, lo, hi)
+    (n2, mn, mx, s2), us2 = timed(s.aggregate, 1, lo, hi)
+    _, _, skipped, summarized, scanned = s.stats()
+    print("%6d rows: list %7d us, series %6d us (%d skipped, %d summarized, %d scanned blocks), mean %.3f %.3f" % (
+        n1, us1, us2, skipped, summarized, scanned, s1 / max(n1, 1), s2 / max(n2, 1)))
+
+# select into an array, for plotting
+out = array.array("f", bytearray(4 * 10000))
+n, us = timed(s.select, 1, T0, T0 + 1000 * 9999, out)
+print("select: %d values in %d us" % (n, us))
@@ -0,0 +1,36 @@
+# spi lcd: send a 320x240 rgb565 frame from spi ram
+# compares machine.SPI.write with spiram.spi_write; no display needed, only sck and mosi are driven.
+# run on the board: mpremote run bench/spi_lcd.py
+
+import time
+import machine
+import spiram
+
+WIDTH = 320
+HEIGHT = 240
+FRAMES = 10
+
+frame = bytearray(WIDTH * HEIGHT * 2)
+for i in range(0, len(frame), 2):
+    frame[i] = i >> 8
+    frame[i + 1] = i
+
+spi = machine.SPI(1, baudrate=50000000, polarity=0, phase=0)
+
+
+def bench(name, write):
+    t = time.ticks_us()
+    for i in range(FRAMES):
+        write(frame)
+    us = time.ticks_diff(time.ticks_us(), t)
+    mbps = len(frame) * FRAMES / us
+    print("%-18s %6.2f MB/s %6.1f fps" % (name, mbps, FRAMES * 1000000 / us))
+
+
+bench("spi.write", spi.write)
+bench("spiram.spi_write", lambda b: spiram.spi_write(spi, b))
+
+# loopback check: connect mosi to miso
+rx = bytearray(len(frame))
+spiram.spi_write_readinto(spi, frame, rx)
+print("loopback", "ok" if rx == frame else "no connection")
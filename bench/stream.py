@@ -0,0 +1,44 @@
+# stream: copy, scale, add, triad in Mbyte/s and pointer chase in ns, per memory and mpu mode
+# run on the board: mpremote run bench/stream.py
+
+import gc
+import uctypes
+import spiram
+
+SPIRAM_MAP_ADDR = 0x90000000
+DCACHE = 16 * 1024
+
+# unused parts of internal ram: the upper half of dtcm, the storage cache is at the start
+memories = [("DTCM", 0x20010000, 64 * 1024)]
+probe = bytearray(16)
+if uctypes.addressof(probe) >= SPIRAM_MAP_ADDR:
+    # heap in spi ram; the firmware uses the start of axi sram
+    memories.append(("AXI SRAM", 0x24080000, 256 * 1024))
+else:
+    print("heap in axi sram, axi sram skipped")
+memories.append(("CD SRAM1+2", 0x30000000, 128 * 1024))
+memories.append(("SRD SRAM", 0x38000000, 32 * 1024))
+
+print("%-10s %-4s %6s %8s %8s %8s %8s %9s" % ("memory", "mpu", "kbyte", "copy", "scale", "add", "triad", "chase ns"))
+
+
+def row(name, mode, buf, nbytes):
+    r = spiram.membench(buf, mode)
+    note = " (< 4x dcache)" if nbytes < 4 * DCACHE else ""
+    print("%-10s %-4s %6d %8.1f %8.1f %8.1f %8.1f %9.1f%s" % ((name, mode or "-", nbytes // 1024) + r + (note,)))
+
+
+for name, addr, nbytes in memories:
+    row(name, None, (addr, nbytes), nbytes)
+
+# spi ram: a window of the heap aligned to its size, so one mpu region covers it
+WINDOW = 512 * 1024
+gc.collect()
+area = bytearray(2 * WINDOW)
+addr = (uctypes.addressof(area) + WINDOW - 1) & ~(WINDOW - 1)
+if addr < SPIRAM_MAP_ADDR:
+    print("heap not in spi ram, spi ram skipped")
+else:
+    for mode in (None, "wb", "wt", "nc", "dev"):
+        row("PSRAM", mode, (addr, WINDOW), WINDOW)
+del area
@@ -0,0 +1,27 @@
+# telemetry: counters on the second usb vcp while the board allocates and copies
+# needs pyb.usb_mode('VCP+VCP') in boot.py
+# run on the board: mpremote connect /dev/ttyACM0 run bench/telemetry.py
+# on the host: python3 bench/telemetry_read.py /dev/ttyACM1
+
+import gc
+import time
+import pyb
+import spiram
+
+t = spiram.Telemetry(pyb.USB_VCP(1), 100)
+print(t)
+
+src = bytearray(256 * 1024)
+dst = bytearray(256 * 1024)
+keep = []
+start = time.ticks_ms()
+while time.ticks_diff(time.ticks_ms(), start) < 20000:
+    spiram.copy(dst, src)
+    keep.append(bytearray(4096))
+    if len(keep) > 256:
+        keep = []
+        gc.collect()
+
+frames, dropped, nbytes = t.stats()
+print("%d frames, %d dropped, %d bytes" % (frames, dropped, nbytes))
+t.deinit()
@@ -0,0 +1,100 @@
+# telemetry_read: read the frames of spiram.Telemetry, print them, and optionally plot
+# run on the host: python3 bench/telemetry_read.py /dev/ttyACM1 [--plot] [--csv out.csv]
+# needs pyserial; --plot needs matplotlib. Frame layout in telemetry.h.
+
+import argparse
+import struct
+import sys
+import zlib
+
+import serial
+
+MAGIC = b"TM"
+VERSION = 2
+CLIENTS = ("copy", "background", "display", "sdcard")
+FIELDS = ("seq", "ms", "dropped") + tuple("dma_" + c for c in CLIENTS) + (
+    "seq_bytes", "crc_bytes", "gc_count", "gc_last_us", "gc_max_us", "gc_total_us",
+    "heap_flags", "heap_total", "heap_used", "heap_max_free", "spiram_tested", "ospi_errors")
+FRAME = struct.Struct("<2sBB%dII" % len(FIELDS))
+
+
+def frames(port):
+    """yields each frame as a dict; skips bytes up to the next magic with a good crc"""
+    buf = b""
+    while True:
+        buf += port.read(max(1, port.in_waiting))
+        while True:
+            i = buf.find(MAGIC)
+            if i < 0:
+                buf = buf[-1:]
+                break
+            buf = buf[i:]
+            if len(buf) < FRAME.size:
+                break
+            magic, version, length, *values = FRAME.unpack_from(buf)
+            crc = values.pop()
+            if version != VERSION or length != FRAME.size or zlib.crc32(buf[:FRAME.size - 4]) != crc:
+                buf = buf[1:]
+                continue
+            buf = buf[FRAME.size:]
+            yield dict(zip(FIELDS, values))
+
+
+def rates(prev, f):
+    """Mbyte/s per counter since the frame before; counters wrap at 2^32"""
+    dt = ((f["ms"] - prev["ms"]) & 0xffffffff) / 1000 or 1
+    return {k: ((f[k] - prev[k]) & 0xffffffff) / dt / 1e6 for k in FIELDS if k.startswith("dma_") or k.endswith("_bytes")}
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("port")
+    ap.add_argument("--plot", action="store_true")
+    ap.add_argument("--csv")
+    args = ap.parse_args()
+
+    port = serial.Serial(args.port, timeout=1)
+    csv = open(args.csv, "w") if args.csv else None
+    if csv:
+        csv.write(",".join(FIELDS) + "\n")
+    if args.plot:
+        import matplotlib.pyplot as plt
+        plt.ion()
+        fig, (ax_bw, ax_gc, ax_heap) = plt.subplots(3, 1, sharex=True)
+        hist = {"t": [], "bw": [], "gc": [], "used": [], "total": []}
+
+    prev = None
+    for f in frames(port):
+        if csv:
+            csv.write(",".join(str(f[k]) for k in FIELDS) + "\n")
+            csv.flush()
+        if prev is not None and f["seq"] != (prev["seq"] + 1) & 0xffffffff:
+            print("lost %d frames" % ((f["seq"] - prev["seq"] - 1) & 0xffffffff), file=sys.stderr)
+        if prev is not None:
+            r = rates(prev, f)
+            bw = sum(r.values())
+            print("%8.1f s  dma %7.1f MB/s  gc %3d pauses, max %6d us  heap %7d/%7d kbyte%s  ospi errors %d  dropped %d" % (
+                f["ms"] / 1000, bw, (f["gc_count"] - prev["gc_count"]) & 0xffffffff, f["gc_max_us"],
+                f["heap_used"] // 1024, f["heap_total"] // 1024, "" if f["heap_flags"] & 1 else " (internal ram)",
+                f["ospi_errors"], f["dropped"]))
+            if args.plot:
+                hist["t"].append(f["ms"] / 1000)
+                hist["bw"].append(bw)
+                hist["gc"].append(f["gc_max_us"] / 1000)
+                hist["used"].append(f["heap_used"] / 1048576)
+                hist["total"].append(f["heap_total"] / 1048576)
+                for ax in (ax_bw, ax_gc, ax_heap):
+                    ax.clear()
+                ax_bw.plot(hist["t"], hist["bw"])
+                ax_bw.set_ylabel("dma MB/s")
+                ax_gc.plot(hist["t"], hist["gc"])
+                ax_gc.set_ylabel("gc pause ms")
+                ax_heap.plot(hist["t"], hist["used"], hist["t"], hist["total"])
+                ax_heap.set_ylabel("heap Mbyte")
+                ax_heap.set_xlabel("s")
+                plt.pause(0.001)
+        prev = f
+
+
+if __name__ == "__main__":
+    main()
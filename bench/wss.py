@@ -0,0 +1,35 @@
+# wss: working set of spi ram while the interpreter walks a buffer
+# run on the board: mpremote run bench/wss.py
+
+import time
+import gc
+import spiram
+
+WINDOW_MS = 100
+BLOCK = 128 * 1024
+
+# idle: the interpreter alone
+spiram.wss_start(window_ms=WINDOW_MS)
+time.sleep_ms(1000)
+w, faults, last, peak = spiram.wss_stats()
+print("idle: %d windows, %d faults, working set %d kbyte, max %d kbyte" % (w, faults, last // 1024, peak // 1024))
+spiram.wss_stop()
+
+# workload: touch 1 Mbyte every window
+gc.collect()
+buf = bytearray(1024 * 1024)
+spiram.wss_start(window_ms=WINDOW_MS)
+t = time.ticks_ms()
+while time.ticks_diff(time.ticks_ms(), t) < 2000:
+    for i in range(0, len(buf), 4096):
+        buf[i] += 1
+w, faults, last, peak = spiram.wss_stats()
+heat = spiram.wss_heatmap()
+spiram.wss_stop()
+print("1 Mbyte: %d windows, %d faults, working set %d kbyte, max %d kbyte" % (w, faults, last // 1024, peak // 1024))
+
+# one character per 128 kbyte block: ' ' never, '.' sometimes, '#' every window
+row = ""
+for h in heat:
+    row += " " if h == 0 else ("#" if h >= w else ".")
+print("heatmap, 8 Mbyte: [%s]" % row)
@@ -0,0 +1,379 @@
+/*
+ * fdcan bus logger, timestamped frames into a spi ram ring buffer
+ */
+
+/* notes:
+ * fdcan1 accepts all frames into rx fifo 0, 64 elements of 64 data bytes.
+ * The new message interrupt empties the fifo straight from the message ram,
+ * stamps each frame with a 32-bit microsecond timer, and appends a compact
+ * record to the ring. Python drains whole records in batches with readinto().
+ *
+ * At 5 Mbit/s data rate, a saturated bus is some 100000 frames/s;
+ * a 4 Mbyte ring holds a few seconds of that.
+ * Ring full: the frame is dropped and counted. Fifo full: the fdcan counts a lost frame.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "timer.h"
+#include "spiram_ring.h"
+#include "can_logger.h"
+
+#if MICROPY_HW_ENABLE_CAN_LOGGER
+
+#if MICROPY_HW_ENABLE_CAN
+#error "can logger and pyb.CAN both use fdcan1"
+#endif
+
+// 32-bit timer for the timestamps
+#ifndef MICROPY_HW_CAN_LOGGER_TIM
+#define MICROPY_HW_CAN_LOGGER_TIM (TIM5)
+#define MICROPY_HW_CAN_LOGGER_TIM_ID (5)
+#define MICROPY_HW_CAN_LOGGER_TIM_CLK_ENABLE() __HAL_RCC_TIM5_CLK_ENABLE()
+#endif
+
+#ifndef MICROPY_HW_CAN_LOGGER_AF
+#define MICROPY_HW_CAN_LOGGER_AF (GPIO_AF9_FDCAN1)
+#endif
+
+#define CAN_LOGGER_FIFO_LEN (64)
+#define CAN_LOGGER_ELEMENT_WORDS (2 + 64 / 4)
+#define CAN_LOGGER_RECORD_MAX (CAN_LOGGER_HDR_LEN + 64 + 2)
+
+typedef struct _spiram_canlog_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the ring storage alive
+    spiram_ring_t ring;
+    uint32_t bitrate;
+    uint32_t data_bitrate;
+    bool listen_only;
+    bool running;
+    volatile uint32_t frames;
+    volatile uint32_t dropped;  // ring full
+    volatile uint32_t lost;     // fifo full
+} spiram_canlog_obj_t;
+
+static FDCAN_HandleTypeDef can_logger_fdcan;
+static spiram_canlog_obj_t *can_logger_active = NULL;
+
+static const uint8_t can_logger_dlc_len[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+static inline uint32_t can_logger_record_len(uint32_t len) {
+    return (CAN_LOGGER_HDR_LEN + len + 3) & ~3;
+}
+
+// -----------------------------------------------------------------------------
+// irq
+
+void FDCAN1_IT0_IRQHandler(void) {
+    IRQ_ENTER(FDCAN1_IT0_IRQn);
+    FDCAN_GlobalTypeDef *can = FDCAN1;
+    spiram_canlog_obj_t *self = can_logger_active;
+    uint32_t ir = can->IR;
+    can->IR = ir & (FDCAN_IR_RF0N | FDCAN_IR_RF0L);
+    if (self == NULL) {
+        IRQ_EXIT(FDCAN1_IT0_IRQn);
+        return;
+    }
+    if (ir & FDCAN_IR_RF0L) {
+        self->lost += 1;
+    }
+
+    uint32_t rec[CAN_LOGGER_RECORD_MAX / 4];
+    uint32_t rxf0s;
+    while ((rxf0s = can->RXF0S) & FDCAN_RXF0S_F0FL) {
+        uint32_t gi = (rxf0s & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+        const volatile uint32_t *e = (const volatile uint32_t *)(can_logger_fdcan.msgRam.RxFIFO0SA + gi * CAN_LOGGER_ELEMENT_WORDS * 4);
+        uint32_t r0 = e[0];
+        uint32_t r1 = e[1];
+        uint32_t len = can_logger_dlc_len[(r1 >> 16) & 0xf];
+
+        rec[0] = MICROPY_HW_CAN_LOGGER_TIM->CNT;
+        uint32_t id = r0 & (1u << 30) ? r0 & 0x1fffffff : (r0 >> 18) & 0x7ff;
+        if (r0 & (1u << 30)) {
+            id |= CAN_LOGGER_ID_XTD;
+        }
+        if (r0 & (1u << 29)) {
+            id |= CAN_LOGGER_ID_RTR;
+            len = 0;
+        }
+        if (r1 & (1u << 21)) {
+            id |= CAN_LOGGER_ID_FDF;
+        } else {
+            // classic frame: dlc 9 .. 15 is 8 data bytes
+            len = MIN(len, 8);
+        }
+        rec[1] = id;
+        uint32_t flags = (r1 & (1u << 20) ? CAN_LOGGER_FLAG_BRS : 0) | (r0 & (1u << 31) ? CAN_LOGGER_FLAG_ESI : 0);
+        // len, flags and the first two data bytes share a word
+        uint32_t words = (len + 3) / 4;
+        uint32_t d = words ? e[2] : 0;
+        rec[2] = len | flags << 8 | d << 16;
+        for (uint32_t i = 1; i <= words; ++i) {
+            uint32_t next = i < words ? e[2 + i] : 0;
+            rec[2 + i] = d >> 16 | next << 16;
+            d = next;
+        }
+        can->RXF0A = gi;
+
+        uint32_t n = can_logger_record_len(len);
+        if (spiram_ring_free(&self->ring) < n) {
+            self->dropped += 1;
+        } else {
+            spiram_ring_write(&self->ring, rec, n);
+            self->frames += 1;
+        }
+    }
+    IRQ_EXIT(FDCAN1_IT0_IRQn);
+}
+
+// -----------------------------------------------------------------------------
+
+// sample point at 80%. Returns false if the clock cannot make the bit rate.
+static bool can_logger_timing(uint32_t clk, uint32_t bitrate, uint32_t presc_max, uint32_t seg1_max, uint32_t seg2_max,
+    uint32_t *presc, uint32_t *seg1, uint32_t *seg2) {
+    for (uint32_t p = 1; p <= presc_max; ++p) {
+        if (clk % (p * bitrate) != 0) {
+            continue;
+        }
+        uint32_t tq = clk / (p * bitrate);
+        uint32_t s2 = MAX(tq / 5, 1);
+        if (tq < 4 || tq - 1 - s2 > seg1_max || s2 > seg2_max) {
+            continue;
+        }
+        *presc = p;
+        *seg1 = tq - 1 - s2;
+        *seg2 = s2;
+        return true;
+    }
+    return false;
+}
+
+static void can_logger_timer_init(void) {
+    MICROPY_HW_CAN_LOGGER_TIM_CLK_ENABLE();
+    TIM_TypeDef *tim = MICROPY_HW_CAN_LOGGER_TIM;
+    tim->CR1 = 0;
+    tim->PSC = timer_get_source_freq(MICROPY_HW_CAN_LOGGER_TIM_ID) / 1000000 - 1;
+    tim->ARR = 0xffffffff;
+    tim->EGR = TIM_EGR_UG;
+    tim->CR1 = TIM_CR1_CEN;
+}
+
+static void can_logger_stop(spiram_canlog_obj_t *self) {
+    if (!self->running) {
+        return;
+    }
+    HAL_NVIC_DisableIRQ(FDCAN1_IT0_IRQn);
+    HAL_FDCAN_Stop(&can_logger_fdcan);
+    HAL_FDCAN_DeInit(&can_logger_fdcan);
+    self->running = false;
+    can_logger_active = NULL;
+}
+
+static int can_logger_start(spiram_canlog_obj_t *self) {
+    if (can_logger_active != NULL) {
+        return -MP_EBUSY;
+    }
+    mp_hal_pin_config(MICROPY_HW_CAN_LOGGER_TX, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_UP, MICROPY_HW_CAN_LOGGER_AF);
+    mp_hal_pin_config(MICROPY_HW_CAN_LOGGER_RX, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_UP, MICROPY_HW_CAN_LOGGER_AF);
+    __HAL_RCC_FDCAN_CLK_ENABLE();
+
+    FDCAN_InitTypeDef *init = &can_logger_fdcan.Init;
+    memset(&can_logger_fdcan, 0, sizeof(can_logger_fdcan));
+    can_logger_fdcan.Instance = FDCAN1;
+    uint32_t clk = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN);
+    uint32_t presc, seg1, seg2;
+    if (!can_logger_timing(clk, self->bitrate, 512, 256, 128, &presc, &seg1, &seg2)) {
+        return -MP_EINVAL;
+    }
+    init->NominalPrescaler = presc;
+    init->NominalTimeSeg1 = seg1;
+    init->NominalTimeSeg2 = seg2;
+    init->NominalSyncJumpWidth = seg2;
+    if (self->data_bitrate != 0) {
+        if (!can_logger_timing(clk, self->data_bitrate, 32, 32, 16, &presc, &seg1, &seg2)) {
+            return -MP_EINVAL;
+        }
+        init->FrameFormat = FDCAN_FRAME_FD_BRS;
+    } else {
+        init->FrameFormat = FDCAN_FRAME_FD_NO_BRS;
+    }
+    init->DataPrescaler = presc;
+    init->DataTimeSeg1 = seg1;
+    init->DataTimeSeg2 = seg2;
+    init->DataSyncJumpWidth = seg2;
+    init->Mode = self->listen_only ? FDCAN_MODE_BUS_MONITORING : FDCAN_MODE_NORMAL;
+    init->AutoRetransmission = DISABLE;
+    init->TransmitPause = DISABLE;
+    init->ProtocolException = ENABLE;
+    init->MessageRAMOffset = 0;
+    init->StdFiltersNbr = 0;
+    init->ExtFiltersNbr = 0;
+    init->RxFifo0ElmtsNbr = CAN_LOGGER_FIFO_LEN;
+    init->RxFifo0ElmtSize = FDCAN_DATA_BYTES_64;
+    init->RxFifo1ElmtsNbr = 0;
+    init->RxBuffersNbr = 0;
+    init->TxEventsNbr = 0;
+    init->TxBuffersNbr = 0;
+    init->TxFifoQueueElmtsNbr = 1;
+    init->TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
+    init->TxElmtSize = FDCAN_DATA_BYTES_8;
+    if (HAL_FDCAN_Init(&can_logger_fdcan) != HAL_OK) {
+        return -MP_EIO;
+    }
+    HAL_FDCAN_ConfigGlobalFilter(&can_logger_fdcan, FDCAN_ACCEPT_IN_RX_FIFO0, FDCAN_ACCEPT_IN_RX_FIFO0,
+        FDCAN_FILTER_REMOTE, FDCAN_FILTER_REMOTE);
+    HAL_FDCAN_ConfigFifoWatermark(&can_logger_fdcan, FDCAN_CFG_RX_FIFO0, 0);
+
+    can_logger_timer_init();
+    can_logger_active = self;
+    self->running = true;
+    FDCAN1->ILS = 0;
+    FDCAN1->IE = FDCAN_IE_RF0NE | FDCAN_IE_RF0LE;
+    FDCAN1->ILE = FDCAN_ILE_EINT0;
+    NVIC_SetPriority(FDCAN1_IT0_IRQn, IRQ_PRI_CAN);
+    HAL_NVIC_EnableIRQ(FDCAN1_IT0_IRQn);
+    HAL_FDCAN_Start(&can_logger_fdcan);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.CANLog(buf, *, bitrate=500000, data_bitrate=0, listen_only=True)
+// buf is the ring buffer. data_bitrate 0: no bit rate switch.
+
+STATIC mp_obj_t spiram_canlog_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_bitrate, ARG_data_bitrate, ARG_listen_only };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_bitrate, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 500000} },
+        { MP_QSTR_data_bitrate, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_listen_only, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    if (bufinfo.len < 4 * CAN_LOGGER_RECORD_MAX || args[ARG_bitrate].u_int <= 0 || args[ARG_data_bitrate].u_int < 0) {
+        mp_raise_ValueError(NULL);
+    }
+
+    spiram_canlog_obj_t *self = m_new_obj_with_finaliser(spiram_canlog_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->bitrate = args[ARG_bitrate].u_int;
+    self->data_bitrate = args[ARG_data_bitrate].u_int;
+    self->listen_only = args[ARG_listen_only].u_bool;
+    // records are word aligned in the ring
+    uint32_t start = ((uint32_t)bufinfo.buf + 3) & ~3;
+    spiram_ring_init(&self->ring, (void *)start, ((uint32_t)bufinfo.buf + bufinfo.len - start) & ~3);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t spiram_canlog_start(mp_obj_t self_in) {
+    spiram_canlog_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->running) {
+        int ret = can_logger_start(self);
+        if (ret != 0) {
+            mp_raise_OSError(-ret);
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_canlog_start_obj, spiram_canlog_start);
+
+STATIC mp_obj_t spiram_canlog_stop(mp_obj_t self_in) {
+    can_logger_stop(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_canlog_stop_obj, spiram_canlog_stop);
+
+// canlog.stats()
+// returns (frames, dropped because ring full, lost because fifo full, bytes in ring)
+
+STATIC mp_obj_t spiram_canlog_stats(mp_obj_t self_in) {
+    spiram_canlog_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t t[4] = {
+        mp_obj_new_int_from_uint(self->frames),
+        mp_obj_new_int_from_uint(self->dropped),
+        mp_obj_new_int_from_uint(self->lost),
+        mp_obj_new_int_from_uint(spiram_ring_used(&self->ring)),
+    };
+    return mp_obj_new_tuple(4, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_canlog_stats_obj, spiram_canlog_stats);
+
+// read returns whole records only; does not block.
+
+STATIC mp_uint_t spiram_canlog_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+    spiram_canlog_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    size_t used = spiram_ring_used(&self->ring);
+    size_t n = 0;
+    while (n + CAN_LOGGER_HDR_LEN <= used) {
+        size_t rec = can_logger_record_len(spiram_ring_peek(&self->ring, n + 8));
+        if (n + rec > size) {
+            break;
+        }
+        n += rec;
+    }
+    if (n == 0) {
+        if (size < CAN_LOGGER_RECORD_MAX && used != 0) {
+            *errcode = MP_EINVAL;
+        } else {
+            *errcode = MP_EAGAIN;
+        }
+        return MP_STREAM_ERROR;
+    }
+    return spiram_ring_read(&self->ring, buf, n);
+}
+
+STATIC mp_uint_t spiram_canlog_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    spiram_canlog_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (request == MP_STREAM_POLL) {
+        if ((arg & MP_STREAM_POLL_RD) && spiram_ring_used(&self->ring) != 0) {
+            return MP_STREAM_POLL_RD;
+        }
+        return 0;
+    } else if (request == MP_STREAM_CLOSE) {
+        can_logger_stop(self);
+        return 0;
+    }
+    *errcode = MP_EINVAL;
+    return MP_STREAM_ERROR;
+}
+
+STATIC const mp_rom_map_elem_t spiram_canlog_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_start), MP_ROM_PTR(&spiram_canlog_start_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&spiram_canlog_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_canlog_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_stream_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_canlog_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_HDR_LEN), MP_ROM_INT(CAN_LOGGER_HDR_LEN) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_canlog_locals_dict, spiram_canlog_locals_dict_table);
+
+STATIC const mp_stream_p_t spiram_canlog_stream_p = {
+    .read = spiram_canlog_read,
+    .ioctl = spiram_canlog_ioctl,
+};
+
+const mp_obj_type_t spiram_canlog_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_CANLog,
+    .make_new = spiram_canlog_make_new,
+    .protocol = &spiram_canlog_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&spiram_canlog_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_CAN_LOGGER
+
+// not truncated
@@ -0,0 +1,29 @@
+/*
+ * fdcan bus logger, timestamped frames into a spi ram ring buffer
+ */
+#ifndef __CAN_LOGGER_H__
+#define __CAN_LOGGER_H__
+#include "py/obj.h"
+
+// owns fdcan1 and its interrupts, so not together with pyb.CAN.
+// needs pins MICROPY_HW_CAN_LOGGER_TX and _RX in mpconfigboard.h
+#ifndef MICROPY_HW_ENABLE_CAN_LOGGER
+#define MICROPY_HW_ENABLE_CAN_LOGGER (0)
+#endif
+
+/* record, little endian, padded to a multiple of 4 bytes:
+   uint32 time      microseconds
+   uint32 id        bits 0-28 id, 29 fd frame, 30 rtr, 31 extended id
+   uint8  len       data bytes, 0 .. 64
+   uint8  flags     bit 0 bit rate switch, bit 1 error state indicator
+   uint8  data[len]
+ */
+#define CAN_LOGGER_HDR_LEN (10)
+#define CAN_LOGGER_ID_FDF (1u << 29)
+#define CAN_LOGGER_ID_RTR (1u << 30)
+#define CAN_LOGGER_ID_XTD (1u << 31)
+#define CAN_LOGGER_FLAG_BRS (1 << 0)
+#define CAN_LOGGER_FLAG_ESI (1 << 1)
+
+extern const mp_obj_type_t spiram_canlog_type;
+#endif // __CAN_LOGGER_H__
@@ -0,0 +1,245 @@
+/*
+ * crc32 on the crc peripheral, fed by mdma
+ */
+
+/* notes:
+ * binascii.crc32() of micropython works a nibble at a time from a 16 entry table,
+ * and reads every byte through the cpu. Over a few Mbyte of spi ram that is seconds.
+ *
+ * The crc peripheral computes the crc32 of zlib with polynomial 0x04c11db7, input
+ * bits reversed and output bits reversed; the caller does the final xor. The start
+ * value is the bit reversed running crc, so a crc can be continued over several
+ * calls. Words go in with input reversal by word; the bytes before the first word
+ * boundary and after the last word go in one at a time, with reversal by byte.
+ *
+ * Buffers of MICROPY_HW_CRC_DMA_THRESHOLD bytes and more are fed by the mdma, from
+ * memory to the fixed data register, a node of up to 256 Mbyte at a time. Shorter
+ * buffers are fed by the cpu, a word at a time; very short ones are done in software.
+ * The peripheral has no context to save, so a call that finds it in use, from the
+ * scheduler while waiting for the mdma, is done in software.
+ *
+ * The patch routes binascii.crc32() here. spiram.crc32() does the same, and
+ * spiram.CRC32 is a hashlib-style object.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "lib/uzlib/tinf.h"
+#include "mdma.h"
+#include "crc_dma.h"
+
+#if MICROPY_HW_ENABLE_CRC_DMA
+
+#define CRC_MDMA_PRIORITY (1)
+#define CRC_MDMA_TIMEOUT_MS (1000)
+#define CRC32_POLY (0x04c11db7)
+
+static volatile uint32_t crc_mdma_cisr;
+static bool crc_busy;
+static crc_dma_stats_t crc_stats;
+
+static void crc_mdma_done(uint32_t channel, uint32_t cisr, void *arg) {
+    crc_mdma_cisr = cisr;
+}
+
+static void crc_start(uint32_t crc) {
+    __HAL_RCC_CRC_CLK_ENABLE();
+    CRC->POL = CRC32_POLY;
+    CRC->INIT = __RBIT(crc);
+    // 32 bit polynomial, output reversed, input reversed by byte; reset loads INIT
+    CRC->CR = CRC_CR_REV_OUT | CRC_CR_REV_IN_0 | CRC_CR_RESET;
+}
+
+static inline void crc_rev_in_word(bool word) {
+    CRC->CR = (CRC->CR & ~CRC_CR_REV_IN) | (word ? CRC_CR_REV_IN : CRC_CR_REV_IN_0);
+}
+
+static void crc_feed_bytes(const uint8_t *p, size_t len) {
+    crc_rev_in_word(false);
+    while (len--) {
+        *(volatile uint8_t *)&CRC->DR = *p++;
+    }
+}
+
+static void crc_feed_words(const uint8_t *p, size_t len) {
+    crc_rev_in_word(true);
+    const uint32_t *w = (const uint32_t *)p;
+    for (size_t n = len / 4; n; --n) {
+        CRC->DR = *w++;
+    }
+}
+
+// len a multiple of 4, p word aligned
+static int crc_feed_mdma(const uint8_t *p, size_t len) {
+    crc_rev_in_word(true);
+    mdma_dcache_clean(p, len);
+    while (len) {
+        mdma_node_t node;
+        size_t n = mdma_node_memcpy(&node, (void *)&CRC->DR, p, len);
+        // every word to the same register, single beats
+        node.CTCR &= ~(MDMA_CTCR_DINC_Msk | MDMA_CTCR_DBURST_Msk);
+        crc_mdma_cisr = 0;
+        mdma_start(MDMA_CHANNEL_CRC, &node, CRC_MDMA_PRIORITY);
+        uint32_t start = mp_hal_ticks_ms();
+        while (mdma_busy(MDMA_CHANNEL_CRC) && crc_mdma_cisr == 0) {
+            if (mp_hal_ticks_ms() - start >= CRC_MDMA_TIMEOUT_MS) {
+                mdma_abort(MDMA_CHANNEL_CRC);
+                return -MP_ETIMEDOUT;
+            }
+            MICROPY_EVENT_POLL_HOOK
+        }
+        if (crc_mdma_cisr & MDMA_CISR_TEIF) {
+            return -MP_EIO;
+        }
+        p += n;
+        len -= n;
+        crc_stats.bytes_dma += n;
+    }
+    return 0;
+}
+
+uint32_t crc_dma_crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = data;
+    ++crc_stats.calls;
+    if (len < CRC_DMA_SOFT_MAX || crc_busy) {
+        ++crc_stats.soft;
+        return uzlib_crc32(data, len, crc);
+    }
+    crc_busy = true;
+    crc_start(crc);
+    size_t head = MIN(-(uintptr_t)p & 3, len);
+    crc_feed_bytes(p, head);
+    p += head;
+    len -= head;
+    size_t words = len & ~3;
+    if (words >= MICROPY_HW_CRC_DMA_THRESHOLD) {
+        mdma_init();
+        mdma_set_callback(MDMA_CHANNEL_CRC, crc_mdma_done, NULL);
+        int ret;
+        nlr_buf_t nlr;
+        if (nlr_push(&nlr) == 0) {
+            ret = crc_feed_mdma(p, words);
+            nlr_pop();
+        } else {
+            // the poll hook raised: stop the channel and free the unit before passing it on
+            mdma_abort(MDMA_CHANNEL_CRC);
+            mdma_set_callback(MDMA_CHANNEL_CRC, NULL, NULL);
+            crc_busy = false;
+            nlr_jump(nlr.ret_val);
+        }
+        mdma_set_callback(MDMA_CHANNEL_CRC, NULL, NULL);
+        if (ret != 0) {
+            // start over in software
+            ++crc_stats.errors;
+            crc_busy = false;
+            return uzlib_crc32(data, head + len, crc);
+        }
+    } else {
+        crc_feed_words(p, words);
+        crc_stats.bytes_cpu += words;
+    }
+    crc_feed_bytes(p + words, len - words);
+    crc_stats.bytes_cpu += head + len - words;
+    crc = CRC->DR;
+    crc_busy = false;
+    return crc;
+}
+
+void crc_dma_get_stats(crc_dma_stats_t *stats) {
+    *stats = crc_stats;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+static uint32_t crc_update(uint32_t crc, mp_obj_t data, bool hw) {
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
+    return hw ? crc_dma_crc32(bufinfo.buf, bufinfo.len, crc) : uzlib_crc32(bufinfo.buf, bufinfo.len, crc);
+}
+
+// spiram.crc32(data, crc=0, hw=True)
+// as binascii.crc32(); hw=False does it in software, for comparison.
+
+STATIC mp_obj_t spiram_crc32_fn(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_data, ARG_crc, ARG_hw };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_data, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_crc, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_INT(0)} },
+        { MP_QSTR_hw, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    uint32_t crc = mp_obj_get_int_truncated(args[ARG_crc].u_obj);
+    crc = crc_update(crc ^ 0xffffffff, args[ARG_data].u_obj, args[ARG_hw].u_bool);
+    return mp_obj_new_int_from_uint(crc ^ 0xffffffff);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_crc32_obj, 1, spiram_crc32_fn);
+
+// spiram.crc_stats()
+// returns (calls, calls in software, bytes fed by cpu, bytes fed by mdma, mdma errors)
+
+STATIC mp_obj_t spiram_crc_stats_fn(void) {
+    mp_obj_t t[5] = {
+        mp_obj_new_int_from_uint(crc_stats.calls),
+        mp_obj_new_int_from_uint(crc_stats.soft),
+        mp_obj_new_int_from_ull(crc_stats.bytes_cpu),
+        mp_obj_new_int_from_ull(crc_stats.bytes_dma),
+        mp_obj_new_int_from_uint(crc_stats.errors),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(spiram_crc_stats_obj, spiram_crc_stats_fn);
+
+// spiram.CRC32(data=None), hashlib style: update(data), digest() as 4 bytes big-endian.
+
+typedef struct _spiram_crc32_hash_t {
+    mp_obj_base_t base;
+    uint32_t crc;               // running value, without the final xor
+} spiram_crc32_hash_t;
+
+STATIC mp_obj_t spiram_crc32_update(mp_obj_t self_in, mp_obj_t data) {
+    spiram_crc32_hash_t *self = MP_OBJ_TO_PTR(self_in);
+    self->crc = crc_update(self->crc, data, true);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_crc32_update_obj, spiram_crc32_update);
+
+STATIC mp_obj_t spiram_crc32_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    mp_arg_check_num(n_args, n_kw, 0, 1, false);
+    spiram_crc32_hash_t *self = m_new_obj(spiram_crc32_hash_t);
+    self->base.type = type;
+    self->crc = 0xffffffff;
+    if (n_args == 1) {
+        spiram_crc32_update(MP_OBJ_FROM_PTR(self), all_args[0]);
+    }
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t spiram_crc32_digest(mp_obj_t self_in) {
+    spiram_crc32_hash_t *self = MP_OBJ_TO_PTR(self_in);
+    uint32_t crc = self->crc ^ 0xffffffff;
+    byte digest[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    return mp_obj_new_bytes(digest, sizeof(digest));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_crc32_digest_obj, spiram_crc32_digest);
+
+STATIC const mp_rom_map_elem_t spiram_crc32_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_update), MP_ROM_PTR(&spiram_crc32_update_obj) },
+    { MP_ROM_QSTR(MP_QSTR_digest), MP_ROM_PTR(&spiram_crc32_digest_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_crc32_locals_dict, spiram_crc32_locals_dict_table);
+
+const mp_obj_type_t spiram_crc32_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_CRC32,
+    .make_new = spiram_crc32_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_crc32_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_CRC_DMA
+
+// not truncated
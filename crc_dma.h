@@ -0,0 +1,40 @@
+/*
+ * crc32 on the crc peripheral, fed by mdma
+ */
+#ifndef __CRC_DMA_H__
+#define __CRC_DMA_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+
+#ifndef MICROPY_HW_ENABLE_CRC_DMA
+#define MICROPY_HW_ENABLE_CRC_DMA (0)
+#endif
+
+// shorter buffers are fed to the crc peripheral by the cpu
+#ifndef MICROPY_HW_CRC_DMA_THRESHOLD
+#define MICROPY_HW_CRC_DMA_THRESHOLD (1024)
+#endif
+
+// shorter buffers are done in software, without the peripheral
+#define CRC_DMA_SOFT_MAX (16)
+
+// crc32 of zlib, as uzlib_crc32(): crc is the running value, without the final xor.
+// Falls back to software when the peripheral is in use.
+uint32_t crc_dma_crc32(const void *data, size_t len, uint32_t crc);
+
+typedef struct _crc_dma_stats_t {
+    uint32_t calls;
+    uint32_t soft;              // calls done in software
+    uint64_t bytes_cpu;         // bytes fed by the cpu
+    uint64_t bytes_dma;         // bytes fed by the mdma
+    uint32_t errors;            // mdma errors and timeouts, redone in software
+} crc_dma_stats_t;
+
+void crc_dma_get_stats(crc_dma_stats_t *stats);
+
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_crc32_obj);
+MP_DECLARE_CONST_FUN_OBJ_0(spiram_crc_stats_obj);
+extern const mp_obj_type_t spiram_crc32_type;
+#endif // __CRC_DMA_H__
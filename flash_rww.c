@@ -0,0 +1,312 @@
+/*
+ * internal flash programming from spi ram, while code runs from the other bank
+ */
+
+/* notes:
+ * the stm32h7a3 has two flash banks of 1 Mbyte, each with its own erase and
+ * program logic. The cpu can read, and run code from, one bank while the other
+ * is erased or programmed. The stock flash.c programs with the cpu waiting
+ * for each flash word, so the interpreter stops for the whole erase and write.
+ *
+ * Here, the flash interrupt drives the write: each end-of-operation erases
+ * the next sector or programs the next flash word (16 bytes), from a buffer in
+ * spi ram. Between interrupts the interpreter runs, from the bank that holds
+ * the firmware. Only the bank without firmware can be written.
+ *
+ * micropython owns FLASH_IRQHandler (flash storage cache), so ram_vectors puts
+ * this handler in front of it; the original handler runs after.
+ *
+ * Not together with pyb.Flash writes or mboot on the same bank, and not with
+ * swapped banks. pyb.Flash and flashbdev still use flash.c and block; only
+ * writes through flash_rww_write_async, such as firmware updates, run here.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "ram_vectors.h"
+#include "flash_rww.h"
+
+#if MICROPY_HW_ENABLE_FLASH_RWW
+
+#define RWW_FLASH_WORD (FLASH_NB_32BITWORD_IN_FLASHWORD * 4)
+#define RWW_SR_ERRORS (FLASH_SR_WRPERR | FLASH_SR_PGSERR | FLASH_SR_STRBERR | FLASH_SR_INCERR)
+#define RWW_CR_IE (FLASH_CR_EOPIE | FLASH_CR_WRPERRIE | FLASH_CR_PGSERRIE | FLASH_CR_STRBERRIE | FLASH_CR_INCERRIE)
+
+enum { RWW_IDLE, RWW_ERASE, RWW_PROGRAM };
+
+// end of the firmware image in flash
+extern uint8_t _sidata, _sdata, _edata;
+
+static struct {
+    volatile int state;
+    volatile uint32_t *cr;
+    volatile uint32_t *sr;
+    volatile uint32_t *ccr;
+    uint32_t start;
+    uint32_t dest;
+    uint32_t end;
+    uint32_t sector;
+    uint32_t sector_end;
+    const uint8_t *src;
+    flash_rww_done_t done;
+    void *arg;
+} rww;
+
+static void (*rww_irq_saved)(void);
+
+static inline uint32_t rww_bank(uint32_t addr) {
+    return addr < FLASH_BANK2_BASE ? 1 : 2;
+}
+
+static void rww_erase_sector(void) {
+    *rww.cr = (*rww.cr & ~(FLASH_CR_SNB | FLASH_CR_PG)) | FLASH_CR_SER | (rww.sector << FLASH_CR_SNB_Pos);
+    *rww.cr |= FLASH_CR_START;
+}
+
+// one flash word; the write buffer starts programming when full
+static void rww_program_word(void) {
+    uint32_t w[FLASH_NB_32BITWORD_IN_FLASHWORD];
+    uint32_t n = MIN(RWW_FLASH_WORD, rww.end - rww.dest);
+    memset(w, 0xff, sizeof(w));
+    memcpy(w, rww.src + (rww.dest - rww.start), n);
+    volatile uint32_t *d = (volatile uint32_t *)rww.dest;
+    __ISB();
+    __DSB();
+    for (uint32_t i = 0; i < FLASH_NB_32BITWORD_IN_FLASHWORD; ++i) {
+        d[i] = w[i];
+    }
+    __ISB();
+    __DSB();
+}
+
+static void rww_finish(int err) {
+    *rww.cr &= ~(FLASH_CR_PG | FLASH_CR_SER | RWW_CR_IE);
+    *rww.cr |= FLASH_CR_LOCK;
+    // the cpu may have cached the old contents
+    uint32_t addr = rww.start & ~31;
+    SCB_InvalidateDCache_by_Addr((uint32_t *)addr, ((rww.end - addr) + 31) & ~31);
+    rww.state = RWW_IDLE;
+    if (rww.done != NULL) {
+        rww.done(rww.arg, err);
+    }
+}
+
+static void flash_rww_irq(void) {
+    uint32_t sr = rww.state == RWW_IDLE ? 0 : *rww.sr & (FLASH_SR_EOP | RWW_SR_ERRORS);
+    if (sr != 0) {
+        *rww.ccr = sr;
+        if (sr & RWW_SR_ERRORS) {
+            rww_finish(-MP_EIO);
+        } else if (rww.state == RWW_ERASE) {
+            if (++rww.sector < rww.sector_end) {
+                rww_erase_sector();
+            } else {
+                rww.state = RWW_PROGRAM;
+                *rww.cr = (*rww.cr & ~FLASH_CR_SER) | FLASH_CR_PG;
+                rww_program_word();
+            }
+        } else {
+            rww.dest += RWW_FLASH_WORD;
+            if (rww.dest < rww.end) {
+                rww_program_word();
+            } else {
+                rww_finish(0);
+            }
+        }
+    }
+    rww_irq_saved();
+}
+
+bool flash_rww_busy(void) {
+    return rww.state != RWW_IDLE;
+}
+
+int flash_rww_write_async(uint32_t dest, const void *src, size_t len, bool erase, flash_rww_done_t done, void *arg) {
+    if (rww.state != RWW_IDLE) {
+        return -MP_EBUSY;
+    }
+    uint32_t image_end = (uint32_t)&_sidata + (&_edata - &_sdata);
+    if (len == 0 || dest % RWW_FLASH_WORD != 0 || (erase && dest % FLASH_SECTOR_SIZE != 0)
+        || dest < FLASH_BANK1_BASE || dest + len > FLASH_BANK2_BASE + FLASH_BANK_SIZE
+        || rww_bank(dest) != rww_bank(dest + len - 1)) {
+        return -MP_EINVAL;
+    }
+    // not the bank with the firmware, not with swapped banks
+    if (rww_bank(dest) == rww_bank(FLASH_BANK1_BASE) || rww_bank(dest) == rww_bank(image_end - 1)
+        || (FLASH->OPTCR & FLASH_OPTCR_SWAP_BANK)) {
+        return -MP_EPERM;
+    }
+
+    if (rww_bank(dest) == 1) {
+        FLASH->KEYR1 = FLASH_KEY1;
+        FLASH->KEYR1 = FLASH_KEY2;
+        rww.cr = &FLASH->CR1;
+        rww.sr = &FLASH->SR1;
+        rww.ccr = &FLASH->CCR1;
+    } else {
+        FLASH->KEYR2 = FLASH_KEY1;
+        FLASH->KEYR2 = FLASH_KEY2;
+        rww.cr = &FLASH->CR2;
+        rww.sr = &FLASH->SR2;
+        rww.ccr = &FLASH->CCR2;
+    }
+    if (*rww.cr & FLASH_CR_LOCK) {
+        return -MP_EIO;
+    }
+    if (rww_irq_saved == NULL) {
+        rww_irq_saved = (void (*)(void))ram_vector_set(FLASH_IRQn, (uint32_t)flash_rww_irq);
+        NVIC_SetPriority(FLASH_IRQn, IRQ_PRI_FLASH);
+        HAL_NVIC_EnableIRQ(FLASH_IRQn);
+    }
+
+    uint32_t bank_base = rww_bank(dest) == 1 ? FLASH_BANK1_BASE : FLASH_BANK2_BASE;
+    rww.start = dest;
+    rww.dest = dest;
+    rww.end = dest + len;
+    rww.src = src;
+    rww.sector = (dest - bank_base) / FLASH_SECTOR_SIZE;
+    rww.sector_end = (dest + len - bank_base + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+    rww.done = done;
+    rww.arg = arg;
+
+    *rww.ccr = FLASH_SR_EOP | RWW_SR_ERRORS;
+    uint32_t irq_state = raise_irq_pri(IRQ_PRI_FLASH);
+    *rww.cr |= RWW_CR_IE;
+    if (erase) {
+        rww.state = RWW_ERASE;
+        rww_erase_sector();
+    } else {
+        rww.state = RWW_PROGRAM;
+        *rww.cr |= FLASH_CR_PG;
+        rww_program_word();
+    }
+    restore_irq_pri(irq_state);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+typedef struct _spiram_flashwriter_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // staging buffer, kept alive while writing
+    mp_obj_t callback;
+    volatile int err;
+    volatile bool busy;
+} spiram_flashwriter_obj_t;
+
+static void spiram_flashwriter_done(void *arg, int err) {
+    spiram_flashwriter_obj_t *self = arg;
+    self->err = err;
+    self->busy = false;
+    if (self->callback != mp_const_none) {
+        mp_sched_schedule(self->callback, MP_OBJ_FROM_PTR(self));
+    }
+}
+
+// spiram.FlashWriter()
+STATIC mp_obj_t spiram_flashwriter_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 0, 0, false);
+    spiram_flashwriter_obj_t *self = m_new_obj_with_finaliser(spiram_flashwriter_obj_t);
+    self->base.type = type;
+    self->buf = mp_const_none;
+    self->callback = mp_const_none;
+    self->err = 0;
+    self->busy = false;
+    return MP_OBJ_FROM_PTR(self);
+}
+
+// fw.write(addr, buf, *, erase=True, callback=None)
+// starts erasing the sectors from addr and programming buf, and returns.
+// buf, normally in spi ram, must not change until done. callback(fw) is
+// scheduled when done.
+
+STATIC mp_obj_t spiram_flashwriter_write(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_addr, ARG_buf, ARG_erase, ARG_callback };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_addr, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_erase, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+        { MP_QSTR_callback, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+    };
+    spiram_flashwriter_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_READ);
+    if (self->busy) {
+        mp_raise_OSError(MP_EBUSY);
+    }
+    self->buf = args[ARG_buf].u_obj;
+    self->callback = args[ARG_callback].u_obj;
+    self->err = 0;
+    self->busy = true;
+    int ret = flash_rww_write_async(args[ARG_addr].u_int, bufinfo.buf, bufinfo.len, args[ARG_erase].u_bool, spiram_flashwriter_done, self);
+    if (ret != 0) {
+        self->busy = false;
+        self->buf = mp_const_none;
+        mp_raise_OSError(-ret);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(spiram_flashwriter_write_obj, 3, spiram_flashwriter_write);
+
+STATIC mp_obj_t spiram_flashwriter_busy(mp_obj_t self_in) {
+    spiram_flashwriter_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_bool(self->busy);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_flashwriter_busy_obj, spiram_flashwriter_busy);
+
+// fw.wait()
+// waits until the write is done; raises OSError if it failed.
+
+STATIC mp_obj_t spiram_flashwriter_wait(mp_obj_t self_in) {
+    spiram_flashwriter_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    while (self->busy) {
+        MICROPY_EVENT_POLL_HOOK
+    }
+    self->buf = mp_const_none;
+    if (self->err != 0) {
+        int err = self->err;
+        self->err = 0;
+        mp_raise_OSError(-err);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_flashwriter_wait_obj, spiram_flashwriter_wait);
+
+// a write in progress reads buf: wait before it can be freed
+STATIC mp_obj_t spiram_flashwriter_del(mp_obj_t self_in) {
+    spiram_flashwriter_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    while (self->busy) {
+        __WFI();
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_flashwriter_del_obj, spiram_flashwriter_del);
+
+STATIC const mp_rom_map_elem_t spiram_flashwriter_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&spiram_flashwriter_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_busy), MP_ROM_PTR(&spiram_flashwriter_busy_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wait), MP_ROM_PTR(&spiram_flashwriter_wait_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_flashwriter_del_obj) },
+    { MP_ROM_QSTR(MP_QSTR_SECTOR_SIZE), MP_ROM_INT(FLASH_SECTOR_SIZE) },
+    { MP_ROM_QSTR(MP_QSTR_BANK2), MP_ROM_INT(FLASH_BANK2_BASE) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_flashwriter_locals_dict, spiram_flashwriter_locals_dict_table);
+
+const mp_obj_type_t spiram_flashwriter_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_FlashWriter,
+    .make_new = spiram_flashwriter_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_flashwriter_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_FLASH_RWW
+
+// not truncated
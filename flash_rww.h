@@ -0,0 +1,25 @@
+/*
+ * internal flash programming from spi ram, while code runs from the other bank
+ */
+#ifndef __FLASH_RWW_H__
+#define __FLASH_RWW_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+
+#ifndef MICROPY_HW_ENABLE_FLASH_RWW
+#define MICROPY_HW_ENABLE_FLASH_RWW (0)
+#endif
+
+// called from the flash interrupt; err is 0 or negative errno
+typedef void (*flash_rww_done_t)(void *arg, int err);
+
+// erase (optional) and program len bytes at flash address dest, from src.
+// dest is flash word aligned, and sector aligned when erasing; src stays valid
+// until done. Returns 0 or negative errno.
+int flash_rww_write_async(uint32_t dest, const void *src, size_t len, bool erase, flash_rww_done_t done, void *arg);
+bool flash_rww_busy(void);
+
+extern const mp_obj_type_t spiram_flashwriter_type;
+#endif // __FLASH_RWW_H__
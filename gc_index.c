@@ -0,0 +1,243 @@
+/*
+ * free space index for gc_alloc, in internal ram
+ */
+
+/* notes:
+ * gc_alloc looks for a run of free blocks by reading the allocation table from
+ * gc_last_free_atb_index on. With the heap in spi ram, that table is in spi ram
+ * too: 128 kbyte for an 8 Mbyte heap, and a large allocation in a fragmented
+ * heap reads most of it over qspi.
+ *
+ * The index cuts the heap in 256 leaves of a power of two blocks and keeps a
+ * segment tree over them in internal ram. Every node has the free run at its
+ * start, the free run at its end and its longest free run, so the first run
+ * of n blocks is found walking down from the root: left child, the run across
+ * the middle, or right child. That is 8 levels, and one leaf of the table read
+ * back to find the run inside the leaf.
+ *
+ * The runs in the tree are upper bounds, not exact. Allocating only shortens
+ * free runs, so gc_alloc does not tell the index. Freeing lengthens them, so
+ * gc.c marks the leaf of each freed block; before the next search marked leaves
+ * are set to all free. A candidate is checked against the allocation table; when
+ * it is not free, the leaves involved are read back, which lowers their bounds,
+ * and the search starts again. Every retry lowers a bound, so the search ends.
+ *
+ * A sweep frees blocks all over the heap; afterwards the first large allocations
+ * read back the leaves they pass, once. Small allocations keep the linear scan,
+ * which finds a free block within a few bytes of gc_last_free_atb_index.
+ */
+
+#include "py/mpstate.h"
+#include "py/misc.h"
+#include "gc_index.h"
+
+#if MICROPY_GC_INDEX
+
+#define BLOCKS_PER_ATB (4)
+#define LEAVES (GC_INDEX_LEAVES)
+
+bool gc_index_enabled = true;
+uint32_t gc_index_shift = 31; // before gc_index_init every block marks leaf 0
+uint32_t gc_index_dirty[GC_INDEX_LEAVES / 32];
+
+// segment tree, root at 1, leaves at LEAVES .. 2 * LEAVES - 1. Lengths in blocks.
+static uint32_t node_len[2 * LEAVES];
+static uint32_t node_head[2 * LEAVES];
+static uint32_t node_tail[2 * LEAVES];
+static uint32_t node_best[2 * LEAVES];
+static gc_index_stats_t gc_index_stats;
+
+static inline bool block_is_free(const byte *atb, size_t block) {
+    return ((atb[block / BLOCKS_PER_ATB] >> (2 * (block % BLOCKS_PER_ATB))) & 3) == 0;
+}
+
+static void node_combine(size_t i) {
+    size_t l = 2 * i;
+    size_t r = l + 1;
+    node_head[i] = node_head[l] == node_len[l] ? node_len[l] + node_head[r] : node_head[l];
+    node_tail[i] = node_tail[r] == node_len[r] ? node_len[r] + node_tail[l] : node_tail[r];
+    node_best[i] = MAX(MAX(node_best[l], node_best[r]), node_tail[l] + node_head[r]);
+}
+
+static void leaf_set(size_t leaf, uint32_t head, uint32_t tail, uint32_t best) {
+    size_t i = LEAVES + leaf;
+    node_head[i] = head;
+    node_tail[i] = tail;
+    node_best[i] = best;
+    for (i /= 2; i >= 1; i /= 2) {
+        node_combine(i);
+    }
+}
+
+static inline void leaf_set_free(size_t leaf) {
+    uint32_t len = node_len[LEAVES + leaf];
+    leaf_set(leaf, len, len, len);
+}
+
+void gc_index_init(void) {
+    size_t blocks = MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB;
+    uint32_t shift = 2; // leaves start on an allocation table byte
+    while (((blocks + (1u << shift) - 1) >> shift) > LEAVES) {
+        ++shift;
+    }
+    // gc_init cleared the allocation table: all free
+    for (size_t leaf = 0; leaf < LEAVES; ++leaf) {
+        size_t first = leaf << shift;
+        uint32_t len = first >= blocks ? 0 : MIN(blocks - first, 1u << shift);
+        size_t i = LEAVES + leaf;
+        node_len[i] = node_head[i] = node_tail[i] = node_best[i] = len;
+    }
+    for (size_t i = LEAVES - 1; i >= 1; --i) {
+        node_len[i] = node_len[2 * i] + node_len[2 * i + 1];
+        node_combine(i);
+    }
+    for (size_t w = 0; w < LEAVES / 32; ++w) {
+        gc_index_dirty[w] = 0;
+    }
+    gc_index_shift = shift;
+    gc_index_stats = (gc_index_stats_t) {0};
+}
+
+// the end of the heap moved, see spiram_heap.c. The leaves keep their size; leaves
+// that changed length are all free, which is an upper bound like any other.
+void gc_index_resize(void) {
+    size_t blocks = MP_STATE_MEM(gc_alloc_table_byte_len) * BLOCKS_PER_ATB;
+    for (size_t leaf = 0; leaf < LEAVES; ++leaf) {
+        size_t first = leaf << gc_index_shift;
+        uint32_t len = first >= blocks ? 0 : MIN(blocks - first, 1u << gc_index_shift);
+        size_t i = LEAVES + leaf;
+        if (node_len[i] != len) {
+            node_len[i] = node_head[i] = node_tail[i] = node_best[i] = len;
+        }
+    }
+    for (size_t i = LEAVES - 1; i >= 1; --i) {
+        node_len[i] = node_len[2 * i] + node_len[2 * i + 1];
+        node_combine(i);
+    }
+}
+
+// leaves that had blocks freed are all free, as far as the index knows
+static void apply_dirty(void) {
+    for (size_t w = 0; w < LEAVES / 32; ++w) {
+        uint32_t bits = gc_index_dirty[w];
+        gc_index_dirty[w] = 0;
+        while (bits != 0) {
+            uint32_t bit = __builtin_ctz(bits);
+            bits &= bits - 1;
+            leaf_set_free(32 * w + bit);
+        }
+    }
+}
+
+// read a leaf back from the allocation table, so its runs are exact.
+// Returns the first block of the first run of n free blocks inside the leaf, if any.
+static size_t leaf_scan(size_t leaf, size_t n) {
+    const byte *atb = MP_STATE_MEM(gc_alloc_table_start);
+    size_t first = leaf << gc_index_shift;
+    size_t end = first + node_len[LEAVES + leaf];
+    size_t found = GC_INDEX_NONE;
+    uint32_t head = 0;
+    uint32_t best = 0;
+    uint32_t run = 0;
+    bool in_head = true;
+    for (size_t block = first; block < end;) {
+        if (atb[block / BLOCKS_PER_ATB] == 0) {
+            // four free blocks at once
+            run += BLOCKS_PER_ATB;
+            block += BLOCKS_PER_ATB;
+        } else {
+            for (size_t stop = block + BLOCKS_PER_ATB; block < stop; ++block) {
+                if (block_is_free(atb, block)) {
+                    ++run;
+                    if (n != 0 && run == n && found == GC_INDEX_NONE) {
+                        found = block + 1 - n;
+                    }
+                } else {
+                    if (in_head) {
+                        head = run;
+                        in_head = false;
+                    }
+                    best = MAX(best, run);
+                    run = 0;
+                }
+            }
+            continue;
+        }
+        if (n != 0 && run >= n && found == GC_INDEX_NONE) {
+            found = block - run;
+        }
+    }
+    if (in_head) {
+        head = run;
+    }
+    leaf_set(leaf, head, run, MAX(best, run));
+    ++gc_index_stats.leaf_scans;
+    return found;
+}
+
+static bool run_is_free(size_t start, size_t n) {
+    const byte *atb = MP_STATE_MEM(gc_alloc_table_start);
+    for (size_t block = start; block < start + n; ++block) {
+        if (block % BLOCKS_PER_ATB == 0 && block + BLOCKS_PER_ATB <= start + n) {
+            if (atb[block / BLOCKS_PER_ATB] != 0) {
+                return false;
+            }
+            block += BLOCKS_PER_ATB - 1;
+        } else if (!block_is_free(atb, block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t gc_index_find(size_t n) {
+    apply_dirty();
+    ++gc_index_stats.finds;
+    for (;;) {
+        if (node_best[1] < n) {
+            return GC_INDEX_NONE;
+        }
+        // walk down to the leftmost node that may hold the run
+        size_t i = 1;
+        size_t base = 0;
+        size_t start = GC_INDEX_NONE;
+        while (i < LEAVES) {
+            size_t l = 2 * i;
+            size_t r = l + 1;
+            if (node_best[l] >= n) {
+                i = l;
+            } else if (node_tail[l] + node_head[r] >= n) {
+                // the run crosses from the left child into the right child
+                start = base + node_len[l] - node_tail[l];
+                break;
+            } else {
+                base += node_len[l];
+                i = r;
+            }
+        }
+        if (start == GC_INDEX_NONE) {
+            start = leaf_scan(i - LEAVES, n);
+            if (start != GC_INDEX_NONE) {
+                return start;
+            }
+        } else {
+            if (run_is_free(start, n)) {
+                return start;
+            }
+            for (size_t leaf = start >> gc_index_shift; leaf <= (start + n - 1) >> gc_index_shift; ++leaf) {
+                leaf_scan(leaf, 0);
+            }
+        }
+        ++gc_index_stats.misses;
+    }
+}
+
+void gc_index_get_stats(gc_index_stats_t *stats) {
+    *stats = gc_index_stats;
+    stats->leaves = LEAVES;
+    stats->leaf_blocks = 1u << gc_index_shift;
+}
+
+#endif // MICROPY_GC_INDEX
+
+// not truncated
@@ -0,0 +1,50 @@
+/*
+ * free space index for gc_alloc, in internal ram
+ */
+#ifndef __GC_INDEX_H__
+#define __GC_INDEX_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MICROPY_GC_INDEX
+#define MICROPY_GC_INDEX (0)
+#endif
+
+// leaves of the index; each covers a power of two blocks of the heap
+#define GC_INDEX_LEAVES (256)
+
+// smaller allocations scan from gc_last_free_atb_index, as before
+#define GC_INDEX_MIN_BLOCKS (8)
+
+#define GC_INDEX_NONE ((size_t)-1)
+
+typedef struct _gc_index_stats_t {
+    uint32_t finds;             // allocations through the index
+    uint32_t leaf_scans;        // leaves read back from the allocation table
+    uint32_t misses;            // candidates that were not free after all
+    uint32_t leaves;
+    uint32_t leaf_blocks;
+} gc_index_stats_t;
+
+extern bool gc_index_enabled;
+extern uint32_t gc_index_shift;
+extern uint32_t gc_index_dirty[GC_INDEX_LEAVES / 32];
+
+// gc.c calls this for every block it frees. Only marks the leaf, so a sweep stays cheap.
+static inline void gc_index_freed(size_t block) {
+    size_t leaf = block >> gc_index_shift;
+    gc_index_dirty[leaf / 32] |= 1u << (leaf % 32);
+}
+
+// after gc_init(). The index then covers the heap of gc_init().
+void gc_index_init(void);
+
+// after the heap grew or shrank at its end, with the gc locked. Not beyond the heap of gc_init().
+void gc_index_resize(void);
+
+// first block of the first run of n free blocks, or GC_INDEX_NONE. Call with the gc locked.
+size_t gc_index_find(size_t n);
+
+void gc_index_get_stats(gc_index_stats_t *stats);
+#endif // __GC_INDEX_H__
@@ -0,0 +1,521 @@
+/*
+ * hardware jpeg codec, with image buffers in spi ram
+ */
+
+/* notes:
+ * the codec works on mcu's, minimum coded units of 8x8 pixel blocks, not on raster images.
+ * encode: the cpu converts the raster image in spi ram to mcu's, a chunk at a time,
+ * in two small buffers in internal ram. The mdma feeds one buffer to the codec
+ * while the cpu fills the other. The jpeg output goes straight to spi ram.
+ * decode: the mdma reads the jpeg straight from spi ram. The codec output goes to
+ * the two internal buffers, and the cpu converts the mcu's to the raster image in spi ram.
+ * So image size is only limited by spi ram, not by internal ram.
+ *
+ * the mdma block length is 17 bits, so the jpeg in spi ram goes to and from the codec
+ * in buffers of at most JPEG_DMA_MAX bytes, and the callbacks hand the codec the next one.
+ *
+ * supported: grayscale, and YCbCr 4:4:4, 4:2:2 and 4:2:0 from or to rgb565.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "mdma.h"
+#include "jpeg.h"
+
+#if MICROPY_HW_ENABLE_JPEG
+
+// multiple of all mcu sizes: 64 (gray), 192 (4:4:4), 256 (4:2:2), 384 (4:2:0)
+#define JPEG_CHUNK (3072)
+#define JPEG_TIMEOUT_MS (5000)
+// largest buffer for one mdma transfer, a multiple of 32
+#define JPEG_DMA_MAX (64 * 1024)
+
+typedef struct _jpeg_state_t {
+    uint8_t *raster;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t hs;                // luma blocks per mcu, horizontal
+    uint32_t vs;                // luma blocks per mcu, vertical
+    uint32_t mcu_bytes;
+    uint32_t mcus_per_row;
+    uint32_t mcus_per_chunk;
+    uint32_t mcu_total;
+    volatile uint32_t mcu_next; // next mcu the cpu converts
+    bool decoding;
+    const uint8_t *in;          // decode: jpeg
+    size_t in_len;
+    size_t in_pos;
+    uint8_t *out;               // encode: jpeg
+    size_t out_len;
+    volatile size_t out_pos;
+    volatile uint32_t buf_len[2]; // bytes of mcu's in buffer, 0 if empty
+    volatile uint32_t cur;      // buffer in use by the codec
+    volatile bool paused;
+    volatile bool done;
+    volatile int err;
+} jpeg_state_t;
+
+static JPEG_HandleTypeDef jpeg_handle;
+static MDMA_HandleTypeDef jpeg_mdma_in;
+static MDMA_HandleTypeDef jpeg_mdma_out;
+static jpeg_state_t jpeg_state;
+static uint8_t jpeg_buf[2][JPEG_CHUNK] __attribute__((aligned(32)));
+
+static void jpeg_init(void) {
+    if (jpeg_handle.Instance == JPEG) {
+        return;
+    }
+    mdma_init();
+    __HAL_RCC_JPGDECEN_CLK_ENABLE();
+
+    jpeg_mdma_in.Instance = (MDMA_Channel_TypeDef *)(MDMA_Channel0_BASE + MDMA_CHANNEL_JPEG_IN * 0x40);
+    jpeg_mdma_in.Init.Request = MDMA_REQUEST_JPEG_INFIFO_TH;
+    jpeg_mdma_in.Init.TransferTriggerMode = MDMA_BUFFER_TRANSFER;
+    jpeg_mdma_in.Init.Priority = MDMA_PRIORITY_HIGH;
+    jpeg_mdma_in.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    jpeg_mdma_in.Init.SourceInc = MDMA_SRC_INC_BYTE;
+    jpeg_mdma_in.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    jpeg_mdma_in.Init.SourceDataSize = MDMA_SRC_DATASIZE_BYTE;
+    jpeg_mdma_in.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    jpeg_mdma_in.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    jpeg_mdma_in.Init.BufferTransferLength = 32;
+    jpeg_mdma_in.Init.SourceBurst = MDMA_SOURCE_BURST_32BEATS;
+    jpeg_mdma_in.Init.DestBurst = MDMA_DEST_BURST_16BEATS;
+    jpeg_mdma_in.Init.SourceBlockAddressOffset = 0;
+    jpeg_mdma_in.Init.DestBlockAddressOffset = 0;
+    HAL_MDMA_Init(&jpeg_mdma_in);
+    __HAL_LINKDMA(&jpeg_handle, hdmain, jpeg_mdma_in);
+    mdma_set_hal_handle(MDMA_CHANNEL_JPEG_IN, &jpeg_mdma_in);
+
+    jpeg_mdma_out.Instance = (MDMA_Channel_TypeDef *)(MDMA_Channel0_BASE + MDMA_CHANNEL_JPEG_OUT * 0x40);
+    jpeg_mdma_out.Init.Request = MDMA_REQUEST_JPEG_OUTFIFO_TH;
+    jpeg_mdma_out.Init.TransferTriggerMode = MDMA_BUFFER_TRANSFER;
+    jpeg_mdma_out.Init.Priority = MDMA_PRIORITY_VERY_HIGH;
+    jpeg_mdma_out.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    jpeg_mdma_out.Init.SourceInc = MDMA_SRC_INC_DISABLE;
+    jpeg_mdma_out.Init.DestinationInc = MDMA_DEST_INC_BYTE;
+    jpeg_mdma_out.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    jpeg_mdma_out.Init.DestDataSize = MDMA_DEST_DATASIZE_BYTE;
+    jpeg_mdma_out.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    jpeg_mdma_out.Init.BufferTransferLength = 32;
+    jpeg_mdma_out.Init.SourceBurst = MDMA_SOURCE_BURST_32BEATS;
+    jpeg_mdma_out.Init.DestBurst = MDMA_DEST_BURST_32BEATS;
+    jpeg_mdma_out.Init.SourceBlockAddressOffset = 0;
+    jpeg_mdma_out.Init.DestBlockAddressOffset = 0;
+    HAL_MDMA_Init(&jpeg_mdma_out);
+    __HAL_LINKDMA(&jpeg_handle, hdmaout, jpeg_mdma_out);
+    mdma_set_hal_handle(MDMA_CHANNEL_JPEG_OUT, &jpeg_mdma_out);
+
+    jpeg_handle.Instance = JPEG;
+    HAL_JPEG_Init(&jpeg_handle);
+    NVIC_SetPriority(JPEG_IRQn, IRQ_PRI_DMA);
+    HAL_NVIC_EnableIRQ(JPEG_IRQn);
+}
+
+void JPEG_IRQHandler(void) {
+    IRQ_ENTER(JPEG_IRQn);
+    HAL_JPEG_IRQHandler(&jpeg_handle);
+    IRQ_EXIT(JPEG_IRQn);
+}
+
+static void jpeg_geometry(jpeg_state_t *s) {
+    uint32_t chroma = s->format == JPEG_FORMAT_GRAYSCALE ? 0 : 2;
+    s->mcu_bytes = 64 * (s->hs * s->vs + chroma);
+    s->mcus_per_row = (s->width + 8 * s->hs - 1) / (8 * s->hs);
+    s->mcu_total = s->mcus_per_row * ((s->height + 8 * s->vs - 1) / (8 * s->vs));
+    s->mcus_per_chunk = JPEG_CHUNK / s->mcu_bytes;
+}
+
+static inline uint32_t jpeg_bytes_per_pixel(uint32_t format) {
+    return format == JPEG_FORMAT_GRAYSCALE ? 1 : 2;
+}
+
+// -----------------------------------------------------------------------------
+// raster <-> mcu conversion. Pixels outside the image repeat the last row and column.
+
+static void jpeg_raster_to_mcu(const jpeg_state_t *s, uint32_t mcu, uint8_t *out) {
+    uint32_t mx = (mcu % s->mcus_per_row) * 8 * s->hs;
+    uint32_t my = (mcu / s->mcus_per_row) * 8 * s->vs;
+    uint32_t nblocks = s->hs * s->vs;
+    uint16_t cb_sum[64] = {0};
+    uint16_t cr_sum[64] = {0};
+
+    for (uint32_t py = 0; py < 8 * s->vs; ++py) {
+        uint32_t y = MIN(my + py, s->height - 1);
+        for (uint32_t px = 0; px < 8 * s->hs; ++px) {
+            uint32_t x = MIN(mx + px, s->width - 1);
+            uint8_t *yblk = out + 64 * ((py / 8) * s->hs + px / 8);
+            uint32_t i = (py % 8) * 8 + px % 8;
+            if (s->format == JPEG_FORMAT_GRAYSCALE) {
+                yblk[i] = s->raster[y * s->width + x];
+                continue;
+            }
+            uint32_t p = ((const uint16_t *)s->raster)[y * s->width + x];
+            int r = ((p >> 8) & 0xf8) | (p >> 13);
+            int g = ((p >> 3) & 0xfc) | ((p >> 9) & 0x03);
+            int b = ((p << 3) & 0xf8) | ((p >> 2) & 0x07);
+            yblk[i] = (77 * r + 150 * g + 29 * b) >> 8;
+            uint32_t c = (py / s->vs) * 8 + px / s->hs;
+            cb_sum[c] += ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+            cr_sum[c] += ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+        }
+    }
+    if (s->format != JPEG_FORMAT_GRAYSCALE) {
+        uint8_t *cb = out + 64 * nblocks;
+        uint8_t *cr = cb + 64;
+        for (uint32_t c = 0; c < 64; ++c) {
+            cb[c] = cb_sum[c] / nblocks;
+            cr[c] = cr_sum[c] / nblocks;
+        }
+    }
+}
+
+static inline uint32_t jpeg_clamp(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static void jpeg_mcu_to_raster(jpeg_state_t *s, uint32_t mcu, const uint8_t *in) {
+    uint32_t mx = (mcu % s->mcus_per_row) * 8 * s->hs;
+    uint32_t my = (mcu / s->mcus_per_row) * 8 * s->vs;
+    const uint8_t *cb = in + 64 * s->hs * s->vs;
+    const uint8_t *cr = cb + 64;
+
+    for (uint32_t py = 0; py < 8 * s->vs && my + py < s->height; ++py) {
+        uint32_t y = my + py;
+        for (uint32_t px = 0; px < 8 * s->hs && mx + px < s->width; ++px) {
+            uint32_t x = mx + px;
+            int luma = in[64 * ((py / 8) * s->hs + px / 8) + (py % 8) * 8 + px % 8];
+            if (s->format == JPEG_FORMAT_GRAYSCALE) {
+                s->raster[y * s->width + x] = luma;
+                continue;
+            }
+            uint32_t c = (py / s->vs) * 8 + px / s->hs;
+            int d = cb[c] - 128;
+            int e = cr[c] - 128;
+            uint32_t r = jpeg_clamp(luma + ((359 * e) >> 8));
+            uint32_t g = jpeg_clamp(luma - ((88 * d + 183 * e) >> 8));
+            uint32_t b = jpeg_clamp(luma + ((454 * d) >> 8));
+            ((uint16_t *)s->raster)[y * s->width + x] = (r & 0xf8) << 8 | (g & 0xfc) << 3 | b >> 3;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// codec callbacks, irq context
+
+void HAL_JPEG_InfoReadyCallback(JPEG_HandleTypeDef *hjpeg, JPEG_ConfTypeDef *info) {
+    jpeg_state_t *s = &jpeg_state;
+    s->width = info->ImageWidth;
+    s->height = info->ImageHeight;
+    s->hs = 1;
+    s->vs = 1;
+    if (info->ColorSpace == JPEG_GRAYSCALE_COLORSPACE) {
+        s->format = JPEG_FORMAT_GRAYSCALE;
+    } else if (info->ColorSpace == JPEG_YCBCR_COLORSPACE) {
+        s->format = JPEG_FORMAT_RGB565;
+        if (info->ChromaSubsampling != JPEG_444_SUBSAMPLING) {
+            s->hs = 2;
+        }
+        if (info->ChromaSubsampling == JPEG_420_SUBSAMPLING) {
+            s->vs = 2;
+        }
+    } else {
+        s->err = -MP_EINVAL; // cmyk
+    }
+    jpeg_geometry(s);
+    if ((uint64_t)s->width * s->height * jpeg_bytes_per_pixel(s->format) > s->out_len) {
+        s->err = -MP_ENOSPC;
+    }
+}
+
+void HAL_JPEG_GetDataCallback(JPEG_HandleTypeDef *hjpeg, uint32_t NbDecodedData) {
+    jpeg_state_t *s = &jpeg_state;
+    if (s->decoding) {
+        // the next part of the jpeg; the codec may stop early after the header
+        s->in_pos += NbDecodedData;
+        if (s->in_pos < s->in_len) {
+            HAL_JPEG_ConfigInputBuffer(hjpeg, (uint8_t *)s->in + s->in_pos, MIN(s->in_len - s->in_pos, JPEG_DMA_MAX));
+        }
+        return;
+    }
+    s->buf_len[s->cur] = 0;
+    s->cur ^= 1;
+    if (s->buf_len[s->cur] != 0) {
+        HAL_JPEG_ConfigInputBuffer(hjpeg, jpeg_buf[s->cur], s->buf_len[s->cur]);
+    } else if (s->mcu_next < s->mcu_total) {
+        // cpu has not finished converting the next chunk
+        HAL_JPEG_Pause(hjpeg, JPEG_PAUSE_RESUME_INPUT);
+        s->paused = true;
+    }
+}
+
+void HAL_JPEG_DataReadyCallback(JPEG_HandleTypeDef *hjpeg, uint8_t *pDataOut, uint32_t OutDataLength) {
+    jpeg_state_t *s = &jpeg_state;
+    if (!s->decoding) {
+        s->out_pos += OutDataLength;
+        if (s->out_pos < s->out_len) {
+            HAL_JPEG_ConfigOutputBuffer(hjpeg, s->out + s->out_pos, MIN(s->out_len - s->out_pos, JPEG_DMA_MAX));
+        } else if (!s->done) {
+            s->err = -MP_ENOSPC;
+        }
+        return;
+    }
+    s->buf_len[s->cur] = OutDataLength;
+    s->cur ^= 1;
+    if (s->buf_len[s->cur] == 0) {
+        HAL_JPEG_ConfigOutputBuffer(hjpeg, jpeg_buf[s->cur], JPEG_CHUNK);
+    } else {
+        // cpu has not finished converting the previous chunk
+        HAL_JPEG_Pause(hjpeg, JPEG_PAUSE_RESUME_OUTPUT);
+        s->paused = true;
+    }
+}
+
+void HAL_JPEG_EncodeCpltCallback(JPEG_HandleTypeDef *hjpeg) {
+    jpeg_state.done = true;
+}
+
+void HAL_JPEG_DecodeCpltCallback(JPEG_HandleTypeDef *hjpeg) {
+    jpeg_state.done = true;
+}
+
+void HAL_JPEG_ErrorCallback(JPEG_HandleTypeDef *hjpeg) {
+    jpeg_state.err = -MP_EIO;
+    jpeg_state.done = true;
+}
+
+// -----------------------------------------------------------------------------
+
+// convert the next chunk of the raster image into buffer b
+static void jpeg_encode_fill(jpeg_state_t *s, uint32_t b) {
+    uint32_t n = MIN(s->mcus_per_chunk, s->mcu_total - s->mcu_next);
+    if (n == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        jpeg_raster_to_mcu(s, s->mcu_next + i, jpeg_buf[b] + i * s->mcu_bytes);
+    }
+    MP_HAL_CLEAN_DCACHE(jpeg_buf[b], n * s->mcu_bytes);
+    // buffer before counter, see HAL_JPEG_GetDataCallback
+    s->buf_len[b] = n * s->mcu_bytes;
+    s->mcu_next += n;
+}
+
+static int jpeg_finish(jpeg_state_t *s, uint32_t start) {
+    if (s->err == 0 && mp_hal_ticks_ms() - start < JPEG_TIMEOUT_MS) {
+        return 0;
+    }
+    HAL_JPEG_Abort(&jpeg_handle);
+    return s->err != 0 ? s->err : -MP_ETIMEDOUT;
+}
+
+int jpeg_encode(const uint8_t *src, uint32_t width, uint32_t height, uint32_t format,
+    uint32_t subsampling, uint32_t quality, uint8_t *dst, size_t dst_len) {
+    jpeg_init();
+    jpeg_state_t *s = &jpeg_state;
+    memset(s, 0, sizeof(*s));
+    s->raster = (uint8_t *)src;
+    s->width = width;
+    s->height = height;
+    s->format = format;
+    s->out = dst;
+    s->out_len = dst_len & ~3;
+
+    JPEG_ConfTypeDef conf = {0};
+    conf.ImageWidth = width;
+    conf.ImageHeight = height;
+    conf.ImageQuality = quality;
+    s->hs = 1;
+    s->vs = 1;
+    if (format == JPEG_FORMAT_GRAYSCALE) {
+        conf.ColorSpace = JPEG_GRAYSCALE_COLORSPACE;
+        conf.ChromaSubsampling = JPEG_444_SUBSAMPLING;
+    } else {
+        conf.ColorSpace = JPEG_YCBCR_COLORSPACE;
+        if (subsampling == 420) {
+            conf.ChromaSubsampling = JPEG_420_SUBSAMPLING;
+            s->hs = 2;
+            s->vs = 2;
+        } else if (subsampling == 422) {
+            conf.ChromaSubsampling = JPEG_422_SUBSAMPLING;
+            s->hs = 2;
+        } else {
+            conf.ChromaSubsampling = JPEG_444_SUBSAMPLING;
+        }
+    }
+    if (HAL_JPEG_ConfigEncoding(&jpeg_handle, &conf) != HAL_OK) {
+        return -MP_EINVAL;
+    }
+    jpeg_geometry(s);
+
+    jpeg_encode_fill(s, 0);
+    jpeg_encode_fill(s, 1);
+    MP_HAL_CLEANINVALIDATE_DCACHE(dst, dst_len);
+    if (HAL_JPEG_Encode_DMA(&jpeg_handle, jpeg_buf[0], s->buf_len[0], s->out, MIN(s->out_len, JPEG_DMA_MAX)) != HAL_OK) {
+        return -MP_EIO;
+    }
+
+    uint32_t start = mp_hal_ticks_ms();
+    while (!s->done) {
+        int ret = jpeg_finish(s, start);
+        if (ret != 0) {
+            return ret;
+        }
+        uint32_t cur = s->cur;
+        if (s->paused && s->buf_len[cur] != 0) {
+            s->paused = false;
+            HAL_JPEG_ConfigInputBuffer(&jpeg_handle, jpeg_buf[cur], s->buf_len[cur]);
+            HAL_JPEG_Resume(&jpeg_handle, JPEG_PAUSE_RESUME_INPUT);
+        } else if (s->mcu_next < s->mcu_total && s->buf_len[s->paused ? cur : cur ^ 1] == 0) {
+            jpeg_encode_fill(s, s->paused ? cur : cur ^ 1);
+        } else {
+            MICROPY_EVENT_POLL_HOOK
+        }
+    }
+    if (s->err != 0) {
+        return s->err;
+    }
+    mdma_dcache_invalidate(dst, s->out_pos);
+    return s->out_pos;
+}
+
+int jpeg_decode(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len,
+    uint32_t *width, uint32_t *height, uint32_t *format) {
+    jpeg_init();
+    jpeg_state_t *s = &jpeg_state;
+    memset(s, 0, sizeof(*s));
+    s->decoding = true;
+    s->raster = dst;
+    s->out_len = dst_len;
+    s->in = src;
+    s->in_len = src_len;
+
+    MP_HAL_CLEAN_DCACHE(src, src_len);
+    if (HAL_JPEG_Decode_DMA(&jpeg_handle, (uint8_t *)src, MIN(src_len, JPEG_DMA_MAX), jpeg_buf[0], JPEG_CHUNK) != HAL_OK) {
+        return -MP_EIO;
+    }
+
+    uint32_t start = mp_hal_ticks_ms();
+    uint32_t rd = 0; // next buffer to convert
+    for (;;) {
+        int ret = jpeg_finish(s, start);
+        if (ret != 0) {
+            return ret;
+        }
+        uint32_t len = s->buf_len[rd];
+        if (len != 0) {
+            SCB_InvalidateDCache_by_Addr((uint32_t *)jpeg_buf[rd], JPEG_CHUNK);
+            uint32_t n = MIN(len / s->mcu_bytes, s->mcu_total - s->mcu_next);
+            for (uint32_t i = 0; i < n; ++i) {
+                jpeg_mcu_to_raster(s, s->mcu_next + i, jpeg_buf[rd] + i * s->mcu_bytes);
+            }
+            s->mcu_next += n;
+            s->buf_len[rd] = 0;
+            rd ^= 1;
+            if (s->paused && s->buf_len[s->cur] == 0) {
+                s->paused = false;
+                HAL_JPEG_ConfigOutputBuffer(&jpeg_handle, jpeg_buf[s->cur], JPEG_CHUNK);
+                HAL_JPEG_Resume(&jpeg_handle, JPEG_PAUSE_RESUME_OUTPUT);
+            }
+        } else if (s->done) {
+            break;
+        } else {
+            MICROPY_EVENT_POLL_HOOK
+        }
+    }
+    *width = s->width;
+    *height = s->height;
+    *format = s->format;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// spiram.jpeg_encode(src, dst, width, height, *, format=RGB565, subsampling=420, quality=80)
+// encode raster image src into dst. Returns the size of the jpeg.
+
+STATIC mp_obj_t spiram_jpeg_encode(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_src, ARG_dst, ARG_width, ARG_height, ARG_format, ARG_subsampling, ARG_quality };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_dst, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_width, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_height, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_format, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = JPEG_FORMAT_RGB565} },
+        { MP_QSTR_subsampling, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 420} },
+        { MP_QSTR_quality, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 80} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t src;
+    mp_buffer_info_t dst;
+    mp_get_buffer_raise(args[ARG_src].u_obj, &src, MP_BUFFER_READ);
+    mp_get_buffer_raise(args[ARG_dst].u_obj, &dst, MP_BUFFER_WRITE);
+    mp_int_t width = args[ARG_width].u_int;
+    mp_int_t height = args[ARG_height].u_int;
+    mp_int_t format = args[ARG_format].u_int;
+    mp_int_t quality = args[ARG_quality].u_int;
+    if (width <= 0 || height <= 0 || width > 0xffff || height > 0xffff
+        || (format != JPEG_FORMAT_GRAYSCALE && format != JPEG_FORMAT_RGB565)
+        || quality < 1 || quality > 100) {
+        mp_raise_ValueError(NULL);
+    }
+    if (src.len < (uint64_t)width * height * jpeg_bytes_per_pixel(format)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("src too small"));
+    }
+    int ret;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        ret = jpeg_encode(src.buf, width, height, format, args[ARG_subsampling].u_int, quality, dst.buf, dst.len);
+        nlr_pop();
+    } else {
+        // the poll hook raised: stop the codec before it writes on to dst
+        HAL_JPEG_Abort(&jpeg_handle);
+        nlr_jump(nlr.ret_val);
+    }
+    if (ret < 0) {
+        mp_raise_OSError(-ret);
+    }
+    return MP_OBJ_NEW_SMALL_INT(ret);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_jpeg_encode_obj, 4, spiram_jpeg_encode);
+
+// spiram.jpeg_decode(src, dst)
+// decode jpeg src into raster image dst. Returns (width, height, format).
+
+STATIC mp_obj_t spiram_jpeg_decode(mp_obj_t src_in, mp_obj_t dst_in) {
+    mp_buffer_info_t src;
+    mp_buffer_info_t dst;
+    mp_get_buffer_raise(src_in, &src, MP_BUFFER_READ);
+    mp_get_buffer_raise(dst_in, &dst, MP_BUFFER_WRITE);
+    uint32_t width, height, format;
+    int ret;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        ret = jpeg_decode(src.buf, src.len, dst.buf, dst.len, &width, &height, &format);
+        nlr_pop();
+    } else {
+        HAL_JPEG_Abort(&jpeg_handle);
+        nlr_jump(nlr.ret_val);
+    }
+    if (ret < 0) {
+        mp_raise_OSError(-ret);
+    }
+    mp_obj_t tuple[3] = {
+        MP_OBJ_NEW_SMALL_INT(width),
+        MP_OBJ_NEW_SMALL_INT(height),
+        MP_OBJ_NEW_SMALL_INT(format),
+    };
+    return mp_obj_new_tuple(3, tuple);
+}
+MP_DEFINE_CONST_FUN_OBJ_2(spiram_jpeg_decode_obj, spiram_jpeg_decode);
+
+#endif // MICROPY_HW_ENABLE_JPEG
+
+// not truncated
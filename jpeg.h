@@ -0,0 +1,26 @@
+/*
+ * hardware jpeg codec, with image buffers in spi ram
+ */
+#ifndef __JPEG_H__
+#define __JPEG_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+
+// needs HAL_JPEG_MODULE_ENABLED and HAL_MDMA_MODULE_ENABLED in stm32h7xx_hal_conf.h
+#ifndef MICROPY_HW_ENABLE_JPEG
+#define MICROPY_HW_ENABLE_JPEG (0)
+#endif
+
+enum { JPEG_FORMAT_GRAYSCALE, JPEG_FORMAT_RGB565 };
+
+// returns jpeg size, or negative errno
+int jpeg_encode(const uint8_t *src, uint32_t width, uint32_t height, uint32_t format,
+    uint32_t subsampling, uint32_t quality, uint8_t *dst, size_t dst_len);
+// returns 0 or negative errno. Output is grayscale or rgb565, as in the jpeg.
+int jpeg_decode(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len,
+    uint32_t *width, uint32_t *height, uint32_t *format);
+
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_jpeg_encode_obj);
+MP_DECLARE_CONST_FUN_OBJ_2(spiram_jpeg_decode_obj);
+#endif // __JPEG_H__
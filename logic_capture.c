@@ -0,0 +1,416 @@
+/*
+ * logic analyzer: timer-triggered dma capture of a gpio port into spi ram
+ */
+
+/* notes:
+ * the update event of tim8 is a dma request. A dma stream reads the 16-bit
+ * input data register of a gpio port, and writes the samples straight to spi ram,
+ * in 16 byte bursts through the dma fifo.
+ *
+ * the dma stream runs in double buffer mode over 64 kbyte chunks of the capture buffer.
+ * At the end of each chunk the transfer complete flag of the stream triggers one node
+ * of an mdma linked list. The node points the idle buffer of the stream at the next
+ * free chunk, and clears the flag. The node of the last chunk stops the timer.
+ * The cpu is not involved until the capture is complete.
+ *
+ * triggers are polled: the cpu reads the port until the condition holds,
+ * and then starts the timer. Latency is some 100 ns.
+ *
+ * export: samples() is the raw capture, 16 channels, little endian. Import in pulseview
+ * or sigrok-cli with the "binary" input format:
+ *   sigrok-cli -I binary:numchannels=16:samplerate=10m -i capture.bin -o capture.sr
+ * export_vcd() writes a value change dump; pulseview, sigrok-cli and dsview import vcd.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "timer.h"
+#include "mdma.h"
+#include "logic_capture.h"
+
+#if MICROPY_HW_ENABLE_LOGIC_CAPTURE
+
+// tim8 update request, on dma2 stream 6. Its transfer complete flag is mdma request 0x0e.
+#ifndef MICROPY_HW_LOGIC_TIM
+#define MICROPY_HW_LOGIC_TIM (TIM8)
+#define MICROPY_HW_LOGIC_TIM_ID (8)
+#define MICROPY_HW_LOGIC_TIM_CLK_ENABLE() __HAL_RCC_TIM8_CLK_ENABLE()
+#define MICROPY_HW_LOGIC_DMA_REQUEST (DMA_REQUEST_TIM8_UP)
+#define MICROPY_HW_LOGIC_DMA_STREAM (DMA2_Stream6)
+#define MICROPY_HW_LOGIC_DMAMUX (DMAMUX1_Channel14)
+#define MICROPY_HW_LOGIC_DMA_IFCR (&DMA2->HIFCR)
+#define MICROPY_HW_LOGIC_DMA_TCIF (DMA_HIFCR_CTCIF6)
+#define MICROPY_HW_LOGIC_MDMA_REQUEST (0x0e)
+#endif
+
+#define LOGIC_CHUNK (32768)         // samples per dma buffer
+#define LOGIC_ALIGN (8)             // samples per dma burst
+#define LOGIC_MDMA_PRIORITY (3)
+
+enum { LOGIC_TRIGGER_NONE, LOGIC_TRIGGER_LEVEL, LOGIC_TRIGGER_RISING, LOGIC_TRIGGER_FALLING };
+
+typedef struct _spiram_logic_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the capture buffer alive
+    uint16_t *samples;
+    uint32_t n_samples;
+    uint32_t chunk;             // samples per dma buffer
+    uint32_t n_chunks;
+    GPIO_TypeDef *port;
+    uint32_t period;            // timer ticks per sample
+    uint32_t rate;
+    mdma_node_t *node;          // one per chunk
+    uint32_t *value;            // register value each node writes
+    uint32_t captured;
+    volatile bool running;
+} spiram_logic_obj_t;
+
+// the dma overshoots the last chunk by a few samples, until the mdma stops the timer
+static uint16_t logic_guard[128] __attribute__((aligned(16)));
+
+static void logic_stop(spiram_logic_obj_t *self) {
+    DMA_Stream_TypeDef *dma = MICROPY_HW_LOGIC_DMA_STREAM;
+    MICROPY_HW_LOGIC_TIM->CR1 = 0;
+    MICROPY_HW_LOGIC_TIM->DIER = 0;
+    dma->CR &= ~DMA_SxCR_EN;
+    while (dma->CR & DMA_SxCR_EN) {
+    }
+    mdma_abort(MDMA_CHANNEL_LOGIC);
+    self->running = false;
+}
+
+static void logic_mdma_irq(uint32_t channel, uint32_t cisr, void *arg) {
+    logic_stop(arg);
+}
+
+static void logic_setup(spiram_logic_obj_t *self) {
+    DMA_Stream_TypeDef *dma = MICROPY_HW_LOGIC_DMA_STREAM;
+    TIM_TypeDef *tim = MICROPY_HW_LOGIC_TIM;
+    uint32_t n = self->n_chunks;
+
+    // mdma list: node k runs when chunk k is full
+    for (uint32_t k = 0; k < n; ++k) {
+        volatile uint32_t *reg;
+        if (k == n - 1) {
+            reg = &tim->CR1;
+            self->value[k] = 0;
+        } else {
+            reg = (k & 1) ? &dma->M1AR : &dma->M0AR;
+            self->value[k] = k + 2 < n ? (uint32_t)(self->samples + (k + 2) * self->chunk) : (uint32_t)logic_guard;
+        }
+        mdma_node_memcpy(&self->node[k], (void *)reg, &self->value[k], 4);
+        mdma_node_trigger(&self->node[k], MICROPY_HW_LOGIC_MDMA_REQUEST, MICROPY_HW_LOGIC_DMA_IFCR, MICROPY_HW_LOGIC_DMA_TCIF);
+        self->node[k].CLAR = k + 1 < n ? (uint32_t)&self->node[k + 1] : 0;
+    }
+    // nodes, values and capture buffer in memory, not in cache
+    SCB_CleanInvalidateDCache();
+
+    MICROPY_HW_LOGIC_TIM_CLK_ENABLE();
+    tim->CR1 = TIM_CR1_URS;
+    tim->DIER = 0;
+    tim->PSC = 0;
+    tim->ARR = self->period - 1;
+    tim->CNT = 0;
+    tim->EGR = TIM_EGR_UG;
+    tim->SR = 0;
+    tim->DIER = TIM_DIER_UDE;
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    MICROPY_HW_LOGIC_DMAMUX->CCR = MICROPY_HW_LOGIC_DMA_REQUEST;
+    dma->CR = 0;
+    while (dma->CR & DMA_SxCR_EN) {
+    }
+    *MICROPY_HW_LOGIC_DMA_IFCR = MICROPY_HW_LOGIC_DMA_TCIF;
+    dma->PAR = (uint32_t)&self->port->IDR;
+    dma->M0AR = (uint32_t)self->samples;
+    dma->M1AR = n > 1 ? (uint32_t)(self->samples + self->chunk) : (uint32_t)logic_guard;
+    dma->NDTR = self->chunk;
+    dma->FCR = DMA_SxFCR_DMDIS | 3 << DMA_SxFCR_FTH_Pos;
+    dma->CR = DMA_SxCR_DBM
+        | DMA_SxCR_MINC
+        | 1 << DMA_SxCR_PSIZE_Pos
+        | 2 << DMA_SxCR_MSIZE_Pos
+        | 1 << DMA_SxCR_MBURST_Pos
+        | 3 << DMA_SxCR_PL_Pos;
+
+    mdma_init();
+    mdma_set_callback(MDMA_CHANNEL_LOGIC, logic_mdma_irq, self);
+    mdma_start(MDMA_CHANNEL_LOGIC, &self->node[0], LOGIC_MDMA_PRIORITY);
+    self->running = true;
+    dma->CR |= DMA_SxCR_EN;
+}
+
+// poll the port until the trigger condition holds, then start the timer
+static bool logic_trigger(spiram_logic_obj_t *self, uint32_t trigger, uint32_t mask, uint32_t value, uint32_t timeout_ms) {
+    volatile uint32_t *idr = &self->port->IDR;
+    TIM_TypeDef *tim = MICROPY_HW_LOGIC_TIM;
+    uint32_t start = mp_hal_ticks_ms();
+    uint32_t prev = *idr;
+    for (uint32_t i = 1;; ++i) {
+        uint32_t s = *idr;
+        bool hit;
+        switch (trigger) {
+            case LOGIC_TRIGGER_LEVEL:
+                hit = (s & mask) == value;
+                break;
+            case LOGIC_TRIGGER_RISING:
+                hit = (~prev & s & mask) != 0;
+                break;
+            case LOGIC_TRIGGER_FALLING:
+                hit = (prev & ~s & mask) != 0;
+                break;
+            default:
+                hit = true;
+                break;
+        }
+        if (hit) {
+            tim->CR1 |= TIM_CR1_CEN;
+            return true;
+        }
+        prev = s;
+        if ((i & 0xffff) == 0) {
+            if (mp_hal_ticks_ms() - start >= timeout_ms) {
+                return false;
+            }
+            MICROPY_EVENT_POLL_HOOK
+            prev = *idr;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.Logic(buf, *, port='B', rate=10000000)
+// buf holds the samples, 2 bytes each; normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_logic_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_port, ARG_rate };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_port, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_QSTR(MP_QSTR_B)} },
+        { MP_QSTR_rate, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 10000000} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_uint_t port;
+    if (mp_obj_is_str(args[ARG_port].u_obj)) {
+        const char *s = mp_obj_str_get_str(args[ARG_port].u_obj);
+        port = s[0] - 'A';
+    } else {
+        port = mp_obj_get_int(args[ARG_port].u_obj);
+    }
+    if (port > 10) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad port"));
+    }
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    // 16 byte bursts must not cross a 1 kbyte boundary: align the buffer to the burst
+    uint32_t start = ((uint32_t)bufinfo.buf + 2 * LOGIC_ALIGN - 1) & ~(2 * LOGIC_ALIGN - 1);
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    uint32_t samples = end > start ? (end - start) / 2 : 0;
+    uint32_t chunk = MIN(samples, LOGIC_CHUNK) & ~(LOGIC_ALIGN - 1);
+    if (chunk == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+
+    uint32_t clk = timer_get_source_freq(MICROPY_HW_LOGIC_TIM_ID);
+    mp_int_t rate = args[ARG_rate].u_int;
+    if (rate <= 0 || (uint32_t)rate > clk / 2) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad rate"));
+    }
+
+    spiram_logic_obj_t *self = m_new_obj_with_finaliser(spiram_logic_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->samples = (uint16_t *)start;
+    self->chunk = chunk;
+    self->n_chunks = samples / chunk;
+    self->n_samples = self->n_chunks * chunk;
+    self->port = (GPIO_TypeDef *)(GPIOA_BASE + port * (GPIOB_BASE - GPIOA_BASE));
+    self->period = MIN(clk / rate, 0x10000);
+    self->rate = clk / self->period;
+    self->node = m_new(mdma_node_t, self->n_chunks);
+    self->value = m_new(uint32_t, self->n_chunks);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_logic_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "Logic(port=%c, rate=%u, samples=%u)",
+        'A' + ((uint32_t)self->port - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE), self->rate, self->n_samples);
+}
+
+// logic.capture(*, trigger=Logic.NONE, mask=0, value=0, timeout_ms=1000)
+// trigger LEVEL: port & mask == value. RISING, FALLING: edge on any pin in mask.
+// Returns number of samples, 0 if the trigger timed out.
+
+STATIC mp_obj_t spiram_logic_capture(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_trigger, ARG_mask, ARG_value, ARG_timeout_ms };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_trigger, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = LOGIC_TRIGGER_NONE} },
+        { MP_QSTR_mask, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_value, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_timeout_ms, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1000} },
+    };
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    if (self->running) {
+        mp_raise_OSError(MP_EBUSY);
+    }
+    self->captured = 0;
+    logic_setup(self);
+    if (!logic_trigger(self, args[ARG_trigger].u_int, args[ARG_mask].u_int, args[ARG_value].u_int, args[ARG_timeout_ms].u_int)) {
+        logic_stop(self);
+        return MP_OBJ_NEW_SMALL_INT(0);
+    }
+
+    uint32_t start = mp_hal_ticks_ms();
+    uint32_t timeout_ms = (uint64_t)self->n_samples * 1000 / self->rate + 100;
+    while (self->running) {
+        if (mp_hal_ticks_ms() - start >= timeout_ms) {
+            // dma too slow for the sample rate
+            logic_stop(self);
+            mp_raise_OSError(MP_ETIMEDOUT);
+        }
+        MICROPY_EVENT_POLL_HOOK
+    }
+    // lines of the buffer were cleaned before the capture, so this only drops stale lines
+    SCB_CleanInvalidateDCache();
+    self->captured = self->n_samples;
+    return mp_obj_new_int_from_uint(self->captured);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(spiram_logic_capture_obj, 1, spiram_logic_capture);
+
+// logic.samples()
+// memoryview of the last capture, typecode 'H'
+
+STATIC mp_obj_t spiram_logic_samples(mp_obj_t self_in) {
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_memoryview('H', self->captured, self->samples);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_logic_samples_obj, spiram_logic_samples);
+
+STATIC mp_obj_t spiram_logic_samplerate(mp_obj_t self_in) {
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_int_from_uint(self->rate);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_logic_samplerate_obj, spiram_logic_samplerate);
+
+// logic.export_vcd(stream, mask=0xffff)
+// write the last capture as value change dump, channels D0..D15
+
+typedef struct _logic_vcd_t {
+    mp_obj_t stream;
+    size_t len;
+    char buf[256];
+} logic_vcd_t;
+
+static void logic_vcd_flush(logic_vcd_t *vcd) {
+    int errcode;
+    if (vcd->len != 0 && mp_stream_rw(vcd->stream, vcd->buf, vcd->len, &errcode, MP_STREAM_RW_WRITE) != vcd->len) {
+        mp_raise_OSError(errcode);
+    }
+    vcd->len = 0;
+}
+
+static void logic_vcd_printf(logic_vcd_t *vcd, const char *fmt, ...) {
+    if (vcd->len > sizeof(vcd->buf) - 64) {
+        logic_vcd_flush(vcd);
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vcd->len += vsnprintf(vcd->buf + vcd->len, sizeof(vcd->buf) - vcd->len, fmt, ap);
+    va_end(ap);
+}
+
+STATIC mp_obj_t spiram_logic_export_vcd(size_t n_args, const mp_obj_t *args) {
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    uint32_t mask = n_args > 2 ? mp_obj_get_int(args[2]) & 0xffff : 0xffff;
+    logic_vcd_t vcd;
+    vcd.stream = args[1];
+    vcd.len = 0;
+    mp_get_stream_raise(vcd.stream, MP_STREAM_OP_WRITE);
+
+    // timestamps are 32 bit; long captures at low rates get a coarser timescale
+    static const char *const unit[] = {"ns", "us", "ms"};
+    uint32_t u = 0;
+    uint32_t div = 1;
+    while (u < 2 && (uint64_t)self->captured * 1000000000ull / self->rate / div > 0xffffffff) {
+        u += 1;
+        div *= 1000;
+    }
+    logic_vcd_printf(&vcd, "$timescale 1 %s $end\n$scope module logic $end\n", unit[u]);
+    for (uint32_t ch = 0; ch < 16; ++ch) {
+        if (mask & (1 << ch)) {
+            logic_vcd_printf(&vcd, "$var wire 1 %c D%u $end\n", '!' + ch, ch);
+        }
+    }
+    logic_vcd_printf(&vcd, "$upscope $end\n$enddefinitions $end\n");
+
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < self->captured; ++i) {
+        uint32_t s = self->samples[i] & mask;
+        uint32_t changed = i == 0 ? mask : s ^ prev;
+        if (changed == 0) {
+            continue;
+        }
+        logic_vcd_printf(&vcd, "#%u\n", (uint32_t)((uint64_t)i * 1000000000ull / self->rate / div));
+        for (uint32_t ch = 0; changed != 0; ++ch, changed >>= 1) {
+            if (changed & 1) {
+                logic_vcd_printf(&vcd, "%c%c\n", s & (1 << ch) ? '1' : '0', '!' + ch);
+            }
+        }
+        prev = s;
+    }
+    logic_vcd_printf(&vcd, "#%u\n", (uint32_t)((uint64_t)self->captured * 1000000000ull / self->rate / div));
+    logic_vcd_flush(&vcd);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_logic_export_vcd_obj, 2, 3, spiram_logic_export_vcd);
+
+STATIC mp_obj_t spiram_logic_deinit(mp_obj_t self_in) {
+    spiram_logic_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->running) {
+        logic_stop(self);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_logic_deinit_obj, spiram_logic_deinit);
+
+STATIC const mp_rom_map_elem_t spiram_logic_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_capture), MP_ROM_PTR(&spiram_logic_capture_obj) },
+    { MP_ROM_QSTR(MP_QSTR_samples), MP_ROM_PTR(&spiram_logic_samples_obj) },
+    { MP_ROM_QSTR(MP_QSTR_samplerate), MP_ROM_PTR(&spiram_logic_samplerate_obj) },
+    { MP_ROM_QSTR(MP_QSTR_export_vcd), MP_ROM_PTR(&spiram_logic_export_vcd_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_logic_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_NONE), MP_ROM_INT(LOGIC_TRIGGER_NONE) },
+    { MP_ROM_QSTR(MP_QSTR_LEVEL), MP_ROM_INT(LOGIC_TRIGGER_LEVEL) },
+    { MP_ROM_QSTR(MP_QSTR_RISING), MP_ROM_INT(LOGIC_TRIGGER_RISING) },
+    { MP_ROM_QSTR(MP_QSTR_FALLING), MP_ROM_INT(LOGIC_TRIGGER_FALLING) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_logic_locals_dict, spiram_logic_locals_dict_table);
+
+const mp_obj_type_t spiram_logic_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Logic,
+    .print = spiram_logic_print,
+    .make_new = spiram_logic_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_logic_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_LOGIC_CAPTURE
+
+// not truncated
@@ -0,0 +1,13 @@
+/*
+ * logic analyzer: timer-triggered dma capture of a gpio port into spi ram
+ */
+#ifndef __LOGIC_CAPTURE_H__
+#define __LOGIC_CAPTURE_H__
+#include "py/obj.h"
+
+#ifndef MICROPY_HW_ENABLE_LOGIC_CAPTURE
+#define MICROPY_HW_ENABLE_LOGIC_CAPTURE (0)
+#endif
+
+extern const mp_obj_type_t spiram_logic_type;
+#endif // __LOGIC_CAPTURE_H__
@@ -0,0 +1,553 @@
+/*
+ * mdma driver and memcpy service
+ * tested on stm32h7a3.
+ */
+
+/* notes:
+ * the mdma is the only dma controller that reaches all memories:
+ * itcm and dtcm over the ahb slave port, axi sram and the memory-mapped spi ram over axi.
+ *
+ * dma_memcpy_async() queues copies. Each copy is a linked list of mdma nodes,
+ * transferred back-to-back on a single software request.
+ * A node holds up to 4096 blocks of 64 kbyte, so most copies are one node.
+ *
+ * data cache: source is cleaned before the transfer, destination is invalidated
+ * before and after the transfer. The destination must not be written by the cpu
+ * while the transfer runs. A cache line at either end of the destination may hold
+ * a neighbouring object, e.g. a 16 byte gc block; the cpu copies those partial
+ * lines when the job starts, and the mdma only writes whole lines.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/mpconfig.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "mdma.h"
+
+#if MICROPY_HW_ENABLE_MDMA
+
+#define MDMA_CHANNEL(ch) ((MDMA_Channel_TypeDef *)(MDMA_Channel0_BASE + (ch) * 0x40))
+#define MDMA_CISR_ALL (MDMA_CISR_TEIF | MDMA_CISR_CTCIF | MDMA_CISR_BRTIF | MDMA_CISR_BTIF | MDMA_CISR_TCIF)
+
+#define MDMA_BLOCK_MAX (65536)      // max bytes per block
+#define MDMA_REPEAT_MAX (4096)      // max blocks per node
+#define MDMA_DCACHE_SIZE (16 * 1024)
+
+#define DMA_MEMCPY_QUEUE_LEN (8)
+#define DMA_MEMCPY_NODES (32)
+#define DMA_MEMCPY_EDGES (32)
+#define DMA_MEMCPY_LINE (32)
+
+static bool mdma_inited = false;
+static mdma_callback_t mdma_callback[MDMA_NUM_CHANNELS];
+static void *mdma_callback_arg[MDMA_NUM_CHANNELS];
+#if defined(HAL_MDMA_MODULE_ENABLED)
+static MDMA_HandleTypeDef *mdma_hal_handle[MDMA_NUM_CHANNELS];
+#endif
+
+// -----------------------------------------------------------------------------
+// data cache maintenance, also for other dma drivers.
+// Above the cache size, doing the whole cache is faster.
+
+static inline bool mdma_dcache_enabled(void) {
+    return SCB->CCR & SCB_CCR_DC_Msk;
+}
+
+void mdma_dcache_clean(const void *addr, size_t len) {
+    if (!mdma_dcache_enabled()) {
+        return;
+    }
+    if (len > MDMA_DCACHE_SIZE) {
+        SCB_CleanDCache();
+    } else {
+        MP_HAL_CLEAN_DCACHE(addr, len);
+    }
+}
+
+void mdma_dcache_clean_invalidate(void *addr, size_t len) {
+    if (!mdma_dcache_enabled()) {
+        return;
+    }
+    if (len > MDMA_DCACHE_SIZE) {
+        SCB_CleanInvalidateDCache();
+    } else {
+        MP_HAL_CLEANINVALIDATE_DCACHE(addr, len);
+    }
+}
+
+void mdma_dcache_invalidate(void *addr, size_t len) {
+    if (!mdma_dcache_enabled()) {
+        return;
+    }
+    if (len > MDMA_DCACHE_SIZE) {
+        // lines of the destination were cleaned before the transfer, so this
+        // only writes back unrelated dirty lines.
+        SCB_CleanInvalidateDCache();
+    } else {
+        uint32_t start = (uint32_t)addr;
+        uint32_t end = start + len;
+        // partial lines at the ends hold other data too: written back, not dropped
+        if (start & 0x1f) {
+            SCB_CleanInvalidateDCache_by_Addr((uint32_t *)(start & ~0x1f), 32);
+            start = (start + 0x1f) & ~0x1f;
+        }
+        if ((end & 0x1f) && end > start) {
+            SCB_CleanInvalidateDCache_by_Addr((uint32_t *)(end & ~0x1f), 32);
+            end &= ~0x1f;
+        }
+        if (end > start) {
+            SCB_InvalidateDCache_by_Addr((uint32_t *)start, end - start);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void mdma_init(void) {
+    if (mdma_inited) {
+        return;
+    }
+    __HAL_RCC_MDMA_CLK_ENABLE();
+    for (uint32_t ch = 0; ch < MDMA_NUM_CHANNELS; ++ch) {
+        mdma_callback[ch] = NULL;
+        #if defined(HAL_MDMA_MODULE_ENABLED)
+        mdma_hal_handle[ch] = NULL;
+        #endif
+    }
+    NVIC_SetPriority(MDMA_IRQn, IRQ_PRI_DMA);
+    HAL_NVIC_EnableIRQ(MDMA_IRQn);
+    mdma_inited = true;
+}
+
+void mdma_set_callback(uint32_t channel, mdma_callback_t cb, void *arg) {
+    mdma_callback_arg[channel] = arg;
+    mdma_callback[channel] = cb;
+}
+
+// channels driven by a hal driver, like the jpeg codec, get HAL_MDMA_IRQHandler()
+void mdma_set_hal_handle(uint32_t channel, void *hmdma) {
+    #if defined(HAL_MDMA_MODULE_ENABLED)
+    mdma_hal_handle[channel] = hmdma;
+    #endif
+}
+
+// tcm is reached over the ahb bus, everything else over axi
+static inline uint32_t mdma_bus(uint32_t addr) {
+    return addr < 0x00010000 || (addr >= 0x20000000 && addr < 0x20020000);
+}
+
+/* fill in a memory-to-memory node for the start of a copy.
+   returns the number of bytes the node covers; call again for the rest. */
+
+size_t mdma_node_memcpy(mdma_node_t *node, void *dst, const void *src, size_t len) {
+    uint32_t d = (uint32_t)dst;
+    uint32_t s = (uint32_t)src;
+    uint32_t size_log2;
+
+    if (((d ^ s) & 3) == 0 && (d & 3) != 0) {
+        // byte copy up to the first word boundary
+        size_log2 = 0;
+        len = MIN(len, 4 - (d & 3));
+    } else if (((d | s) & 3) == 0 && len >= 4) {
+        size_log2 = 2;
+    } else if (((d | s) & 1) == 0 && len >= 2) {
+        size_log2 = 1;
+    } else {
+        size_log2 = 0;
+    }
+    len &= ~((1 << size_log2) - 1);
+
+    uint32_t blocks = 1;
+    uint32_t block_len = len;
+    if (len > MDMA_BLOCK_MAX) {
+        block_len = MDMA_BLOCK_MAX;
+        blocks = MIN(len / MDMA_BLOCK_MAX, MDMA_REPEAT_MAX);
+        len = blocks * MDMA_BLOCK_MAX;
+    }
+
+    // 128 byte buffer, 64 byte bursts
+    uint32_t burst = 6 - size_log2;
+    node->CTCR = 2 << MDMA_CTCR_SINC_Pos
+        | 2 << MDMA_CTCR_DINC_Pos
+        | size_log2 << MDMA_CTCR_SSIZE_Pos
+        | size_log2 << MDMA_CTCR_DSIZE_Pos
+        | size_log2 << MDMA_CTCR_SINCOS_Pos
+        | size_log2 << MDMA_CTCR_DINCOS_Pos
+        | burst << MDMA_CTCR_SBURST_Pos
+        | burst << MDMA_CTCR_DBURST_Pos
+        | 127 << MDMA_CTCR_TLEN_Pos
+        | 3 << MDMA_CTCR_TRGM_Pos // one request transfers the whole linked list
+        | MDMA_CTCR_SWRM;
+    node->CBNDTR = block_len << MDMA_CBNDTR_BNDT_Pos | (blocks - 1) << MDMA_CBNDTR_BRC_Pos;
+    node->CSAR = s;
+    node->CDAR = d;
+    node->CBRUR = 0; // blocks are contiguous
+    node->CLAR = 0;
+    node->CTBR = mdma_bus(s) << MDMA_CTBR_SBUS_Pos | mdma_bus(d) << MDMA_CTBR_DBUS_Pos;
+    node->reserved = 0;
+    node->CMAR = 0;
+    node->CMDR = 0;
+
+    return len;
+}
+
+/* make a node wait for a hardware request, e.g. the transfer complete flag of a dma stream.
+   Each request transfers one block. At the end of the block the mdma writes clear_mask
+   to clear_reg, to acknowledge the request. */
+
+void mdma_node_trigger(mdma_node_t *node, uint32_t request, volatile uint32_t *clear_reg, uint32_t clear_mask) {
+    node->CTCR = (node->CTCR & ~(MDMA_CTCR_SWRM | MDMA_CTCR_TRGM_Msk)) | 1 << MDMA_CTCR_TRGM_Pos;
+    node->CTBR = (node->CTBR & ~MDMA_CTBR_TSEL_Msk) | request << MDMA_CTBR_TSEL_Pos;
+    node->CMAR = (uint32_t)clear_reg;
+    node->CMDR = clear_mask;
+}
+
+static inline size_t mdma_node_len(const mdma_node_t *node) {
+    uint32_t block_len = (node->CBNDTR & MDMA_CBNDTR_BNDT_Msk) >> MDMA_CBNDTR_BNDT_Pos;
+    uint32_t blocks = ((node->CBNDTR & MDMA_CBNDTR_BRC_Msk) >> MDMA_CBNDTR_BRC_Pos) + 1;
+    return block_len * blocks;
+}
+
+/* load the first node in the channel and start. Nodes must be in memory, not in cache.
+   ccr adds channel options, e.g. MDMA_CCR_BEX to swap the bytes of each half-word. */
+
+void mdma_start_ex(uint32_t channel, const mdma_node_t *first, uint32_t priority, uint32_t ccr) {
+    MDMA_Channel_TypeDef *mdma = MDMA_CHANNEL(channel);
+
+    mdma->CCR = 0;
+    mdma->CIFCR = MDMA_CISR_ALL;
+    mdma->CTCR = first->CTCR;
+    mdma->CBNDTR = first->CBNDTR;
+    mdma->CSAR = first->CSAR;
+    mdma->CDAR = first->CDAR;
+    mdma->CBRUR = first->CBRUR;
+    mdma->CLAR = first->CLAR;
+    mdma->CTBR = first->CTBR;
+    mdma->CMAR = first->CMAR;
+    mdma->CMDR = first->CMDR;
+    __DSB();
+    mdma->CCR = ccr | priority << MDMA_CCR_PL_Pos | MDMA_CCR_TEIE | MDMA_CCR_CTCIE | MDMA_CCR_EN;
+    if (first->CTCR & MDMA_CTCR_SWRM) {
+        mdma->CCR |= MDMA_CCR_SWRQ;
+    }
+}
+
+void mdma_start(uint32_t channel, const mdma_node_t *first, uint32_t priority) {
+    mdma_start_ex(channel, first, priority, 0);
+}
+
+void mdma_abort(uint32_t channel) {
+    MDMA_Channel_TypeDef *mdma = MDMA_CHANNEL(channel);
+    mdma->CCR &= ~(MDMA_CCR_TEIE | MDMA_CCR_CTCIE | MDMA_CCR_EN);
+    while (mdma->CISR & MDMA_CISR_CRQA) {
+    }
+    mdma->CIFCR = MDMA_CISR_ALL;
+}
+
+bool mdma_busy(uint32_t channel) {
+    return MDMA_CHANNEL(channel)->CCR & MDMA_CCR_EN;
+}
+
+void MDMA_IRQHandler(void) {
+    IRQ_ENTER(MDMA_IRQn);
+    uint32_t gisr = MDMA->GISR0;
+    for (uint32_t ch = 0; gisr != 0; ++ch, gisr >>= 1) {
+        if (!(gisr & 1)) {
+            continue;
+        }
+        #if defined(HAL_MDMA_MODULE_ENABLED)
+        if (mdma_hal_handle[ch] != NULL) {
+            HAL_MDMA_IRQHandler(mdma_hal_handle[ch]);
+            continue;
+        }
+        #endif
+        MDMA_Channel_TypeDef *mdma = MDMA_CHANNEL(ch);
+        uint32_t cisr = mdma->CISR;
+        mdma->CIFCR = cisr & MDMA_CISR_ALL;
+        if (cisr & MDMA_CISR_TEIF) {
+            mdma->CCR &= ~MDMA_CCR_EN;
+        }
+        if ((cisr & (MDMA_CISR_CTCIF | MDMA_CISR_TEIF)) && mdma_callback[ch] != NULL) {
+            mdma_callback[ch](ch, cisr, mdma_callback_arg[ch]);
+        }
+    }
+    IRQ_EXIT(MDMA_IRQn);
+}
+
+// -----------------------------------------------------------------------------
+// memcpy service
+
+typedef struct _dma_memcpy_job_t {
+    uint16_t node_first;
+    uint16_t node_count;
+    uint16_t edge_first;
+    uint16_t edge_count;
+    dma_memcpy_done_t done;
+    void *arg;
+} dma_memcpy_job_t;
+
+static mdma_node_t dma_memcpy_node[DMA_MEMCPY_NODES];
+static dma_memcpy_sg_t dma_memcpy_edge[DMA_MEMCPY_EDGES]; // partial cache lines, copied by the cpu
+static dma_memcpy_job_t dma_memcpy_job[DMA_MEMCPY_QUEUE_LEN];
+static volatile uint32_t dma_memcpy_job_head = 0; // next job to queue
+static volatile uint32_t dma_memcpy_job_tail = 0; // oldest job, running
+static volatile uint32_t dma_memcpy_node_head = 0;
+static volatile uint32_t dma_memcpy_node_tail = 0;
+static volatile uint32_t dma_memcpy_edge_head = 0;
+static volatile uint32_t dma_memcpy_edge_tail = 0;
+static volatile bool dma_memcpy_running = false;
+static bool dma_memcpy_cancelling = false;
+static volatile int dma_memcpy_err = 0;
+static volatile uint32_t dma_memcpy_priority = 1;
+static volatile uint64_t dma_memcpy_total = 0;
+
+static inline mdma_node_t *dma_memcpy_node_at(uint32_t i) {
+    return &dma_memcpy_node[i % DMA_MEMCPY_NODES];
+}
+
+static inline dma_memcpy_sg_t *dma_memcpy_edge_at(uint32_t i) {
+    return &dma_memcpy_edge[i % DMA_MEMCPY_EDGES];
+}
+
+// the oldest job is done, or failed. Called with irq disabled.
+static void dma_memcpy_finish(int err) {
+    dma_memcpy_job_t *job = &dma_memcpy_job[dma_memcpy_job_tail % DMA_MEMCPY_QUEUE_LEN];
+
+    // drop lines the cpu may have speculatively fetched during the transfer
+    for (uint32_t i = 0; i < job->node_count; ++i) {
+        mdma_node_t *node = dma_memcpy_node_at(job->node_first + i);
+        mdma_dcache_invalidate((void *)node->CDAR, mdma_node_len(node));
+        dma_memcpy_total += mdma_node_len(node);
+    }
+    for (uint32_t i = 0; i < job->edge_count; ++i) {
+        dma_memcpy_total += dma_memcpy_edge_at(job->edge_first + i)->len;
+    }
+
+    dma_memcpy_done_t done = job->done;
+    void *done_arg = job->arg;
+    dma_memcpy_node_tail += job->node_count;
+    dma_memcpy_edge_tail += job->edge_count;
+    dma_memcpy_job_tail += 1;
+    dma_memcpy_running = false;
+    if (err != 0) {
+        dma_memcpy_err = err;
+    }
+    if (done != NULL) {
+        done(done_arg, err);
+    }
+}
+
+// called with irq disabled. The jobs before are done, so the cpu copies the
+// partial lines now; a job of partial lines only is done here.
+static void dma_memcpy_start_next(void) {
+    while (!dma_memcpy_running && !dma_memcpy_cancelling && dma_memcpy_job_tail != dma_memcpy_job_head) {
+        dma_memcpy_job_t *job = &dma_memcpy_job[dma_memcpy_job_tail % DMA_MEMCPY_QUEUE_LEN];
+        for (uint32_t i = 0; i < job->edge_count; ++i) {
+            dma_memcpy_sg_t *edge = dma_memcpy_edge_at(job->edge_first + i);
+            memcpy(edge->dst, edge->src, edge->len);
+        }
+        if (job->node_count == 0) {
+            dma_memcpy_finish(0);
+            continue;
+        }
+        dma_memcpy_running = true;
+        mdma_start(MDMA_CHANNEL_MEMCPY, dma_memcpy_node_at(job->node_first), dma_memcpy_priority);
+    }
+}
+
+static void dma_memcpy_irq(uint32_t channel, uint32_t cisr, void *arg) {
+    dma_memcpy_finish((cisr & MDMA_CISR_TEIF) ? -MP_EIO : 0);
+    dma_memcpy_start_next();
+}
+
+// queue a partial line for the cpu. Returns false if the edge ring is full.
+static bool dma_memcpy_edge_add(uint32_t first, uint32_t *count, uint8_t *dst, const uint8_t *src, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    if (first + *count - dma_memcpy_edge_tail >= DMA_MEMCPY_EDGES) {
+        return false;
+    }
+    dma_memcpy_sg_t *edge = dma_memcpy_edge_at(first + *count);
+    edge->dst = dst;
+    edge->src = src;
+    edge->len = len;
+    *count += 1;
+    return true;
+}
+
+int dma_memcpy_sg_async(const dma_memcpy_sg_t *sg, size_t n, dma_memcpy_done_t done, void *arg) {
+    mdma_init();
+
+    uint32_t irq_state = disable_irq();
+    if (dma_memcpy_job_head - dma_memcpy_job_tail >= DMA_MEMCPY_QUEUE_LEN) {
+        enable_irq(irq_state);
+        return -MP_EBUSY;
+    }
+
+    // build the linked list in the node ring, and the partial lines in the edge ring
+    uint32_t first = dma_memcpy_node_head;
+    uint32_t count = 0;
+    uint32_t edge_first = dma_memcpy_edge_head;
+    uint32_t edge_count = 0;
+    mdma_node_t *prev = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t *dst = sg[i].dst;
+        const uint8_t *src = sg[i].src;
+        size_t len = sg[i].len;
+        size_t head = MIN(-(uintptr_t)dst & (DMA_MEMCPY_LINE - 1), len);
+        size_t tail = (len - head) & (DMA_MEMCPY_LINE - 1);
+        if (!dma_memcpy_edge_add(edge_first, &edge_count, dst, src, head)
+            || !dma_memcpy_edge_add(edge_first, &edge_count, dst + len - tail, src + len - tail, tail)) {
+            enable_irq(irq_state);
+            return -MP_EBUSY;
+        }
+        dst += head;
+        src += head;
+        len -= head + tail;
+        while (len > 0) {
+            if (dma_memcpy_node_head + count - dma_memcpy_node_tail >= DMA_MEMCPY_NODES) {
+                enable_irq(irq_state);
+                return -MP_EBUSY;
+            }
+            mdma_node_t *node = dma_memcpy_node_at(first + count);
+            size_t node_len = mdma_node_memcpy(node, dst, src, len);
+            if (prev != NULL) {
+                prev->CLAR = (uint32_t)node;
+            }
+            prev = node;
+            dst += node_len;
+            src += node_len;
+            len -= node_len;
+            ++count;
+        }
+    }
+    if (count == 0 && edge_count == 0) {
+        enable_irq(irq_state);
+        if (done != NULL) {
+            done(arg, 0);
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        // the whole lines of the destination; the partial ones stay with the cpu
+        uint8_t *dst = sg[i].dst;
+        size_t head = MIN(-(uintptr_t)dst & (DMA_MEMCPY_LINE - 1), sg[i].len);
+        size_t middle = (sg[i].len - head) & ~(DMA_MEMCPY_LINE - 1);
+        mdma_dcache_clean(sg[i].src, sg[i].len);
+        if (middle != 0) {
+            mdma_dcache_clean_invalidate(dst + head, middle);
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        mdma_dcache_clean(dma_memcpy_node_at(first + i), sizeof(mdma_node_t));
+    }
+
+    dma_memcpy_job_t *job = &dma_memcpy_job[dma_memcpy_job_head % DMA_MEMCPY_QUEUE_LEN];
+    job->node_first = first % DMA_MEMCPY_NODES;
+    job->node_count = count;
+    job->edge_first = edge_first % DMA_MEMCPY_EDGES;
+    job->edge_count = edge_count;
+    job->done = done;
+    job->arg = arg;
+    dma_memcpy_node_head = first + count;
+    dma_memcpy_edge_head = edge_first + edge_count;
+    dma_memcpy_job_head += 1;
+
+    mdma_set_callback(MDMA_CHANNEL_MEMCPY, dma_memcpy_irq, NULL);
+    dma_memcpy_start_next();
+    enable_irq(irq_state);
+    return 0;
+}
+
+int dma_memcpy_async(void *dst, const void *src, size_t len, dma_memcpy_done_t done, void *arg) {
+    dma_memcpy_sg_t sg = { .dst = dst, .src = src, .len = len };
+    return dma_memcpy_sg_async(&sg, 1, done, arg);
+}
+
+// priority of the memcpy channel, 0 (low) .. 3 (very high)
+void dma_memcpy_set_priority(uint32_t priority) {
+    dma_memcpy_priority = priority & 3;
+}
+
+// bytes copied since boot
+uint64_t dma_memcpy_bytes(void) {
+    uint32_t irq_state = disable_irq();
+    uint64_t total = dma_memcpy_total;
+    enable_irq(irq_state);
+    return total;
+}
+
+bool dma_memcpy_busy(void) {
+    return dma_memcpy_job_tail != dma_memcpy_job_head;
+}
+
+/* stop the running job and drop the queued ones; their callbacks get err.
+   Jobs queued by those callbacks start afterwards. */
+
+void dma_memcpy_cancel(int err) {
+    uint32_t irq_state = disable_irq();
+    mdma_abort(MDMA_CHANNEL_MEMCPY);
+    dma_memcpy_running = false;
+    dma_memcpy_cancelling = true;
+    uint32_t head = dma_memcpy_job_head;
+    while (dma_memcpy_job_tail != head) {
+        dma_memcpy_finish(err);
+    }
+    dma_memcpy_cancelling = false;
+    dma_memcpy_start_next();
+    enable_irq(irq_state);
+}
+
+/* wait until the queue is empty. Returns the first error since the last wait.
+   On a timeout, or an exception in the poll hook, the copies are cancelled first:
+   the caller may free the buffers. */
+
+int dma_memcpy_wait(uint32_t timeout_ms) {
+    uint32_t start = mp_hal_ticks_ms();
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        while (dma_memcpy_busy()) {
+            if (mp_hal_ticks_ms() - start >= timeout_ms) {
+                nlr_pop();
+                dma_memcpy_cancel(-MP_ETIMEDOUT);
+                dma_memcpy_err = 0;
+                return -MP_ETIMEDOUT;
+            }
+            MICROPY_EVENT_POLL_HOOK
+        }
+        nlr_pop();
+    } else {
+        dma_memcpy_cancel(-MP_EINTR);
+        dma_memcpy_err = 0;
+        nlr_jump(nlr.ret_val);
+    }
+    int err = dma_memcpy_err;
+    dma_memcpy_err = 0;
+    return err;
+}
+
+/* blocking copy. Short copies are done by the cpu. */
+
+int dma_memcpy(void *dst, const void *src, size_t len) {
+    if (len < MICROPY_HW_MDMA_MEMCPY_THRESHOLD) {
+        memcpy(dst, src, len);
+        return 0;
+    }
+    int ret;
+    while ((ret = dma_memcpy_async(dst, src, len, NULL, NULL)) == -MP_EBUSY) {
+        MICROPY_EVENT_POLL_HOOK
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    return dma_memcpy_wait(1000 + len / 1000);
+}
+
+#endif // MICROPY_HW_ENABLE_MDMA
+
+// not truncated
@@ -0,0 +1,84 @@
+/*
+ * mdma driver and memcpy service
+ */
+#ifndef __MDMA_H__
+#define __MDMA_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MICROPY_HW_ENABLE_MDMA
+#if defined(STM32H7)
+#define MICROPY_HW_ENABLE_MDMA (1)
+#else
+#define MICROPY_HW_ENABLE_MDMA (0)
+#endif
+#endif
+
+// copies shorter than this are done by the cpu
+#ifndef MICROPY_HW_MDMA_MEMCPY_THRESHOLD
+#define MICROPY_HW_MDMA_MEMCPY_THRESHOLD (512)
+#endif
+
+// mdma channel allocation
+#define MDMA_CHANNEL_MEMCPY     (0)
+#define MDMA_CHANNEL_JPEG_IN    (1)
+#define MDMA_CHANNEL_JPEG_OUT   (2)
+#define MDMA_CHANNEL_AUDIO      (3)
+#define MDMA_CHANNEL_LOGIC      (4)
+#define MDMA_CHANNEL_MEMTEST    (5)
+#define MDMA_CHANNEL_FRAMEBUF   (6)
+#define MDMA_CHANNEL_OSPI_SEQ   (7)
+#define MDMA_CHANNEL_CRC        (8)
+#define MDMA_NUM_CHANNELS       (16)
+
+// linked list node. Same layout as channel registers CTCR .. CMDR.
+typedef struct _mdma_node_t {
+    uint32_t CTCR;
+    uint32_t CBNDTR;
+    uint32_t CSAR;
+    uint32_t CDAR;
+    uint32_t CBRUR;
+    uint32_t CLAR;
+    uint32_t CTBR;
+    uint32_t reserved;
+    uint32_t CMAR;
+    uint32_t CMDR;
+} __attribute__((aligned(8))) mdma_node_t;
+
+// called from irq on channel transfer complete (CTCIF) or transfer error (TEIF)
+typedef void (*mdma_callback_t)(uint32_t channel, uint32_t cisr, void *arg);
+
+void mdma_init(void);
+void mdma_set_callback(uint32_t channel, mdma_callback_t cb, void *arg);
+void mdma_set_hal_handle(uint32_t channel, void *hmdma);
+size_t mdma_node_memcpy(mdma_node_t *node, void *dst, const void *src, size_t len);
+void mdma_node_trigger(mdma_node_t *node, uint32_t request, volatile uint32_t *clear_reg, uint32_t clear_mask);
+void mdma_start(uint32_t channel, const mdma_node_t *first, uint32_t priority);
+void mdma_start_ex(uint32_t channel, const mdma_node_t *first, uint32_t priority, uint32_t ccr);
+void mdma_abort(uint32_t channel);
+bool mdma_busy(uint32_t channel);
+
+// data cache maintenance around dma transfers
+void mdma_dcache_clean(const void *addr, size_t len);
+void mdma_dcache_clean_invalidate(void *addr, size_t len);
+void mdma_dcache_invalidate(void *addr, size_t len);
+
+// memcpy service. Completion callbacks run in irq context.
+typedef struct _dma_memcpy_sg_t {
+    void *dst;
+    const void *src;
+    size_t len;
+} dma_memcpy_sg_t;
+
+typedef void (*dma_memcpy_done_t)(void *arg, int err);
+
+int dma_memcpy_async(void *dst, const void *src, size_t len, dma_memcpy_done_t done, void *arg);
+int dma_memcpy_sg_async(const dma_memcpy_sg_t *sg, size_t n, dma_memcpy_done_t done, void *arg);
+void dma_memcpy_set_priority(uint32_t priority);
+uint64_t dma_memcpy_bytes(void);
+bool dma_memcpy_busy(void);
+int dma_memcpy_wait(uint32_t timeout_ms);
+void dma_memcpy_cancel(int err);
+int dma_memcpy(void *dst, const void *src, size_t len);
+#endif // __MDMA_H__
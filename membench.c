@@ -0,0 +1,265 @@
+/*
+ * stream benchmark of a memory: copy, scale, add, triad and a pointer chase
+ */
+
+/* notes:
+ * the four kernels of stream, on three arrays of doubles that fill the memory under
+ * test, and counted as stream counts: copy and scale move 16 bytes per element, add
+ * and triad 24. Each kernel runs reps times and the best time counts, so an interrupt
+ * in one run does not show. Arrays smaller than four times the 16 kbyte data cache
+ * measure the cache, not the memory, for cacheable memory; the bench prints the size.
+ *
+ * The pointer chase is the latency: one 32 bit index per cache line, linked into a
+ * single cycle in random order (Sattolo), and followed; each load depends on the one
+ * before, so nothing overlaps. Picoseconds per load.
+ *
+ * The memory attributes come from the mpu. An mpu mode adds a region over the memory
+ * under test, above the regions of micropython, so it overrides them for the test only;
+ * the cache is cleaned and invalidated before and after. A region is a power of two in
+ * size and aligned to it. Modes: write-back, write-through, not cacheable, and device.
+ * The heap in spi ram is write-back (MPU_CONFIG_SDRAM); see the warning in mpu.h.
+ *
+ * dtcm is not cached, the mpu mode makes no difference there. The ahb srams of the cd
+ * domain and the sram of the srd domain get their clocks enabled here.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "mpu.h"
+#include "spiram_wss.h"
+#include "membench.h"
+
+#if MICROPY_HW_ENABLE_MEMBENCH
+
+#define MEMBENCH_LINE (32)
+#define MEMBENCH_SCALAR (3.0)
+
+static volatile uint32_t membench_sink;
+
+static inline uint32_t membench_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+static uint32_t membench_mpu_attr(uint32_t mode, uint32_t size_log2) {
+    uint32_t tex = 0, c = 0, b = 0, s = 0;
+    switch (mode) {
+        case MEMBENCH_MPU_WB:
+            tex = 1;
+            c = 1;
+            b = 1;
+            break;
+        case MEMBENCH_MPU_WT:
+            c = 1;
+            break;
+        case MEMBENCH_MPU_NC:
+            tex = 1;
+            break;
+        case MEMBENCH_MPU_DEVICE:
+            b = 1;
+            s = 1;
+            break;
+    }
+    return MPU_INSTRUCTION_ACCESS_DISABLE << MPU_RASR_XN_Pos
+           | MPU_REGION_FULL_ACCESS << MPU_RASR_AP_Pos
+           | tex << MPU_RASR_TEX_Pos
+           | s << MPU_RASR_S_Pos
+           | c << MPU_RASR_C_Pos
+           | b << MPU_RASR_B_Pos
+           | (size_log2 - 1) << MPU_RASR_SIZE_Pos
+           | MPU_REGION_ENABLE << MPU_RASR_ENABLE_Pos;
+}
+
+static void membench_mpu_set(uint32_t base, uint32_t attr) {
+    SCB_CleanInvalidateDCache();
+    uint32_t irq_state = mpu_config_start();
+    mpu_config_region(MICROPY_HW_MEMBENCH_MPU_REGION, base, attr);
+    mpu_config_end(irq_state);
+}
+
+static void membench_clocks(uint32_t addr) {
+    #if defined(RCC_AHB2ENR_AHBSRAM1EN)
+    if (addr >= 0x30000000 && addr < 0x30020000) {
+        __HAL_RCC_AHBSRAM1_CLK_ENABLE();
+        __HAL_RCC_AHBSRAM2_CLK_ENABLE();
+    }
+    #endif
+    #if defined(RCC_AHB4ENR_SRDSRAMEN)
+    if (addr >= 0x38000000 && addr < 0x38008000) {
+        __HAL_RCC_SRDSRAM_CLK_ENABLE();
+    }
+    #endif
+}
+
+static uint32_t membench_kbps(uint64_t bytes, uint32_t cycles) {
+    return cycles ? bytes * (SystemCoreClock / 1000) / cycles : 0;
+}
+
+static void membench_stream(double *a, double *b, double *c, size_t n, uint32_t reps, membench_result_t *res) {
+    uint32_t best[4] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+    for (uint32_t r = 0; r < reps; ++r) {
+        uint32_t t = membench_cycles();
+        for (size_t i = 0; i < n; ++i) {
+            c[i] = a[i];
+        }
+        best[0] = MIN(best[0], membench_cycles() - t);
+
+        t = membench_cycles();
+        for (size_t i = 0; i < n; ++i) {
+            b[i] = MEMBENCH_SCALAR * c[i];
+        }
+        best[1] = MIN(best[1], membench_cycles() - t);
+
+        t = membench_cycles();
+        for (size_t i = 0; i < n; ++i) {
+            c[i] = a[i] + b[i];
+        }
+        best[2] = MIN(best[2], membench_cycles() - t);
+
+        t = membench_cycles();
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = b[i] + MEMBENCH_SCALAR * c[i];
+        }
+        best[3] = MIN(best[3], membench_cycles() - t);
+    }
+    res->copy_kbps = membench_kbps(2 * sizeof(double) * (uint64_t)n, best[0]);
+    res->scale_kbps = membench_kbps(2 * sizeof(double) * (uint64_t)n, best[1]);
+    res->add_kbps = membench_kbps(3 * sizeof(double) * (uint64_t)n, best[2]);
+    res->triad_kbps = membench_kbps(3 * sizeof(double) * (uint64_t)n, best[3]);
+}
+
+static uint32_t membench_chase(uint8_t *mem, size_t len) {
+    size_t lines = len / MEMBENCH_LINE;
+    uint32_t *slot = (uint32_t *)mem;
+    const size_t stride = MEMBENCH_LINE / sizeof(uint32_t);
+    // Sattolo: a random permutation that is one cycle through all lines
+    for (size_t i = 0; i < lines; ++i) {
+        slot[i * stride] = i;
+    }
+    uint32_t x = 0x9e3779b9;
+    for (size_t i = lines - 1; i > 0; --i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        size_t j = x % i;
+        uint32_t tmp = slot[i * stride];
+        slot[i * stride] = slot[j * stride];
+        slot[j * stride] = tmp;
+    }
+    // once round to warm up, then time
+    size_t steps = MAX(lines, 16384);
+    uint32_t k = 0;
+    for (size_t i = 0; i < lines; ++i) {
+        k = slot[k * stride];
+    }
+    uint32_t t = membench_cycles();
+    for (size_t i = 0; i < steps; ++i) {
+        k = slot[k * stride];
+    }
+    t = membench_cycles() - t;
+    membench_sink = k;
+    return (uint64_t)t * 1000000 / (SystemCoreClock / 1000000) / steps;
+}
+
+int membench_run(void *mem, size_t len, uint32_t mpu, uint32_t reps, membench_result_t *res) {
+    uint32_t base = (uint32_t)mem;
+    len &= ~(MEMBENCH_LINE - 1);
+    if (len < 3 * MEMBENCH_LINE || reps == 0 || mpu > MEMBENCH_MPU_DEVICE || (base & (MEMBENCH_LINE - 1)) != 0) {
+        return -MP_EINVAL;
+    }
+    uint32_t size_log2 = 32 - __CLZ(len - 1);
+    if (mpu != MEMBENCH_MPU_NONE) {
+        if (size_log2 < 5 || (base & ((1u << size_log2) - 1)) != 0) {
+            return -MP_EINVAL;
+        }
+        #if MICROPY_HW_ENABLE_SPIRAM_WSS
+        if (spiram_wss_running()) {
+            return -MP_EBUSY;
+        }
+        #endif
+    }
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    membench_clocks(base);
+
+    if (mpu != MEMBENCH_MPU_NONE) {
+        membench_mpu_set(base, membench_mpu_attr(mpu, size_log2));
+    }
+    size_t n = len / 3 / sizeof(double) & ~3;
+    double *a = mem;
+    membench_stream(a, a + n, a + 2 * n, n, reps, res);
+    res->chase_ps = membench_chase(mem, len);
+    if (mpu != MEMBENCH_MPU_NONE) {
+        membench_mpu_set(base, MPU_CONFIG_DISABLE(0x00, size_log2 - 1));
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.membench(buf, mpu=None, reps=5)
+// buf: a buffer, or an (address, length) tuple for memory outside the heap. Contents are lost.
+// mpu: None, 'wb', 'wt', 'nc' or 'dev'; the buffer is then aligned to its size, a power of two.
+// Returns (copy, scale, add, triad) in Mbyte/s and the pointer chase in ns.
+
+STATIC mp_obj_t spiram_membench_fn(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_buf, ARG_mpu, ARG_reps };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_mpu, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_reps, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 5} },
+    };
+    static const qstr mode[] = { MP_QSTR_, MP_QSTR_wb, MP_QSTR_wt, MP_QSTR_nc, MP_QSTR_dev };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    void *mem;
+    size_t len;
+    if (mp_obj_is_type(args[ARG_buf].u_obj, &mp_type_tuple)) {
+        mp_obj_t *t;
+        mp_obj_get_array_fixed_n(args[ARG_buf].u_obj, 2, &t);
+        mem = (void *)mp_obj_get_int_truncated(t[0]);
+        len = mp_obj_get_int(t[1]);
+    } else {
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_WRITE);
+        mem = bufinfo.buf;
+        len = bufinfo.len;
+    }
+    uint32_t mpu = MEMBENCH_MPU_NONE;
+    if (args[ARG_mpu].u_obj != mp_const_none) {
+        qstr q = mp_obj_str_get_qstr(args[ARG_mpu].u_obj);
+        for (mpu = 1; mpu < MP_ARRAY_SIZE(mode) && mode[mpu] != q; ++mpu) {
+        }
+        if (mpu == MP_ARRAY_SIZE(mode)) {
+            mp_raise_ValueError(MP_ERROR_TEXT("mpu"));
+        }
+    }
+    membench_result_t res;
+    int ret = membench_run(mem, len, mpu, args[ARG_reps].u_int, &res);
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    mp_obj_t t[5] = {
+        mp_obj_new_float((mp_float_t)res.copy_kbps / 1000),
+        mp_obj_new_float((mp_float_t)res.scale_kbps / 1000),
+        mp_obj_new_float((mp_float_t)res.add_kbps / 1000),
+        mp_obj_new_float((mp_float_t)res.triad_kbps / 1000),
+        mp_obj_new_float((mp_float_t)res.chase_ps / 1000),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_membench_obj, 1, spiram_membench_fn);
+
+#endif // MICROPY_HW_ENABLE_MEMBENCH
+
+// not truncated
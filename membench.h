@@ -0,0 +1,42 @@
+/*
+ * stream benchmark of a memory: copy, scale, add, triad and a pointer chase
+ */
+#ifndef __MEMBENCH_H__
+#define __MEMBENCH_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+
+#ifndef MICROPY_HW_ENABLE_MEMBENCH
+#define MICROPY_HW_ENABLE_MEMBENCH (1)
+#endif
+
+// mpu region that overrides the attributes of the memory under test.
+// Above the regions micropython uses; spiram_wss uses 8 .. 15 while it runs.
+#ifndef MICROPY_HW_MEMBENCH_MPU_REGION
+#define MICROPY_HW_MEMBENCH_MPU_REGION (15)
+#endif
+
+// memory attributes for the test, as mpu TEX, C and B
+enum {
+    MEMBENCH_MPU_NONE,          // as mapped
+    MEMBENCH_MPU_WB,            // normal, write-back, read and write allocate
+    MEMBENCH_MPU_WT,            // normal, write-through, no write allocate
+    MEMBENCH_MPU_NC,            // normal, not cacheable
+    MEMBENCH_MPU_DEVICE,        // device, shareable
+};
+
+typedef struct _membench_result_t {
+    uint32_t copy_kbps;         // kbyte/s, best of the repetitions, as stream counts bytes
+    uint32_t scale_kbps;
+    uint32_t add_kbps;
+    uint32_t triad_kbps;
+    uint32_t chase_ps;          // picoseconds per dependent load, cache line stride, random order
+} membench_result_t;
+
+// run on len bytes at mem; the contents are lost. With an mpu mode, mem is aligned
+// to len rounded up to a power of two. Returns 0 or a negative MP_Exxx.
+int membench_run(void *mem, size_t len, uint32_t mpu, uint32_t reps, membench_result_t *res);
+
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_membench_obj);
+#endif // __MEMBENCH_H__
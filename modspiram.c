@@ -0,0 +1,407 @@
+/*
+ * spiram python module
+ */
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "spiram.h"
+#include "mdma.h"
+#include "spiram_qos.h"
+#include "jpeg.h"
+#include "sai_audio.h"
+#include "can_logger.h"
+#include "logic_capture.h"
+#include "spiram_spi.h"
+#include "spiram_queue.h"
+#include "spiram_wss.h"
+#include "sd_stage.h"
+#include "flash_rww.h"
+#include "spiram_pipe.h"
+#include "spiram_series.h"
+#include "spiram_hash.h"
+#include "spiram_fb.h"
+#include "spiram_ramfs.h"
+#include "gc_index.h"
+#include "spiram_heap.h"
+#include "spiram_seq.h"
+#include "crc_dma.h"
+#include "telemetry.h"
+#include "membench.h"
+
+#if defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+
+// the gc does not see the mdma: the buffers of a background copy stay in a root pointer
+// pair until the copy is done. The board declares it in MICROPY_BOARD_ROOT_POINTERS.
+#define SPIRAM_COPY_ROOTS (MP_ARRAY_SIZE(MP_STATE_PORT(spiram_copy_root)) / 2)
+_Static_assert(SPIRAM_COPY_ROOTS >= SPIRAM_QOS_QUEUE_LEN, "spiram_copy_root too small");
+
+STATIC void spiram_copy_done(void *arg, int err) {
+    size_t i = (uintptr_t)arg;
+    MP_STATE_PORT(spiram_copy_root)[2 * i] = MP_OBJ_NULL;
+    MP_STATE_PORT(spiram_copy_root)[2 * i + 1] = MP_OBJ_NULL;
+}
+
+// a free root pair, or -1
+STATIC int spiram_copy_root_alloc(mp_obj_t dst, mp_obj_t src) {
+    int ret = -1;
+    uint32_t irq_state = disable_irq();
+    if (!spiram_qos_busy()) {
+        // nothing in flight; also forgets pairs left over from before a soft reset
+        for (size_t i = 0; i < 2 * SPIRAM_COPY_ROOTS; ++i) {
+            MP_STATE_PORT(spiram_copy_root)[i] = MP_OBJ_NULL;
+        }
+    }
+    for (size_t i = 0; i < SPIRAM_COPY_ROOTS; ++i) {
+        if (MP_STATE_PORT(spiram_copy_root)[2 * i] == MP_OBJ_NULL) {
+            MP_STATE_PORT(spiram_copy_root)[2 * i] = dst;
+            MP_STATE_PORT(spiram_copy_root)[2 * i + 1] = src;
+            ret = i;
+            break;
+        }
+    }
+    enable_irq(irq_state);
+    return ret;
+}
+
+// spiram.copy(dst, src, *, background=False)
+// copy buffer src to buffer dst using mdma. Returns number of bytes copied.
+// background copies return immediately and are limited to the qos budget;
+// dst and src are kept alive until the copy is done.
+
+STATIC mp_obj_t spiram_copy(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_dst, ARG_src, ARG_background };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_dst, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_background, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t dst;
+    mp_buffer_info_t src;
+    mp_get_buffer_raise(args[ARG_dst].u_obj, &dst, MP_BUFFER_WRITE);
+    mp_get_buffer_raise(args[ARG_src].u_obj, &src, MP_BUFFER_READ);
+    if (src.len > dst.len) {
+        mp_raise_ValueError(MP_ERROR_TEXT("dst too small"));
+    }
+    int ret = 0;
+    if (args[ARG_background].u_bool) {
+        while (src.len != 0) {
+            int root = spiram_copy_root_alloc(args[ARG_dst].u_obj, args[ARG_src].u_obj);
+            if (root >= 0) {
+                void *arg = (void *)(uintptr_t)root;
+                ret = spiram_qos_copy_async(dst.buf, src.buf, src.len, spiram_copy_done, arg);
+                if (ret != -MP_EBUSY) {
+                    if (ret != 0) {
+                        spiram_copy_done(arg, ret);
+                    }
+                    break;
+                }
+                spiram_copy_done(arg, 0);
+            }
+            MICROPY_EVENT_POLL_HOOK
+        }
+    } else {
+        ret = dma_memcpy(dst.buf, src.buf, src.len);
+    }
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return MP_OBJ_NEW_SMALL_INT(src.len);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(spiram_copy_obj, 2, spiram_copy);
+
+// spiram.wait()
+// wait until all copies, including background copies, are done.
+
+STATIC mp_obj_t spiram_wait(void) {
+    while (spiram_qos_busy()) {
+        MICROPY_EVENT_POLL_HOOK
+    }
+    int ret = dma_memcpy_wait(1000);
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(spiram_wait_obj, spiram_wait);
+
+// spiram.qos_budget([mbps])
+// get or set the bandwidth budget for background copies, 1 .. SPIRAM_QOS_BUDGET_MAX Mbyte/s.
+// None is no limit.
+
+STATIC mp_obj_t spiram_qos_budget(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 0) {
+        uint32_t mbps = spiram_qos_get_budget();
+        return mbps == 0 ? mp_const_none : MP_OBJ_NEW_SMALL_INT(mbps);
+    }
+    mp_int_t mbps = 0;
+    if (args[0] != mp_const_none) {
+        mbps = mp_obj_get_int(args[0]);
+        if (mbps <= 0 || mbps > SPIRAM_QOS_BUDGET_MAX) {
+            mp_raise_ValueError(MP_ERROR_TEXT("bad budget"));
+        }
+    }
+    spiram_qos_set_budget(mbps);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_qos_budget_obj, 0, 1, spiram_qos_budget);
+
+// spiram.qos_priority(client, priority)
+// priority 0 (low) .. 3 (very high) of the mdma memcpy channel or of the dma stream of a client.
+
+STATIC mp_obj_t spiram_qos_priority(mp_obj_t client_in, mp_obj_t priority_in) {
+    mp_uint_t client = mp_obj_get_int(client_in);
+    if (client >= SPIRAM_QOS_NUM_CLIENTS) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad client"));
+    }
+    spiram_qos_set_priority(client, mp_obj_get_int(priority_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_qos_priority_obj, spiram_qos_priority);
+
+// spiram.qos_axi(port, read_qos, write_qos)
+// qos 0 (low) .. 15 (high) of an axi interconnect initiator port 1 .. SPIRAM_QOS_AXI_PORTS.
+
+STATIC mp_obj_t spiram_qos_axi(mp_obj_t port_in, mp_obj_t read_in, mp_obj_t write_in) {
+    mp_int_t port = mp_obj_get_int(port_in);
+    mp_int_t read_qos = mp_obj_get_int(read_in);
+    mp_int_t write_qos = mp_obj_get_int(write_in);
+    if (port < 1 || port > SPIRAM_QOS_AXI_PORTS) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad port"));
+    }
+    if (read_qos < 0 || read_qos > SPIRAM_QOS_AXI_MAX || write_qos < 0 || write_qos > SPIRAM_QOS_AXI_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad qos"));
+    }
+    spiram_qos_set_axi(port, read_qos, write_qos);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_qos_axi_obj, spiram_qos_axi);
+
+// spiram.qos_stats()
+// per client, bytes transferred and Mbyte/s since the previous call.
+
+STATIC uint64_t spiram_qos_last_bytes[SPIRAM_QOS_NUM_CLIENTS];
+STATIC uint32_t spiram_qos_last_us;
+
+STATIC mp_obj_t spiram_qos_report(void) {
+    static const qstr name[SPIRAM_QOS_NUM_CLIENTS] = {
+        MP_QSTR_copy, MP_QSTR_background, MP_QSTR_display, MP_QSTR_sdcard
+    };
+    uint64_t bytes[SPIRAM_QOS_NUM_CLIENTS];
+    spiram_qos_stats(bytes);
+    uint32_t now = mp_hal_ticks_us();
+    uint32_t dt = now - spiram_qos_last_us;
+    spiram_qos_last_us = now;
+
+    mp_obj_t stats[SPIRAM_QOS_NUM_CLIENTS];
+    for (uint32_t i = 0; i < SPIRAM_QOS_NUM_CLIENTS; ++i) {
+        uint64_t delta = bytes[i] - spiram_qos_last_bytes[i];
+        spiram_qos_last_bytes[i] = bytes[i];
+        mp_obj_t t[3] = {
+            MP_OBJ_NEW_QSTR(name[i]),
+            mp_obj_new_int_from_ull(bytes[i]),
+            mp_obj_new_float(dt ? (mp_float_t)delta / dt : 0),
+        };
+        stats[i] = mp_obj_new_tuple(3, t);
+    }
+    return mp_obj_new_tuple(SPIRAM_QOS_NUM_CLIENTS, stats);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(spiram_qos_stats_obj, spiram_qos_report);
+
+#if defined(MICROPY_HW_SPIRAM_STARTUP_TEST)
+
+// spiram.memtest_stats()
+// per pass of the boot memtest: name, bytes, us and Mbyte/s.
+// The python heap is in spi ram, so the memtest only runs at boot, and with
+// MICROPY_HW_SPIRAM_HEAP_GROW on the part that goes to the heap; the last test is shown.
+
+STATIC mp_obj_t spiram_memtest_stats(void) {
+    const spiram_pass_t *passes;
+    size_t n = spiram_test_passes(&passes);
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (size_t i = 0; i < n; ++i) {
+        mp_obj_t t[4] = {
+            mp_obj_new_str(passes[i].name, strlen(passes[i].name)),
+            mp_obj_new_int_from_uint(passes[i].bytes),
+            mp_obj_new_int_from_uint(passes[i].us),
+            mp_obj_new_float(passes[i].us ? (mp_float_t)passes[i].bytes / passes[i].us : 0),
+        };
+        mp_obj_list_append(list, mp_obj_new_tuple(4, t));
+    }
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(spiram_memtest_stats_obj, spiram_memtest_stats);
+
+#endif
+
+#if MICROPY_GC_INDEX
+
+// spiram.gc_index([enable])
+// get or set whether gc_alloc finds large free runs through the index, for comparison.
+
+STATIC mp_obj_t spiram_gc_index(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 0) {
+        return mp_obj_new_bool(gc_index_enabled);
+    }
+    gc_index_enabled = mp_obj_is_true(args[0]);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_gc_index_obj, 0, 1, spiram_gc_index);
+
+// spiram.gc_index_stats()
+// (allocations through the index, leaves read back, misses, leaves, blocks per leaf)
+
+STATIC mp_obj_t spiram_gc_index_stats(void) {
+    gc_index_stats_t stats;
+    gc_index_get_stats(&stats);
+    mp_obj_t t[5] = {
+        mp_obj_new_int_from_uint(stats.finds),
+        mp_obj_new_int_from_uint(stats.leaf_scans),
+        mp_obj_new_int_from_uint(stats.misses),
+        mp_obj_new_int_from_uint(stats.leaves),
+        mp_obj_new_int_from_uint(stats.leaf_blocks),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(spiram_gc_index_stats_obj, spiram_gc_index_stats);
+
+#endif
+
+#if MICROPY_HW_SPIRAM_HEAP_GROW
+
+// spiram.heap_grow([nbytes])
+// test at least nbytes more spi ram, default all of it, and add it to the python heap.
+// Returns the bytes added; 0 when all spi ram is in the heap.
+
+STATIC mp_obj_t spiram_heap_grow_fn(size_t n_args, const mp_obj_t *args) {
+    size_t len = SPIRAM_SIZE;
+    if (n_args > 0 && args[0] != mp_const_none) {
+        mp_int_t n = mp_obj_get_int(args[0]);
+        if (n < 0) {
+            mp_raise_ValueError(NULL);
+        }
+        len = n;
+    }
+    int ret = spiram_heap_grow(len);
+    if (ret < 0) {
+        mp_raise_OSError(-ret);
+    }
+    return MP_OBJ_NEW_SMALL_INT(ret);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_heap_grow_obj, 0, 1, spiram_heap_grow_fn);
+
+// spiram.heap_info()
+// (heap in spi ram, growing failed, heap bytes, spi ram bytes tested, spi ram bytes, steps grown)
+
+STATIC mp_obj_t spiram_heap_info(void) {
+    spiram_heap_info_t info;
+    spiram_heap_get_info(&info);
+    mp_obj_t t[6] = {
+        mp_obj_new_bool(info.in_spiram),
+        mp_obj_new_bool(info.failed),
+        mp_obj_new_int_from_uint(info.heap),
+        mp_obj_new_int_from_uint(info.tested),
+        mp_obj_new_int_from_uint(info.size),
+        mp_obj_new_int_from_uint(info.grows),
+    };
+    return mp_obj_new_tuple(6, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(spiram_heap_info_obj, spiram_heap_info);
+
+#endif
+
+STATIC const mp_rom_map_elem_t spiram_module_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_spiram) },
+    { MP_ROM_QSTR(MP_QSTR_copy), MP_ROM_PTR(&spiram_copy_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wait), MP_ROM_PTR(&spiram_wait_obj) },
+    { MP_ROM_QSTR(MP_QSTR_qos_budget), MP_ROM_PTR(&spiram_qos_budget_obj) },
+    { MP_ROM_QSTR(MP_QSTR_qos_priority), MP_ROM_PTR(&spiram_qos_priority_obj) },
+    { MP_ROM_QSTR(MP_QSTR_qos_axi), MP_ROM_PTR(&spiram_qos_axi_obj) },
+    { MP_ROM_QSTR(MP_QSTR_qos_stats), MP_ROM_PTR(&spiram_qos_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_QOS_COPY), MP_ROM_INT(SPIRAM_QOS_COPY) },
+    { MP_ROM_QSTR(MP_QSTR_QOS_BACKGROUND), MP_ROM_INT(SPIRAM_QOS_BACKGROUND) },
+    { MP_ROM_QSTR(MP_QSTR_QOS_DISPLAY), MP_ROM_INT(SPIRAM_QOS_DISPLAY) },
+    { MP_ROM_QSTR(MP_QSTR_QOS_SDCARD), MP_ROM_INT(SPIRAM_QOS_SDCARD) },
+    { MP_ROM_QSTR(MP_QSTR_spi_write), MP_ROM_PTR(&spiram_spi_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_spi_readinto), MP_ROM_PTR(&spiram_spi_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_spi_write_readinto), MP_ROM_PTR(&spiram_spi_write_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_Queue), MP_ROM_PTR(&spiram_queue_type) },
+    { MP_ROM_QSTR(MP_QSTR_Pipe), MP_ROM_PTR(&spiram_pipe_type) },
+    { MP_ROM_QSTR(MP_QSTR_Series), MP_ROM_PTR(&spiram_series_type) },
+    { MP_ROM_QSTR(MP_QSTR_HashTable), MP_ROM_PTR(&spiram_hash_type) },
+    #if MICROPY_HW_ENABLE_MDMA
+    { MP_ROM_QSTR(MP_QSTR_FrameBuffer), MP_ROM_PTR(&spiram_fb_type) },
+    #endif
+    { MP_ROM_QSTR(MP_QSTR_RamFS), MP_ROM_PTR(&spiram_ramfs_type) },
+    #if defined(MICROPY_HW_SPIRAM_STARTUP_TEST)
+    { MP_ROM_QSTR(MP_QSTR_memtest_stats), MP_ROM_PTR(&spiram_memtest_stats_obj) },
+    #endif
+    #if MICROPY_GC_INDEX
+    { MP_ROM_QSTR(MP_QSTR_gc_index), MP_ROM_PTR(&spiram_gc_index_obj) },
+    { MP_ROM_QSTR(MP_QSTR_gc_index_stats), MP_ROM_PTR(&spiram_gc_index_stats_obj) },
+    #endif
+    #if MICROPY_HW_SPIRAM_HEAP_GROW
+    { MP_ROM_QSTR(MP_QSTR_heap_grow), MP_ROM_PTR(&spiram_heap_grow_obj) },
+    { MP_ROM_QSTR(MP_QSTR_heap_info), MP_ROM_PTR(&spiram_heap_info_obj) },
+    #endif
+    #if MICROPY_HW_ENABLE_JPEG
+    { MP_ROM_QSTR(MP_QSTR_jpeg_encode), MP_ROM_PTR(&spiram_jpeg_encode_obj) },
+    { MP_ROM_QSTR(MP_QSTR_jpeg_decode), MP_ROM_PTR(&spiram_jpeg_decode_obj) },
+    { MP_ROM_QSTR(MP_QSTR_GRAYSCALE), MP_ROM_INT(JPEG_FORMAT_GRAYSCALE) },
+    { MP_ROM_QSTR(MP_QSTR_RGB565), MP_ROM_INT(JPEG_FORMAT_RGB565) },
+    #endif
+    #if MICROPY_HW_ENABLE_SAI_AUDIO
+    { MP_ROM_QSTR(MP_QSTR_Audio), MP_ROM_PTR(&spiram_audio_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_CAN_LOGGER
+    { MP_ROM_QSTR(MP_QSTR_CANLog), MP_ROM_PTR(&spiram_canlog_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_LOGIC_CAPTURE
+    { MP_ROM_QSTR(MP_QSTR_Logic), MP_ROM_PTR(&spiram_logic_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_SDCARD
+    { MP_ROM_QSTR(MP_QSTR_SDStage), MP_ROM_PTR(&spiram_sdstage_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_FLASH_RWW
+    { MP_ROM_QSTR(MP_QSTR_FlashWriter), MP_ROM_PTR(&spiram_flashwriter_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_SPIRAM_WSS
+    { MP_ROM_QSTR(MP_QSTR_wss_start), MP_ROM_PTR(&spiram_wss_start_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wss_stop), MP_ROM_PTR(&spiram_wss_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wss_stats), MP_ROM_PTR(&spiram_wss_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wss_heatmap), MP_ROM_PTR(&spiram_wss_heatmap_obj) },
+    #endif
+    #if MICROPY_HW_ENABLE_SPIRAM_SEQ
+    { MP_ROM_QSTR(MP_QSTR_seq_read), MP_ROM_PTR(&spiram_seq_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_seq_write), MP_ROM_PTR(&spiram_seq_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_seq_stats), MP_ROM_PTR(&spiram_seq_stats_obj) },
+    #endif
+    #if MICROPY_HW_ENABLE_CRC_DMA
+    { MP_ROM_QSTR(MP_QSTR_crc32), MP_ROM_PTR(&spiram_crc32_obj) },
+    { MP_ROM_QSTR(MP_QSTR_crc_stats), MP_ROM_PTR(&spiram_crc_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_CRC32), MP_ROM_PTR(&spiram_crc32_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_TELEMETRY
+    { MP_ROM_QSTR(MP_QSTR_Telemetry), MP_ROM_PTR(&spiram_telemetry_type) },
+    #endif
+    #if MICROPY_HW_ENABLE_MEMBENCH
+    { MP_ROM_QSTR(MP_QSTR_membench), MP_ROM_PTR(&spiram_membench_obj) },
+    #endif
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_module_globals, spiram_module_globals_table);
+
+const mp_obj_module_t spiram_module = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t *)&spiram_module_globals,
+};
+
+MP_REGISTER_MODULE(MP_QSTR_spiram, spiram_module, MICROPY_HW_SPIRAM_SIZE_BITS_LOG2);
+
+#endif
+
+// not truncated
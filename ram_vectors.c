@@ -0,0 +1,38 @@
+/*
+ * vector table in ram, to take over single interrupt or fault handlers
+ */
+
+/* notes:
+ * micropython defines the fault handlers and most interrupt handlers.
+ * Drivers that need one of those handlers copy the vector table to ram,
+ * once, and replace the entry. The replaced handler is returned, so
+ * the driver can pass on what it does not handle, and put it back when done.
+ * VTOR stays on the ram table.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "irq.h"
+#include "ram_vectors.h"
+
+#define RAM_VECTORS_NUM (16 + 160)
+
+static uint32_t ram_vectors[RAM_VECTORS_NUM] __attribute__((aligned(1024)));
+
+uint32_t ram_vector_set(int irqn, uint32_t handler) {
+    uint32_t irq_state = disable_irq();
+    if (SCB->VTOR != (uint32_t)ram_vectors) {
+        memcpy(ram_vectors, (const void *)SCB->VTOR, sizeof(ram_vectors));
+        __DSB();
+        SCB->VTOR = (uint32_t)ram_vectors;
+    }
+    uint32_t old = ram_vectors[16 + irqn];
+    ram_vectors[16 + irqn] = handler;
+    __DSB();
+    __ISB();
+    enable_irq(irq_state);
+    return old;
+}
+
+// not truncated
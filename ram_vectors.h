@@ -0,0 +1,11 @@
+/*
+ * vector table in ram, to take over single interrupt or fault handlers
+ */
+#ifndef __RAM_VECTORS_H__
+#define __RAM_VECTORS_H__
+#include <stdint.h>
+
+// irqn as in IRQn_Type, negative for the cortex-m exceptions.
+// Returns the handler it replaces.
+uint32_t ram_vector_set(int irqn, uint32_t handler);
+#endif // __RAM_VECTORS_H__
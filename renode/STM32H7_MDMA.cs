@@ -0,0 +1,264 @@
+//
+// stm32h7 mdma, software requests only.
+//
+// enough for dma_memcpy_async() and spiram.copy(): a software request runs the whole
+// linked list at once, with block repeats, address increments and the mask write.
+// A node that waits for a hardware request (TRGM < 3 without SWRM, e.g. the jpeg
+// codec, sai audio, logic analyzer) leaves the channel enabled and idle.
+//
+// no timing; a transfer completes when it is requested.
+//
+using Antmicro.Renode.Core;
+using Antmicro.Renode.Logging;
+using Antmicro.Renode.Peripherals.Bus;
+
+namespace Antmicro.Renode.Peripherals.DMA
+{
+    public class STM32H7_MDMA : IDoubleWordPeripheral, IKnownSize
+    {
+        public STM32H7_MDMA(IMachine machine)
+        {
+            sysbus = machine.GetSystemBus(this);
+            IRQ = new GPIO();
+            channels = new Channel[ChannelCount];
+            for(var i = 0; i < ChannelCount; ++i)
+            {
+                channels[i] = new Channel();
+            }
+            Reset();
+        }
+
+        public void Reset()
+        {
+            foreach(var ch in channels)
+            {
+                ch.Reset();
+            }
+            IRQ.Unset();
+        }
+
+        public long Size => 0x1000;
+
+        public GPIO IRQ { get; private set; }
+
+        public uint ReadDoubleWord(long offset)
+        {
+            if(offset == GlobalInterruptStatus)
+            {
+                uint gisr = 0;
+                for(var i = 0; i < ChannelCount; ++i)
+                {
+                    if(channels[i].Pending)
+                    {
+                        gisr |= 1u << i;
+                    }
+                }
+                return gisr;
+            }
+            if(offset < ChannelBase || offset >= ChannelBase + ChannelCount * ChannelSize)
+            {
+                return 0;
+            }
+            var ch = channels[(offset - ChannelBase) / ChannelSize];
+            switch((ChannelRegisters)((offset - ChannelBase) % ChannelSize))
+            {
+            case ChannelRegisters.InterruptStatus: return ch.cisr;
+            case ChannelRegisters.ErrorStatus: return 0;
+            case ChannelRegisters.Control: return ch.ccr;
+            case ChannelRegisters.TransferConfiguration: return ch.ctcr;
+            case ChannelRegisters.BlockNumberOfData: return ch.cbndtr;
+            case ChannelRegisters.SourceAddress: return ch.csar;
+            case ChannelRegisters.DestinationAddress: return ch.cdar;
+            case ChannelRegisters.BlockRepeatAddressUpdate: return ch.cbrur;
+            case ChannelRegisters.LinkAddress: return ch.clar;
+            case ChannelRegisters.TriggerAndBus: return ch.ctbr;
+            case ChannelRegisters.MaskAddress: return ch.cmar;
+            case ChannelRegisters.MaskData: return ch.cmdr;
+            default: return 0;
+            }
+        }
+
+        public void WriteDoubleWord(long offset, uint value)
+        {
+            if(offset < ChannelBase || offset >= ChannelBase + ChannelCount * ChannelSize)
+            {
+                return;
+            }
+            var index = (int)((offset - ChannelBase) / ChannelSize);
+            var ch = channels[index];
+            switch((ChannelRegisters)((offset - ChannelBase) % ChannelSize))
+            {
+            case ChannelRegisters.InterruptFlagClear:
+                ch.cisr &= ~(value & FlagsAll);
+                break;
+            case ChannelRegisters.Control:
+                ch.ccr = value & ~ControlSoftwareRequest;
+                if((value & ControlEnable) != 0 && (value & ControlSoftwareRequest) != 0)
+                {
+                    Run(index, ch);
+                }
+                break;
+            case ChannelRegisters.TransferConfiguration: ch.ctcr = value; break;
+            case ChannelRegisters.BlockNumberOfData: ch.cbndtr = value; break;
+            case ChannelRegisters.SourceAddress: ch.csar = value; break;
+            case ChannelRegisters.DestinationAddress: ch.cdar = value; break;
+            case ChannelRegisters.BlockRepeatAddressUpdate: ch.cbrur = value; break;
+            case ChannelRegisters.LinkAddress: ch.clar = value; break;
+            case ChannelRegisters.TriggerAndBus: ch.ctbr = value; break;
+            case ChannelRegisters.MaskAddress: ch.cmar = value; break;
+            case ChannelRegisters.MaskData: ch.cmdr = value; break;
+            }
+            UpdateInterrupt();
+        }
+
+        private void Run(int index, Channel ch)
+        {
+            while(true)
+            {
+                var blockLength = ch.cbndtr & 0x1FFFF;
+                var repeats = ((ch.cbndtr >> 20) & 0xFFF) + 1;
+                for(var r = 0; r < repeats; ++r)
+                {
+                    CopyBlock(ch, blockLength);
+                    if(ch.cmar != 0)
+                    {
+                        sysbus.WriteDoubleWord(ch.cmar, ch.cmdr);
+                    }
+                    ch.cisr |= FlagBlockTransfer;
+                }
+                ch.cisr |= FlagBlockRepeat | FlagBufferTransfer;
+                if(ch.clar == 0)
+                {
+                    break;
+                }
+                LoadNode(ch, ch.clar);
+                if((ch.ctcr & TransferSoftwareRequestMode) == 0)
+                {
+                    this.Log(LogLevel.Debug, "channel {0}: node waits for hardware request {1}, not emulated", index, (ch.ctbr & 0x3F));
+                    UpdateInterrupt();
+                    return;
+                }
+            }
+            ch.cisr |= FlagChannelTransferComplete;
+            ch.ccr &= ~ControlEnable;
+            UpdateInterrupt();
+        }
+
+        private void CopyBlock(Channel ch, uint length)
+        {
+            var sourceIncrement = Increment(ch.ctcr & 3, (ch.ctcr >> 8) & 3);
+            var destinationIncrement = Increment((ch.ctcr >> 2) & 3, (ch.ctcr >> 10) & 3);
+            var sourceSize = 1u << (int)((ch.ctcr >> 4) & 3);
+            var destinationSize = 1u << (int)((ch.ctcr >> 6) & 3);
+            var source = ch.csar;
+            var destination = ch.cdar;
+            if(sourceIncrement == sourceSize && destinationIncrement == destinationSize)
+            {
+                // memory to memory, the common case
+                sysbus.WriteBytes(sysbus.ReadBytes(source, (int)length), destination);
+                source += length;
+                destination += length;
+                length = 0;
+            }
+            for(uint done = 0; done < length; done += sourceSize)
+            {
+                for(uint i = 0; i < sourceSize && done + i < length; ++i)
+                {
+                    var b = sysbus.ReadByte(source + i);
+                    sysbus.WriteByte(destination + ((done + i) % destinationSize), b);
+                    if((done + i) % destinationSize == destinationSize - 1)
+                    {
+                        destination = (uint)(destination + destinationIncrement);
+                    }
+                }
+                source = (uint)(source + sourceIncrement);
+            }
+            // block repeat address update
+            var sourceUpdate = ch.cbrur & 0xFFFF;
+            var destinationUpdate = ch.cbrur >> 16;
+            ch.csar = (ch.cbndtr & (1u << 18)) != 0 ? source - sourceUpdate : source + sourceUpdate;
+            ch.cdar = (ch.cbndtr & (1u << 19)) != 0 ? destination - destinationUpdate : destination + destinationUpdate;
+        }
+
+        private static int Increment(uint mode, uint offsetSizeLog2)
+        {
+            switch(mode)
+            {
+            case 2: return 1 << (int)offsetSizeLog2;
+            case 3: return -(1 << (int)offsetSizeLog2);
+            default: return 0;
+            }
+        }
+
+        private void LoadNode(Channel ch, uint address)
+        {
+            ch.ctcr = sysbus.ReadDoubleWord(address + 0x00);
+            ch.cbndtr = sysbus.ReadDoubleWord(address + 0x04);
+            ch.csar = sysbus.ReadDoubleWord(address + 0x08);
+            ch.cdar = sysbus.ReadDoubleWord(address + 0x0C);
+            ch.cbrur = sysbus.ReadDoubleWord(address + 0x10);
+            ch.clar = sysbus.ReadDoubleWord(address + 0x14);
+            ch.ctbr = sysbus.ReadDoubleWord(address + 0x18);
+            ch.cmar = sysbus.ReadDoubleWord(address + 0x20);
+            ch.cmdr = sysbus.ReadDoubleWord(address + 0x24);
+        }
+
+        private void UpdateInterrupt()
+        {
+            var pending = false;
+            foreach(var ch in channels)
+            {
+                pending |= ch.Pending;
+            }
+            IRQ.Set(pending);
+        }
+
+        private readonly IBusController sysbus;
+        private readonly Channel[] channels;
+
+        private class Channel
+        {
+            public void Reset()
+            {
+                cisr = ccr = ctcr = cbndtr = csar = cdar = cbrur = clar = ctbr = cmar = cmdr = 0;
+            }
+
+            // CCR interrupt enables TEIE..TCIE are CISR flags TEIF..TCIF shifted by one
+            public bool Pending => (cisr & (ccr >> 1) & FlagsAll) != 0;
+
+            public uint cisr, ccr, ctcr, cbndtr, csar, cdar, cbrur, clar, ctbr, cmar, cmdr;
+        }
+
+        private const int ChannelCount = 16;
+        private const long ChannelBase = 0x40;
+        private const long ChannelSize = 0x40;
+        private const long GlobalInterruptStatus = 0x00;
+
+        private const uint ControlEnable = 1u << 0;
+        private const uint ControlSoftwareRequest = 1u << 16;
+        private const uint TransferSoftwareRequestMode = 1u << 31;
+
+        private const uint FlagChannelTransferComplete = 1u << 1;
+        private const uint FlagBlockRepeat = 1u << 2;
+        private const uint FlagBlockTransfer = 1u << 3;
+        private const uint FlagBufferTransfer = 1u << 4;
+        private const uint FlagsAll = 0x1F;
+
+        private enum ChannelRegisters : long
+        {
+            InterruptStatus = 0x00,
+            InterruptFlagClear = 0x04,
+            ErrorStatus = 0x08,
+            Control = 0x0C,
+            TransferConfiguration = 0x10,
+            BlockNumberOfData = 0x14,
+            SourceAddress = 0x18,
+            DestinationAddress = 0x1C,
+            BlockRepeatAddressUpdate = 0x20,
+            LinkAddress = 0x24,
+            TriggerAndBus = 0x28,
+            MaskAddress = 0x30,
+            MaskData = 0x34,
+        }
+    }
+}
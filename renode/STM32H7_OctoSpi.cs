@@ -0,0 +1,470 @@
+//
+// stm32h7a3 octospi controller with an esp-psram64h / aps6404l spi ram behind it.
+//
+// indirect mode: commands, reads and writes through IR, AR, DLR and DR, as HAL_OSPI_Command(),
+// HAL_OSPI_Transmit() and HAL_OSPI_Receive() do them.
+// memory-mapped mode: the spi ram contents are a MappedMemory at 0x90000000, so the cpu and
+// dma masters reach it at full emulation speed. The same memory backs the indirect commands.
+//
+// the spi ram model knows spi and qpi mode: reset enable/reset, quad on/off, read id,
+// read, fast read, quad read, write and quad write. A command sent on the wrong number
+// of lines is ignored, like the real chip does.
+//
+// no timing; every transfer completes when it is started.
+//
+using System.Collections.Generic;
+using Antmicro.Renode.Core;
+using Antmicro.Renode.Logging;
+using Antmicro.Renode.Peripherals.Bus;
+using Antmicro.Renode.Peripherals.Memory;
+
+namespace Antmicro.Renode.Peripherals.SPI
+{
+    public class STM32H7_OctoSpi : IDoubleWordPeripheral, IWordPeripheral, IBytePeripheral, IKnownSize
+    {
+        public STM32H7_OctoSpi(MappedMemory psram = null)
+        {
+            this.psram = psram;
+            IRQ = new GPIO();
+            Reset();
+        }
+
+        public void Reset()
+        {
+            cr = 0;
+            sr = 0;
+            dcr1 = dcr2 = dcr3 = dcr4 = 0;
+            dlr = ar = ccr = tcr = ir = abr = lptr = 0;
+            psmkr = psmar = pir = 0;
+            wccr = wtcr = wir = wabr = 0;
+            hlcr = 0;
+            rxFifo.Clear();
+            writeActive = false;
+            qpi = false;
+            resetEnabled = false;
+            IRQ.Unset();
+        }
+
+        public long Size => 0x400;
+
+        public GPIO IRQ { get; private set; }
+
+        public uint ReadDoubleWord(long offset)
+        {
+            switch((Registers)offset)
+            {
+            case Registers.Control: return cr;
+            case Registers.DeviceConfiguration1: return dcr1;
+            case Registers.DeviceConfiguration2: return dcr2;
+            case Registers.DeviceConfiguration3: return dcr3;
+            case Registers.DeviceConfiguration4: return dcr4;
+            case Registers.Status: return Status();
+            case Registers.DataLength: return dlr;
+            case Registers.Address: return ar;
+            case Registers.Data: return ReadData(4);
+            case Registers.PollingStatusMask: return psmkr;
+            case Registers.PollingStatusMatch: return psmar;
+            case Registers.PollingInterval: return pir;
+            case Registers.CommunicationConfiguration: return ccr;
+            case Registers.TimingConfiguration: return tcr;
+            case Registers.Instruction: return ir;
+            case Registers.AlternateBytes: return abr;
+            case Registers.LowPowerTimeout: return lptr;
+            case Registers.WriteCommunicationConfiguration: return wccr;
+            case Registers.WriteTimingConfiguration: return wtcr;
+            case Registers.WriteInstruction: return wir;
+            case Registers.WriteAlternateBytes: return wabr;
+            case Registers.HyperBusLatency: return hlcr;
+            case Registers.HardwareConfiguration: return 0x00000000;
+            case Registers.Version: return 0x00000011;
+            case Registers.Identification: return 0x00180011;
+            case Registers.Size: return 0xA3C5DD01;
+            default:
+                this.Log(LogLevel.Warning, "read from unknown register 0x{0:X}", offset);
+                return 0;
+            }
+        }
+
+        public void WriteDoubleWord(long offset, uint value)
+        {
+            switch((Registers)offset)
+            {
+            case Registers.Control:
+                WriteControl(value);
+                break;
+            case Registers.DeviceConfiguration1: dcr1 = value; break;
+            case Registers.DeviceConfiguration2: dcr2 = value; break;
+            case Registers.DeviceConfiguration3: dcr3 = value; break;
+            case Registers.DeviceConfiguration4: dcr4 = value; break;
+            case Registers.FlagClear:
+                sr &= ~(value & (StatusTransferError | StatusTransferComplete | StatusMatch | StatusTimeout));
+                UpdateInterrupt();
+                break;
+            case Registers.DataLength: dlr = value; break;
+            case Registers.Address:
+                ar = value;
+                if(AddressMode != 0)
+                {
+                    Trigger();
+                }
+                break;
+            case Registers.Data:
+                WriteData(value, 4);
+                break;
+            case Registers.PollingStatusMask: psmkr = value; break;
+            case Registers.PollingStatusMatch: psmar = value; break;
+            case Registers.PollingInterval: pir = value; break;
+            case Registers.CommunicationConfiguration: ccr = value; break;
+            case Registers.TimingConfiguration: tcr = value; break;
+            case Registers.Instruction:
+                ir = value;
+                if(AddressMode == 0)
+                {
+                    Trigger();
+                }
+                break;
+            case Registers.AlternateBytes: abr = value; break;
+            case Registers.LowPowerTimeout: lptr = value; break;
+            case Registers.WriteCommunicationConfiguration: wccr = value; break;
+            case Registers.WriteTimingConfiguration: wtcr = value; break;
+            case Registers.WriteInstruction: wir = value; break;
+            case Registers.WriteAlternateBytes: wabr = value; break;
+            case Registers.HyperBusLatency: hlcr = value; break;
+            default:
+                this.Log(LogLevel.Warning, "write 0x{0:X} to unknown register 0x{1:X}", value, offset);
+                break;
+            }
+        }
+
+        // HAL_OSPI_Transmit() and HAL_OSPI_Receive() access DR a byte at a time
+        public ushort ReadWord(long offset)
+        {
+            if(offset == (long)Registers.Data)
+            {
+                return (ushort)ReadData(2);
+            }
+            return (ushort)(ReadDoubleWord(offset & ~3) >> (int)(8 * (offset & 3)));
+        }
+
+        public void WriteWord(long offset, ushort value)
+        {
+            if(offset == (long)Registers.Data)
+            {
+                WriteData(value, 2);
+                return;
+            }
+            var shift = (int)(8 * (offset & 3));
+            var old = ReadDoubleWord(offset & ~3);
+            WriteDoubleWord(offset & ~3, (old & ~(0xFFFFu << shift)) | ((uint)value << shift));
+        }
+
+        public byte ReadByte(long offset)
+        {
+            if(offset == (long)Registers.Data)
+            {
+                return (byte)ReadData(1);
+            }
+            return (byte)(ReadDoubleWord(offset & ~3) >> (int)(8 * (offset & 3)));
+        }
+
+        public void WriteByte(long offset, byte value)
+        {
+            if(offset == (long)Registers.Data)
+            {
+                WriteData(value, 1);
+                return;
+            }
+            var shift = (int)(8 * (offset & 3));
+            var old = ReadDoubleWord(offset & ~3);
+            WriteDoubleWord(offset & ~3, (old & ~(0xFFu << shift)) | ((uint)value << shift));
+        }
+
+        private void WriteControl(uint value)
+        {
+            var oldMode = FunctionalMode;
+            cr = value & ~ControlAbort;
+            if((value & ControlAbort) != 0 || (value & ControlEnable) == 0)
+            {
+                rxFifo.Clear();
+                writeActive = false;
+            }
+            if(FunctionalMode != oldMode)
+            {
+                // a pending indirect write does not survive a mode change
+                writeActive = false;
+                if(FunctionalMode == ModeMemoryMapped)
+                {
+                    this.Log(LogLevel.Debug, "memory-mapped, read 0x{0:X2}, write 0x{1:X2}", ir & 0xFF, wir & 0xFF);
+                }
+            }
+            UpdateInterrupt();
+        }
+
+        private uint Status()
+        {
+            var status = sr & ~(StatusBusy | StatusFifoThreshold | StatusFifoLevelMask);
+            var level = (uint)System.Math.Min(rxFifo.Count, 32);
+            if(writeActive)
+            {
+                // the transfer starts with the first byte in DR
+                status |= StatusFifoThreshold | (writeCount > 0 ? StatusBusy : 0);
+            }
+            else if(rxFifo.Count > 0)
+            {
+                status |= StatusBusy | StatusFifoThreshold | (level << 8);
+            }
+            return status;
+        }
+
+        // start of an indirect transfer: the last of IR or AR the command needs was written
+        private void Trigger()
+        {
+            if((cr & ControlEnable) == 0 || FunctionalMode == ModeMemoryMapped || FunctionalMode == ModeAutoPolling)
+            {
+                return;
+            }
+            rxFifo.Clear();
+            writeActive = false;
+            if(DataMode == 0)
+            {
+                Execute(null, 0);
+                Complete();
+            }
+            else if(FunctionalMode == ModeIndirectRead)
+            {
+                var data = new byte[dlr + 1];
+                Execute(data, data.Length);
+                foreach(var b in data)
+                {
+                    rxFifo.Enqueue(b);
+                }
+                Complete();
+            }
+            else
+            {
+                // indirect write: the command goes out with the first byte in DR
+                writeActive = true;
+                writeAddress = ar;
+                writeCount = 0;
+            }
+        }
+
+        private void Complete()
+        {
+            sr |= StatusTransferComplete;
+            UpdateInterrupt();
+        }
+
+        private uint ReadData(int bytes)
+        {
+            uint value = 0;
+            for(var i = 0; i < bytes; ++i)
+            {
+                if(rxFifo.Count == 0)
+                {
+                    this.Log(LogLevel.Warning, "read from empty fifo");
+                    break;
+                }
+                value |= (uint)rxFifo.Dequeue() << (8 * i);
+            }
+            return value;
+        }
+
+        private void WriteData(uint value, int bytes)
+        {
+            if(!writeActive)
+            {
+                this.Log(LogLevel.Warning, "write to DR without an indirect write command");
+                return;
+            }
+            if(writeCount == 0)
+            {
+                Execute(null, 0);
+            }
+            for(var i = 0; i < bytes && writeActive; ++i)
+            {
+                if(psramWrite)
+                {
+                    WritePsram(writeAddress + writeCount, (byte)(value >> (8 * i)));
+                }
+                writeCount += 1;
+                if(writeCount > dlr)
+                {
+                    writeActive = false;
+                    Complete();
+                }
+            }
+        }
+
+        // the spi ram side of a command, in indirect mode
+        private void Execute(byte[] data, int length)
+        {
+            psramWrite = false;
+            var instruction = (byte)ir;
+            var instructionQuad = InstructionMode == 3;
+            var instructionSingle = InstructionMode == 1;
+            if(psram == null)
+            {
+                this.Log(LogLevel.Debug, "command 0x{0:X2}, no memory connected", instruction);
+                return;
+            }
+            if((qpi && !instructionQuad) || (!qpi && !instructionSingle))
+            {
+                this.Log(LogLevel.Debug, "command 0x{0:X2} on {1} lines ignored in {2} mode", instruction, instructionQuad ? 4 : 1, qpi ? "qpi" : "spi");
+                return;
+            }
+            if(instruction != CommandResetEnable)
+            {
+                var wasEnabled = resetEnabled;
+                resetEnabled = false;
+                if(instruction == CommandReset && wasEnabled)
+                {
+                    qpi = false;
+                    this.Log(LogLevel.Debug, "spi ram reset");
+                    return;
+                }
+            }
+            switch(instruction)
+            {
+            case CommandResetEnable:
+                resetEnabled = true;
+                break;
+            case CommandQuadOn:
+                qpi = true;
+                break;
+            case CommandQuadOff:
+                qpi = false;
+                break;
+            case CommandBurstLength:
+                break;
+            case CommandReadId:
+                if(data != null)
+                {
+                    for(var i = 0; i < length; ++i)
+                    {
+                        data[i] = ReadId[i % ReadId.Length];
+                    }
+                }
+                break;
+            case CommandRead:
+            case CommandFastRead:
+            case CommandQuadRead:
+                if(data != null)
+                {
+                    for(var i = 0; i < length; ++i)
+                    {
+                        data[i] = ReadPsram(ar + (uint)i);
+                    }
+                }
+                break;
+            case CommandWrite:
+            case CommandQuadWrite:
+                psramWrite = true;
+                break;
+            default:
+                this.Log(LogLevel.Warning, "unknown spi ram command 0x{0:X2}", instruction);
+                break;
+            }
+        }
+
+        private byte ReadPsram(uint address)
+        {
+            return psram.ReadByte(address % (uint)psram.Size);
+        }
+
+        private void WritePsram(uint address, byte value)
+        {
+            psram.WriteByte(address % (uint)psram.Size, value);
+        }
+
+        private void UpdateInterrupt()
+        {
+            var pending = ((cr & ControlTransferCompleteIrq) != 0 && (sr & StatusTransferComplete) != 0)
+                || ((cr & ControlTransferErrorIrq) != 0 && (sr & StatusTransferError) != 0);
+            IRQ.Set(pending);
+        }
+
+        private uint FunctionalMode => (cr >> 28) & 3;
+        private uint InstructionMode => ccr & 7;
+        private uint AddressMode => (ccr >> 8) & 7;
+        private uint DataMode => (ccr >> 24) & 7;
+
+        private readonly MappedMemory psram;
+        private readonly Queue<byte> rxFifo = new Queue<byte>();
+
+        private uint cr, sr, dcr1, dcr2, dcr3, dcr4;
+        private uint dlr, ar, ccr, tcr, ir, abr, lptr;
+        private uint psmkr, psmar, pir;
+        private uint wccr, wtcr, wir, wabr, hlcr;
+        private bool writeActive;
+        private uint writeAddress;
+        private uint writeCount;
+        private bool psramWrite;
+        private bool qpi;
+        private bool resetEnabled;
+
+        // esp-psram64h: mfid, kgd, eid
+        private static readonly byte[] ReadId = { 0x0D, 0x5D, 0x52, 0xA2, 0x64, 0x31, 0x91, 0x31 };
+
+        private const uint ModeIndirectWrite = 0;
+        private const uint ModeIndirectRead = 1;
+        private const uint ModeAutoPolling = 2;
+        private const uint ModeMemoryMapped = 3;
+
+        private const uint ControlEnable = 1u << 0;
+        private const uint ControlAbort = 1u << 1;
+        private const uint ControlTransferErrorIrq = 1u << 16;
+        private const uint ControlTransferCompleteIrq = 1u << 17;
+
+        private const uint StatusTransferError = 1u << 0;
+        private const uint StatusTransferComplete = 1u << 1;
+        private const uint StatusFifoThreshold = 1u << 2;
+        private const uint StatusMatch = 1u << 3;
+        private const uint StatusTimeout = 1u << 4;
+        private const uint StatusBusy = 1u << 5;
+        private const uint StatusFifoLevelMask = 0x3Fu << 8;
+
+        private const byte CommandRead = 0x03;
+        private const byte CommandFastRead = 0x0B;
+        private const byte CommandQuadRead = 0xEB;
+        private const byte CommandWrite = 0x02;
+        private const byte CommandQuadWrite = 0x38;
+        private const byte CommandQuadOn = 0x35;
+        private const byte CommandQuadOff = 0xF5;
+        private const byte CommandResetEnable = 0x66;
+        private const byte CommandReset = 0x99;
+        private const byte CommandBurstLength = 0xC0;
+        private const byte CommandReadId = 0x9F;
+
+        private enum Registers : long
+        {
+            Control = 0x000,
+            DeviceConfiguration1 = 0x008,
+            DeviceConfiguration2 = 0x00C,
+            DeviceConfiguration3 = 0x010,
+            DeviceConfiguration4 = 0x014,
+            Status = 0x020,
+            FlagClear = 0x024,
+            DataLength = 0x040,
+            Address = 0x048,
+            Data = 0x050,
+            PollingStatusMask = 0x080,
+            PollingStatusMatch = 0x088,
+            PollingInterval = 0x090,
+            CommunicationConfiguration = 0x100,
+            TimingConfiguration = 0x108,
+            Instruction = 0x110,
+            AlternateBytes = 0x120,
+            LowPowerTimeout = 0x130,
+            WriteCommunicationConfiguration = 0x180,
+            WriteTimingConfiguration = 0x188,
+            WriteInstruction = 0x190,
+            WriteAlternateBytes = 0x1A0,
+            HyperBusLatency = 0x200,
+            HardwareConfiguration = 0x3F0,
+            Version = 0x3F4,
+            Identification = 0x3F8,
+            Size = 0x3FC,
+        }
+    }
+}
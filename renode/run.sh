@@ -0,0 +1,11 @@
+#!/bin/sh
+# run micropython for the devebox stm32h7a3 in renode, without a board.
+# needs a firmware built with CFLAGS_EXTRA=-DMICROPY_HW_RENODE=1, for the repl on uart7.
+# the console is a pty; in another shell: mpremote connect /tmp/devebox_uart7 run bench/copy.py
+# usage: renode/run.sh [firmware.elf] [pty]
+
+ELF=$(realpath "${1:-build-DEVEBOX_STM32H7A3/firmware.elf}")
+PTY=${2:-/tmp/devebox_uart7}
+DIR=$(dirname "$(realpath "$0")")
+
+exec renode --disable-xwt --console -e "\$elf=@$ELF; include @$DIR/devebox_stm32h7a3.resc; emulation CreateUartPtyTerminal \"term\" \"$PTY\" true; connector Connect sysbus.uart7 term; start"
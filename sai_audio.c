@@ -0,0 +1,403 @@
+/*
+ * sai audio, dma double buffering into a spi ram ring buffer
+ */
+
+/* notes:
+ * sai1 block a, i2s, 16 bit stereo.
+ * A dma stream in double buffer mode moves samples between the sai and two
+ * small buffers in internal ram. The transfer complete flag of the stream
+ * triggers the mdma, which copies the buffer the dma just finished to or from
+ * the ring buffer in spi ram, and clears the flag. The cpu only re-arms the mdma,
+ * once per buffer, so the interpreter can keep the bus busy without gaps in the audio.
+ *
+ * ring full when recording: the buffer is dropped, and overruns counts.
+ * ring empty when playing: silence is played, and underruns counts.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "mdma.h"
+#include "spiram_ring.h"
+#include "sai_audio.h"
+
+#if MICROPY_HW_ENABLE_SAI_AUDIO
+
+// dma2 stream 7. Its transfer complete flag is mdma request 0x0f.
+#ifndef MICROPY_HW_SAI_AUDIO_DMA_STREAM
+#define MICROPY_HW_SAI_AUDIO_DMA_STREAM (DMA2_Stream7)
+#define MICROPY_HW_SAI_AUDIO_DMAMUX (DMAMUX1_Channel15)
+#define MICROPY_HW_SAI_AUDIO_DMA_IFCR (&DMA2->HIFCR)
+#define MICROPY_HW_SAI_AUDIO_DMA_TCIF (DMA_HIFCR_CTCIF7)
+#define MICROPY_HW_SAI_AUDIO_MDMA_REQUEST (0x0f)
+#endif
+
+#ifndef MICROPY_HW_SAI_AUDIO_AF
+#define MICROPY_HW_SAI_AUDIO_AF (GPIO_AF6_SAI1)
+#endif
+
+#define SAI_AUDIO_HALF (2048)       // bytes per dma buffer, 512 stereo frames
+#define SAI_AUDIO_MDMA_PRIORITY (3)
+
+enum { SAI_AUDIO_RECORD, SAI_AUDIO_PLAY };
+
+typedef struct _spiram_audio_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the ring storage alive
+    spiram_ring_t ring;
+    uint32_t rate;
+    uint32_t mode;
+    bool running;
+    uint32_t half;              // dma buffer the next mdma transfer serves
+    bool skipped;               // next mdma transfer does not touch the ring
+    volatile uint64_t bytes;
+    volatile uint32_t underruns;
+    volatile uint32_t overruns;
+} spiram_audio_obj_t;
+
+static SAI_HandleTypeDef sai_audio_sai;
+static spiram_audio_obj_t *sai_audio_active = NULL;
+static mdma_node_t sai_audio_node;
+static uint32_t sai_audio_scratch;
+static const uint32_t sai_audio_zero = 0;
+static uint8_t sai_audio_dma[2][SAI_AUDIO_HALF] __attribute__((aligned(32)));
+
+static void sai_audio_pins(void) {
+    mp_hal_pin_config(MICROPY_HW_SAI_AUDIO_SCK, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_NONE, MICROPY_HW_SAI_AUDIO_AF);
+    mp_hal_pin_config(MICROPY_HW_SAI_AUDIO_FS, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_NONE, MICROPY_HW_SAI_AUDIO_AF);
+    mp_hal_pin_config(MICROPY_HW_SAI_AUDIO_SD, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_NONE, MICROPY_HW_SAI_AUDIO_AF);
+    #if defined(MICROPY_HW_SAI_AUDIO_MCK)
+    mp_hal_pin_config(MICROPY_HW_SAI_AUDIO_MCK, MP_HAL_PIN_MODE_ALT, MP_HAL_PIN_PULL_NONE, MICROPY_HW_SAI_AUDIO_AF);
+    mp_hal_pin_config_speed(MICROPY_HW_SAI_AUDIO_MCK, MP_HAL_PIN_SPEED_VERY_HIGH);
+    #endif
+}
+
+static int sai_audio_sai_init(spiram_audio_obj_t *self) {
+    __HAL_RCC_SAI1_CLK_ENABLE();
+    SAI_HandleTypeDef *sai = &sai_audio_sai;
+    memset(sai, 0, sizeof(*sai));
+    sai->Instance = SAI1_Block_A;
+    sai->Init.AudioMode = self->mode == SAI_AUDIO_RECORD ? SAI_MODEMASTER_RX : SAI_MODEMASTER_TX;
+    sai->Init.Synchro = SAI_ASYNCHRONOUS;
+    sai->Init.SynchroExt = SAI_SYNCEXT_DISABLE;
+    sai->Init.OutputDrive = SAI_OUTPUTDRIVE_ENABLE;
+    sai->Init.NoDivider = SAI_MASTERDIVIDER_ENABLE;
+    sai->Init.FIFOThreshold = SAI_FIFOTHRESHOLD_1QF;
+    sai->Init.AudioFrequency = self->rate;
+    sai->Init.MonoStereoMode = SAI_STEREOMODE;
+    sai->Init.CompandingMode = SAI_NOCOMPANDING;
+    sai->Init.TriState = SAI_OUTPUT_NOTRELEASED;
+    #if defined(MICROPY_HW_SAI_AUDIO_MCK)
+    sai->Init.MckOutput = SAI_MCK_OUTPUT_ENABLE;
+    #else
+    sai->Init.MckOutput = SAI_MCK_OUTPUT_DISABLE;
+    #endif
+    if (HAL_SAI_InitProtocol(sai, SAI_I2S_STANDARD, SAI_PROTOCOL_DATASIZE_16BIT, 2) != HAL_OK) {
+        return -MP_EINVAL;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// mdma, one transfer per dma buffer
+
+static void sai_audio_arm(spiram_audio_obj_t *self) {
+    uint8_t *half = sai_audio_dma[self->half];
+    size_t n;
+    if (self->mode == SAI_AUDIO_RECORD) {
+        uint8_t *dst = spiram_ring_write_ptr(&self->ring, &n);
+        self->skipped = n < SAI_AUDIO_HALF;
+        mdma_node_memcpy(&sai_audio_node, self->skipped ? (void *)&sai_audio_scratch : dst, half, SAI_AUDIO_HALF);
+        if (self->skipped) {
+            sai_audio_node.CTCR &= ~MDMA_CTCR_DINC_Msk;
+        }
+    } else {
+        const uint8_t *src = spiram_ring_read_ptr(&self->ring, &n);
+        self->skipped = n < SAI_AUDIO_HALF;
+        mdma_node_memcpy(&sai_audio_node, half, self->skipped ? (const void *)&sai_audio_zero : src, SAI_AUDIO_HALF);
+        if (self->skipped) {
+            sai_audio_node.CTCR &= ~MDMA_CTCR_SINC_Msk;
+        }
+    }
+    mdma_node_trigger(&sai_audio_node, MICROPY_HW_SAI_AUDIO_MDMA_REQUEST,
+        MICROPY_HW_SAI_AUDIO_DMA_IFCR, MICROPY_HW_SAI_AUDIO_DMA_TCIF);
+    mdma_start(MDMA_CHANNEL_AUDIO, &sai_audio_node, SAI_AUDIO_MDMA_PRIORITY);
+}
+
+static void sai_audio_mdma_irq(uint32_t channel, uint32_t cisr, void *arg) {
+    spiram_audio_obj_t *self = arg;
+    if (!self->running) {
+        return;
+    }
+    if (self->skipped) {
+        if (self->mode == SAI_AUDIO_RECORD) {
+            self->overruns += 1;
+        } else {
+            self->underruns += 1;
+        }
+    } else if (self->mode == SAI_AUDIO_RECORD) {
+        spiram_ring_commit(&self->ring, SAI_AUDIO_HALF);
+    } else {
+        spiram_ring_consume(&self->ring, SAI_AUDIO_HALF);
+    }
+    self->bytes += SAI_AUDIO_HALF;
+    self->half ^= 1;
+    sai_audio_arm(self);
+}
+
+// -----------------------------------------------------------------------------
+
+static void sai_audio_stop(spiram_audio_obj_t *self) {
+    if (!self->running) {
+        return;
+    }
+    self->running = false;
+    DMA_Stream_TypeDef *dma = MICROPY_HW_SAI_AUDIO_DMA_STREAM;
+    sai_audio_sai.Instance->CR1 &= ~SAI_xCR1_DMAEN;
+    dma->CR &= ~DMA_SxCR_EN;
+    while (dma->CR & DMA_SxCR_EN) {
+    }
+    mdma_abort(MDMA_CHANNEL_AUDIO);
+    mdma_set_callback(MDMA_CHANNEL_AUDIO, NULL, NULL);
+    HAL_SAI_DeInit(&sai_audio_sai);
+    sai_audio_active = NULL;
+}
+
+static int sai_audio_start(spiram_audio_obj_t *self) {
+    if (sai_audio_active != NULL) {
+        return -MP_EBUSY;
+    }
+    mdma_init();
+    sai_audio_pins();
+    int ret = sai_audio_sai_init(self);
+    if (ret != 0) {
+        return ret;
+    }
+
+    self->half = 0;
+    if (self->mode == SAI_AUDIO_PLAY) {
+        // prime both buffers; the mdma refills buffer 0 after the dma played it
+        for (uint32_t i = 0; i < 2; ++i) {
+            // whole buffers only, so the tail stays a multiple of the dma buffer
+            size_t n = 0;
+            if (spiram_ring_used(&self->ring) >= SAI_AUDIO_HALF) {
+                n = spiram_ring_read(&self->ring, sai_audio_dma[i], SAI_AUDIO_HALF);
+            }
+            memset(sai_audio_dma[i] + n, 0, SAI_AUDIO_HALF - n);
+        }
+        MP_HAL_CLEAN_DCACHE(sai_audio_dma, sizeof(sai_audio_dma));
+    }
+
+    sai_audio_active = self;
+    self->running = true;
+    mdma_set_callback(MDMA_CHANNEL_AUDIO, sai_audio_mdma_irq, self);
+    *MICROPY_HW_SAI_AUDIO_DMA_IFCR = MICROPY_HW_SAI_AUDIO_DMA_TCIF;
+    sai_audio_arm(self);
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    DMA_Stream_TypeDef *dma = MICROPY_HW_SAI_AUDIO_DMA_STREAM;
+    MICROPY_HW_SAI_AUDIO_DMAMUX->CCR = DMA_REQUEST_SAI1_A;
+    dma->CR = 0;
+    dma->PAR = (uint32_t)&sai_audio_sai.Instance->DR;
+    dma->M0AR = (uint32_t)sai_audio_dma[0];
+    dma->M1AR = (uint32_t)sai_audio_dma[1];
+    dma->NDTR = SAI_AUDIO_HALF / 2;
+    dma->FCR = 0;
+    dma->CR = DMA_SxCR_DBM
+        | DMA_SxCR_MINC
+        | 1 << DMA_SxCR_PSIZE_Pos
+        | 1 << DMA_SxCR_MSIZE_Pos
+        | (self->mode == SAI_AUDIO_RECORD ? 0 : 1) << DMA_SxCR_DIR_Pos
+        | 2 << DMA_SxCR_PL_Pos;
+    dma->CR |= DMA_SxCR_EN;
+    sai_audio_sai.Instance->CR1 |= SAI_xCR1_DMAEN;
+    __HAL_SAI_ENABLE(&sai_audio_sai);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.Audio(buf, *, rate=48000, mode=Audio.RECORD)
+// buf is the ring buffer, normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_audio_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_rate, ARG_mode };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_rate, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 48000} },
+        { MP_QSTR_mode, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = SAI_AUDIO_RECORD} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    // ring is cache line aligned, and a multiple of the dma buffer, so mdma transfers never wrap
+    uint32_t start = ((uint32_t)bufinfo.buf + 31) & ~31;
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    if (end < start + 2 * SAI_AUDIO_HALF) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+    if (args[ARG_mode].u_int != SAI_AUDIO_RECORD && args[ARG_mode].u_int != SAI_AUDIO_PLAY) {
+        mp_raise_ValueError(NULL);
+    }
+
+    spiram_audio_obj_t *self = m_new_obj_with_finaliser(spiram_audio_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->rate = args[ARG_rate].u_int;
+    self->mode = args[ARG_mode].u_int;
+    spiram_ring_init(&self->ring, (void *)start, (end - start) / SAI_AUDIO_HALF * SAI_AUDIO_HALF);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_audio_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "Audio(%s, rate=%u, ring=%u, used=%u)",
+        self->mode == SAI_AUDIO_RECORD ? "record" : "play",
+        self->rate, self->ring.size, spiram_ring_used(&self->ring));
+}
+
+STATIC mp_obj_t spiram_audio_start(mp_obj_t self_in) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->running) {
+        int ret = sai_audio_start(self);
+        if (ret != 0) {
+            mp_raise_OSError(-ret);
+        }
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_audio_start_obj, spiram_audio_start);
+
+STATIC mp_obj_t spiram_audio_stop(mp_obj_t self_in) {
+    sai_audio_stop(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_audio_stop_obj, spiram_audio_stop);
+
+// audio.stats()
+// returns (bytes, underruns, overruns, bytes in ring)
+
+STATIC mp_obj_t spiram_audio_stats(mp_obj_t self_in) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    uint32_t irq_state = disable_irq();
+    uint64_t bytes = self->bytes;
+    uint32_t underruns = self->underruns;
+    uint32_t overruns = self->overruns;
+    enable_irq(irq_state);
+    mp_obj_t t[4] = {
+        mp_obj_new_int_from_ull(bytes),
+        mp_obj_new_int_from_uint(underruns),
+        mp_obj_new_int_from_uint(overruns),
+        mp_obj_new_int_from_uint(spiram_ring_used(&self->ring)),
+    };
+    return mp_obj_new_tuple(4, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_audio_stats_obj, spiram_audio_stats);
+
+// read and write do not block; they return None if the ring is empty or full.
+
+STATIC mp_uint_t spiram_audio_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    size_t done = 0;
+    while (done < size) {
+        size_t n;
+        const uint8_t *p = spiram_ring_read_ptr(&self->ring, &n);
+        n = MIN(n, size - done);
+        if (n == 0) {
+            break;
+        }
+        // written by the mdma
+        SCB_InvalidateDCache_by_Addr((uint32_t *)((uint32_t)p & ~31), (((uint32_t)p & 31) + n + 31) & ~31);
+        memcpy((uint8_t *)buf + done, p, n);
+        spiram_ring_consume(&self->ring, n);
+        done += n;
+    }
+    if (done == 0 && size != 0) {
+        *errcode = MP_EAGAIN;
+        return MP_STREAM_ERROR;
+    }
+    return done;
+}
+
+STATIC mp_uint_t spiram_audio_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    size_t done = 0;
+    while (done < size) {
+        size_t n;
+        uint8_t *p = spiram_ring_write_ptr(&self->ring, &n);
+        n = MIN(n, size - done);
+        if (n == 0) {
+            break;
+        }
+        memcpy(p, (const uint8_t *)buf + done, n);
+        // read by the mdma
+        MP_HAL_CLEAN_DCACHE(p, n);
+        spiram_ring_commit(&self->ring, n);
+        done += n;
+    }
+    if (done == 0 && size != 0) {
+        *errcode = MP_EAGAIN;
+        return MP_STREAM_ERROR;
+    }
+    return done;
+}
+
+STATIC mp_uint_t spiram_audio_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    spiram_audio_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (request == MP_STREAM_POLL) {
+        mp_uint_t ret = 0;
+        if ((arg & MP_STREAM_POLL_RD) && spiram_ring_used(&self->ring) != 0) {
+            ret |= MP_STREAM_POLL_RD;
+        }
+        if ((arg & MP_STREAM_POLL_WR) && spiram_ring_free(&self->ring) != 0) {
+            ret |= MP_STREAM_POLL_WR;
+        }
+        return ret;
+    } else if (request == MP_STREAM_CLOSE) {
+        sai_audio_stop(self);
+        return 0;
+    }
+    *errcode = MP_EINVAL;
+    return MP_STREAM_ERROR;
+}
+
+STATIC const mp_rom_map_elem_t spiram_audio_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_start), MP_ROM_PTR(&spiram_audio_start_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&spiram_audio_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_audio_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_stream_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_audio_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_RECORD), MP_ROM_INT(SAI_AUDIO_RECORD) },
+    { MP_ROM_QSTR(MP_QSTR_PLAY), MP_ROM_INT(SAI_AUDIO_PLAY) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_audio_locals_dict, spiram_audio_locals_dict_table);
+
+STATIC const mp_stream_p_t spiram_audio_stream_p = {
+    .read = spiram_audio_read,
+    .write = spiram_audio_write,
+    .ioctl = spiram_audio_ioctl,
+};
+
+const mp_obj_type_t spiram_audio_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Audio,
+    .print = spiram_audio_print,
+    .make_new = spiram_audio_make_new,
+    .protocol = &spiram_audio_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&spiram_audio_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_SAI_AUDIO
+
+// not truncated
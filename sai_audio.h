@@ -0,0 +1,15 @@
+/*
+ * sai audio, dma double buffering into a spi ram ring buffer
+ */
+#ifndef __SAI_AUDIO_H__
+#define __SAI_AUDIO_H__
+#include "py/obj.h"
+
+// needs HAL_SAI_MODULE_ENABLED in stm32h7xx_hal_conf.h, and pins
+// MICROPY_HW_SAI_AUDIO_SCK, _FS and _SD in mpconfigboard.h; _MCK if the codec needs a master clock
+#ifndef MICROPY_HW_ENABLE_SAI_AUDIO
+#define MICROPY_HW_ENABLE_SAI_AUDIO (0)
+#endif
+
+extern const mp_obj_type_t spiram_audio_type;
+#endif // __SAI_AUDIO_H__
@@ -0,0 +1,477 @@
+/*
+ * write-behind staging in spi ram for the sd card
+ */
+
+/* notes:
+ * a block device in front of the sd card. The staging buffer, megabytes in spi ram,
+ * is cut into slots of one segment each; a segment is an aligned run of blocks
+ * on the card, 64 kbyte by default, a multiple of the erase size of most cards.
+ * Writes from the filesystem are copied into the slot of their segment,
+ * and a bitmap records which blocks of the segment hold data.
+ *
+ * A slot is written to the card when the staging buffer is full (least recently
+ * written slot first), on sync (ioctl 3, os.sync(), umount), on deinit, and when
+ * no block was written for idle_ms. A slot that is at least half written gets
+ * its holes read from the card first, so it goes out as one aligned multi-block
+ * write of the whole segment. Otherwise, each run of consecutive blocks is one
+ * multi-block write. Slots are flushed in card order.
+ *
+ * The sdmmc idma reads the slots straight from spi ram; no copy to internal ram.
+ * Reads see staged blocks.
+ *
+ * The idle flush is a soft timer that schedules a flush in the interpreter, so it
+ * never runs in the middle of a filesystem operation. Staged data is lost on a reset
+ * without sync.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "extmod/vfs.h"
+#include "softtimer.h"
+#include "sdcard.h"
+#include "spiram_qos.h"
+#include "sd_stage.h"
+
+#if MICROPY_HW_ENABLE_SDCARD
+
+#define SD_STAGE_FREE (0xffffffff)
+
+typedef struct _sd_stage_slot_t {
+    uint32_t segment;           // card block / segment size, or SD_STAGE_FREE
+    uint32_t seq;               // last write, for lru
+    uint32_t count;             // blocks with data
+} sd_stage_slot_t;
+
+typedef struct _spiram_sdstage_obj_t {
+    soft_timer_entry_t timer;   // first, its base is the object base
+    mp_obj_t buf;               // keeps the storage alive
+    uint8_t *data;
+    sd_stage_slot_t *slot;
+    uint32_t *map;              // block bitmap, map_words per slot
+    uint32_t n_slots;
+    uint32_t used;              // slots with data
+    uint32_t seg_blocks;
+    uint32_t map_words;
+    uint32_t seq;
+    uint32_t idle_ms;
+    uint32_t last_ms;           // time of last write
+    bool timer_armed;
+    bool busy;
+    // stats
+    uint32_t writes;
+    uint32_t blocks;
+    uint32_t card_writes;
+    uint32_t card_blocks;
+    uint32_t errors;
+    uint32_t max_us;
+} spiram_sdstage_obj_t;
+
+static inline uint8_t *sd_stage_data(spiram_sdstage_obj_t *self, uint32_t slot) {
+    return self->data + slot * self->seg_blocks * SDCARD_BLOCK_SIZE;
+}
+
+static inline uint32_t *sd_stage_map(spiram_sdstage_obj_t *self, uint32_t slot) {
+    return self->map + slot * self->map_words;
+}
+
+static inline bool sd_stage_valid(const uint32_t *map, uint32_t i) {
+    return map[i / 32] & (1u << (i % 32));
+}
+
+static inline void sd_stage_set_valid(uint32_t *map, uint32_t i) {
+    map[i / 32] |= 1u << (i % 32);
+}
+
+static int sd_stage_find(spiram_sdstage_obj_t *self, uint32_t segment) {
+    for (uint32_t i = 0; i < self->n_slots; ++i) {
+        if (self->slot[i].segment == segment) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int sd_stage_card_write(spiram_sdstage_obj_t *self, const uint8_t *src, uint32_t block, uint32_t n) {
+    if (sdcard_write_blocks(src, block, n) != 0) {
+        self->errors += 1;
+        return -MP_EIO;
+    }
+    self->card_writes += 1;
+    self->card_blocks += n;
+    spiram_qos_account(SPIRAM_QOS_SDCARD, n * SDCARD_BLOCK_SIZE);
+    return 0;
+}
+
+// write one slot to the card and free it. On error, the slot keeps its data.
+static int sd_stage_flush_slot(spiram_sdstage_obj_t *self, uint32_t n) {
+    sd_stage_slot_t *s = &self->slot[n];
+    if (s->segment == SD_STAGE_FREE) {
+        return 0;
+    }
+    uint8_t *data = sd_stage_data(self, n);
+    uint32_t *map = sd_stage_map(self, n);
+    uint32_t base = s->segment * self->seg_blocks;
+
+    // mostly written: fill the holes from the card, write the whole segment
+    if (s->count < self->seg_blocks && s->count >= self->seg_blocks / 2) {
+        for (uint32_t i = 0; i < self->seg_blocks;) {
+            if (sd_stage_valid(map, i)) {
+                ++i;
+                continue;
+            }
+            uint32_t j = i;
+            while (j < self->seg_blocks && !sd_stage_valid(map, j)) {
+                ++j;
+            }
+            if (sdcard_read_blocks(data + i * SDCARD_BLOCK_SIZE, base + i, j - i) != 0) {
+                self->errors += 1;
+                return -MP_EIO;
+            }
+            for (; i < j; ++i) {
+                sd_stage_set_valid(map, i);
+            }
+        }
+        s->count = self->seg_blocks;
+    }
+
+    // one multi-block write per run of consecutive blocks
+    for (uint32_t i = 0; i < self->seg_blocks;) {
+        if (!sd_stage_valid(map, i)) {
+            ++i;
+            continue;
+        }
+        uint32_t j = i;
+        while (j < self->seg_blocks && sd_stage_valid(map, j)) {
+            ++j;
+        }
+        int ret = sd_stage_card_write(self, data + i * SDCARD_BLOCK_SIZE, base + i, j - i);
+        if (ret != 0) {
+            return ret;
+        }
+        i = j;
+    }
+
+    s->segment = SD_STAGE_FREE;
+    s->count = 0;
+    memset(map, 0, self->map_words * sizeof(uint32_t));
+    self->used -= 1;
+    return 0;
+}
+
+// all slots, lowest segment first
+static int sd_stage_flush(spiram_sdstage_obj_t *self) {
+    if (self->busy) {
+        return 0;
+    }
+    self->busy = true;
+    int ret = 0;
+    while (self->used != 0) {
+        uint32_t first = 0;
+        for (uint32_t i = 1; i < self->n_slots; ++i) {
+            if (self->slot[i].segment < self->slot[first].segment) {
+                first = i;
+            }
+        }
+        ret = sd_stage_flush_slot(self, first);
+        if (ret != 0) {
+            break;
+        }
+    }
+    self->busy = false;
+    return ret;
+}
+
+// slot for a segment: a free slot, or the least recently written one after a flush
+static int sd_stage_alloc(spiram_sdstage_obj_t *self, uint32_t segment) {
+    int n = -1;
+    for (uint32_t i = 0; i < self->n_slots; ++i) {
+        if (self->slot[i].segment == SD_STAGE_FREE) {
+            n = i;
+            break;
+        }
+        if (n < 0 || self->slot[i].seq < self->slot[n].seq) {
+            n = i;
+        }
+    }
+    if (self->slot[n].segment != SD_STAGE_FREE) {
+        int ret = sd_stage_flush_slot(self, n);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    self->slot[n].segment = segment;
+    self->used += 1;
+    return n;
+}
+
+static void sd_stage_arm(spiram_sdstage_obj_t *self, uint32_t delay_ms) {
+    soft_timer_insert(&self->timer, delay_ms);
+    self->timer_armed = true;
+}
+
+static int sd_stage_write(spiram_sdstage_obj_t *self, const uint8_t *src, uint32_t block, uint32_t n) {
+    uint32_t t0 = mp_hal_ticks_us();
+    self->busy = true;
+    self->writes += 1;
+    self->blocks += n;
+    int ret = 0;
+    while (n != 0) {
+        uint32_t segment = block / self->seg_blocks;
+        uint32_t off = block % self->seg_blocks;
+        uint32_t cnt = MIN(n, self->seg_blocks - off);
+        int slot = sd_stage_find(self, segment);
+        if (slot < 0) {
+            slot = sd_stage_alloc(self, segment);
+            if (slot < 0) {
+                ret = slot;
+                break;
+            }
+        }
+        sd_stage_slot_t *s = &self->slot[slot];
+        uint32_t *map = sd_stage_map(self, slot);
+        memcpy(sd_stage_data(self, slot) + off * SDCARD_BLOCK_SIZE, src, cnt * SDCARD_BLOCK_SIZE);
+        for (uint32_t i = off; i < off + cnt; ++i) {
+            if (!sd_stage_valid(map, i)) {
+                sd_stage_set_valid(map, i);
+                s->count += 1;
+            }
+        }
+        s->seq = ++self->seq;
+        block += cnt;
+        src += cnt * SDCARD_BLOCK_SIZE;
+        n -= cnt;
+    }
+    self->busy = false;
+    self->last_ms = mp_hal_ticks_ms();
+    if (self->idle_ms != 0 && self->used != 0 && !self->timer_armed) {
+        sd_stage_arm(self, self->idle_ms);
+    }
+    self->max_us = MAX(self->max_us, mp_hal_ticks_us() - t0);
+    return ret;
+}
+
+static int sd_stage_read(spiram_sdstage_obj_t *self, uint8_t *dest, uint32_t block, uint32_t n) {
+    while (n != 0) {
+        uint32_t segment = block / self->seg_blocks;
+        uint32_t off = block % self->seg_blocks;
+        uint32_t cnt = MIN(n, self->seg_blocks - off);
+        int slot = sd_stage_find(self, segment);
+        uint32_t staged = 0;
+        if (slot >= 0) {
+            uint32_t *map = sd_stage_map(self, slot);
+            for (uint32_t i = off; i < off + cnt; ++i) {
+                staged += sd_stage_valid(map, i);
+            }
+        }
+        // from the card, unless all staged; then staged blocks on top
+        if (staged < cnt && sdcard_read_blocks(dest, block, cnt) != 0) {
+            return -MP_EIO;
+        }
+        if (staged != 0) {
+            uint32_t *map = sd_stage_map(self, slot);
+            uint8_t *data = sd_stage_data(self, slot);
+            for (uint32_t i = off; i < off + cnt; ++i) {
+                if (sd_stage_valid(map, i)) {
+                    memcpy(dest + (i - off) * SDCARD_BLOCK_SIZE, data + i * SDCARD_BLOCK_SIZE, SDCARD_BLOCK_SIZE);
+                }
+            }
+        }
+        block += cnt;
+        dest += cnt * SDCARD_BLOCK_SIZE;
+        n -= cnt;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// scheduled by the soft timer
+STATIC mp_obj_t spiram_sdstage_idle(mp_obj_t self_in) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    self->timer_armed = false;
+    if (self->used == 0 || self->idle_ms == 0) {
+        return mp_const_none;
+    }
+    uint32_t idle = mp_hal_ticks_ms() - self->last_ms;
+    if (idle >= self->idle_ms && !self->busy) {
+        sd_stage_flush(self);
+    } else {
+        sd_stage_arm(self, idle < self->idle_ms ? self->idle_ms - idle : self->idle_ms);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_sdstage_idle_obj, spiram_sdstage_idle);
+
+// spiram.SDStage(buf, *, segment=128, idle_ms=500)
+// buf is the staging buffer, a few megabyte in spi ram. segment is in blocks of 512 bytes.
+// idle_ms 0: no idle flush.
+
+STATIC mp_obj_t spiram_sdstage_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_segment, ARG_idle_ms };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_segment, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 128} },
+        { MP_QSTR_idle_ms, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 500} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    mp_int_t seg_blocks = args[ARG_segment].u_int;
+    if (seg_blocks <= 0 || seg_blocks > SD_STAGE_SEGMENT_MAX || (seg_blocks & (seg_blocks - 1)) != 0 || args[ARG_idle_ms].u_int < 0) {
+        mp_raise_ValueError(NULL);
+    }
+    // slots on a cache line, for the idma and cache maintenance
+    uint32_t start = ((uint32_t)bufinfo.buf + 31) & ~31;
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    uint32_t n_slots = end > start ? (end - start) / (seg_blocks * SDCARD_BLOCK_SIZE) : 0;
+    if (n_slots < 2) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+
+    spiram_sdstage_obj_t *self = m_new_obj_with_finaliser(spiram_sdstage_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->timer.pairheap.base.type = type;
+    self->timer.flags = SOFT_TIMER_FLAG_PY_CALLBACK | SOFT_TIMER_FLAG_GC_ALLOCATED;
+    self->timer.mode = SOFT_TIMER_MODE_ONE_SHOT;
+    self->timer.py_callback = MP_OBJ_FROM_PTR(&spiram_sdstage_idle_obj);
+    self->buf = args[ARG_buf].u_obj;
+    self->data = (uint8_t *)start;
+    self->n_slots = n_slots;
+    self->seg_blocks = seg_blocks;
+    self->map_words = (seg_blocks + 31) / 32;
+    self->idle_ms = args[ARG_idle_ms].u_int;
+    self->slot = m_new(sd_stage_slot_t, n_slots);
+    self->map = m_new0(uint32_t, n_slots * self->map_words);
+    for (uint32_t i = 0; i < n_slots; ++i) {
+        self->slot[i].segment = SD_STAGE_FREE;
+        self->slot[i].seq = 0;
+        self->slot[i].count = 0;
+    }
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_sdstage_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "SDStage(slots=%u, segment=%u, used=%u)", self->n_slots, self->seg_blocks, self->used);
+}
+
+// block device protocol. Return None, or a negative errno for the filesystem.
+
+STATIC mp_obj_t spiram_sdstage_readblocks(mp_obj_t self_in, mp_obj_t block_num, mp_obj_t buf) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buf, &bufinfo, MP_BUFFER_WRITE);
+    int ret = sd_stage_read(self, bufinfo.buf, mp_obj_get_int(block_num), bufinfo.len / SDCARD_BLOCK_SIZE);
+    return ret == 0 ? mp_const_none : MP_OBJ_NEW_SMALL_INT(ret);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_sdstage_readblocks_obj, spiram_sdstage_readblocks);
+
+STATIC mp_obj_t spiram_sdstage_writeblocks(mp_obj_t self_in, mp_obj_t block_num, mp_obj_t buf) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buf, &bufinfo, MP_BUFFER_READ);
+    int ret = sd_stage_write(self, bufinfo.buf, mp_obj_get_int(block_num), bufinfo.len / SDCARD_BLOCK_SIZE);
+    return ret == 0 ? mp_const_none : MP_OBJ_NEW_SMALL_INT(ret);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_sdstage_writeblocks_obj, spiram_sdstage_writeblocks);
+
+STATIC mp_obj_t spiram_sdstage_ioctl(mp_obj_t self_in, mp_obj_t cmd_in, mp_obj_t arg_in) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    switch (mp_obj_get_int(cmd_in)) {
+        case MP_BLOCKDEV_IOCTL_INIT:
+            return MP_OBJ_NEW_SMALL_INT(sdcard_power_on() ? 0 : -MP_EIO);
+        case MP_BLOCKDEV_IOCTL_DEINIT: {
+            int ret = sd_stage_flush(self);
+            if (ret == 0) {
+                sdcard_power_off();
+            }
+            return MP_OBJ_NEW_SMALL_INT(ret);
+        }
+        case MP_BLOCKDEV_IOCTL_SYNC:
+            return MP_OBJ_NEW_SMALL_INT(sd_stage_flush(self));
+        case MP_BLOCKDEV_IOCTL_BLOCK_COUNT:
+            return MP_OBJ_NEW_SMALL_INT(sdcard_get_capacity_in_bytes() / SDCARD_BLOCK_SIZE);
+        case MP_BLOCKDEV_IOCTL_BLOCK_SIZE:
+            return MP_OBJ_NEW_SMALL_INT(SDCARD_BLOCK_SIZE);
+        default:
+            return mp_const_none;
+    }
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_sdstage_ioctl_obj, spiram_sdstage_ioctl);
+
+// stage.flush()
+// writes all staged blocks to the card.
+
+STATIC mp_obj_t spiram_sdstage_flush(mp_obj_t self_in) {
+    int ret = sd_stage_flush(MP_OBJ_TO_PTR(self_in));
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_sdstage_flush_obj, spiram_sdstage_flush);
+
+// stage.stats()
+// returns (writeblocks calls, blocks written, card writes, blocks written to card,
+// errors, longest writeblocks in us, blocks staged)
+
+STATIC mp_obj_t spiram_sdstage_stats(mp_obj_t self_in) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    uint32_t staged = 0;
+    for (uint32_t i = 0; i < self->n_slots; ++i) {
+        staged += self->slot[i].count;
+    }
+    mp_obj_t t[7] = {
+        mp_obj_new_int_from_uint(self->writes),
+        mp_obj_new_int_from_uint(self->blocks),
+        mp_obj_new_int_from_uint(self->card_writes),
+        mp_obj_new_int_from_uint(self->card_blocks),
+        mp_obj_new_int_from_uint(self->errors),
+        mp_obj_new_int_from_uint(self->max_us),
+        mp_obj_new_int_from_uint(staged),
+    };
+    self->max_us = 0;
+    return mp_obj_new_tuple(7, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_sdstage_stats_obj, spiram_sdstage_stats);
+
+// flush, and take the timer off the soft timer heap before the object is freed
+STATIC mp_obj_t spiram_sdstage_deinit(mp_obj_t self_in) {
+    spiram_sdstage_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->timer_armed) {
+        soft_timer_remove(&self->timer);
+        self->timer_armed = false;
+    }
+    sd_stage_flush(self);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_sdstage_deinit_obj, spiram_sdstage_deinit);
+
+STATIC const mp_rom_map_elem_t spiram_sdstage_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_readblocks), MP_ROM_PTR(&spiram_sdstage_readblocks_obj) },
+    { MP_ROM_QSTR(MP_QSTR_writeblocks), MP_ROM_PTR(&spiram_sdstage_writeblocks_obj) },
+    { MP_ROM_QSTR(MP_QSTR_ioctl), MP_ROM_PTR(&spiram_sdstage_ioctl_obj) },
+    { MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&spiram_sdstage_flush_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_sdstage_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&spiram_sdstage_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_sdstage_deinit_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_sdstage_locals_dict, spiram_sdstage_locals_dict_table);
+
+const mp_obj_type_t spiram_sdstage_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_SDStage,
+    .print = spiram_sdstage_print,
+    .make_new = spiram_sdstage_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_sdstage_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_SDCARD
+
+// not truncated
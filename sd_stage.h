@@ -0,0 +1,12 @@
+/*
+ * write-behind staging in spi ram for the sd card
+ */
+#ifndef __SD_STAGE_H__
+#define __SD_STAGE_H__
+#include "py/obj.h"
+
+// largest segment, in 512 byte blocks
+#define SD_STAGE_SEGMENT_MAX (2048)
+
+extern const mp_obj_type_t spiram_sdstage_type;
+#endif // __SD_STAGE_H__
@@ -22,6 +22,8 @@
 #include "mpu.h"
 #include "pin.h"
 #include "pin_static_af.h"
+#include "mdma.h"
+#include "spiram_config.h"
 #include "spiram.h"
 
 #include <stm32h7xx_hal_rcc.h>
@@ -30,23 +32,11 @@
 extern void __fatal_error(const char *msg);
 #define mp_raise_RuntimeError(msg) (mp_raise_msg(&mp_type_RuntimeError, MP_ROM_QSTR(msg)))
 
-// SPI commands, from ESP-PSRAM64H and APS6404L-3SQR-SN datasheet
-#define SRAM_CMD_READ           0x03
-#define SRAM_CMD_FAST_READ      0x0b
-#define SRAM_CMD_QUAD_READ      0xeb
-#define SRAM_CMD_WRITE          0x02
-#define SRAM_CMD_QUAD_WRITE     0x38
-#define SRAM_CMD_QUAD_ON        0x35
-#define SRAM_CMD_QUAD_OFF       0xf5
-#define SRAM_CMD_RST_EN         0x66
-#define SRAM_CMD_RST            0x99
-#define SRAM_CMD_BURST_LEN      0xc0
-#define SRAM_CMD_READ_ID        0x9f
-
 #ifdef MICROPY_HW_SPIRAM_SIZE_BITS_LOG2
 
-#define OSPI_MAP_ADDR OCTOSPI1_BASE
-#define MICROPY_HW_SPIRAM_SIZE (0x800000)
+// the driver runs octospi1, so the map address is the octospi1 window
+_Static_assert(SPIRAM_MAP_ADDR == OCTOSPI1_BASE, "spiram is on octospi1");
+_Static_assert(SPIRAM_MPU_SIZE == MPU_REGION_SIZE_8MB + (SPIRAM_SIZE_LOG2 - 23), "mpu region size encoding");
 
 #if defined(MICROPY_HW_SPIRAM_STARTUP_TEST)
 
@@ -54,7 +44,7 @@ extern void __fatal_error(const char *msg);
 // spiram_test() tests memory before uart or usb is initialized.
 // spiram_dmesg() prints memory test results later, when uart or usb console is initialized.
 
-enum spiram_err_enum {SPIRAM_ERR_OK, SPIRAM_ERR_MEMTEST_PASS, SPIRAM_ERR_MEMTEST8, SPIRAM_ERR_MEMTEST16, SPIRAM_ERR_MEMTEST32, SPIRAM_ERR_OSPI_INIT, SPIRAM_ERR_OSPI_WRITE_CONFIG,SPIRAM_ERR_OSPI_READ_CONFIG,SPIRAM_ERR_OSPI_MMAP,SPIRAM_ERR_READID_CMD,SPIRAM_ERR_READID_DTA, SPIRAM_ERR_QSPI_RST_EN,SPIRAM_ERR_QSPI_RST,SPIRAM_ERR_SPI_RSTEN,SPIRAM_ERR_SPI_RST,SPIRAM_ERR_QUAD_ON, SPIRAM_ERR_CLEAR};
+enum spiram_err_enum {SPIRAM_ERR_OK, SPIRAM_ERR_MEMTEST_PASS, SPIRAM_ERR_MEMTEST8, SPIRAM_ERR_MEMTEST16, SPIRAM_ERR_MEMTEST32, SPIRAM_ERR_OSPI_INIT, SPIRAM_ERR_OSPI_WRITE_CONFIG,SPIRAM_ERR_OSPI_READ_CONFIG,SPIRAM_ERR_OSPI_MMAP,SPIRAM_ERR_READID_CMD,SPIRAM_ERR_READID_DTA, SPIRAM_ERR_QSPI_RST_EN,SPIRAM_ERR_QSPI_RST,SPIRAM_ERR_SPI_RSTEN,SPIRAM_ERR_SPI_RST,SPIRAM_ERR_QUAD_ON, SPIRAM_ERR_CLEAR, SPIRAM_ERR_MEMTEST_BURST, SPIRAM_ERR_MEMTEST_DMA};
 static enum spiram_err_enum spiram_err = SPIRAM_ERR_OK;
 static uint8_t spiram_id[8] = {0};
 static const uint8_t spiram_pattern8 = 0xA5;
@@ -64,6 +54,8 @@ static uint32_t spiram_bad_addr = -1;
 static uint8_t spiram_bad_pattern8 = -1;
 static uint16_t spiram_bad_pattern16 = -1;
 static uint32_t spiram_bad_pattern32 = -1;
+static spiram_pass_t spiram_passes[SPIRAM_TEST_PASSES_MAX];
+static size_t spiram_n_passes = 0;
 
 static inline void spiram_error(enum spiram_err_enum errno) {
     if (spiram_err == SPIRAM_ERR_OK) {
@@ -73,6 +65,7 @@ static inline void spiram_error(enum spiram_err_enum errno) {
 #endif
 
 OSPI_HandleTypeDef hospi1;
+static uint32_t spiram_ospi_errors;     // failed octospi commands
 
 // -----------------------------------------------------------------------------
 // Configure MPU. Two options: use HAL, or use micropython primitives.
@@ -89,8 +82,8 @@ static inline void ospi_mpu_enable_mapped(void) {
 
     MPU_InitStruct.Enable = MPU_REGION_ENABLE;
     MPU_InitStruct.Number = MPU_REGION_NUMBER0;
-    MPU_InitStruct.BaseAddress = 0x90000000;
-    MPU_InitStruct.Size = MPU_REGION_SIZE_8MB;
+    MPU_InitStruct.BaseAddress = SPIRAM_MAP_ADDR;
+    MPU_InitStruct.Size = SPIRAM_MPU_SIZE;
     MPU_InitStruct.SubRegionDisable = 0x0;
     MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL1;
     MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
@@ -109,17 +102,16 @@ static inline void ospi_mpu_disable_all(void) {
     // Configure MPU to disable access to entire OSPI region, to prevent CPU
     // speculative execution from accessing this region and modifying QSPI registers.
     uint32_t irq_state = mpu_config_start();
-    mpu_config_region(MPU_REGION_QSPI1, OSPI_MAP_ADDR, MPU_CONFIG_DISABLE(0x00, MPU_REGION_SIZE_256MB));
+    mpu_config_region(MPU_REGION_QSPI1, SPIRAM_MAP_ADDR, MPU_CONFIG_DISABLE(0x00, MPU_REGION_SIZE_256MB));
     mpu_config_end(irq_state);
 }
 
 static inline void ospi_mpu_enable_mapped(void) {
     // Configure MPU to allow access to the valid part of external SPI RAM only.
-    // At the moment this is hard-coded to 8 Mbyte of OSPI address space.
 
     uint32_t irq_state = mpu_config_start();
-    mpu_config_region(MPU_REGION_QSPI1, OSPI_MAP_ADDR, MPU_CONFIG_DISABLE(0x00, MPU_REGION_SIZE_256MB));
-    mpu_config_region(MPU_REGION_QSPI2, OSPI_MAP_ADDR, MPU_CONFIG_SDRAM(MPU_REGION_SIZE_8MB));
+    mpu_config_region(MPU_REGION_QSPI1, SPIRAM_MAP_ADDR, MPU_CONFIG_DISABLE(0x00, MPU_REGION_SIZE_256MB));
+    mpu_config_region(MPU_REGION_QSPI2, SPIRAM_MAP_ADDR, MPU_CONFIG_SDRAM(SPIRAM_MPU_SIZE));
     mpu_config_end(irq_state);
 }
 #endif
@@ -158,14 +150,14 @@ void ospi_init(void) {
     hospi1.Init.FifoThreshold = 1;
     hospi1.Init.DualQuad = HAL_OSPI_DUALQUAD_DISABLE;
     hospi1.Init.MemoryType = HAL_OSPI_MEMTYPE_APMEMORY; // sdr qspi
-    hospi1.Init.DeviceSize = 23;          // 8 Mbyte, 2**23 MBits
+    hospi1.Init.DeviceSize = SPIRAM_SIZE_LOG2; // 2**n bytes
     hospi1.Init.ChipSelectHighTime = 1;
     hospi1.Init.FreeRunningClock = HAL_OSPI_FREERUNCLK_DISABLE;
     hospi1.Init.ClockMode = HAL_OSPI_CLOCK_MODE_0;
-    hospi1.Init.ClockPrescaler = 0x02; // set clock frequency
+    hospi1.Init.ClockPrescaler = SPIRAM_OSPI_PRESCALER; // SPIRAM_CLK_HZ
     hospi1.Init.SampleShifting = HAL_OSPI_SAMPLE_SHIFTING_HALFCYCLE;
     hospi1.Init.DelayHoldQuarterCycle = HAL_OSPI_DHQC_DISABLE;
-    hospi1.Init.ChipSelectBoundary = 10; // 1 kbyte page size
+    hospi1.Init.ChipSelectBoundary = SPIRAM_PAGE_LOG2; // no burst across a page
     hospi1.Init.DelayBlockBypass = HAL_OSPI_DELAY_BLOCK_BYPASSED;
     hospi1.Init.MaxTran = 0;
     hospi1.Init.Refresh = 0;
@@ -200,7 +192,7 @@ void ospi_mmap() {
     sCommand.Instruction = SRAM_CMD_QUAD_WRITE;
     sCommand.Address = 0;
     sCommand.NbData = 0;
-    sCommand.DummyCycles = 0;
+    sCommand.DummyCycles = SPIRAM_QUAD_WRITE_DUMMY;
 
     if (HAL_OSPI_Command(&hospi1, &sCommand, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         spiram_error(SPIRAM_ERR_OSPI_WRITE_CONFIG);
@@ -211,7 +203,7 @@ void ospi_mmap() {
     sCommand.DQSMode = HAL_OSPI_DQS_DISABLE;
     sCommand.OperationType = HAL_OSPI_OPTYPE_READ_CFG;
     sCommand.Instruction = SRAM_CMD_QUAD_READ;
-    sCommand.DummyCycles = 6;
+    sCommand.DummyCycles = SPIRAM_QUAD_READ_DUMMY;
 
     if (HAL_OSPI_Command(&hospi1, &sCommand, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         spiram_error(SPIRAM_ERR_OSPI_READ_CONFIG);
@@ -225,12 +217,33 @@ void ospi_mmap() {
 
     if (HAL_OSPI_MemoryMapped(&hospi1, &sMemMappedCfg) != HAL_OK) {
         spiram_error(SPIRAM_ERR_OSPI_MMAP);
+        ++spiram_ospi_errors;
     }
 
     /* set up mpu access */
     ospi_mpu_enable_mapped();
 }
 
+/* indirect commands need memory-mapped mode off. Spi ram is then not mapped: the mpu
+   stops the cpu, also speculative reads; the caller keeps interrupts and dma away. */
+
+void spiram_suspend(void) {
+    ospi_mpu_disable_all();
+    HAL_OSPI_Abort(&hospi1);
+}
+
+void spiram_resume(void) {
+    ospi_mmap();
+}
+
+void spiram_ospi_error(void) {
+    ++spiram_ospi_errors;
+}
+
+uint32_t spiram_ospi_error_count(void) {
+    return spiram_ospi_errors;
+}
+
 // -----------------------------------------------------------------------------
 
 /* spiram read id */
@@ -338,6 +351,7 @@ void spiram_quad_on() {
 
 /* Initialize spi ram to zero. Use after spi ram in qspi mode and before memory mapping. */
 
+#if !MICROPY_HW_SPIRAM_HEAP_GROW
 static void spiram_clear() {
     // const uint32_t src[256] = {0};
     const uint32_t src[8] = {0xDEADBEEF, 0xDEADBEEF,0xDEADBEEF,0xDEADBEEF,0xDEADBEEF,0xDEADBEEF,0xDEADBEEF,0xDEADBEEF};
@@ -359,9 +373,9 @@ static void spiram_clear() {
     sCommand.Instruction = SRAM_CMD_QUAD_WRITE;
     sCommand.Address = 0;
     sCommand.NbData = sizeof(src);
-    sCommand.DummyCycles = 0;
+    sCommand.DummyCycles = SPIRAM_QUAD_WRITE_DUMMY;
 
-    for (uint32_t addr = 0; addr < MICROPY_HW_SPIRAM_SIZE; addr += sizeof(src)) {
+    for (uint32_t addr = 0; addr < SPIRAM_SIZE; addr += sizeof(src)) {
         sCommand.Address = addr;
 
         if (HAL_OSPI_Command(&hospi1, &sCommand, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
@@ -374,6 +388,7 @@ static void spiram_clear() {
     }
 
 }
+#endif
 
 // -----------------------------------------------------------------------------
 // spiram read and write commands. Use in qspi mode, when not memory-mapped.
@@ -399,7 +414,7 @@ void spiram_read(uint32_t addr, size_t len, uint8_t *dest) {
     sCommand.Instruction = SRAM_CMD_QUAD_READ;
     sCommand.Address = addr;
     sCommand.NbData = len;
-    sCommand.DummyCycles = 6;
+    sCommand.DummyCycles = SPIRAM_QUAD_READ_DUMMY;
 
     if (HAL_OSPI_Command(&hospi1, &sCommand, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         mp_raise_RuntimeError("HAL_OSPI_Command");
@@ -431,7 +446,7 @@ void spiram_write(uint32_t addr, size_t len, const uint8_t *src) {
     sCommand.Instruction = SRAM_CMD_QUAD_WRITE;
     sCommand.Address = addr;
     sCommand.NbData = len;
-    sCommand.DummyCycles = 0;
+    sCommand.DummyCycles = SPIRAM_QUAD_WRITE_DUMMY;
 
     if (HAL_OSPI_Command(&hospi1, &sCommand, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         mp_raise_RuntimeError("HAL_OSPI_Command");
@@ -448,22 +463,19 @@ void spiram_write(uint32_t addr, size_t len, const uint8_t *src) {
 bool spiram_init(void) {
     ospi_init();
     spiram_quad_on();
+    #if MICROPY_HW_SPIRAM_HEAP_GROW
+    // spiram_heap_boot() tests and clears the start, the rest is tested when the heap grows
+    ospi_mmap();
+    #else
     spiram_clear(); // not necessary, but play it safe
     ospi_mmap();
     #if defined(MICROPY_HW_SPIRAM_STARTUP_TEST)
-    spiram_test(false);
+    spiram_test(true);
+    #endif
     #endif
     return true;
 }
 
-void *spiram_start(void) {
-    return (void *)OSPI_MAP_ADDR;
-}
-
-void *spiram_end(void) {
-    return (void *)(OSPI_MAP_ADDR + MICROPY_HW_SPIRAM_SIZE);
-}
-
 // -----------------------------------------------------------------------------
 
 /* spi ram tests. Write 8, 16, and 32 bit data to ram.
@@ -472,11 +484,11 @@ void *spiram_end(void) {
  */
 
 static void spiram_memtest8() {
-    uint8_t *const mem_base = (uint8_t *)OSPI_MAP_ADDR;
+    uint8_t *const mem_base = (uint8_t *)SPIRAM_MAP_ADDR;
     uint8_t mem_read8;
 
     /* write pattern to ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE; ++i) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE; ++i) {
         mem_base[i] = spiram_pattern8;
     }
 
@@ -484,11 +496,11 @@ static void spiram_memtest8() {
       the data cache no longer contains the contents of the first address. */
 
     /* read ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE; ++i) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE; ++i) {
         mem_read8 = mem_base[i];
         if (mem_read8 != spiram_pattern8) {
             spiram_error(SPIRAM_ERR_MEMTEST8);
-            spiram_bad_addr = OSPI_MAP_ADDR + i;
+            spiram_bad_addr = SPIRAM_MAP_ADDR + i;
             spiram_bad_pattern8 = mem_read8;
             return;
         }
@@ -496,20 +508,20 @@ static void spiram_memtest8() {
 }
 
 static void spiram_memtest16() {
-    uint16_t *const mem_base = (uint16_t *)OSPI_MAP_ADDR;
+    uint16_t *const mem_base = (uint16_t *)SPIRAM_MAP_ADDR;
     uint16_t mem_read16;
 
     /* write pattern to ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE / 2; i++) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE / 2; i++) {
         mem_base[i] = spiram_pattern16;
     }
 
     /* read ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE / 2; i++) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE / 2; i++) {
         mem_read16 = mem_base[i];
         if (mem_read16 != spiram_pattern16) {
             spiram_error(SPIRAM_ERR_MEMTEST16);
-            spiram_bad_addr = OSPI_MAP_ADDR + 2 * i;
+            spiram_bad_addr = SPIRAM_MAP_ADDR + 2 * i;
             spiram_bad_pattern16 = mem_read16;
             return;
         }
@@ -517,34 +529,226 @@ static void spiram_memtest16() {
 }
 
 static void spiram_memtest32() {
-    uint32_t *const mem_base = (uint32_t *)OSPI_MAP_ADDR;
+    uint32_t *const mem_base = (uint32_t *)SPIRAM_MAP_ADDR;
     uint32_t mem_read32;
 
     /* write pattern to ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE / 4; i++) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE / 4; i++) {
         mem_base[i] = spiram_pattern32;
     }
 
     /* read ram */
-    for (uint32_t i = 0; i < MICROPY_HW_SPIRAM_SIZE / 4; i++) {
+    for (uint32_t i = 0; i < SPIRAM_SIZE / 4; i++) {
         mem_read32 = mem_base[i];
         if (mem_read32 != spiram_pattern32) {
             spiram_error(SPIRAM_ERR_MEMTEST32);
-            spiram_bad_addr = OSPI_MAP_ADDR + 4 * i;
+            spiram_bad_addr = SPIRAM_MAP_ADDR + 4 * i;
             spiram_bad_pattern32 = mem_read32;
             return;
         }
     }
 }
 
-bool spiram_test(bool fast) {
-    spiram_memtest32();
-    spiram_memtest16();
-    spiram_memtest8();
+/* burst tests. The cpu writes and compares a cache line per ldm/stm of eight registers,
+   the mdma replicates the first block over the rest of the ram with 64 byte bursts.
+   Each pass is timed with the cycle counter. The data cache is cleaned and invalidated
+   between write and compare, so the compare reads the ram. */
+
+#define SPIRAM_DMA_BLOCK (32 * 1024)
+
+static uint32_t spiram_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+static void spiram_pass_done(const char *name, uint32_t bytes, uint32_t cycles) {
+    if (spiram_n_passes < SPIRAM_TEST_PASSES_MAX) {
+        spiram_pass_t *pass = &spiram_passes[spiram_n_passes++];
+        pass->name = name;
+        pass->bytes = bytes;
+        pass->us = cycles / (SystemCoreClock / 1000000);
+    }
+}
+
+static void spiram_fill_burst(uint32_t *p, uint32_t *end, uint32_t pattern) {
+    __asm volatile (
+        "mov r4, %[v]\n"
+        "mov r5, %[v]\n"
+        "mov r6, %[v]\n"
+        "mov r8, %[v]\n"
+        "mov r9, %[v]\n"
+        "mov r10, %[v]\n"
+        "mov r11, %[v]\n"
+        "mov r12, %[v]\n"
+        "1: stmia %[p]!, {r4, r5, r6, r8, r9, r10, r11, r12}\n"
+        "cmp %[p], %[e]\n"
+        "blo 1b\n"
+        : [p] "+r" (p)
+        : [e] "r" (end), [v] "r" (pattern)
+        : "r4", "r5", "r6", "r8", "r9", "r10", "r11", "r12", "cc", "memory");
+}
+
+// returns end, or the address just past the first cache line that does not match
+static uint32_t *spiram_check_burst(uint32_t *p, uint32_t *end, uint32_t pattern) {
+    __asm volatile (
+        "1: ldmia %[p]!, {r4, r5, r6, r8, r9, r10, r11, r12}\n"
+        "eor r4, r4, %[v]\n"
+        "eor r5, r5, %[v]\n"
+        "eor r6, r6, %[v]\n"
+        "eor r8, r8, %[v]\n"
+        "eor r9, r9, %[v]\n"
+        "eor r10, r10, %[v]\n"
+        "eor r11, r11, %[v]\n"
+        "eor r12, r12, %[v]\n"
+        "orr r4, r4, r5\n"
+        "orr r6, r6, r8\n"
+        "orr r9, r9, r10\n"
+        "orr r11, r11, r12\n"
+        "orr r4, r4, r6\n"
+        "orr r9, r9, r11\n"
+        "orrs r4, r4, r9\n"
+        "bne 2f\n"
+        "cmp %[p], %[e]\n"
+        "blo 1b\n"
+        "2:\n"
+        : [p] "+r" (p)
+        : [e] "r" (end), [v] "r" (pattern)
+        : "r4", "r5", "r6", "r8", "r9", "r10", "r11", "r12", "cc", "memory");
+    return p;
+}
+
+static bool spiram_memtest_check(const char *name, uint32_t *mem_base, uint32_t *mem_end, uint32_t pattern, enum spiram_err_enum err) {
+    SCB_CleanInvalidateDCache();
+    uint32_t t = spiram_cycles();
+    uint32_t *p = spiram_check_burst(mem_base, mem_end, pattern);
+    spiram_pass_done(name, (mem_end - mem_base) * sizeof(uint32_t), spiram_cycles() - t);
+    // the compare stops after the first bad cache line; find the word
+    for (uint32_t *q = p - 8; q < p; ++q) {
+        if (*q != pattern) {
+            spiram_error(err);
+            spiram_bad_addr = (uint32_t)q;
+            spiram_bad_pattern32 = *q;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool spiram_memtest_burst(uint32_t *mem_base, uint32_t *mem_end, uint32_t pattern) {
+    uint32_t t = spiram_cycles();
+    spiram_fill_burst(mem_base, mem_end, pattern);
+    SCB_CleanDCache();
+    spiram_pass_done("stm write", (mem_end - mem_base) * sizeof(uint32_t), spiram_cycles() - t);
+    return spiram_memtest_check("ldm read", mem_base, mem_end, pattern, SPIRAM_ERR_MEMTEST_BURST);
+}
+
+static volatile uint32_t spiram_dma_cisr;
+
+static void spiram_dma_done(uint32_t channel, uint32_t cisr, void *arg) {
+    spiram_dma_cisr = cisr;
+}
+
+// the cpu writes the first block, the mdma copies it over the rest
+static bool spiram_memtest_dma(uint32_t pattern) {
+    uint8_t *const mem_base = (uint8_t *)SPIRAM_MAP_ADDR;
+    mdma_node_t node;
+    mdma_init();
+    mdma_set_callback(MDMA_CHANNEL_MEMTEST, spiram_dma_done, NULL);
+    spiram_fill_burst((uint32_t *)mem_base, (uint32_t *)(mem_base + SPIRAM_DMA_BLOCK), pattern);
+    SCB_CleanInvalidateDCache();
+
+    // one block of the size of the source, repeated; the source address goes back each block
+    mdma_node_memcpy(&node, mem_base + SPIRAM_DMA_BLOCK, mem_base, SPIRAM_DMA_BLOCK);
+    node.CBNDTR = SPIRAM_DMA_BLOCK << MDMA_CBNDTR_BNDT_Pos | MDMA_CBNDTR_BRSUM
+        | (SPIRAM_SIZE / SPIRAM_DMA_BLOCK - 2) << MDMA_CBNDTR_BRC_Pos;
+    node.CBRUR = SPIRAM_DMA_BLOCK << MDMA_CBRUR_SUV_Pos;
+    spiram_dma_cisr = 0;
+    uint32_t t = spiram_cycles();
+    mdma_start(MDMA_CHANNEL_MEMTEST, &node, 3);
+    while (mdma_busy(MDMA_CHANNEL_MEMTEST) && spiram_dma_cisr == 0) {
+    }
+    spiram_pass_done("mdma write", SPIRAM_SIZE - SPIRAM_DMA_BLOCK, spiram_cycles() - t);
+    mdma_set_callback(MDMA_CHANNEL_MEMTEST, NULL, NULL);
+    if (spiram_dma_cisr & MDMA_CISR_TEIF) {
+        spiram_error(SPIRAM_ERR_MEMTEST_DMA);
+        return false;
+    }
+    return spiram_memtest_check("ldm read", (uint32_t *)SPIRAM_MAP_ADDR, (uint32_t *)SPIRAM_MAP_END, pattern, SPIRAM_ERR_MEMTEST_DMA);
+}
+
+_Static_assert(SPIRAM_SIZE / SPIRAM_DMA_BLOCK - 1 <= 4096, "too many mdma block repeats");
+
+// the cycle counter is not reset: the heap grows at run time, while membench,
+// spiram_seq or a profiler may be timing with it. Passes take differences.
+static void spiram_test_start(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    spiram_n_passes = 0;
+}
+
+// sum of the passes; the cycle counter wraps after a few seconds
+static bool spiram_test_done(void) {
+    uint32_t total_us = 0;
+    for (size_t i = 0; i < spiram_n_passes; ++i) {
+        total_us += spiram_passes[i].us;
+    }
+    if (spiram_n_passes < SPIRAM_TEST_PASSES_MAX) {
+        spiram_passes[spiram_n_passes++] = (spiram_pass_t) {"total", 0, total_us};
+    }
     spiram_error(SPIRAM_ERR_MEMTEST_PASS);
     return spiram_err == SPIRAM_ERR_MEMTEST_PASS;
 }
 
+/* fast: burst passes only, a fraction of a second for 8 Mbyte.
+   else also the 8, 16 and 32 bit single access tests, for the byte lanes. */
+
+bool spiram_test(bool fast) {
+    spiram_test_start();
+
+    uint32_t t;
+    if (!fast) {
+        t = spiram_cycles();
+        spiram_memtest32();
+        spiram_pass_done("32 bit", 2 * SPIRAM_SIZE, spiram_cycles() - t);
+        t = spiram_cycles();
+        spiram_memtest16();
+        spiram_pass_done("16 bit", 2 * SPIRAM_SIZE, spiram_cycles() - t);
+        t = spiram_cycles();
+        spiram_memtest8();
+        spiram_pass_done("8 bit", 2 * SPIRAM_SIZE, spiram_cycles() - t);
+    }
+    uint32_t *const mem_base = (uint32_t *)SPIRAM_MAP_ADDR;
+    uint32_t *const mem_end = (uint32_t *)SPIRAM_MAP_END;
+    if (spiram_memtest_burst(mem_base, mem_end, 0xA5A5A5A5) && spiram_memtest_burst(mem_base, mem_end, 0x5A5A5A5A)) {
+        // ends with the ram cleared
+        spiram_memtest_dma(0x00000000);
+    }
+    return spiram_test_done();
+}
+
+/* test part of spi ram that nothing uses yet, e.g. before it goes to the heap.
+   Burst passes by the cpu only; ends with the part cleared. A failed test
+   stays failed: later calls return false without testing. */
+
+bool spiram_test_range(size_t offset, size_t len) {
+    if (spiram_err != SPIRAM_ERR_OK && spiram_err != SPIRAM_ERR_MEMTEST_PASS) {
+        return false;
+    }
+    spiram_err = SPIRAM_ERR_OK;
+    spiram_test_start();
+    uint32_t *const mem_base = (uint32_t *)(SPIRAM_MAP_ADDR + offset);
+    uint32_t *const mem_end = (uint32_t *)(SPIRAM_MAP_ADDR + offset + len);
+    if (spiram_memtest_burst(mem_base, mem_end, 0xA5A5A5A5) && spiram_memtest_burst(mem_base, mem_end, 0x5A5A5A5A)) {
+        spiram_memtest_burst(mem_base, mem_end, 0x00000000);
+    }
+    return spiram_test_done();
+}
+
+size_t spiram_test_passes(const spiram_pass_t **passes) {
+    *passes = spiram_passes;
+    return spiram_n_passes;
+}
+
 void spiram_dmesg() {
     mp_printf(MICROPY_ERROR_PRINTER, "spiram eid");
     for (int i = 0; i < sizeof(spiram_id); i++) {
@@ -603,10 +807,24 @@ void spiram_dmesg() {
         case SPIRAM_ERR_CLEAR:
             mp_printf(MICROPY_ERROR_PRINTER, "spiram clear fail\n");
             break;
+        case SPIRAM_ERR_MEMTEST_BURST:
+            mp_printf(MICROPY_ERROR_PRINTER, "spiram burst memtest fail, address 0x%08x read 0x%08x\n", spiram_bad_addr, spiram_bad_pattern32);
+            break;
+        case SPIRAM_ERR_MEMTEST_DMA:
+            mp_printf(MICROPY_ERROR_PRINTER, "spiram dma memtest fail, address 0x%08x read 0x%08x\n", spiram_bad_addr, spiram_bad_pattern32);
+            break;
         default:
             mp_printf(MICROPY_ERROR_PRINTER, "spiram fail, errcode 0x%x\n", spiram_err);
             break;
     }
+    for (size_t i = 0; i < spiram_n_passes; i++) {
+        const spiram_pass_t *pass = &spiram_passes[i];
+        if (pass->bytes != 0 && pass->us != 0) {
+            mp_printf(MICROPY_ERROR_PRINTER, "spiram %s %u MB/s, %u us\n", pass->name, pass->bytes / pass->us, pass->us);
+        } else {
+            mp_printf(MICROPY_ERROR_PRINTER, "spiram %s %u us\n", pass->name, pass->us);
+        }
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -4,9 +4,35 @@
 #ifndef __SPIRAM_H__
 #define __SPIRAM_H__
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "spiram_config.h"
 bool spiram_init(void);       // memory-map spiram
-void *spiram_start(void);     // lowest spiram address
-void *spiram_end(void);       // highest spiram address+1
+#if defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+static inline void *spiram_start(void) {  // lowest spiram address
+    return (void *)SPIRAM_MAP_ADDR;
+}
+static inline void *spiram_end(void) {    // highest spiram address+1
+    return (void *)SPIRAM_MAP_END;
+}
+#endif
+// leave and re-enter memory-mapped mode, for indirect commands. In between nothing may
+// access spi ram: irq disabled, data cache cleaned, no dma on spi ram.
+void spiram_suspend(void);
+void spiram_resume(void);
+// failed octospi commands after boot: memory-mapped mode, and indirect commands that count them
+void spiram_ospi_error(void);
+uint32_t spiram_ospi_error_count(void);
 bool spiram_test(bool fast);  // run memtest
+bool spiram_test_range(size_t offset, size_t len);  // memtest part of spiram, multiples of 32 bytes
 void spiram_dmesg();          // print memtest result on console
+
+// memtest passes, with bandwidth
+#define SPIRAM_TEST_PASSES_MAX (12)
+typedef struct _spiram_pass_t {
+    const char *name;
+    uint32_t bytes;           // bytes read or written
+    uint32_t us;              // time
+} spiram_pass_t;
+size_t spiram_test_passes(const spiram_pass_t **passes);
 #endif // __SPIRAM_H__
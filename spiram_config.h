@@ -0,0 +1,109 @@
+/*
+ * spi ram board descriptor, and everything derived from it at compile time
+ */
+#ifndef __SPIRAM_CONFIG_H__
+#define __SPIRAM_CONFIG_H__
+#include "py/mpconfig.h"
+
+/* the board sets, in mpconfigboard.h:
+ *   MICROPY_HW_SPIRAM_CHIP            chip type, below
+ *   MICROPY_HW_SPIRAM_SIZE_BITS_LOG2  size in bits, log2; also enables the driver
+ *   MICROPY_HW_SPIRAM_MAP_ADDR        memory-mapped address, octospi1
+ *   MICROPY_HW_SPIRAM_KERNEL_HZ       octospi kernel clock
+ *   MICROPY_HW_SPIRAM_CLK_HZ          highest spi ram clock wanted
+ *   MICROPY_HW_SPIRAM_CS, _SCK, _IO0 .. _IO3  pins
+ *   MICROPY_HW_SPIRAM_HEAP_GROW       heap in spi ram, tested and grown after boot
+ *   MICROPY_HW_SPIRAM_HEAP_BOOT       bytes tested at boot, for the gc tables and the first heap
+ *   MICROPY_HW_SPIRAM_HEAP_STEP       bytes tested per step when the heap grows
+ * defaults are the DEVEBOX STM32H7A3 with esp-psram64h.
+ * The driver, the mpu setup, the memtest and the other spiram modules
+ * only use the SPIRAM_ values below.
+ */
+
+// chip types
+#define SPIRAM_CHIP_ESP_PSRAM64H (1)
+#define SPIRAM_CHIP_APS6404L (2)
+
+#ifndef MICROPY_HW_SPIRAM_CHIP
+#define MICROPY_HW_SPIRAM_CHIP (SPIRAM_CHIP_ESP_PSRAM64H)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_MAP_ADDR
+#define MICROPY_HW_SPIRAM_MAP_ADDR (0x90000000)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_KERNEL_HZ
+#define MICROPY_HW_SPIRAM_KERNEL_HZ (280000000)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_CLK_HZ
+#define MICROPY_HW_SPIRAM_CLK_HZ (140000000)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_HEAP_GROW
+#define MICROPY_HW_SPIRAM_HEAP_GROW (0)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_HEAP_BOOT
+#define MICROPY_HW_SPIRAM_HEAP_BOOT (1024 * 1024)
+#endif
+
+#ifndef MICROPY_HW_SPIRAM_HEAP_STEP
+#define MICROPY_HW_SPIRAM_HEAP_STEP (256 * 1024)
+#endif
+
+// chip properties, from the ESP-PSRAM64H and APS6404L-3SQR-SN datasheets.
+// Both are the same die: 64 Mbit, 1 kbyte wrap page, 144 MHz within a page.
+#if MICROPY_HW_SPIRAM_CHIP == SPIRAM_CHIP_ESP_PSRAM64H || MICROPY_HW_SPIRAM_CHIP == SPIRAM_CHIP_APS6404L
+#define SPIRAM_CHIP_SIZE_BITS_LOG2 (26)
+#define SPIRAM_CHIP_PAGE_LOG2 (10)
+#define SPIRAM_CHIP_MAX_HZ (144000000)
+#define SPIRAM_QUAD_READ_DUMMY (6)
+#define SPIRAM_QUAD_WRITE_DUMMY (0)
+#define SRAM_CMD_READ           0x03
+#define SRAM_CMD_FAST_READ      0x0b
+#define SRAM_CMD_QUAD_READ      0xeb
+#define SRAM_CMD_WRITE          0x02
+#define SRAM_CMD_QUAD_WRITE     0x38
+#define SRAM_CMD_QUAD_ON        0x35
+#define SRAM_CMD_QUAD_OFF       0xf5
+#define SRAM_CMD_RST_EN         0x66
+#define SRAM_CMD_RST            0x99
+#define SRAM_CMD_BURST_LEN      0xc0
+#define SRAM_CMD_READ_ID        0x9f
+#else
+#error "unknown MICROPY_HW_SPIRAM_CHIP"
+#endif
+
+#if defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+
+// derived
+#define SPIRAM_SIZE_LOG2 (MICROPY_HW_SPIRAM_SIZE_BITS_LOG2 - 3)
+#define SPIRAM_SIZE (1u << SPIRAM_SIZE_LOG2)
+#define SPIRAM_MAP_ADDR (MICROPY_HW_SPIRAM_MAP_ADDR)
+#define SPIRAM_MAP_END (SPIRAM_MAP_ADDR + SPIRAM_SIZE)
+#define SPIRAM_PAGE_LOG2 (SPIRAM_CHIP_PAGE_LOG2)
+#define SPIRAM_OSPI_PRESCALER ((MICROPY_HW_SPIRAM_KERNEL_HZ + MICROPY_HW_SPIRAM_CLK_HZ - 1) / MICROPY_HW_SPIRAM_CLK_HZ)
+#define SPIRAM_CLK_HZ (MICROPY_HW_SPIRAM_KERNEL_HZ / SPIRAM_OSPI_PRESCALER)
+#define SPIRAM_MPU_SIZE (SPIRAM_SIZE_LOG2 - 1) // MPU_REGION_SIZE_xx
+
+// consistency
+_Static_assert(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2 == SPIRAM_CHIP_SIZE_BITS_LOG2, "spiram size does not match the chip");
+_Static_assert(SPIRAM_MAP_ADDR % SPIRAM_SIZE == 0, "spiram map address not aligned to its size, mpu region impossible");
+_Static_assert(SPIRAM_MAP_ADDR >= 0x90000000 && SPIRAM_MAP_END <= 0xa0000000, "spiram outside the octospi1 window");
+_Static_assert(SPIRAM_MPU_SIZE >= 4 && SPIRAM_MPU_SIZE <= 31, "spiram size out of mpu range");
+_Static_assert(SPIRAM_OSPI_PRESCALER >= 1 && SPIRAM_OSPI_PRESCALER <= 256, "spiram clock prescaler out of range");
+_Static_assert(SPIRAM_CLK_HZ <= SPIRAM_CHIP_MAX_HZ, "spiram clock above the chip maximum");
+_Static_assert(SPIRAM_PAGE_LOG2 < SPIRAM_SIZE_LOG2, "spiram page larger than the chip");
+#if MICROPY_HW_SPIRAM_HEAP_GROW
+#if !defined(MICROPY_HW_SPIRAM_STARTUP_TEST)
+#error "MICROPY_HW_SPIRAM_HEAP_GROW needs MICROPY_HW_SPIRAM_STARTUP_TEST"
+#endif
+// the gc tables take 1/44 of the heap, and are at its start
+_Static_assert(MICROPY_HW_SPIRAM_HEAP_BOOT >= SPIRAM_SIZE / 32 && MICROPY_HW_SPIRAM_HEAP_BOOT <= SPIRAM_SIZE, "spiram heap boot test does not hold the gc tables");
+_Static_assert(MICROPY_HW_SPIRAM_HEAP_BOOT % 32 == 0 && MICROPY_HW_SPIRAM_HEAP_STEP % 32 == 0, "spiram heap test not in cache lines");
+#endif
+
+#endif
+
+#endif // __SPIRAM_CONFIG_H__
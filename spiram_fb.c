@@ -0,0 +1,513 @@
+/*
+ * rgb565 framebuffer in spi ram, flushes only what changed
+ */
+
+/* notes:
+ * drawing goes to a framebuf.FrameBuffer on the same buffer; each drawing method
+ * adds the rectangle it touches to a short list of dirty rectangles. Overlapping
+ * and touching rectangles are merged; when the list is full, the pair that grows
+ * least is merged, and above 3/4 of the frame the whole frame is dirty.
+ *
+ * flush() sends each dirty rectangle to an spi display with the mipi dcs commands
+ * column address set (0x2a), page address set (0x2b) and memory write (0x2c), as
+ * used by the st7789, ili9341 and friends. The mdma gathers the rows of the
+ * rectangle from spi ram into a staging buffer, one block per row, with block
+ * repeat and source stride, and swaps the bytes to the big-endian rgb565 of the
+ * display on the way. The spi dma sends one half of the staging buffer while the
+ * mdma fills the other half.
+ *
+ * Rectangles start and end on even columns, so rows are word aligned for the mdma.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "spi.h"
+#include "mdma.h"
+#include "spiram_spi.h"
+#include "spiram_fb.h"
+
+#if defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2) && MICROPY_HW_ENABLE_MDMA
+
+#define FB_MDMA_PRIORITY (2)
+
+typedef struct _fb_rect_t {
+    int16_t x;
+    int16_t y;
+    int16_t w;
+    int16_t h;
+} fb_rect_t;
+
+typedef struct _spiram_fb_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the pixels alive
+    mp_obj_t fb;                // framebuf.FrameBuffer on buf
+    uint8_t *mem;
+    uint8_t *stage_alloc;        // keeps the staging alive; stage points into it
+    uint8_t *stage;
+    int16_t width;
+    int16_t height;
+    bool swap;
+    size_t n_rects;
+    fb_rect_t rect[SPIRAM_FB_RECTS];
+    uint32_t flushes;
+    uint32_t rects_sent;
+    uint64_t bytes_sent;
+    uint32_t last_us;
+} spiram_fb_obj_t;
+
+static volatile uint32_t fb_mdma_cisr;
+
+static inline int32_t fb_area(const fb_rect_t *r) {
+    return (int32_t)r->w * r->h;
+}
+
+static fb_rect_t fb_union(const fb_rect_t *a, const fb_rect_t *b) {
+    int16_t x0 = MIN(a->x, b->x);
+    int16_t y0 = MIN(a->y, b->y);
+    int16_t x1 = MAX(a->x + a->w, b->x + b->w);
+    int16_t y1 = MAX(a->y + a->h, b->y + b->h);
+    return (fb_rect_t) {x0, y0, x1 - x0, y1 - y0};
+}
+
+// overlapping or touching
+static bool fb_touch(const fb_rect_t *a, const fb_rect_t *b) {
+    return a->x <= b->x + b->w && b->x <= a->x + a->w
+           && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void fb_remove(spiram_fb_obj_t *self, size_t i) {
+    self->rect[i] = self->rect[--self->n_rects];
+}
+
+static void fb_dirty(spiram_fb_obj_t *self, mp_int_t x, mp_int_t y, mp_int_t w, mp_int_t h) {
+    // clip, then widen to even columns
+    mp_int_t x0 = MAX(x, 0) & ~1;
+    mp_int_t y0 = MAX(y, 0);
+    mp_int_t x1 = MIN(x + w, self->width);
+    mp_int_t y1 = MIN(y + h, self->height);
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+    x1 = (x1 + 1) & ~1;
+    fb_rect_t r = {x0, y0, x1 - x0, y1 - y0};
+
+    // merge with what it touches, until nothing does
+    for (size_t i = 0; i < self->n_rects;) {
+        if (fb_touch(&r, &self->rect[i])) {
+            r = fb_union(&r, &self->rect[i]);
+            fb_remove(self, i);
+            i = 0;
+        } else {
+            ++i;
+        }
+    }
+    if (self->n_rects == SPIRAM_FB_RECTS) {
+        // merge with the rectangle that grows least
+        size_t best = 0;
+        int32_t best_growth = INT32_MAX;
+        for (size_t i = 0; i < self->n_rects; ++i) {
+            fb_rect_t u = fb_union(&r, &self->rect[i]);
+            int32_t growth = fb_area(&u) - fb_area(&self->rect[i]) - fb_area(&r);
+            if (growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        r = fb_union(&r, &self->rect[best]);
+        fb_remove(self, best);
+    }
+    self->rect[self->n_rects++] = r;
+
+    int32_t total = 0;
+    for (size_t i = 0; i < self->n_rects; ++i) {
+        total += fb_area(&self->rect[i]);
+    }
+    if (4 * total > 3 * (int32_t)self->width * self->height) {
+        self->rect[0] = (fb_rect_t) {0, 0, self->width, self->height};
+        self->n_rects = 1;
+    }
+}
+
+static void fb_dirty_all(spiram_fb_obj_t *self) {
+    self->n_rects = 0;
+    fb_dirty(self, 0, 0, self->width, self->height);
+}
+
+// -----------------------------------------------------------------------------
+// flush
+
+static void fb_mdma_done(uint32_t channel, uint32_t cisr, void *arg) {
+    fb_mdma_cisr = cisr;
+}
+
+// start gathering rows of r, from row y, into dst
+static int fb_gather_start(spiram_fb_obj_t *self, const fb_rect_t *r, int16_t y, int16_t rows, uint8_t *dst) {
+    size_t stride = self->width * 2;
+    size_t row_bytes = r->w * 2;
+    const uint8_t *src = self->mem + y * stride + r->x * 2;
+    mdma_node_t node;
+    if (mdma_node_memcpy(&node, dst, src, row_bytes) != row_bytes) {
+        return -MP_EINVAL;
+    }
+    // one block per row; after each row the source skips to the next row
+    node.CBNDTR = row_bytes << MDMA_CBNDTR_BNDT_Pos | (rows - 1) << MDMA_CBNDTR_BRC_Pos;
+    node.CBRUR = (stride - row_bytes) << MDMA_CBRUR_SUV_Pos;
+    mdma_dcache_clean(src, (rows - 1) * stride + row_bytes);
+    mdma_dcache_clean_invalidate(dst, rows * row_bytes);
+    fb_mdma_cisr = 0;
+    mdma_start_ex(MDMA_CHANNEL_FRAMEBUF, &node, FB_MDMA_PRIORITY, self->swap ? MDMA_CCR_BEX : 0);
+    return 0;
+}
+
+static int fb_gather_wait(void) {
+    uint32_t start = mp_hal_ticks_ms();
+    while (mdma_busy(MDMA_CHANNEL_FRAMEBUF) && fb_mdma_cisr == 0) {
+        if (mp_hal_ticks_ms() - start >= 100) {
+            mdma_abort(MDMA_CHANNEL_FRAMEBUF);
+            return -MP_ETIMEDOUT;
+        }
+    }
+    return fb_mdma_cisr & MDMA_CISR_TEIF ? -MP_EIO : 0;
+}
+
+static void fb_command(const spi_t *spi, mp_hal_pin_obj_t dc, uint8_t cmd, const uint8_t *data, size_t len) {
+    mp_hal_pin_low(dc);
+    spi_transfer(spi, 1, &cmd, NULL, 100);
+    mp_hal_pin_high(dc);
+    if (len != 0) {
+        spi_transfer(spi, len, data, NULL, 100);
+    }
+}
+
+static int fb_send_rect(spiram_fb_obj_t *self, const spi_t *spi, mp_hal_pin_obj_t dc, const fb_rect_t *r) {
+    uint16_t x1 = r->x + r->w - 1;
+    uint16_t y1 = r->y + r->h - 1;
+    uint8_t caset[4] = {r->x >> 8, r->x, x1 >> 8, x1};
+    uint8_t raset[4] = {r->y >> 8, r->y, y1 >> 8, y1};
+    fb_command(spi, dc, 0x2a, caset, 4);
+    fb_command(spi, dc, 0x2b, raset, 4);
+    fb_command(spi, dc, 0x2c, NULL, 0);
+
+    size_t row_bytes = r->w * 2;
+    int16_t chunk_rows = MIN(MICROPY_HW_SPIRAM_FB_STAGE / 2 / row_bytes, 4096);
+    uint8_t *half[2] = {self->stage, self->stage + MICROPY_HW_SPIRAM_FB_STAGE / 2};
+    int16_t y = r->y;
+    int16_t rows = MIN(chunk_rows, r->h);
+    int ret = fb_gather_start(self, r, y, rows, half[0]);
+    for (uint32_t i = 0; ret == 0; ++i) {
+        ret = fb_gather_wait();
+        if (ret != 0) {
+            break;
+        }
+        uint8_t *ready = half[i & 1];
+        size_t ready_bytes = rows * row_bytes;
+        y += rows;
+        int16_t left = r->y + r->h - y;
+        if (left > 0) {
+            // gather the next rows while these are sent
+            rows = MIN(chunk_rows, left);
+            ret = fb_gather_start(self, r, y, rows, half[(i + 1) & 1]);
+        }
+        if (ret == 0) {
+            ret = spiram_spi_transfer(spi, ready, NULL, ready_bytes, 1000);
+            self->bytes_sent += ready_bytes;
+        }
+        if (left <= 0) {
+            break;
+        }
+    }
+    if (ret != 0) {
+        mdma_abort(MDMA_CHANNEL_FRAMEBUF);
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.FrameBuffer(buf, width, height, *, swap=True)
+// rgb565 framebuffer on buf, normally in spi ram. swap sends big-endian pixels, as spi displays want.
+
+STATIC mp_obj_t spiram_fb_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_width, ARG_height, ARG_swap };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_width, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_height, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_swap, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t width = args[ARG_width].u_int;
+    mp_int_t height = args[ARG_height].u_int;
+    if (width <= 0 || (width & 1) != 0 || width * 2 > MICROPY_HW_SPIRAM_FB_STAGE / 2 || height <= 0 || height > 4096) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad size"));
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    if (bufinfo.len < (size_t)width * height * 2 || ((uint32_t)bufinfo.buf & 3) != 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad buf"));
+    }
+
+    // the drawing is done by framebuf
+    mp_obj_t framebuf = mp_import_name(MP_QSTR_framebuf, mp_const_none, MP_OBJ_NEW_SMALL_INT(0));
+    mp_obj_t fb_args[4] = {
+        args[ARG_buf].u_obj,
+        MP_OBJ_NEW_SMALL_INT(width),
+        MP_OBJ_NEW_SMALL_INT(height),
+        mp_load_attr(framebuf, MP_QSTR_RGB565),
+    };
+
+    spiram_fb_obj_t *self = m_new_obj(spiram_fb_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->fb = mp_call_function_n_kw(mp_load_attr(framebuf, MP_QSTR_FrameBuffer), 4, 0, fb_args);
+    self->mem = bufinfo.buf;
+    self->width = width;
+    self->height = height;
+    self->swap = args[ARG_swap].u_bool;
+    // staging on a cache line
+    self->stage_alloc = m_new(uint8_t, MICROPY_HW_SPIRAM_FB_STAGE + 32);
+    self->stage = (uint8_t *)(((uint32_t)self->stage_alloc + 31) & ~31);
+    fb_dirty_all(self);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_fb_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "FrameBuffer(%dx%d, dirty=%u)", self->width, self->height, self->n_rects);
+}
+
+STATIC mp_int_t spiram_fb_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    bufinfo->buf = self->mem;
+    bufinfo->len = self->width * self->height * 2;
+    bufinfo->typecode = 'B';
+    return 0;
+}
+
+// call the framebuf method of the same name
+static mp_obj_t fb_forward(size_t n_args, const mp_obj_t *args, qstr name) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_t dest[2 + 6];
+    mp_load_method(self->fb, name, dest);
+    for (size_t i = 1; i < n_args; ++i) {
+        dest[1 + i] = args[i];
+    }
+    return mp_call_method_n_kw(n_args - 1, 0, dest);
+}
+
+#define FB_ARG(i) mp_obj_get_int(args[i])
+
+STATIC mp_obj_t spiram_fb_fill(mp_obj_t self_in, mp_obj_t col_in) {
+    fb_dirty_all(MP_OBJ_TO_PTR(self_in));
+    mp_obj_t args[2] = {self_in, col_in};
+    return fb_forward(2, args, MP_QSTR_fill);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_fb_fill_obj, spiram_fb_fill);
+
+STATIC mp_obj_t spiram_fb_fill_rect(size_t n_args, const mp_obj_t *args) {
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(1), FB_ARG(2), FB_ARG(3), FB_ARG(4));
+    return fb_forward(n_args, args, MP_QSTR_fill_rect);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_fill_rect_obj, 6, 6, spiram_fb_fill_rect);
+
+STATIC mp_obj_t spiram_fb_rect(size_t n_args, const mp_obj_t *args) {
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(1), FB_ARG(2), FB_ARG(3), FB_ARG(4));
+    return fb_forward(n_args, args, MP_QSTR_rect);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_rect_obj, 6, 6, spiram_fb_rect);
+
+STATIC mp_obj_t spiram_fb_pixel(size_t n_args, const mp_obj_t *args) {
+    if (n_args == 4) {
+        fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(1), FB_ARG(2), 1, 1);
+    }
+    return fb_forward(n_args, args, MP_QSTR_pixel);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_pixel_obj, 3, 4, spiram_fb_pixel);
+
+STATIC mp_obj_t spiram_fb_hline(size_t n_args, const mp_obj_t *args) {
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(1), FB_ARG(2), FB_ARG(3), 1);
+    return fb_forward(n_args, args, MP_QSTR_hline);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_hline_obj, 5, 5, spiram_fb_hline);
+
+STATIC mp_obj_t spiram_fb_vline(size_t n_args, const mp_obj_t *args) {
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(1), FB_ARG(2), 1, FB_ARG(3));
+    return fb_forward(n_args, args, MP_QSTR_vline);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_vline_obj, 5, 5, spiram_fb_vline);
+
+STATIC mp_obj_t spiram_fb_line(size_t n_args, const mp_obj_t *args) {
+    mp_int_t x1 = FB_ARG(1), y1 = FB_ARG(2), x2 = FB_ARG(3), y2 = FB_ARG(4);
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), MIN(x1, x2), MIN(y1, y2), MAX(x1, x2) - MIN(x1, x2) + 1, MAX(y1, y2) - MIN(y1, y2) + 1);
+    return fb_forward(n_args, args, MP_QSTR_line);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_line_obj, 6, 6, spiram_fb_line);
+
+STATIC mp_obj_t spiram_fb_text(size_t n_args, const mp_obj_t *args) {
+    size_t len;
+    mp_obj_str_get_data(args[1], &len);
+    // 8x8 font, one character per byte
+    fb_dirty(MP_OBJ_TO_PTR(args[0]), FB_ARG(2), FB_ARG(3), 8 * len, 8);
+    return fb_forward(n_args, args, MP_QSTR_text);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_text_obj, 4, 5, spiram_fb_text);
+
+STATIC mp_obj_t spiram_fb_blit(size_t n_args, const mp_obj_t *args) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_t fwd[5];
+    memcpy(fwd, args, n_args * sizeof(mp_obj_t));
+    if (mp_obj_is_type(args[1], &spiram_fb_type)) {
+        spiram_fb_obj_t *src = MP_OBJ_TO_PTR(args[1]);
+        fb_dirty(self, FB_ARG(2), FB_ARG(3), src->width, src->height);
+        fwd[1] = src->fb;
+    } else {
+        // framebuf does not tell the size of a FrameBuffer
+        fb_dirty_all(self);
+    }
+    return fb_forward(n_args, fwd, MP_QSTR_blit);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_blit_obj, 4, 5, spiram_fb_blit);
+
+STATIC mp_obj_t spiram_fb_scroll(mp_obj_t self_in, mp_obj_t xstep_in, mp_obj_t ystep_in) {
+    fb_dirty_all(MP_OBJ_TO_PTR(self_in));
+    mp_obj_t args[3] = {self_in, xstep_in, ystep_in};
+    return fb_forward(3, args, MP_QSTR_scroll);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_fb_scroll_obj, spiram_fb_scroll);
+
+// fb.invalidate(x=0, y=0, w=width, h=height)
+// mark a rectangle dirty, after writing the buffer directly.
+
+STATIC mp_obj_t spiram_fb_invalidate(size_t n_args, const mp_obj_t *args) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    if (n_args == 1) {
+        fb_dirty_all(self);
+    } else {
+        mp_arg_check_num(n_args, 0, 5, 5, false);
+        fb_dirty(self, FB_ARG(1), FB_ARG(2), FB_ARG(3), FB_ARG(4));
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_invalidate_obj, 1, 5, spiram_fb_invalidate);
+
+// fb.dirty(clear=False)
+// list of dirty rectangles (x, y, w, h), for displays that are not on spi.
+
+STATIC mp_obj_t spiram_fb_dirty_rects(size_t n_args, const mp_obj_t *args) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (size_t i = 0; i < self->n_rects; ++i) {
+        const fb_rect_t *r = &self->rect[i];
+        mp_obj_t t[4] = {
+            MP_OBJ_NEW_SMALL_INT(r->x), MP_OBJ_NEW_SMALL_INT(r->y), MP_OBJ_NEW_SMALL_INT(r->w), MP_OBJ_NEW_SMALL_INT(r->h),
+        };
+        mp_obj_list_append(list, mp_obj_new_tuple(4, t));
+    }
+    if (n_args > 1 && mp_obj_is_true(args[1])) {
+        self->n_rects = 0;
+    }
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_dirty_rects_obj, 1, 2, spiram_fb_dirty_rects);
+
+// fb.flush(spi, dc, cs=None)
+// send the dirty rectangles to an spi display; dc and cs are pins. Returns the number of rectangles.
+
+STATIC mp_obj_t spiram_fb_flush(size_t n_args, const mp_obj_t *args) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    const spi_t *spi = spi_from_mp_obj(args[1]);
+    mp_hal_pin_obj_t dc = mp_hal_get_pin_obj(args[2]);
+    mp_hal_pin_obj_t cs = n_args > 3 && args[3] != mp_const_none ? mp_hal_get_pin_obj(args[3]) : NULL;
+
+    uint32_t t0 = mp_hal_ticks_us();
+    mdma_init();
+    mdma_set_callback(MDMA_CHANNEL_FRAMEBUF, fb_mdma_done, NULL);
+    size_t n = self->n_rects;
+    int ret = 0;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        while (self->n_rects != 0 && ret == 0) {
+            if (cs != NULL) {
+                mp_hal_pin_low(cs);
+            }
+            ret = fb_send_rect(self, spi, dc, &self->rect[self->n_rects - 1]);
+            if (cs != NULL) {
+                mp_hal_pin_high(cs);
+            }
+            if (ret == 0) {
+                self->n_rects--;
+                self->rects_sent++;
+            }
+        }
+        nlr_pop();
+    } else {
+        // the spi raised: leave the display deselected and the channel idle
+        mdma_abort(MDMA_CHANNEL_FRAMEBUF);
+        if (cs != NULL) {
+            mp_hal_pin_high(cs);
+        }
+        mdma_set_callback(MDMA_CHANNEL_FRAMEBUF, NULL, NULL);
+        nlr_jump(nlr.ret_val);
+    }
+    mdma_set_callback(MDMA_CHANNEL_FRAMEBUF, NULL, NULL);
+    self->flushes++;
+    self->last_us = mp_hal_ticks_us() - t0;
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return MP_OBJ_NEW_SMALL_INT(n);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_fb_flush_obj, 3, 4, spiram_fb_flush);
+
+// fb.stats()
+// (flushes, rectangles sent, bytes sent, us of the last flush)
+
+STATIC mp_obj_t spiram_fb_stats(mp_obj_t self_in) {
+    spiram_fb_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t t[4] = {
+        mp_obj_new_int_from_uint(self->flushes),
+        mp_obj_new_int_from_uint(self->rects_sent),
+        mp_obj_new_int_from_ull(self->bytes_sent),
+        mp_obj_new_int_from_uint(self->last_us),
+    };
+    return mp_obj_new_tuple(4, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_fb_stats_obj, spiram_fb_stats);
+
+STATIC const mp_rom_map_elem_t spiram_fb_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_fill), MP_ROM_PTR(&spiram_fb_fill_obj) },
+    { MP_ROM_QSTR(MP_QSTR_fill_rect), MP_ROM_PTR(&spiram_fb_fill_rect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_pixel), MP_ROM_PTR(&spiram_fb_pixel_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hline), MP_ROM_PTR(&spiram_fb_hline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_vline), MP_ROM_PTR(&spiram_fb_vline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rect), MP_ROM_PTR(&spiram_fb_rect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_line), MP_ROM_PTR(&spiram_fb_line_obj) },
+    { MP_ROM_QSTR(MP_QSTR_text), MP_ROM_PTR(&spiram_fb_text_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit), MP_ROM_PTR(&spiram_fb_blit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_scroll), MP_ROM_PTR(&spiram_fb_scroll_obj) },
+    { MP_ROM_QSTR(MP_QSTR_invalidate), MP_ROM_PTR(&spiram_fb_invalidate_obj) },
+    { MP_ROM_QSTR(MP_QSTR_dirty), MP_ROM_PTR(&spiram_fb_dirty_rects_obj) },
+    { MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&spiram_fb_flush_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_fb_stats_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_fb_locals_dict, spiram_fb_locals_dict_table);
+
+const mp_obj_type_t spiram_fb_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_FrameBuffer,
+    .print = spiram_fb_print,
+    .make_new = spiram_fb_make_new,
+    .buffer_p = { .get_buffer = spiram_fb_get_buffer },
+    .locals_dict = (mp_obj_dict_t *)&spiram_fb_locals_dict,
+};
+
+#endif
+
+// not truncated
@@ -0,0 +1,17 @@
+/*
+ * rgb565 framebuffer in spi ram, flushes only what changed
+ */
+#ifndef __SPIRAM_FB_H__
+#define __SPIRAM_FB_H__
+#include "py/obj.h"
+
+// dirty rectangles kept apart; more are merged
+#define SPIRAM_FB_RECTS (16)
+
+// staging for the rows of a rectangle, two halves
+#ifndef MICROPY_HW_SPIRAM_FB_STAGE
+#define MICROPY_HW_SPIRAM_FB_STAGE (32 * 1024)
+#endif
+
+extern const mp_obj_type_t spiram_fb_type;
+#endif // __SPIRAM_FB_H__
@@ -0,0 +1,442 @@
+/*
+ * open addressing hash table in spi ram, fixed size keys and values
+ */
+
+/* notes:
+ * a bucket is one or more 32 byte cache lines: a 32-bit header, then as many
+ * entries (key, value) as fit. One probe is one cache line fill, one qspi burst.
+ * The header has a bit per occupied slot, and an overflow bit: an insert passed
+ * this bucket because it was full. A lookup probes buckets linearly and stops at
+ * the first bucket without overflow bit. Delete clears the slot bit only;
+ * overflow bits go away when the table is resized.
+ *
+ * The table grows to twice its size at 3/4 load, incrementally, so no insert waits
+ * for a whole rehash. Each insert and delete does a bit of the work:
+ * - zero: the new table is cleared, 16 buckets per step; inserts still go to the old table.
+ * - move: inserts go to the new table; 2 buckets of the old table are moved per step.
+ *   Lookups try the new table, then the old one.
+ * Old and new table are at opposite ends of the storage, so the largest table
+ * is 2/3 of the storage.
+ *
+ * Keys and values of up to 4 bytes are python ints, longer ones bytes.
+ * The entries are plain bytes in the storage buffer, not python objects.
+ */
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "spiram_hash.h"
+
+#define HASH_LINE (32)
+#define HASH_OVERFLOW (1u << 31)
+#define HASH_SLOTS_MAX (24)
+#define HASH_BUCKETS_MIN (64)
+#define HASH_ZERO_STEP (16)     // buckets cleared per insert or delete
+#define HASH_MOVE_STEP (2)      // buckets moved per insert or delete
+
+enum { HASH_STABLE, HASH_ZERO, HASH_MOVE };
+
+typedef struct _hash_table_t {
+    uint8_t *mem;
+    uint32_t mask;              // buckets - 1
+    uint32_t entries;
+} hash_table_t;
+
+typedef struct _spiram_hash_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the storage alive
+    uint8_t *arena;
+    size_t arena_size;
+    uint8_t key_size;
+    uint8_t value_size;
+    uint8_t entry_size;
+    uint8_t slots;              // entries per bucket
+    uint32_t bucket_bytes;
+    hash_table_t tab;           // inserts go here
+    hash_table_t next;          // zero: being cleared
+    hash_table_t old;           // move: being moved to tab
+    uint32_t state;
+    uint32_t cursor;            // buckets cleared or moved
+    uint32_t max_probe;
+} spiram_hash_obj_t;
+
+// fnv-1a, then the murmur3 finalizer, so all bits of the key reach the low bits
+static uint32_t hash_key(const uint8_t *key, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint8_t *hash_bucket(const spiram_hash_obj_t *self, const hash_table_t *t, uint32_t i) {
+    return t->mem + i * self->bucket_bytes;
+}
+
+static inline uint8_t *hash_entry(const spiram_hash_obj_t *self, uint8_t *bucket, uint32_t j) {
+    return bucket + 4 + j * self->entry_size;
+}
+
+static inline size_t hash_table_bytes(const spiram_hash_obj_t *self, uint32_t buckets) {
+    return buckets * self->bucket_bytes;
+}
+
+// the entry with key, or NULL. *bucket_out and *slot_out locate it.
+static uint8_t *hash_find(const spiram_hash_obj_t *self, const hash_table_t *t, const uint8_t *key, uint32_t h, uint8_t **bucket_out, uint32_t *slot_out) {
+    uint32_t i = h & t->mask;
+    for (uint32_t probe = 0; probe <= t->mask; ++probe) {
+        uint8_t *b = hash_bucket(self, t, i);
+        uint32_t hdr = *(uint32_t *)b;
+        for (uint32_t used = hdr & ~HASH_OVERFLOW; used != 0; used &= used - 1) {
+            uint32_t j = __builtin_ctz(used);
+            uint8_t *e = hash_entry(self, b, j);
+            if (memcmp(e, key, self->key_size) == 0) {
+                *bucket_out = b;
+                *slot_out = j;
+                return e;
+            }
+        }
+        if (!(hdr & HASH_OVERFLOW)) {
+            break;
+        }
+        i = (i + 1) & t->mask;
+    }
+    return NULL;
+}
+
+// insert an entry that is not in the table. Returns false if the table is full.
+static bool hash_insert_new(spiram_hash_obj_t *self, hash_table_t *t, const uint8_t *entry, uint32_t h) {
+    uint32_t all = (1u << self->slots) - 1;
+    uint32_t i = h & t->mask;
+    for (uint32_t probe = 0; probe <= t->mask; ++probe) {
+        uint8_t *b = hash_bucket(self, t, i);
+        uint32_t hdr = *(uint32_t *)b;
+        uint32_t free = ~hdr & all;
+        if (free != 0) {
+            uint32_t j = __builtin_ctz(free);
+            memcpy(hash_entry(self, b, j), entry, self->entry_size);
+            *(uint32_t *)b = hdr | 1u << j;
+            t->entries++;
+            self->max_probe = MAX(self->max_probe, probe + 1);
+            return true;
+        }
+        *(uint32_t *)b = hdr | HASH_OVERFLOW;
+        i = (i + 1) & t->mask;
+    }
+    return false;
+}
+
+static void hash_remove(hash_table_t *t, uint8_t *bucket, uint32_t slot) {
+    *(uint32_t *)bucket &= ~(1u << slot);
+    t->entries--;
+}
+
+// start growing, if the storage has room for a table of twice the size
+static void hash_grow(spiram_hash_obj_t *self) {
+    uint32_t buckets = 2 * (self->tab.mask + 1);
+    size_t bytes = hash_table_bytes(self, buckets);
+    uint8_t *mem;
+    if (self->tab.mem == self->arena) {
+        // at the low end; the new table goes to the high end
+        if (bytes + hash_table_bytes(self, self->tab.mask + 1) > self->arena_size) {
+            return;
+        }
+        mem = self->arena + self->arena_size - bytes;
+    } else {
+        mem = self->arena;
+        if (mem + bytes > self->tab.mem) {
+            return;
+        }
+    }
+    self->next.mem = mem;
+    self->next.mask = buckets - 1;
+    self->next.entries = 0;
+    self->cursor = 0;
+    self->state = HASH_ZERO;
+}
+
+// a bit of the resize work
+static void hash_step(spiram_hash_obj_t *self) {
+    if (self->state == HASH_ZERO) {
+        uint32_t n = MIN(HASH_ZERO_STEP, self->next.mask + 1 - self->cursor);
+        memset(hash_bucket(self, &self->next, self->cursor), 0, hash_table_bytes(self, n));
+        self->cursor += n;
+        if (self->cursor > self->next.mask) {
+            self->old = self->tab;
+            self->tab = self->next;
+            self->cursor = 0;
+            self->state = HASH_MOVE;
+        }
+    } else if (self->state == HASH_MOVE) {
+        for (uint32_t k = 0; k < HASH_MOVE_STEP && self->cursor <= self->old.mask; ++k) {
+            uint8_t *b = hash_bucket(self, &self->old, self->cursor++);
+            uint32_t hdr = *(uint32_t *)b;
+            for (uint32_t used = hdr & ~HASH_OVERFLOW; used != 0; used &= used - 1) {
+                uint8_t *e = hash_entry(self, b, __builtin_ctz(used));
+                hash_insert_new(self, &self->tab, e, hash_key(e, self->key_size));
+                self->old.entries--;
+            }
+            // keep the overflow bit: lookups in the old table probe past this bucket
+            *(uint32_t *)b &= HASH_OVERFLOW;
+        }
+        if (self->cursor > self->old.mask) {
+            self->state = HASH_STABLE;
+        }
+    }
+}
+
+static uint8_t *hash_lookup(spiram_hash_obj_t *self, const uint8_t *key) {
+    uint32_t h = hash_key(key, self->key_size);
+    uint8_t *b;
+    uint32_t j;
+    uint8_t *e = hash_find(self, &self->tab, key, h, &b, &j);
+    if (e == NULL && self->state == HASH_MOVE) {
+        e = hash_find(self, &self->old, key, h, &b, &j);
+    }
+    return e;
+}
+
+static void hash_reset(spiram_hash_obj_t *self) {
+    uint32_t buckets = HASH_BUCKETS_MIN;
+    while (buckets > 1 && hash_table_bytes(self, buckets) > self->arena_size) {
+        buckets /= 2;
+    }
+    self->tab.mem = self->arena;
+    self->tab.mask = buckets - 1;
+    self->tab.entries = 0;
+    memset(self->tab.mem, 0, hash_table_bytes(self, buckets));
+    self->state = HASH_STABLE;
+    self->max_probe = 0;
+}
+
+// a key or value from python: an int if it is 4 bytes or less, else a buffer of the size
+static void hash_from_obj(mp_obj_t obj, uint8_t *dst, size_t size) {
+    if (size <= 4 && mp_obj_is_int(obj)) {
+        uint32_t v = mp_obj_get_int_truncated(obj);
+        memcpy(dst, &v, size);
+        return;
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(obj, &bufinfo, MP_BUFFER_READ);
+    if (bufinfo.len != size) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad size"));
+    }
+    memcpy(dst, bufinfo.buf, size);
+}
+
+static mp_obj_t hash_to_obj(const uint8_t *src, size_t size) {
+    if (size <= 4) {
+        uint32_t v = 0;
+        memcpy(&v, src, size);
+        return mp_obj_new_int_from_uint(v);
+    }
+    return mp_obj_new_bytes(src, size);
+}
+
+// spiram.HashTable(buf, *, key_size=4, value_size=4)
+// buf is the storage, normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_hash_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_key_size, ARG_value_size };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_key_size, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 4} },
+        { MP_QSTR_value_size, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 4} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t key_size = args[ARG_key_size].u_int;
+    mp_int_t value_size = args[ARG_value_size].u_int;
+    if (key_size < 1 || key_size > SPIRAM_HASH_ITEM_MAX || value_size < 0 || value_size > SPIRAM_HASH_ITEM_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad size"));
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+
+    spiram_hash_obj_t *self = m_new_obj(spiram_hash_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->key_size = key_size;
+    self->value_size = value_size;
+    self->entry_size = key_size + value_size;
+    self->bucket_bytes = (4 + self->entry_size + HASH_LINE - 1) & ~(HASH_LINE - 1);
+    self->slots = MIN((self->bucket_bytes - 4) / self->entry_size, HASH_SLOTS_MAX);
+
+    uint32_t start = ((uint32_t)bufinfo.buf + HASH_LINE - 1) & ~(HASH_LINE - 1);
+    uint32_t end = ((uint32_t)bufinfo.buf + bufinfo.len) & ~(HASH_LINE - 1);
+    if (end < start + self->bucket_bytes) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+    self->buf = args[ARG_buf].u_obj;
+    self->arena = (uint8_t *)start;
+    self->arena_size = end - start;
+    hash_reset(self);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+static mp_uint_t hash_len(const spiram_hash_obj_t *self) {
+    return self->tab.entries + (self->state == HASH_MOVE ? self->old.entries : 0);
+}
+
+STATIC void spiram_hash_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "HashTable(key_size=%u, value_size=%u, len=%u, buckets=%u)", self->key_size, self->value_size, hash_len(self), self->tab.mask + 1);
+}
+
+STATIC mp_obj_t spiram_hash_unary_op(mp_unary_op_t op, mp_obj_t self_in) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    switch (op) {
+        case MP_UNARY_OP_BOOL:
+            return mp_obj_new_bool(hash_len(self) != 0);
+        case MP_UNARY_OP_LEN:
+            return MP_OBJ_NEW_SMALL_INT(hash_len(self));
+        default:
+            return MP_OBJ_NULL;
+    }
+}
+
+STATIC mp_obj_t spiram_hash_binary_op(mp_binary_op_t op, mp_obj_t lhs_in, mp_obj_t rhs_in) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(lhs_in);
+    if (op != MP_BINARY_OP_CONTAINS) {
+        return MP_OBJ_NULL;
+    }
+    uint8_t key[SPIRAM_HASH_ITEM_MAX];
+    hash_from_obj(rhs_in, key, self->key_size);
+    return mp_obj_new_bool(hash_lookup(self, key) != NULL);
+}
+
+static void hash_store(spiram_hash_obj_t *self, mp_obj_t key_in, mp_obj_t value_in) {
+    uint8_t entry[2 * SPIRAM_HASH_ITEM_MAX];
+    hash_from_obj(key_in, entry, self->key_size);
+    hash_from_obj(value_in, entry + self->key_size, self->value_size);
+    hash_step(self);
+    uint32_t h = hash_key(entry, self->key_size);
+    uint8_t *b;
+    uint32_t j;
+    uint8_t *e = hash_find(self, &self->tab, entry, h, &b, &j);
+    if (e != NULL) {
+        memcpy(e + self->key_size, entry + self->key_size, self->value_size);
+        return;
+    }
+    if (self->state == HASH_MOVE) {
+        e = hash_find(self, &self->old, entry, h, &b, &j);
+        if (e != NULL) {
+            // update in the old table; the move takes it along
+            memcpy(e + self->key_size, entry + self->key_size, self->value_size);
+            return;
+        }
+    }
+    if (self->state == HASH_STABLE && 4 * (self->tab.entries + 1) > 3 * (self->tab.mask + 1) * self->slots) {
+        hash_grow(self);
+    }
+    if (!hash_insert_new(self, &self->tab, entry, h)) {
+        mp_raise_OSError(MP_ENOSPC);
+    }
+}
+
+static void hash_delete(spiram_hash_obj_t *self, mp_obj_t key_in) {
+    uint8_t key[SPIRAM_HASH_ITEM_MAX];
+    hash_from_obj(key_in, key, self->key_size);
+    hash_step(self);
+    uint32_t h = hash_key(key, self->key_size);
+    uint8_t *b;
+    uint32_t j;
+    if (hash_find(self, &self->tab, key, h, &b, &j) != NULL) {
+        hash_remove(&self->tab, b, j);
+    } else if (self->state == HASH_MOVE && hash_find(self, &self->old, key, h, &b, &j) != NULL) {
+        hash_remove(&self->old, b, j);
+    } else {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_KeyError, key_in));
+    }
+}
+
+// table[key], table[key] = value, del table[key]
+STATIC mp_obj_t spiram_hash_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t value) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (value == MP_OBJ_NULL) {
+        hash_delete(self, index);
+        return mp_const_none;
+    } else if (value != MP_OBJ_SENTINEL) {
+        hash_store(self, index, value);
+        return mp_const_none;
+    }
+    uint8_t key[SPIRAM_HASH_ITEM_MAX];
+    hash_from_obj(index, key, self->key_size);
+    uint8_t *e = hash_lookup(self, key);
+    if (e == NULL) {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_KeyError, index));
+    }
+    return hash_to_obj(e + self->key_size, self->value_size);
+}
+
+// table.get(key, default=None)
+
+STATIC mp_obj_t spiram_hash_get(size_t n_args, const mp_obj_t *args) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    uint8_t key[SPIRAM_HASH_ITEM_MAX];
+    hash_from_obj(args[1], key, self->key_size);
+    uint8_t *e = hash_lookup(self, key);
+    if (e == NULL) {
+        return n_args > 2 ? args[2] : mp_const_none;
+    }
+    return hash_to_obj(e + self->key_size, self->value_size);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_hash_get_obj, 2, 3, spiram_hash_get);
+
+// table.stats()
+// (entries, buckets, entries per bucket, load, resizing, longest probe, bytes per entry)
+
+STATIC mp_obj_t spiram_hash_stats(mp_obj_t self_in) {
+    spiram_hash_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_uint_t n = hash_len(self);
+    size_t bytes = hash_table_bytes(self, self->tab.mask + 1);
+    if (self->state == HASH_ZERO) {
+        bytes += hash_table_bytes(self, self->next.mask + 1);
+    } else if (self->state == HASH_MOVE) {
+        bytes += hash_table_bytes(self, self->old.mask + 1);
+    }
+    mp_obj_t t[7] = {
+        mp_obj_new_int_from_uint(n),
+        mp_obj_new_int_from_uint(self->tab.mask + 1),
+        MP_OBJ_NEW_SMALL_INT(self->slots),
+        mp_obj_new_float((mp_float_t)self->tab.entries / ((self->tab.mask + 1) * self->slots)),
+        mp_obj_new_bool(self->state != HASH_STABLE),
+        mp_obj_new_int_from_uint(self->max_probe),
+        mp_obj_new_float(n ? (mp_float_t)bytes / n : 0),
+    };
+    return mp_obj_new_tuple(7, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_hash_stats_obj, spiram_hash_stats);
+
+STATIC mp_obj_t spiram_hash_clear(mp_obj_t self_in) {
+    hash_reset(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_hash_clear_obj, spiram_hash_clear);
+
+STATIC const mp_rom_map_elem_t spiram_hash_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_get), MP_ROM_PTR(&spiram_hash_get_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_hash_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&spiram_hash_clear_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_hash_locals_dict, spiram_hash_locals_dict_table);
+
+const mp_obj_type_t spiram_hash_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_HashTable,
+    .print = spiram_hash_print,
+    .make_new = spiram_hash_make_new,
+    .unary_op = spiram_hash_unary_op,
+    .binary_op = spiram_hash_binary_op,
+    .subscr = spiram_hash_subscr,
+    .locals_dict = (mp_obj_dict_t *)&spiram_hash_locals_dict,
+};
+
+// not truncated
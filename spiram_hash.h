@@ -0,0 +1,12 @@
+/*
+ * open addressing hash table in spi ram, fixed size keys and values
+ */
+#ifndef __SPIRAM_HASH_H__
+#define __SPIRAM_HASH_H__
+#include "py/obj.h"
+
+// largest key or value, in bytes
+#define SPIRAM_HASH_ITEM_MAX (32)
+
+extern const mp_obj_type_t spiram_hash_type;
+#endif // __SPIRAM_HASH_H__
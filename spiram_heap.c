@@ -0,0 +1,124 @@
+/*
+ * python heap in spi ram, tested and grown after boot
+ */
+
+/* notes:
+ * The linker script put the whole heap in spi ram, and spiram_init() cleared and
+ * tested all of it before the interpreter started. When the test failed, there was
+ * no usable heap.
+ *
+ * The gc of micropython 1.17 has a single heap: one range of blocks, with the
+ * allocation and finaliser tables at its start. A second region can not be added,
+ * but the heap can end early and grow at its end. gc_init() lays out the tables
+ * for all of spi ram; spiram_heap_init() then moves the end of the heap down to the
+ * end of the tested part, by shortening gc_alloc_table_byte_len and gc_pool_end.
+ * gc_alloc and the sweep stop at the table length, and pointers above gc_pool_end
+ * are not heap pointers, so the blocks above are not in the heap. Growing tests the
+ * next step of spi ram and moves the end up; the tables for it are already there,
+ * cleared by gc_init(), at the tested start of spi ram.
+ *
+ * At boot only MICROPY_HW_SPIRAM_HEAP_BOOT bytes are tested, enough for the tables
+ * and a first heap. If that fails, the heap is in internal ram between the static
+ * data and the stack, as on boards without spi ram, and the board still boots.
+ * When gc_alloc finds no memory after a collection it grows the heap and tries
+ * again; spiram.heap_grow() grows it ahead of time, to keep the memtest out of an
+ * allocation. A step that fails the memtest ends growing; the heap keeps what passed.
+ * The tested size survives a soft reset.
+ */
+
+#include "py/mpstate.h"
+#include "py/mperrno.h"
+#include "py/misc.h"
+#include "spiram.h"
+#include "spiram_heap.h"
+#include "gc_index.h"
+
+#if MICROPY_HW_SPIRAM_HEAP_GROW
+
+#define BLOCKS_PER_ATB (4)
+
+// internal ram between the static data and the stack, from the linker script
+extern uint8_t _ram_heap_start, _ram_heap_end;
+
+static size_t heap_tested;              // bytes of spi ram tested from the start; 0: heap in internal ram
+static bool heap_failed;
+static uint32_t heap_grows;
+static size_t heap_atb_len;             // allocation table length of all of spi ram, from gc_init()
+
+bool spiram_heap_boot(void) {
+    if (spiram_test_range(0, MICROPY_HW_SPIRAM_HEAP_BOOT)) {
+        heap_tested = MICROPY_HW_SPIRAM_HEAP_BOOT;
+    } else {
+        heap_failed = true;
+    }
+    return !heap_failed;
+}
+
+void *spiram_heap_start(void) {
+    return heap_tested != 0 ? spiram_start() : (void *)&_ram_heap_start;
+}
+
+void *spiram_heap_end(void) {
+    return heap_tested != 0 ? spiram_end() : (void *)&_ram_heap_end;
+}
+
+// the heap ends at the last whole allocation table byte in the tested part
+static void heap_set_end(void) {
+    size_t blocks = ((byte *)spiram_start() + heap_tested - MP_STATE_MEM(gc_pool_start)) / MICROPY_BYTES_PER_GC_BLOCK;
+    size_t atb_len = MIN(blocks / BLOCKS_PER_ATB, heap_atb_len);
+    MP_STATE_MEM(gc_alloc_table_byte_len) = atb_len;
+    MP_STATE_MEM(gc_pool_end) = MP_STATE_MEM(gc_pool_start) + atb_len * BLOCKS_PER_ATB * MICROPY_BYTES_PER_GC_BLOCK;
+    #if MICROPY_GC_INDEX
+    gc_index_resize();
+    #endif
+}
+
+void spiram_heap_init(void) {
+    if (heap_tested == 0) {
+        return;
+    }
+    heap_atb_len = MP_STATE_MEM(gc_alloc_table_byte_len);
+    heap_set_end();
+}
+
+int spiram_heap_grow(size_t len) {
+    if (heap_tested == 0) {
+        return -MP_ENODEV;
+    }
+    size_t added = 0;
+    while (added < len && heap_tested < SPIRAM_SIZE && !heap_failed) {
+        size_t step = MIN(MICROPY_HW_SPIRAM_HEAP_STEP, SPIRAM_SIZE - heap_tested);
+        // nothing uses the part above the heap, so it is tested without the gc lock
+        if (!spiram_test_range(heap_tested, step)) {
+            heap_failed = true;
+            break;
+        }
+        #if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
+        mp_thread_mutex_lock(&MP_STATE_MEM(gc_mutex), 1);
+        #endif
+        heap_tested += step;
+        heap_set_end();
+        #if MICROPY_PY_THREAD && !MICROPY_PY_THREAD_GIL
+        mp_thread_mutex_unlock(&MP_STATE_MEM(gc_mutex));
+        #endif
+        ++heap_grows;
+        added += step;
+    }
+    if (added == 0 && heap_failed) {
+        return -MP_EIO;
+    }
+    return added;
+}
+
+void spiram_heap_get_info(spiram_heap_info_t *info) {
+    info->in_spiram = heap_tested != 0;
+    info->failed = heap_failed;
+    info->heap = MP_STATE_MEM(gc_pool_end) - MP_STATE_MEM(gc_pool_start);
+    info->tested = heap_tested;
+    info->size = SPIRAM_SIZE;
+    info->grows = heap_grows;
+}
+
+#endif // MICROPY_HW_SPIRAM_HEAP_GROW
+
+// not truncated
@@ -0,0 +1,36 @@
+/*
+ * python heap in spi ram, tested and grown after boot
+ */
+#ifndef __SPIRAM_HEAP_H__
+#define __SPIRAM_HEAP_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "spiram_config.h"
+
+// before gc_init(): test the start of spi ram. False if it failed; the heap is then in internal ram.
+bool spiram_heap_boot(void);
+
+// MICROPY_HEAP_START and MICROPY_HEAP_END of the board
+void *spiram_heap_start(void);
+void *spiram_heap_end(void);
+
+// after gc_init() and gc_index_init(): the heap ends where the tested part ends
+void spiram_heap_init(void);
+
+// test at least len more bytes of spi ram and add them to the heap, a step at a time.
+// Returns the bytes added, 0 when all spi ram is in the heap, or a negative MP_Exxx.
+// Not with the gc locked.
+int spiram_heap_grow(size_t len);
+
+typedef struct _spiram_heap_info_t {
+    bool in_spiram;             // false: spi ram failed at boot, the heap is in internal ram
+    bool failed;                // a step failed the memtest, the heap does not grow
+    size_t heap;                // bytes of heap, without the gc tables
+    size_t tested;              // bytes of spi ram tested, from the start
+    size_t size;                // bytes of spi ram
+    uint32_t grows;             // steps added after boot
+} spiram_heap_info_t;
+
+void spiram_heap_get_info(spiram_heap_info_t *info);
+#endif // __SPIRAM_HEAP_H__
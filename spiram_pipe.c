@@ -0,0 +1,351 @@
+/*
+ * pipeline of buffers in spi ram, between a dma source and a dma sink
+ */
+
+/* notes:
+ * the storage is cut in depth equal buffers, a multiple of 512 bytes, so a
+ * buffer holds whole sd card blocks. Buffers go round: the producer fills the
+ * buffer at head and publishes it, the consumer empties the buffer at tail and
+ * releases it. With three buffers, the sd card reads into one, the interpreter
+ * processes a second, and usb sends the third.
+ *
+ * Zero-copy: get_free() is a memoryview of the free buffer, for readblocks() or
+ * readinto() of the source, put(n) publishes it. get_full() is a memoryview of the
+ * oldest full buffer, for write() of the sink, release() frees it. The stream
+ * methods read, readinto and write copy, for sources and sinks that are python code.
+ *
+ * The pipe is pollable, so uasyncio.StreamReader and StreamWriter work on it:
+ * readable when a buffer is full or the pipe is closed, writable when a buffer is free.
+ * close() publishes the last, partly filled buffer, as soon as a buffer is free;
+ * after it the consumer sees end of stream.
+ *
+ * One producer and one consumer, no locks: head and tail indices are like spiram_ring.
+ * Dma sources and sinks do their own cache maintenance, as pyb.SDCard and spiram_spi do.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/objarray.h"
+#include "py/mperrno.h"
+#include "spiram_pipe.h"
+
+#define SPIRAM_PIPE_ALIGN (512)
+
+typedef struct _spiram_pipe_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the storage alive
+    uint8_t *mem;
+    size_t slot_size;
+    uint32_t depth;
+    // head and tail run from 0 to 2 * depth - 1, so a full pipe and an empty pipe differ
+    volatile uint32_t head;     // written by the producer only
+    volatile uint32_t tail;     // written by the consumer only
+    size_t len[SPIRAM_PIPE_DEPTH_MAX];
+    size_t fill;                // bytes written in the buffer at head
+    size_t rd;                  // bytes read from the buffer at tail
+    volatile bool closed;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t t_first;           // first byte in
+    uint32_t t_last;            // last byte out
+    bool started;
+    uint32_t producer_waits;
+    uint32_t consumer_waits;
+} spiram_pipe_obj_t;
+
+static inline uint32_t pipe_used(const spiram_pipe_obj_t *self) {
+    uint32_t head = self->head;
+    uint32_t tail = self->tail;
+    return head >= tail ? head - tail : head + 2 * self->depth - tail;
+}
+
+static inline uint32_t pipe_advance(const spiram_pipe_obj_t *self, uint32_t i) {
+    return i + 1 == 2 * self->depth ? 0 : i + 1;
+}
+
+static inline uint32_t pipe_index(const spiram_pipe_obj_t *self, uint32_t i) {
+    return i >= self->depth ? i - self->depth : i;
+}
+
+static inline uint8_t *pipe_slot(const spiram_pipe_obj_t *self, uint32_t i) {
+    return self->mem + pipe_index(self, i) * self->slot_size;
+}
+
+static void pipe_start(spiram_pipe_obj_t *self) {
+    if (!self->started) {
+        self->started = true;
+        self->t_first = mp_hal_ticks_us();
+    }
+}
+
+// producer: publish the buffer at head
+static void pipe_publish(spiram_pipe_obj_t *self) {
+    self->len[pipe_index(self, self->head)] = self->fill;
+    self->bytes_in += self->fill;
+    self->fill = 0;
+    __DMB();
+    self->head = pipe_advance(self, self->head);
+}
+
+// consumer: release the buffer at tail
+static void pipe_release(spiram_pipe_obj_t *self) {
+    self->bytes_out += self->len[pipe_index(self, self->tail)];
+    self->t_last = mp_hal_ticks_us();
+    self->rd = 0;
+    __DMB();
+    self->tail = pipe_advance(self, self->tail);
+}
+
+// after close, the last buffer is published as soon as it is free;
+// the producer is done, so the consumer can move head.
+static void pipe_publish_last(spiram_pipe_obj_t *self) {
+    if (self->closed && self->fill != 0 && pipe_used(self) != self->depth) {
+        pipe_publish(self);
+    }
+}
+
+static bool pipe_eof(const spiram_pipe_obj_t *self) {
+    return self->closed && self->fill == 0 && pipe_used(self) == 0;
+}
+
+// spiram.Pipe(buf, *, depth=3)
+// buf is the storage, normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_pipe_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_depth };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_depth, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 3} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t depth = args[ARG_depth].u_int;
+    if (depth < 2 || depth > SPIRAM_PIPE_DEPTH_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad depth"));
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    // buffers start on a cache line, for dma
+    uint32_t start = ((uint32_t)bufinfo.buf + 31) & ~31;
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    size_t slot_size = end > start ? ((end - start) / depth) & ~(SPIRAM_PIPE_ALIGN - 1) : 0;
+    if (slot_size == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+
+    spiram_pipe_obj_t *self = m_new_obj(spiram_pipe_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->mem = (uint8_t *)start;
+    self->slot_size = slot_size;
+    self->depth = depth;
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_pipe_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "Pipe(depth=%u, size=%u, full=%u%s)", self->depth, self->slot_size, pipe_used(self), self->closed ? ", closed" : "");
+}
+
+// pipe.get_free()
+// memoryview of the free buffer, None if all buffers are full.
+
+STATIC mp_obj_t spiram_pipe_get_free(mp_obj_t self_in) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->closed) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    if (pipe_used(self) == self->depth) {
+        self->producer_waits++;
+        return mp_const_none;
+    }
+    pipe_start(self);
+    return mp_obj_new_memoryview('B' | MP_OBJ_ARRAY_TYPECODE_FLAG_RW, self->slot_size - self->fill, pipe_slot(self, self->head) + self->fill);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_pipe_get_free_obj, spiram_pipe_get_free);
+
+// pipe.put(n)
+// publish the free buffer, with n bytes written into the memoryview of get_free().
+
+STATIC mp_obj_t spiram_pipe_put(mp_obj_t self_in, mp_obj_t n_in) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_int_t n = mp_obj_get_int(n_in);
+    if (self->closed || pipe_used(self) == self->depth) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    if (n < 0 || self->fill + n > self->slot_size) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad length"));
+    }
+    self->fill += n;
+    if (self->fill != 0) {
+        pipe_publish(self);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_pipe_put_obj, spiram_pipe_put);
+
+// pipe.get_full()
+// memoryview of the oldest full buffer, None if no buffer is full yet, b'' at end of stream.
+
+STATIC mp_obj_t spiram_pipe_get_full(mp_obj_t self_in) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    pipe_publish_last(self);
+    if (pipe_used(self) == 0) {
+        if (pipe_eof(self)) {
+            return mp_const_empty_bytes;
+        }
+        self->consumer_waits++;
+        return mp_const_none;
+    }
+    __DMB();
+    size_t len = self->len[pipe_index(self, self->tail)];
+    return mp_obj_new_memoryview('B' | MP_OBJ_ARRAY_TYPECODE_FLAG_RW, len - self->rd, pipe_slot(self, self->tail) + self->rd);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_pipe_get_full_obj, spiram_pipe_get_full);
+
+// pipe.release()
+// free the buffer of get_full().
+
+STATIC mp_obj_t spiram_pipe_release(mp_obj_t self_in) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (pipe_used(self) == 0) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    pipe_release(self);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_pipe_release_obj, spiram_pipe_release);
+
+// pipe.stats()
+// (bytes in, bytes out, us from first byte in to last byte out, Mbyte/s, producer waits, consumer waits)
+
+STATIC mp_obj_t spiram_pipe_stats(mp_obj_t self_in) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    uint32_t us = self->bytes_out != 0 ? self->t_last - self->t_first : 0;
+    mp_obj_t t[6] = {
+        mp_obj_new_int_from_ull(self->bytes_in),
+        mp_obj_new_int_from_ull(self->bytes_out),
+        mp_obj_new_int_from_uint(us),
+        mp_obj_new_float(us ? (mp_float_t)self->bytes_out / us : 0),
+        mp_obj_new_int_from_uint(self->producer_waits),
+        mp_obj_new_int_from_uint(self->consumer_waits),
+    };
+    return mp_obj_new_tuple(6, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_pipe_stats_obj, spiram_pipe_stats);
+
+// read and write copy, and do not block; they fail with EAGAIN if no buffer is full or free.
+// read returns 0 at end of stream.
+
+STATIC mp_uint_t spiram_pipe_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    size_t done = 0;
+    pipe_publish_last(self);
+    while (done < size && pipe_used(self) != 0) {
+        __DMB();
+        size_t len = self->len[pipe_index(self, self->tail)];
+        size_t n = MIN(len - self->rd, size - done);
+        memcpy((uint8_t *)buf + done, pipe_slot(self, self->tail) + self->rd, n);
+        self->rd += n;
+        done += n;
+        if (self->rd == len) {
+            pipe_release(self);
+            pipe_publish_last(self);
+        }
+    }
+    if (done == 0 && size != 0 && !pipe_eof(self)) {
+        self->consumer_waits++;
+        *errcode = MP_EAGAIN;
+        return MP_STREAM_ERROR;
+    }
+    return done;
+}
+
+STATIC mp_uint_t spiram_pipe_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->closed) {
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
+    if (size != 0) {
+        pipe_start(self);
+    }
+    size_t done = 0;
+    while (done < size && pipe_used(self) != self->depth) {
+        size_t n = MIN(self->slot_size - self->fill, size - done);
+        memcpy(pipe_slot(self, self->head) + self->fill, (const uint8_t *)buf + done, n);
+        self->fill += n;
+        done += n;
+        if (self->fill == self->slot_size) {
+            pipe_publish(self);
+        }
+    }
+    if (done == 0 && size != 0) {
+        self->producer_waits++;
+        *errcode = MP_EAGAIN;
+        return MP_STREAM_ERROR;
+    }
+    return done;
+}
+
+STATIC mp_uint_t spiram_pipe_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    spiram_pipe_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (request == MP_STREAM_POLL) {
+        mp_uint_t ret = 0;
+        if ((arg & MP_STREAM_POLL_RD) && (pipe_used(self) != 0 || self->closed)) {
+            ret |= MP_STREAM_POLL_RD;
+        }
+        if ((arg & MP_STREAM_POLL_WR) && pipe_used(self) != self->depth) {
+            ret |= MP_STREAM_POLL_WR;
+        }
+        return ret;
+    } else if (request == MP_STREAM_FLUSH) {
+        // publish a partly filled buffer
+        if (self->fill != 0 && pipe_used(self) != self->depth) {
+            pipe_publish(self);
+        }
+        return 0;
+    } else if (request == MP_STREAM_CLOSE) {
+        self->closed = true;
+        pipe_publish_last(self);
+        return 0;
+    }
+    *errcode = MP_EINVAL;
+    return MP_STREAM_ERROR;
+}
+
+STATIC const mp_rom_map_elem_t spiram_pipe_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_get_free), MP_ROM_PTR(&spiram_pipe_get_free_obj) },
+    { MP_ROM_QSTR(MP_QSTR_put), MP_ROM_PTR(&spiram_pipe_put_obj) },
+    { MP_ROM_QSTR(MP_QSTR_get_full), MP_ROM_PTR(&spiram_pipe_get_full_obj) },
+    { MP_ROM_QSTR(MP_QSTR_release), MP_ROM_PTR(&spiram_pipe_release_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_pipe_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&mp_stream_flush_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_stream_close_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_pipe_locals_dict, spiram_pipe_locals_dict_table);
+
+STATIC const mp_stream_p_t spiram_pipe_stream_p = {
+    .read = spiram_pipe_read,
+    .write = spiram_pipe_write,
+    .ioctl = spiram_pipe_ioctl,
+};
+
+const mp_obj_type_t spiram_pipe_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Pipe,
+    .print = spiram_pipe_print,
+    .make_new = spiram_pipe_make_new,
+    .protocol = &spiram_pipe_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&spiram_pipe_locals_dict,
+};
+
+// not truncated
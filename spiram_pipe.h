@@ -0,0 +1,12 @@
+/*
+ * pipeline of buffers in spi ram, between a dma source and a dma sink
+ */
+#ifndef __SPIRAM_PIPE_H__
+#define __SPIRAM_PIPE_H__
+#include "py/obj.h"
+
+// most buffers in a pipe
+#define SPIRAM_PIPE_DEPTH_MAX (8)
+
+extern const mp_obj_type_t spiram_pipe_type;
+#endif // __SPIRAM_PIPE_H__
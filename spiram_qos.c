@@ -0,0 +1,272 @@
+/*
+ * bandwidth sharing between dma clients and cpu on the spi ram bus
+ */
+
+/* notes:
+ * the interpreter, the mdma and the dma streams of display and sd card
+ * all share one qspi bus to the spi ram.
+ *
+ * three knobs:
+ * - priority of the mdma memcpy channel and of the dma streams of the clients.
+ * - qos of the axi interconnect initiator ports. See the AXI interconnect chapter
+ *   of the reference manual for the port numbers.
+ * - background copies and clears are cut in chunks, and a chunk is only started
+ *   when the token bucket allows. Mbyte/s equals byte/us, so the bucket fills with
+ *   budget bytes per microsecond. lptim1 wakes up the transfer when the bucket is empty.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/mpconfig.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "spiram_qos.h"
+
+#if MICROPY_HW_ENABLE_MDMA
+
+#define SPIRAM_QOS_CHUNK (4096)
+#define SPIRAM_QOS_BURST (2 * SPIRAM_QOS_CHUNK)
+#define SPIRAM_QOS_RETRY_US (100)
+
+// axi interconnect global programmers view
+#define AXI_GPV_BASE (0x51000000)
+#define AXI_INI_READ_QOS(port) (*(volatile uint32_t *)(AXI_GPV_BASE + 0x42100 + 0x1000 * ((port) - 1)))
+#define AXI_INI_WRITE_QOS(port) (*(volatile uint32_t *)(AXI_GPV_BASE + 0x42104 + 0x1000 * ((port) - 1)))
+
+typedef struct _spiram_qos_job_t {
+    uint8_t *dst;
+    const uint8_t *src;     // NULL for clear
+    size_t len;
+    size_t pos;
+    dma_memcpy_done_t done;
+    void *arg;
+} spiram_qos_job_t;
+
+static volatile uint64_t spiram_qos_bytes[SPIRAM_QOS_NUM_CLIENTS];
+static uint8_t spiram_qos_priority[SPIRAM_QOS_NUM_CLIENTS] = {1, 0, 2, 1};
+static uint32_t spiram_qos_budget = 0;
+static uint32_t spiram_qos_tokens = SPIRAM_QOS_BURST;
+static uint32_t spiram_qos_tokens_us = 0;
+
+static spiram_qos_job_t spiram_qos_job[SPIRAM_QOS_QUEUE_LEN];
+static volatile uint32_t spiram_qos_job_head = 0;
+static volatile uint32_t spiram_qos_job_tail = 0;
+static volatile bool spiram_qos_running = false;
+static size_t spiram_qos_chunk_len;
+static bool spiram_qos_timer_inited = false;
+
+static const uint32_t spiram_qos_zero[256] = {0};
+
+static void spiram_qos_pump(void);
+
+// -----------------------------------------------------------------------------
+// accounting
+
+void spiram_qos_account(uint32_t client, uint32_t bytes) {
+    uint32_t irq_state = disable_irq();
+    spiram_qos_bytes[client] += bytes;
+    enable_irq(irq_state);
+}
+
+void spiram_qos_stats(uint64_t *bytes) {
+    uint32_t irq_state = disable_irq();
+    for (uint32_t i = 0; i < SPIRAM_QOS_NUM_CLIENTS; ++i) {
+        bytes[i] = spiram_qos_bytes[i];
+    }
+    // foreground copies are what the memcpy service did besides background work
+    bytes[SPIRAM_QOS_COPY] = dma_memcpy_bytes() - spiram_qos_bytes[SPIRAM_QOS_BACKGROUND];
+    enable_irq(irq_state);
+}
+
+// -----------------------------------------------------------------------------
+// priorities
+
+void spiram_qos_set_priority(uint32_t client, uint32_t priority) {
+    spiram_qos_priority[client] = priority & 3;
+    if (client == SPIRAM_QOS_COPY) {
+        dma_memcpy_set_priority(priority);
+    }
+}
+
+// as DMA_PRIORITY_LOW .. DMA_PRIORITY_VERY_HIGH, for DMA_InitTypeDef.Priority
+uint32_t spiram_qos_dma_priority(uint32_t client) {
+    return (uint32_t)spiram_qos_priority[client] << DMA_SxCR_PL_Pos;
+}
+
+// set priority of a dma stream. Only has effect while the stream is disabled.
+void spiram_qos_apply_dma(void *dma_stream, uint32_t client) {
+    DMA_Stream_TypeDef *stream = dma_stream;
+    if (!(stream->CR & DMA_SxCR_EN)) {
+        stream->CR = (stream->CR & ~DMA_SxCR_PL) | spiram_qos_dma_priority(client);
+    }
+}
+
+// qos 0 (low) .. 15 (high) of an axi initiator port
+int spiram_qos_set_axi(uint32_t port, uint32_t read_qos, uint32_t write_qos) {
+    if (port < 1 || port > SPIRAM_QOS_AXI_PORTS || read_qos > SPIRAM_QOS_AXI_MAX || write_qos > SPIRAM_QOS_AXI_MAX) {
+        return -MP_EINVAL;
+    }
+    AXI_INI_READ_QOS(port) = read_qos;
+    AXI_INI_WRITE_QOS(port) = write_qos;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// lptim1 one-shot, to restart background transfers when the bucket has refilled.
+// lptim1 runs from pclk1, divided by 128.
+
+static void spiram_qos_timer_start(uint32_t us) {
+    if (!spiram_qos_timer_inited) {
+        __HAL_RCC_LPTIM1_CLK_ENABLE();
+        LPTIM1->CR = 0;
+        LPTIM1->CFGR = 7 << LPTIM_CFGR_PRESC_Pos;
+        LPTIM1->IER = LPTIM_IER_ARRMIE;
+        NVIC_SetPriority(LPTIM1_IRQn, IRQ_PRI_DMA);
+        HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+        spiram_qos_timer_inited = true;
+    }
+    uint32_t ticks = (uint64_t)us * (HAL_RCC_GetPCLK1Freq() / 128) / 1000000;
+    ticks = MAX(ticks, 2);
+    ticks = MIN(ticks, 0xffff);
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+    LPTIM1->ICR = LPTIM_ICR_ARROKCF | LPTIM_ICR_ARRMCF;
+    LPTIM1->ARR = ticks;
+    while (!(LPTIM1->ISR & LPTIM_ISR_ARROK)) {
+    }
+    LPTIM1->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+}
+
+void LPTIM1_IRQHandler(void) {
+    IRQ_ENTER(LPTIM1_IRQn);
+    LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+    LPTIM1->CR = 0;
+    uint32_t irq_state = disable_irq();
+    spiram_qos_pump();
+    enable_irq(irq_state);
+    IRQ_EXIT(LPTIM1_IRQn);
+}
+
+// -----------------------------------------------------------------------------
+// background transfers
+
+void spiram_qos_set_budget(uint32_t mbps) {
+    uint32_t irq_state = disable_irq();
+    spiram_qos_budget = MIN(mbps, SPIRAM_QOS_BUDGET_MAX);
+    spiram_qos_tokens = SPIRAM_QOS_BURST;
+    spiram_qos_tokens_us = mp_hal_ticks_us();
+    spiram_qos_pump();
+    enable_irq(irq_state);
+}
+
+uint32_t spiram_qos_get_budget(void) {
+    return spiram_qos_budget;
+}
+
+static void spiram_qos_refill(void) {
+    uint32_t now = mp_hal_ticks_us();
+    uint32_t dt = MIN(now - spiram_qos_tokens_us, 1000000);
+    spiram_qos_tokens_us = now;
+    spiram_qos_tokens = MIN(spiram_qos_tokens + (uint64_t)dt * spiram_qos_budget, SPIRAM_QOS_BURST);
+}
+
+static void spiram_qos_chunk_done(void *arg, int err) {
+    spiram_qos_job_t *job = &spiram_qos_job[spiram_qos_job_tail % SPIRAM_QOS_QUEUE_LEN];
+    spiram_qos_bytes[SPIRAM_QOS_BACKGROUND] += spiram_qos_chunk_len;
+    job->pos += spiram_qos_chunk_len;
+    spiram_qos_running = false;
+    if (err != 0 || job->pos >= job->len) {
+        dma_memcpy_done_t done = job->done;
+        void *done_arg = job->arg;
+        spiram_qos_job_tail += 1;
+        if (done != NULL) {
+            done(done_arg, err);
+        }
+    }
+    spiram_qos_pump();
+}
+
+// start the next chunk, if the budget allows. Called with irq disabled.
+static void spiram_qos_pump(void) {
+    if (spiram_qos_running || spiram_qos_job_tail == spiram_qos_job_head) {
+        return;
+    }
+    spiram_qos_job_t *job = &spiram_qos_job[spiram_qos_job_tail % SPIRAM_QOS_QUEUE_LEN];
+    size_t n = MIN(SPIRAM_QOS_CHUNK, job->len - job->pos);
+
+    if (spiram_qos_budget != 0) {
+        spiram_qos_refill();
+        if (spiram_qos_tokens < n) {
+            spiram_qos_timer_start((n - spiram_qos_tokens) / spiram_qos_budget + 1);
+            return;
+        }
+        spiram_qos_tokens -= n;
+    }
+
+    dma_memcpy_sg_t sg[SPIRAM_QOS_CHUNK / sizeof(spiram_qos_zero)];
+    size_t sg_n = 0;
+    if (job->src != NULL) {
+        sg[0].dst = job->dst + job->pos;
+        sg[0].src = job->src + job->pos;
+        sg[0].len = n;
+        sg_n = 1;
+    } else {
+        for (size_t pos = 0; pos < n; pos += sizeof(spiram_qos_zero)) {
+            sg[sg_n].dst = job->dst + job->pos + pos;
+            sg[sg_n].src = spiram_qos_zero;
+            sg[sg_n].len = MIN(sizeof(spiram_qos_zero), n - pos);
+            ++sg_n;
+        }
+    }
+
+    spiram_qos_running = true;
+    spiram_qos_chunk_len = n;
+    if (dma_memcpy_sg_async(sg, sg_n, spiram_qos_chunk_done, NULL) != 0) {
+        // memcpy queue full of foreground work; try again later
+        spiram_qos_running = false;
+        spiram_qos_tokens += n;
+        spiram_qos_timer_start(SPIRAM_QOS_RETRY_US);
+    }
+}
+
+static int spiram_qos_queue(void *dst, const void *src, size_t len, dma_memcpy_done_t done, void *arg) {
+    uint32_t irq_state = disable_irq();
+    if (spiram_qos_job_head - spiram_qos_job_tail >= SPIRAM_QOS_QUEUE_LEN) {
+        enable_irq(irq_state);
+        return -MP_EBUSY;
+    }
+    spiram_qos_job_t *job = &spiram_qos_job[spiram_qos_job_head % SPIRAM_QOS_QUEUE_LEN];
+    job->dst = dst;
+    job->src = src;
+    job->len = len;
+    job->pos = 0;
+    job->done = done;
+    job->arg = arg;
+    spiram_qos_job_head += 1;
+    spiram_qos_pump();
+    enable_irq(irq_state);
+    return 0;
+}
+
+int spiram_qos_copy_async(void *dst, const void *src, size_t len, dma_memcpy_done_t done, void *arg) {
+    if (len == 0) {
+        return 0;
+    }
+    return spiram_qos_queue(dst, src, len, done, arg);
+}
+
+int spiram_qos_clear_async(void *dst, size_t len, dma_memcpy_done_t done, void *arg) {
+    if (len == 0) {
+        return 0;
+    }
+    return spiram_qos_queue(dst, NULL, len, done, arg);
+}
+
+bool spiram_qos_busy(void) {
+    return spiram_qos_job_tail != spiram_qos_job_head;
+}
+
+#endif // MICROPY_HW_ENABLE_MDMA
+
+// not truncated
@@ -0,0 +1,48 @@
+/*
+ * bandwidth sharing between dma clients and cpu on the spi ram bus
+ */
+#ifndef __SPIRAM_QOS_H__
+#define __SPIRAM_QOS_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mdma.h"
+
+enum {
+    SPIRAM_QOS_COPY,            // mdma memcpy, foreground
+    SPIRAM_QOS_BACKGROUND,      // mdma memcpy, throttled
+    SPIRAM_QOS_DISPLAY,
+    SPIRAM_QOS_SDCARD,
+    SPIRAM_QOS_NUM_CLIENTS
+};
+
+// dma drivers call this when a transfer to or from spi ram completes
+void spiram_qos_account(uint32_t client, uint32_t bytes);
+void spiram_qos_stats(uint64_t *bytes);
+
+// priority 0 (low) .. 3 (very high)
+void spiram_qos_set_priority(uint32_t client, uint32_t priority);
+uint32_t spiram_qos_dma_priority(uint32_t client);
+void spiram_qos_apply_dma(void *dma_stream, uint32_t client);
+
+// axi interconnect initiator ports 1 .. SPIRAM_QOS_AXI_PORTS, qos 0 (low) .. 15 (high).
+// RM0455: ports 1 .. 7 on stm32h7a3/b3/b0. RM0433: ports 1 .. 6 on stm32h743.
+#if defined(STM32H7A3xx) || defined(STM32H7A3xxQ) || defined(STM32H7B3xx) || defined(STM32H7B3xxQ) || defined(STM32H7B0xx) || defined(STM32H7B0xxQ)
+#define SPIRAM_QOS_AXI_PORTS (7)
+#else
+#define SPIRAM_QOS_AXI_PORTS (6)
+#endif
+#define SPIRAM_QOS_AXI_MAX (15)
+
+// returns 0, or -MP_EINVAL for a port or qos out of range
+int spiram_qos_set_axi(uint32_t port, uint32_t read_qos, uint32_t write_qos);
+
+// background transfers, limited to budget Mbyte/s, at most SPIRAM_QOS_BUDGET_MAX. 0 is no limit.
+#define SPIRAM_QOS_BUDGET_MAX (1000)
+void spiram_qos_set_budget(uint32_t mbps);
+#define SPIRAM_QOS_QUEUE_LEN (4)      // background transfers queued
+uint32_t spiram_qos_get_budget(void);
+int spiram_qos_copy_async(void *dst, const void *src, size_t len, dma_memcpy_done_t done, void *arg);
+int spiram_qos_clear_async(void *dst, size_t len, dma_memcpy_done_t done, void *arg);
+bool spiram_qos_busy(void);
+#endif // __SPIRAM_QOS_H__
@@ -0,0 +1,265 @@
+/*
+ * message queue in spi ram, one producer and one consumer, no locks
+ */
+
+/* notes:
+ * a spiram_ring with length-prefixed messages. Each message is a 32-bit length,
+ * then the data, padded to a multiple of 4 bytes, so the length never wraps.
+ * The producer publishes a message with a single head update, after a barrier;
+ * the consumer releases it with a single tail update.
+ *
+ * The queue descriptors come from a small static pool, so head and tail are in
+ * internal ram, even though the python heap is in spi ram. Polling an empty
+ * queue does not touch the qspi bus.
+ *
+ * Producer and consumer can be an interrupt handler, a dma callback, a python
+ * thread or the main interpreter; no lock, no gil, no allocation on either side.
+ * Storage is written and read by the cpu only, so there is no cache maintenance.
+ *
+ * close clears the storage pointer with irqs off. A producer in an interrupt handler
+ * that still holds the queue then finds it closed, and put and get do nothing, until
+ * the descriptor is reused by the next open.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "spiram_ring.h"
+#include "spiram_queue.h"
+
+#define SPIRAM_QUEUE_HDR (4)
+
+static spiram_queue_t spiram_queue_pool[MICROPY_HW_SPIRAM_QUEUE_NUM];
+
+static inline size_t spiram_queue_pad(size_t len) {
+    return (len + 3) & ~3;
+}
+
+static inline size_t spiram_queue_index(const spiram_queue_t *q, size_t i) {
+    return i >= q->ring.size ? i - q->ring.size : i;
+}
+
+spiram_queue_t *spiram_queue_open(void *storage, size_t size) {
+    uint32_t start = ((uint32_t)storage + 3) & ~3;
+    uint32_t end = ((uint32_t)storage + size) & ~3;
+    if (end < start + 2 * SPIRAM_QUEUE_HDR) {
+        return NULL;
+    }
+    spiram_queue_t *q = NULL;
+    uint32_t irq_state = disable_irq();
+    for (size_t i = 0; i < MICROPY_HW_SPIRAM_QUEUE_NUM; ++i) {
+        if (!spiram_queue_pool[i].in_use) {
+            q = &spiram_queue_pool[i];
+            q->in_use = true;
+            break;
+        }
+    }
+    enable_irq(irq_state);
+    if (q != NULL) {
+        spiram_ring_init(&q->ring, (void *)start, end - start);
+    }
+    return q;
+}
+
+void spiram_queue_close(spiram_queue_t *q) {
+    uint32_t irq_state = disable_irq();
+    q->ring.buf = NULL;
+    q->ring.size = 0;
+    __DMB();
+    q->in_use = false;
+    enable_irq(irq_state);
+}
+
+static inline bool spiram_queue_closed(const spiram_queue_t *q) {
+    return q->ring.buf == NULL;
+}
+
+size_t spiram_queue_free(const spiram_queue_t *q) {
+    if (spiram_queue_closed(q)) {
+        return 0;
+    }
+    size_t n = spiram_ring_free(&q->ring);
+    return n > SPIRAM_QUEUE_HDR ? (n - SPIRAM_QUEUE_HDR) & ~3 : 0;
+}
+
+bool spiram_queue_put(spiram_queue_t *q, const void *src, size_t len) {
+    size_t need = SPIRAM_QUEUE_HDR + spiram_queue_pad(len);
+    if (len == 0 || spiram_queue_closed(q) || spiram_ring_free(&q->ring) < need) {
+        return false;
+    }
+    size_t i = spiram_queue_index(q, q->ring.head);
+    *(uint32_t *)(q->ring.buf + i) = len;
+    i = spiram_queue_index(q, i + SPIRAM_QUEUE_HDR);
+    size_t n = MIN(len, q->ring.size - i);
+    memcpy(q->ring.buf + i, src, n);
+    memcpy(q->ring.buf, (const uint8_t *)src + n, len - n);
+    spiram_ring_commit(&q->ring, need);
+    return true;
+}
+
+size_t spiram_queue_next_len(const spiram_queue_t *q) {
+    if (spiram_queue_closed(q) || spiram_ring_used(&q->ring) < SPIRAM_QUEUE_HDR) {
+        return 0;
+    }
+    __DMB();
+    return *(const uint32_t *)(q->ring.buf + spiram_queue_index(q, q->ring.tail));
+}
+
+int spiram_queue_get(spiram_queue_t *q, void *dst, size_t len) {
+    if (spiram_queue_closed(q)) {
+        return -MP_EBADF;
+    }
+    size_t msg_len = spiram_queue_next_len(q);
+    if (msg_len == 0) {
+        return 0;
+    }
+    if (msg_len > len) {
+        return -MP_ENOBUFS;
+    }
+    size_t i = spiram_queue_index(q, spiram_queue_index(q, q->ring.tail) + SPIRAM_QUEUE_HDR);
+    size_t n = MIN(msg_len, q->ring.size - i);
+    memcpy(dst, q->ring.buf + i, n);
+    memcpy((uint8_t *)dst + n, q->ring.buf, msg_len - n);
+    spiram_ring_consume(&q->ring, SPIRAM_QUEUE_HDR + spiram_queue_pad(msg_len));
+    return msg_len;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+typedef struct _spiram_queue_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the storage alive
+    spiram_queue_t *q;
+} spiram_queue_obj_t;
+
+spiram_queue_t *spiram_queue_from_obj(mp_obj_t obj) {
+    if (!mp_obj_is_type(obj, &spiram_queue_type)) {
+        mp_raise_TypeError(MP_ERROR_TEXT("expecting a Queue"));
+    }
+    spiram_queue_obj_t *self = MP_OBJ_TO_PTR(obj);
+    if (self->q == NULL) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    return self->q;
+}
+
+// spiram.Queue(buf)
+// buf is the storage, normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_queue_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_RW);
+    spiram_queue_obj_t *self = m_new_obj_with_finaliser(spiram_queue_obj_t);
+    self->base.type = type;
+    self->buf = args[0];
+    self->q = spiram_queue_open(bufinfo.buf, bufinfo.len);
+    if (self->q == NULL) {
+        mp_raise_OSError(MP_ENOMEM);
+    }
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_queue_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_queue_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->q == NULL) {
+        mp_printf(print, "Queue(closed)");
+    } else {
+        mp_printf(print, "Queue(size=%u, used=%u)", self->q->ring.size, spiram_ring_used(&self->q->ring));
+    }
+}
+
+// queue.put_from(buf, timeout_ms=0)
+// returns True if buf was queued, False if the queue stayed full for timeout_ms.
+
+STATIC mp_obj_t spiram_queue_put_from(size_t n_args, const mp_obj_t *args) {
+    spiram_queue_t *q = spiram_queue_from_obj(args[0]);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
+    if (bufinfo.len == 0 || bufinfo.len + SPIRAM_QUEUE_HDR > q->ring.size) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad message length"));
+    }
+    mp_uint_t timeout_ms = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_uint_t start = mp_hal_ticks_ms();
+    while (!spiram_queue_put(q, bufinfo.buf, bufinfo.len)) {
+        if (mp_hal_ticks_ms() - start >= timeout_ms) {
+            return mp_const_false;
+        }
+        MICROPY_EVENT_POLL_HOOK
+    }
+    return mp_const_true;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_queue_put_from_obj, 2, 3, spiram_queue_put_from);
+
+// queue.get_into(buf, timeout_ms=0)
+// returns the message length, or None if the queue stayed empty for timeout_ms.
+
+STATIC mp_obj_t spiram_queue_get_into(size_t n_args, const mp_obj_t *args) {
+    spiram_queue_t *q = spiram_queue_from_obj(args[0]);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_WRITE);
+    mp_uint_t timeout_ms = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_uint_t start = mp_hal_ticks_ms();
+    int ret;
+    while ((ret = spiram_queue_get(q, bufinfo.buf, bufinfo.len)) == 0) {
+        if (mp_hal_ticks_ms() - start >= timeout_ms) {
+            return mp_const_none;
+        }
+        MICROPY_EVENT_POLL_HOOK
+    }
+    if (ret < 0) {
+        mp_raise_OSError(-ret);
+    }
+    return MP_OBJ_NEW_SMALL_INT(ret);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_queue_get_into_obj, 2, 3, spiram_queue_get_into);
+
+// queue.any()
+// returns the length of the next message, 0 if the queue is empty.
+
+STATIC mp_obj_t spiram_queue_any(mp_obj_t self_in) {
+    return MP_OBJ_NEW_SMALL_INT(spiram_queue_next_len(spiram_queue_from_obj(self_in)));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_queue_any_obj, spiram_queue_any);
+
+// queue.free()
+// returns the longest message that fits now.
+
+STATIC mp_obj_t spiram_queue_free_obj_fn(mp_obj_t self_in) {
+    return MP_OBJ_NEW_SMALL_INT(spiram_queue_free(spiram_queue_from_obj(self_in)));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_queue_free_obj, spiram_queue_free_obj_fn);
+
+STATIC mp_obj_t spiram_queue_close_fn(mp_obj_t self_in) {
+    spiram_queue_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->q != NULL) {
+        spiram_queue_close(self->q);
+        self->q = NULL;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_queue_close_obj, spiram_queue_close_fn);
+
+STATIC const mp_rom_map_elem_t spiram_queue_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_put_from), MP_ROM_PTR(&spiram_queue_put_from_obj) },
+    { MP_ROM_QSTR(MP_QSTR_get_into), MP_ROM_PTR(&spiram_queue_get_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_any), MP_ROM_PTR(&spiram_queue_any_obj) },
+    { MP_ROM_QSTR(MP_QSTR_free), MP_ROM_PTR(&spiram_queue_free_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&spiram_queue_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_queue_close_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_queue_locals_dict, spiram_queue_locals_dict_table);
+
+const mp_obj_type_t spiram_queue_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Queue,
+    .print = spiram_queue_print,
+    .make_new = spiram_queue_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_queue_locals_dict,
+};
+
+// not truncated
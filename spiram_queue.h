@@ -0,0 +1,40 @@
+/*
+ * message queue in spi ram, one producer and one consumer, no locks
+ */
+#ifndef __SPIRAM_QUEUE_H__
+#define __SPIRAM_QUEUE_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+#include "spiram_ring.h"
+
+#ifndef MICROPY_HW_SPIRAM_QUEUE_NUM
+#define MICROPY_HW_SPIRAM_QUEUE_NUM (8)
+#endif
+
+// The queue itself, with head and tail, is in internal ram; only the storage is in spi ram.
+typedef struct _spiram_queue_t {
+    spiram_ring_t ring;
+    bool in_use;
+} spiram_queue_t;
+
+// storage is a buffer in spi ram. Returns NULL if all queues are in use.
+spiram_queue_t *spiram_queue_open(void *storage, size_t size);
+// after close, put returns false, get -MP_EBADF, and free and next_len 0, until the next open
+void spiram_queue_close(spiram_queue_t *q);
+
+// producer side, also from interrupt handlers. A message is put whole, or not at all.
+bool spiram_queue_put(spiram_queue_t *q, const void *src, size_t len);
+size_t spiram_queue_free(const spiram_queue_t *q);
+
+// consumer side. Returns the message length, 0 if empty,
+// or -MP_ENOBUFS if the next message is longer than len; it then stays in the queue.
+int spiram_queue_get(spiram_queue_t *q, void *dst, size_t len);
+size_t spiram_queue_next_len(const spiram_queue_t *q);
+
+// for c drivers that produce into a queue created from python
+spiram_queue_t *spiram_queue_from_obj(mp_obj_t obj);
+
+extern const mp_obj_type_t spiram_queue_type;
+#endif // __SPIRAM_QUEUE_H__
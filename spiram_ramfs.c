@@ -0,0 +1,942 @@
+/*
+ * filesystem in spi ram, files as lists of extents, no block device
+ */
+
+/* notes:
+ * a vfs for os.mount(), like VfsFat and VfsLfs2, but without a block device
+ * below it: no sector translation, no sector buffer, no copy through one. The
+ * storage buf is cut in chunks, 4 kbyte by default, and a bitmap records the
+ * chunks in use. A file is a list of extents, runs of consecutive chunks;
+ * reading and writing copy straight between the caller's buffer and the
+ * extents, by mdma for large copies.
+ *
+ * A growing file first extends its last extent in place, else takes the first
+ * free run that is large enough, else the largest free run. It grows by half
+ * its size at a time, so a file written in small pieces still has few extents;
+ * close() returns the chunks past the end of the file.
+ *
+ * read_view(n) and write_view(n) are memoryviews of the file contents at the
+ * file position, up to the end of the extent, for zero-copy access: dma straight
+ * into a file, or sending a file without reading it first. A view is valid as
+ * long as the file is not truncated or removed.
+ *
+ * Directories and file metadata are small objects on the heap; the contents are
+ * in buf. Everything is lost at reset.
+ */
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/mperrno.h"
+#include "extmod/vfs.h"
+#include "mdma.h"
+#include "spiram_ramfs.h"
+
+typedef struct _ramfs_extent_t {
+    uint32_t start;             // in chunks
+    uint32_t count;
+} ramfs_extent_t;
+
+typedef struct _ramfs_node_t {
+    struct _ramfs_node_t *parent;
+    struct _ramfs_node_t *next; // next entry in the same directory
+    struct _ramfs_node_t *child; // first entry, of a directory
+    ramfs_extent_t *extent;
+    uint32_t n_extents;
+    uint32_t max_extents;
+    uint32_t chunks;            // in all extents
+    uint32_t size;
+    uint32_t ino;
+    uint16_t opens;
+    bool dir;
+    bool unlinked;              // removed while open; freed at the last close
+    char name[SPIRAM_RAMFS_NAME_MAX + 1];
+} ramfs_node_t;
+
+typedef struct _spiram_ramfs_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the storage alive
+    uint8_t *mem;
+    uint32_t *map;              // chunk bitmap, 1 is in use
+    uint32_t n_chunks;
+    uint32_t free_chunks;
+    uint32_t chunk_size;
+    uint32_t n_files;
+    uint32_t next_ino;
+    bool readonly;
+    ramfs_node_t *cwd;
+    ramfs_node_t root;
+} spiram_ramfs_obj_t;
+
+typedef struct _ramfs_file_obj_t {
+    mp_obj_base_t base;
+    spiram_ramfs_obj_t *fs;
+    ramfs_node_t *node;         // NULL when closed
+    uint32_t pos;
+    bool readable;
+    bool writable;
+    bool append;
+} ramfs_file_obj_t;
+
+// a path, split in the directory and the last name
+typedef struct _ramfs_path_t {
+    ramfs_node_t *dir;
+    ramfs_node_t *node;         // the last name in dir, NULL if it does not exist
+    const char *name;
+    size_t len;
+} ramfs_path_t;
+
+STATIC const mp_obj_type_t ramfs_fileio_type;
+STATIC const mp_obj_type_t ramfs_textio_type;
+
+// -----------------------------------------------------------------------------
+// chunks
+
+static inline bool chunk_used(const spiram_ramfs_obj_t *self, uint32_t i) {
+    return self->map[i / 32] & (1u << (i % 32));
+}
+
+static void chunks_mark(spiram_ramfs_obj_t *self, uint32_t start, uint32_t count, bool used) {
+    for (uint32_t i = start; i < start + count; ++i) {
+        if (used) {
+            self->map[i / 32] |= 1u << (i % 32);
+        } else {
+            self->map[i / 32] &= ~(1u << (i % 32));
+        }
+    }
+    if (used) {
+        self->free_chunks -= count;
+    } else {
+        self->free_chunks += count;
+    }
+}
+
+// the first free run of want chunks; if there is none, the longest free run
+static uint32_t chunks_find(const spiram_ramfs_obj_t *self, uint32_t want, uint32_t *got) {
+    uint32_t best_start = 0;
+    uint32_t best_len = 0;
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < self->n_chunks; ++i) {
+        if (i % 32 == 0 && self->map[i / 32] == 0xffffffff) {
+            run = 0;
+            i += 31;
+            continue;
+        }
+        if (chunk_used(self, i)) {
+            run = 0;
+            continue;
+        }
+        if (++run > best_len) {
+            best_len = run;
+            best_start = i + 1 - run;
+            if (run == want) {
+                break;
+            }
+        }
+    }
+    *got = best_len;
+    return best_start;
+}
+
+static void ramfs_format(spiram_ramfs_obj_t *self) {
+    size_t words = (self->n_chunks + 31) / 32;
+    memset(self->map, 0, words * sizeof(uint32_t));
+    // bits past the last chunk are in use, so they are never found
+    for (uint32_t i = self->n_chunks; i < words * 32; ++i) {
+        self->map[i / 32] |= 1u << (i % 32);
+    }
+    self->free_chunks = self->n_chunks;
+    self->n_files = 0;
+    self->next_ino = 1;
+    memset(&self->root, 0, sizeof(self->root));
+    self->root.dir = true;
+    self->root.ino = self->next_ino++;
+    self->cwd = &self->root;
+}
+
+// -----------------------------------------------------------------------------
+// file contents
+
+// make room for size bytes. Returns 0 or negative errno.
+static int node_reserve(spiram_ramfs_obj_t *self, ramfs_node_t *node, uint32_t size) {
+    uint32_t need = (size + self->chunk_size - 1) / self->chunk_size;
+    if (need <= node->chunks) {
+        return 0;
+    }
+    uint32_t min_add = need - node->chunks;
+    if (min_add > self->free_chunks) {
+        return -MP_ENOSPC;
+    }
+    // grow by half the file at least; close() trims
+    uint32_t want = MIN(MAX(min_add, node->chunks / 2), self->free_chunks);
+    uint32_t added = 0;
+    if (node->n_extents != 0) {
+        // in place, after the last extent
+        ramfs_extent_t *last = &node->extent[node->n_extents - 1];
+        uint32_t next = last->start + last->count;
+        while (added < want && next + added < self->n_chunks && !chunk_used(self, next + added)) {
+            ++added;
+        }
+        chunks_mark(self, next, added, true);
+        last->count += added;
+        node->chunks += added;
+    }
+    while (added < min_add) {
+        if (node->n_extents == node->max_extents) {
+            uint32_t max = node->max_extents == 0 ? 2 : 2 * node->max_extents;
+            node->extent = m_renew(ramfs_extent_t, node->extent, node->max_extents, max);
+            node->max_extents = max;
+        }
+        uint32_t got;
+        uint32_t start = chunks_find(self, want - added, &got);
+        chunks_mark(self, start, got, true);
+        node->extent[node->n_extents++] = (ramfs_extent_t) {start, got};
+        node->chunks += got;
+        added += got;
+    }
+    return 0;
+}
+
+// return the chunks past size
+static void node_trim(spiram_ramfs_obj_t *self, ramfs_node_t *node, uint32_t size) {
+    uint32_t keep = (size + self->chunk_size - 1) / self->chunk_size;
+    while (node->chunks > keep) {
+        ramfs_extent_t *last = &node->extent[node->n_extents - 1];
+        uint32_t drop = MIN(last->count, node->chunks - keep);
+        chunks_mark(self, last->start + last->count - drop, drop, false);
+        last->count -= drop;
+        node->chunks -= drop;
+        if (last->count == 0) {
+            node->n_extents--;
+        }
+    }
+    node->size = MIN(node->size, size);
+}
+
+// the byte at pos, and how many bytes follow it in the same extent
+static uint8_t *node_span(const spiram_ramfs_obj_t *self, const ramfs_node_t *node, uint32_t pos, uint32_t *avail) {
+    for (uint32_t i = 0; i < node->n_extents; ++i) {
+        uint32_t len = node->extent[i].count * self->chunk_size;
+        if (pos < len) {
+            *avail = len - pos;
+            return self->mem + node->extent[i].start * self->chunk_size + pos;
+        }
+        pos -= len;
+    }
+    *avail = 0;
+    return NULL;
+}
+
+static int ramfs_copy(void *dst, const void *src, size_t len) {
+    #if MICROPY_HW_ENABLE_MDMA
+    return dma_memcpy(dst, src, len);
+    #else
+    memcpy(dst, src, len);
+    return 0;
+    #endif
+}
+
+// a file that is written past its end reads zeros in between
+static void node_zero(const spiram_ramfs_obj_t *self, const ramfs_node_t *node, uint32_t from, uint32_t to) {
+    while (from < to) {
+        uint32_t avail;
+        uint8_t *p = node_span(self, node, from, &avail);
+        uint32_t n = MIN(avail, to - from);
+        memset(p, 0, n);
+        from += n;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// directories
+
+static ramfs_node_t *node_child(const ramfs_node_t *dir, const char *name, size_t len) {
+    for (ramfs_node_t *node = dir->child; node != NULL; node = node->next) {
+        if (strncmp(node->name, name, len) == 0 && node->name[len] == '\0') {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void node_link(ramfs_node_t *dir, ramfs_node_t *node) {
+    ramfs_node_t **pp = &dir->child;
+    while (*pp != NULL) {
+        pp = &(*pp)->next;
+    }
+    *pp = node;
+    node->parent = dir;
+    node->next = NULL;
+}
+
+static void node_unlink(ramfs_node_t *node) {
+    ramfs_node_t **pp = &node->parent->child;
+    while (*pp != node) {
+        pp = &(*pp)->next;
+    }
+    *pp = node->next;
+    node->next = NULL;
+}
+
+static ramfs_node_t *node_new(spiram_ramfs_obj_t *self, ramfs_node_t *dir, const char *name, size_t len, bool is_dir) {
+    ramfs_node_t *node = m_new0(ramfs_node_t, 1);
+    memcpy(node->name, name, len);
+    node->dir = is_dir;
+    node->ino = self->next_ino++;
+    node_link(dir, node);
+    self->n_files++;
+    return node;
+}
+
+static void node_remove(spiram_ramfs_obj_t *self, ramfs_node_t *node) {
+    node_unlink(node);
+    self->n_files--;
+    if (node->opens == 0) {
+        node_trim(self, node, 0);
+    } else {
+        node->unlinked = true;
+    }
+}
+
+// walk path, absolute or from the current directory. Returns 0 or negative errno.
+static int ramfs_walk(spiram_ramfs_obj_t *self, const char *path, ramfs_path_t *p) {
+    ramfs_node_t *dir = *path == '/' ? &self->root : self->cwd;
+    const char *s = path;
+    for (;;) {
+        while (*s == '/') {
+            ++s;
+        }
+        const char *e = s;
+        while (*e != '\0' && *e != '/') {
+            ++e;
+        }
+        const char *next = e;
+        while (*next == '/') {
+            ++next;
+        }
+        size_t len = e - s;
+        ramfs_node_t *node;
+        if (len == 0 || (len == 1 && s[0] == '.')) {
+            node = dir;
+        } else if (len == 2 && s[0] == '.' && s[1] == '.') {
+            node = dir->parent != NULL ? dir->parent : dir;
+        } else {
+            node = node_child(dir, s, len);
+        }
+        if (*next == '\0') {
+            p->dir = dir;
+            p->node = node;
+            p->name = s;
+            p->len = len;
+            return 0;
+        }
+        if (node == NULL) {
+            return -MP_ENOENT;
+        }
+        if (!node->dir) {
+            return -MP_ENOTDIR;
+        }
+        dir = node;
+        s = next;
+    }
+}
+
+// a name that can be created: not empty, not . or .., not too long
+static int ramfs_check_name(const ramfs_path_t *p) {
+    if (p->len == 0 || (p->len <= 2 && strncmp(p->name, "..", p->len) == 0)) {
+        return -MP_EEXIST;
+    }
+    if (p->len > SPIRAM_RAMFS_NAME_MAX) {
+        return -MP_EINVAL;
+    }
+    return 0;
+}
+
+static void ramfs_check(int ret) {
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+}
+
+static ramfs_path_t ramfs_path(spiram_ramfs_obj_t *self, mp_obj_t path_in) {
+    ramfs_path_t p;
+    ramfs_check(ramfs_walk(self, mp_obj_str_get_str(path_in), &p));
+    return p;
+}
+
+static ramfs_node_t *ramfs_lookup(spiram_ramfs_obj_t *self, mp_obj_t path_in) {
+    ramfs_path_t p = ramfs_path(self, path_in);
+    if (p.node == NULL) {
+        mp_raise_OSError(MP_ENOENT);
+    }
+    return p.node;
+}
+
+static void ramfs_check_writable(spiram_ramfs_obj_t *self) {
+    if (self->readonly) {
+        mp_raise_OSError(MP_EROFS);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// files
+
+static void ramfs_file_close(ramfs_file_obj_t *self) {
+    ramfs_node_t *node = self->node;
+    if (node == NULL) {
+        return;
+    }
+    self->node = NULL;
+    self->readable = false;
+    self->writable = false;
+    node->opens--;
+    if (node->unlinked) {
+        if (node->opens == 0) {
+            node_trim(self->fs, node, 0);
+        }
+    } else if (node->opens == 0) {
+        node_trim(self->fs, node, node->size);
+    }
+}
+
+STATIC mp_uint_t ramfs_file_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+    ramfs_file_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->readable) {
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
+    ramfs_node_t *node = self->node;
+    size_t done = 0;
+    while (done < size && self->pos < node->size) {
+        uint32_t avail;
+        const uint8_t *p = node_span(self->fs, node, self->pos, &avail);
+        size_t n = MIN(MIN(avail, node->size - self->pos), size - done);
+        int ret = ramfs_copy((uint8_t *)buf + done, p, n);
+        if (ret != 0) {
+            *errcode = -ret;
+            return MP_STREAM_ERROR;
+        }
+        self->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+STATIC mp_uint_t ramfs_file_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
+    ramfs_file_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->writable) {
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
+    ramfs_node_t *node = self->node;
+    if (self->append) {
+        self->pos = node->size;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    if (size > UINT32_MAX - self->pos) {
+        *errcode = MP_EFBIG;
+        return MP_STREAM_ERROR;
+    }
+    int ret = node_reserve(self->fs, node, self->pos + size);
+    if (ret != 0) {
+        *errcode = -ret;
+        return MP_STREAM_ERROR;
+    }
+    if (self->pos > node->size) {
+        node_zero(self->fs, node, node->size, self->pos);
+    }
+    size_t done = 0;
+    while (done < size) {
+        uint32_t avail;
+        uint8_t *p = node_span(self->fs, node, self->pos, &avail);
+        size_t n = MIN(avail, size - done);
+        ret = ramfs_copy(p, (const uint8_t *)buf + done, n);
+        if (ret != 0) {
+            *errcode = -ret;
+            return MP_STREAM_ERROR;
+        }
+        self->pos += n;
+        done += n;
+        node->size = MAX(node->size, self->pos);
+    }
+    return done;
+}
+
+STATIC mp_uint_t ramfs_file_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    ramfs_file_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (request == MP_STREAM_CLOSE) {
+        ramfs_file_close(self);
+        return 0;
+    }
+    if (self->node == NULL) {
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
+    if (request == MP_STREAM_SEEK) {
+        struct mp_stream_seek_t *s = (struct mp_stream_seek_t *)arg;
+        mp_off_t pos = s->offset;
+        if (s->whence == MP_SEEK_CUR) {
+            pos += self->pos;
+        } else if (s->whence == MP_SEEK_END) {
+            pos += self->node->size;
+        }
+        if (pos < 0) {
+            *errcode = MP_EINVAL;
+            return MP_STREAM_ERROR;
+        }
+        self->pos = pos;
+        s->offset = pos;
+        return 0;
+    } else if (request == MP_STREAM_FLUSH) {
+        return 0;
+    }
+    *errcode = MP_EINVAL;
+    return MP_STREAM_ERROR;
+}
+
+// f.read_view(n=-1)
+// memoryview of up to n bytes at the file position, up to the end of the extent; b'' at end of file.
+
+STATIC mp_obj_t ramfs_file_read_view(size_t n_args, const mp_obj_t *args) {
+    ramfs_file_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    if (!self->readable) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    ramfs_node_t *node = self->node;
+    if (self->pos >= node->size) {
+        return mp_const_empty_bytes;
+    }
+    uint32_t avail;
+    uint8_t *p = node_span(self->fs, node, self->pos, &avail);
+    size_t len = MIN(avail, node->size - self->pos);
+    if (n_args > 1 && mp_obj_get_int(args[1]) >= 0) {
+        len = MIN(len, (size_t)mp_obj_get_int(args[1]));
+    }
+    self->pos += len;
+    return mp_obj_new_memoryview('B' | (self->writable ? MP_OBJ_ARRAY_TYPECODE_FLAG_RW : 0), len, p);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(ramfs_file_read_view_obj, 1, 2, ramfs_file_read_view);
+
+// f.write_view(n)
+// writable memoryview of up to n bytes at the file position, up to the end of the extent.
+// The file grows to cover it. Fill it, e.g. by dma; write_view again for the rest.
+
+STATIC mp_obj_t ramfs_file_write_view(mp_obj_t self_in, mp_obj_t n_in) {
+    ramfs_file_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->writable) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    ramfs_node_t *node = self->node;
+    if (self->append) {
+        self->pos = node->size;
+    }
+    mp_int_t n = mp_obj_get_int(n_in);
+    if (n < 0 || (mp_uint_t)n > UINT32_MAX - self->pos) {
+        mp_raise_ValueError(NULL);
+    }
+    ramfs_check(node_reserve(self->fs, node, self->pos + n));
+    if (self->pos > node->size) {
+        node_zero(self->fs, node, node->size, self->pos);
+    }
+    uint32_t avail;
+    uint8_t *p = node_span(self->fs, node, self->pos, &avail);
+    size_t len = MIN(avail, (size_t)n);
+    self->pos += len;
+    node->size = MAX(node->size, self->pos);
+    return mp_obj_new_memoryview('B' | MP_OBJ_ARRAY_TYPECODE_FLAG_RW, len, p);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(ramfs_file_write_view_obj, ramfs_file_write_view);
+
+STATIC void ramfs_file_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    mp_printf(print, "<io.%s %p>", mp_obj_get_type_str(self_in), MP_OBJ_TO_PTR(self_in));
+}
+
+STATIC const mp_rom_map_elem_t ramfs_file_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&mp_stream_unbuffered_readline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readlines), MP_ROM_PTR(&mp_stream_unbuffered_readlines_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&mp_stream_flush_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_stream_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR_seek), MP_ROM_PTR(&mp_stream_seek_obj) },
+    { MP_ROM_QSTR(MP_QSTR_tell), MP_ROM_PTR(&mp_stream_tell_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read_view), MP_ROM_PTR(&ramfs_file_read_view_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write_view), MP_ROM_PTR(&ramfs_file_write_view_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&mp_stream_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR___enter__), MP_ROM_PTR(&mp_identity_obj) },
+    { MP_ROM_QSTR(MP_QSTR___exit__), MP_ROM_PTR(&mp_stream___exit___obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(ramfs_file_locals_dict, ramfs_file_locals_dict_table);
+
+STATIC const mp_stream_p_t ramfs_fileio_stream_p = {
+    .read = ramfs_file_read,
+    .write = ramfs_file_write,
+    .ioctl = ramfs_file_ioctl,
+};
+
+STATIC const mp_obj_type_t ramfs_fileio_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_FileIO,
+    .print = ramfs_file_print,
+    .getiter = mp_identity_getiter,
+    .iternext = mp_stream_unbuffered_iter,
+    .protocol = &ramfs_fileio_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&ramfs_file_locals_dict,
+};
+
+STATIC const mp_stream_p_t ramfs_textio_stream_p = {
+    .read = ramfs_file_read,
+    .write = ramfs_file_write,
+    .ioctl = ramfs_file_ioctl,
+    .is_text = true,
+};
+
+STATIC const mp_obj_type_t ramfs_textio_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_TextIOWrapper,
+    .print = ramfs_file_print,
+    .getiter = mp_identity_getiter,
+    .iternext = mp_stream_unbuffered_iter,
+    .protocol = &ramfs_textio_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&ramfs_file_locals_dict,
+};
+
+// -----------------------------------------------------------------------------
+// vfs
+
+// spiram.RamFS(buf, *, chunk=4096)
+// filesystem with storage buf, normally a large bytearray in spi ram. Mount with os.mount(fs, '/ram').
+
+STATIC mp_obj_t spiram_ramfs_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_chunk };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_chunk, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 4096} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t chunk = args[ARG_chunk].u_int;
+    if (chunk < 32 || (chunk & 31) != 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad chunk"));
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    // chunks start on a cache line, for dma
+    uint32_t start = ((uint32_t)bufinfo.buf + 31) & ~31;
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    uint32_t n_chunks = end > start ? (end - start) / chunk : 0;
+    if (n_chunks == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+
+    spiram_ramfs_obj_t *self = m_new_obj(spiram_ramfs_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->buf = args[ARG_buf].u_obj;
+    self->mem = (uint8_t *)start;
+    self->n_chunks = n_chunks;
+    self->chunk_size = chunk;
+    self->map = m_new(uint32_t, (n_chunks + 31) / 32);
+    ramfs_format(self);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_ramfs_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "RamFS(chunks=%u, chunk=%u, free=%u)", self->n_chunks, self->chunk_size, self->free_chunks);
+}
+
+STATIC mp_obj_t spiram_ramfs_mount(mp_obj_t self_in, mp_obj_t readonly, mp_obj_t mkfs) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    self->readonly = mp_obj_is_true(readonly);
+    if (mp_obj_is_true(mkfs)) {
+        ramfs_format(self);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_ramfs_mount_obj, spiram_ramfs_mount);
+
+STATIC mp_obj_t spiram_ramfs_umount(mp_obj_t self_in) {
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_ramfs_umount_obj, spiram_ramfs_umount);
+
+STATIC mp_obj_t spiram_ramfs_open(mp_obj_t self_in, mp_obj_t path_in, mp_obj_t mode_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    bool readable = false, writable = false, create = false, truncate = false, append = false, excl = false;
+    const mp_obj_type_t *type = &ramfs_textio_type;
+    for (const char *m = mp_obj_str_get_str(mode_in); *m != '\0'; ++m) {
+        switch (*m) {
+            case 'r':
+                readable = true;
+                break;
+            case 'w':
+                writable = create = truncate = true;
+                break;
+            case 'a':
+                writable = create = append = true;
+                break;
+            case 'x':
+                writable = create = excl = true;
+                break;
+            case '+':
+                readable = writable = true;
+                break;
+            case 'b':
+                type = &ramfs_fileio_type;
+                break;
+            case 't':
+                type = &ramfs_textio_type;
+                break;
+        }
+    }
+    if (writable) {
+        ramfs_check_writable(self);
+    }
+    ramfs_path_t p = ramfs_path(self, path_in);
+    ramfs_node_t *node = p.node;
+    if (node == NULL) {
+        if (!create) {
+            mp_raise_OSError(MP_ENOENT);
+        }
+        ramfs_check(ramfs_check_name(&p));
+        node = node_new(self, p.dir, p.name, p.len, false);
+    } else if (node->dir) {
+        mp_raise_OSError(MP_EISDIR);
+    } else if (excl) {
+        mp_raise_OSError(MP_EEXIST);
+    } else if (truncate) {
+        node_trim(self, node, 0);
+    }
+
+    ramfs_file_obj_t *f = m_new_obj_with_finaliser(ramfs_file_obj_t);
+    f->base.type = type;
+    f->fs = self;
+    f->node = node;
+    f->pos = 0;
+    f->readable = readable;
+    f->writable = writable;
+    f->append = append;
+    node->opens++;
+    return MP_OBJ_FROM_PTR(f);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_ramfs_open_obj, spiram_ramfs_open);
+
+STATIC mp_obj_t spiram_ramfs_ilistdir(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_node_t *dir = ramfs_lookup(self, path_in);
+    if (!dir->dir) {
+        mp_raise_OSError(MP_ENOTDIR);
+    }
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (ramfs_node_t *node = dir->child; node != NULL; node = node->next) {
+        mp_obj_t t[4] = {
+            mp_obj_new_str(node->name, strlen(node->name)),
+            MP_OBJ_NEW_SMALL_INT(node->dir ? MP_S_IFDIR : MP_S_IFREG),
+            mp_obj_new_int_from_uint(node->ino),
+            mp_obj_new_int_from_uint(node->size),
+        };
+        mp_obj_list_append(list, mp_obj_new_tuple(4, t));
+    }
+    return mp_getiter(list, NULL);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_ilistdir_obj, spiram_ramfs_ilistdir);
+
+STATIC mp_obj_t spiram_ramfs_chdir(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_node_t *dir = ramfs_lookup(self, path_in);
+    if (!dir->dir) {
+        mp_raise_OSError(MP_ENOTDIR);
+    }
+    self->cwd = dir;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_chdir_obj, spiram_ramfs_chdir);
+
+static void ramfs_node_path(vstr_t *vstr, const ramfs_node_t *node) {
+    if (node->parent != NULL) {
+        ramfs_node_path(vstr, node->parent);
+        vstr_add_char(vstr, '/');
+        vstr_add_str(vstr, node->name);
+    }
+}
+
+STATIC mp_obj_t spiram_ramfs_getcwd(mp_obj_t self_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    vstr_t vstr;
+    vstr_init(&vstr, 32);
+    ramfs_node_path(&vstr, self->cwd);
+    if (vstr.len == 0) {
+        vstr_add_char(&vstr, '/');
+    }
+    return mp_obj_new_str_from_vstr(&mp_type_str, &vstr);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_ramfs_getcwd_obj, spiram_ramfs_getcwd);
+
+STATIC mp_obj_t spiram_ramfs_mkdir(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_check_writable(self);
+    ramfs_path_t p = ramfs_path(self, path_in);
+    if (p.node != NULL) {
+        mp_raise_OSError(MP_EEXIST);
+    }
+    ramfs_check(ramfs_check_name(&p));
+    node_new(self, p.dir, p.name, p.len, true);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_mkdir_obj, spiram_ramfs_mkdir);
+
+STATIC mp_obj_t spiram_ramfs_rmdir(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_check_writable(self);
+    ramfs_node_t *node = ramfs_lookup(self, path_in);
+    if (!node->dir) {
+        mp_raise_OSError(MP_ENOTDIR);
+    }
+    if (node == &self->root || node == self->cwd) {
+        mp_raise_OSError(MP_EBUSY);
+    }
+    if (node->child != NULL) {
+        // not empty
+        mp_raise_OSError(MP_EACCES);
+    }
+    node_remove(self, node);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_rmdir_obj, spiram_ramfs_rmdir);
+
+STATIC mp_obj_t spiram_ramfs_remove(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_check_writable(self);
+    ramfs_node_t *node = ramfs_lookup(self, path_in);
+    if (node->dir) {
+        mp_raise_OSError(MP_EISDIR);
+    }
+    node_remove(self, node);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_remove_obj, spiram_ramfs_remove);
+
+STATIC mp_obj_t spiram_ramfs_rename(mp_obj_t self_in, mp_obj_t old_in, mp_obj_t new_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_check_writable(self);
+    ramfs_node_t *node = ramfs_lookup(self, old_in);
+    if (node == &self->root) {
+        mp_raise_OSError(MP_EBUSY);
+    }
+    ramfs_path_t p = ramfs_path(self, new_in);
+    if (p.node == node) {
+        return mp_const_none;
+    }
+    ramfs_check(ramfs_check_name(&p));
+    // a directory does not move into itself
+    for (ramfs_node_t *dir = p.dir; dir != NULL; dir = dir->parent) {
+        if (dir == node) {
+            mp_raise_OSError(MP_EINVAL);
+        }
+    }
+    if (p.node != NULL) {
+        // a file replaces a file
+        if (p.node->dir || node->dir) {
+            mp_raise_OSError(MP_EEXIST);
+        }
+        node_remove(self, p.node);
+    }
+    node_unlink(node);
+    memset(node->name, 0, sizeof(node->name));
+    memcpy(node->name, p.name, p.len);
+    node_link(p.dir, node);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(spiram_ramfs_rename_obj, spiram_ramfs_rename);
+
+STATIC mp_obj_t spiram_ramfs_stat(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    ramfs_node_t *node = ramfs_lookup(self, path_in);
+    mp_obj_tuple_t *t = MP_OBJ_TO_PTR(mp_obj_new_tuple(10, NULL));
+    t->items[0] = MP_OBJ_NEW_SMALL_INT(node->dir ? MP_S_IFDIR : MP_S_IFREG); // st_mode
+    t->items[1] = mp_obj_new_int_from_uint(node->ino); // st_ino
+    t->items[2] = MP_OBJ_NEW_SMALL_INT(0); // st_dev
+    t->items[3] = MP_OBJ_NEW_SMALL_INT(1); // st_nlink
+    t->items[4] = MP_OBJ_NEW_SMALL_INT(0); // st_uid
+    t->items[5] = MP_OBJ_NEW_SMALL_INT(0); // st_gid
+    t->items[6] = mp_obj_new_int_from_uint(node->size); // st_size
+    t->items[7] = MP_OBJ_NEW_SMALL_INT(0); // st_atime
+    t->items[8] = MP_OBJ_NEW_SMALL_INT(0); // st_mtime
+    t->items[9] = MP_OBJ_NEW_SMALL_INT(0); // st_ctime
+    return MP_OBJ_FROM_PTR(t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_stat_obj, spiram_ramfs_stat);
+
+STATIC mp_obj_t spiram_ramfs_statvfs(mp_obj_t self_in, mp_obj_t path_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_tuple_t *t = MP_OBJ_TO_PTR(mp_obj_new_tuple(10, NULL));
+    t->items[0] = mp_obj_new_int_from_uint(self->chunk_size); // f_bsize
+    t->items[1] = t->items[0]; // f_frsize
+    t->items[2] = mp_obj_new_int_from_uint(self->n_chunks); // f_blocks
+    t->items[3] = mp_obj_new_int_from_uint(self->free_chunks); // f_bfree
+    t->items[4] = t->items[3]; // f_bavail
+    t->items[5] = mp_obj_new_int_from_uint(self->n_files); // f_files
+    t->items[6] = MP_OBJ_NEW_SMALL_INT(0); // f_ffree
+    t->items[7] = MP_OBJ_NEW_SMALL_INT(0); // f_favail
+    t->items[8] = MP_OBJ_NEW_SMALL_INT(0); // f_flags
+    t->items[9] = MP_OBJ_NEW_SMALL_INT(SPIRAM_RAMFS_NAME_MAX); // f_namemax
+    return MP_OBJ_FROM_PTR(t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(spiram_ramfs_statvfs_obj, spiram_ramfs_statvfs);
+
+static uint32_t ramfs_count_extents(const ramfs_node_t *dir) {
+    uint32_t n = 0;
+    for (const ramfs_node_t *node = dir->child; node != NULL; node = node->next) {
+        n += node->dir ? ramfs_count_extents(node) : node->n_extents;
+    }
+    return n;
+}
+
+// fs.stats()
+// (files and directories, extents, chunks in use, chunks, chunk size)
+
+STATIC mp_obj_t spiram_ramfs_stats(mp_obj_t self_in) {
+    spiram_ramfs_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t t[5] = {
+        mp_obj_new_int_from_uint(self->n_files),
+        mp_obj_new_int_from_uint(ramfs_count_extents(&self->root)),
+        mp_obj_new_int_from_uint(self->n_chunks - self->free_chunks),
+        mp_obj_new_int_from_uint(self->n_chunks),
+        mp_obj_new_int_from_uint(self->chunk_size),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_ramfs_stats_obj, spiram_ramfs_stats);
+
+STATIC const mp_rom_map_elem_t spiram_ramfs_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_mount), MP_ROM_PTR(&spiram_ramfs_mount_obj) },
+    { MP_ROM_QSTR(MP_QSTR_umount), MP_ROM_PTR(&spiram_ramfs_umount_obj) },
+    { MP_ROM_QSTR(MP_QSTR_open), MP_ROM_PTR(&spiram_ramfs_open_obj) },
+    { MP_ROM_QSTR(MP_QSTR_ilistdir), MP_ROM_PTR(&spiram_ramfs_ilistdir_obj) },
+    { MP_ROM_QSTR(MP_QSTR_chdir), MP_ROM_PTR(&spiram_ramfs_chdir_obj) },
+    { MP_ROM_QSTR(MP_QSTR_getcwd), MP_ROM_PTR(&spiram_ramfs_getcwd_obj) },
+    { MP_ROM_QSTR(MP_QSTR_mkdir), MP_ROM_PTR(&spiram_ramfs_mkdir_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rmdir), MP_ROM_PTR(&spiram_ramfs_rmdir_obj) },
+    { MP_ROM_QSTR(MP_QSTR_remove), MP_ROM_PTR(&spiram_ramfs_remove_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rename), MP_ROM_PTR(&spiram_ramfs_rename_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stat), MP_ROM_PTR(&spiram_ramfs_stat_obj) },
+    { MP_ROM_QSTR(MP_QSTR_statvfs), MP_ROM_PTR(&spiram_ramfs_statvfs_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_ramfs_stats_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_ramfs_locals_dict, spiram_ramfs_locals_dict_table);
+
+const mp_obj_type_t spiram_ramfs_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_RamFS,
+    .print = spiram_ramfs_print,
+    .make_new = spiram_ramfs_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_ramfs_locals_dict,
+};
+
+// not truncated
@@ -0,0 +1,12 @@
+/*
+ * filesystem in spi ram, files as lists of extents, no block device
+ */
+#ifndef __SPIRAM_RAMFS_H__
+#define __SPIRAM_RAMFS_H__
+#include "py/obj.h"
+
+// longest file or directory name, in bytes
+#define SPIRAM_RAMFS_NAME_MAX (31)
+
+extern const mp_obj_type_t spiram_ramfs_type;
+#endif // __SPIRAM_RAMFS_H__
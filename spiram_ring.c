@@ -0,0 +1,106 @@
+/*
+ * byte ring buffer in spi ram, one producer and one consumer
+ */
+
+/* notes:
+ * no locks: the producer only moves head, the consumer only moves tail.
+ * producer and consumer can be an interrupt handler and the interpreter.
+ * The barrier makes the data visible before the index that publishes it.
+ * Data cache maintenance for dma is up to the caller.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "spiram_ring.h"
+
+static inline size_t spiram_ring_index(const spiram_ring_t *r, size_t i) {
+    return i >= r->size ? i - r->size : i;
+}
+
+static inline size_t spiram_ring_advance(const spiram_ring_t *r, size_t i, size_t len) {
+    i += len;
+    return i >= 2 * r->size ? i - 2 * r->size : i;
+}
+
+void spiram_ring_init(spiram_ring_t *r, void *buf, size_t size) {
+    r->buf = buf;
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+}
+
+size_t spiram_ring_used(const spiram_ring_t *r) {
+    size_t head = r->head;
+    size_t tail = r->tail;
+    return head >= tail ? head - tail : head + 2 * r->size - tail;
+}
+
+size_t spiram_ring_free(const spiram_ring_t *r) {
+    return r->size - spiram_ring_used(r);
+}
+
+uint8_t *spiram_ring_write_ptr(const spiram_ring_t *r, size_t *len) {
+    size_t i = spiram_ring_index(r, r->head);
+    *len = MIN(spiram_ring_free(r), r->size - i);
+    return r->buf + i;
+}
+
+void spiram_ring_commit(spiram_ring_t *r, size_t len) {
+    __DMB();
+    r->head = spiram_ring_advance(r, r->head, len);
+}
+
+const uint8_t *spiram_ring_read_ptr(const spiram_ring_t *r, size_t *len) {
+    size_t i = spiram_ring_index(r, r->tail);
+    *len = MIN(spiram_ring_used(r), r->size - i);
+    __DMB();
+    return r->buf + i;
+}
+
+void spiram_ring_consume(spiram_ring_t *r, size_t len) {
+    __DMB();
+    r->tail = spiram_ring_advance(r, r->tail, len);
+}
+
+uint8_t spiram_ring_peek(const spiram_ring_t *r, size_t offset) {
+    size_t i = spiram_ring_index(r, r->tail) + offset;
+    __DMB();
+    return r->buf[i >= r->size ? i - r->size : i];
+}
+
+size_t spiram_ring_write(spiram_ring_t *r, const void *src, size_t len) {
+    const uint8_t *s = src;
+    size_t done = 0;
+    while (done < len) {
+        size_t n;
+        uint8_t *p = spiram_ring_write_ptr(r, &n);
+        n = MIN(n, len - done);
+        if (n == 0) {
+            break;
+        }
+        memcpy(p, s + done, n);
+        spiram_ring_commit(r, n);
+        done += n;
+    }
+    return done;
+}
+
+size_t spiram_ring_read(spiram_ring_t *r, void *dst, size_t len) {
+    uint8_t *d = dst;
+    size_t done = 0;
+    while (done < len) {
+        size_t n;
+        const uint8_t *p = spiram_ring_read_ptr(r, &n);
+        n = MIN(n, len - done);
+        if (n == 0) {
+            break;
+        }
+        memcpy(d + done, p, n);
+        spiram_ring_consume(r, n);
+        done += n;
+    }
+    return done;
+}
+
+// not truncated
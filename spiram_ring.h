@@ -0,0 +1,33 @@
+/*
+ * byte ring buffer in spi ram, one producer and one consumer
+ */
+#ifndef __SPIRAM_RING_H__
+#define __SPIRAM_RING_H__
+#include <stddef.h>
+#include <stdint.h>
+
+// head and tail run from 0 to 2 * size - 1, so a full ring and an empty ring differ.
+typedef struct _spiram_ring_t {
+    uint8_t *buf;
+    size_t size;
+    volatile size_t head;       // written by the producer only
+    volatile size_t tail;       // written by the consumer only
+} spiram_ring_t;
+
+void spiram_ring_init(spiram_ring_t *r, void *buf, size_t size);
+size_t spiram_ring_used(const spiram_ring_t *r);
+size_t spiram_ring_free(const spiram_ring_t *r);
+
+// zero-copy access, e.g. for dma. len is the contiguous part, up to the end of the buffer.
+uint8_t *spiram_ring_write_ptr(const spiram_ring_t *r, size_t *len);
+void spiram_ring_commit(spiram_ring_t *r, size_t len);
+const uint8_t *spiram_ring_read_ptr(const spiram_ring_t *r, size_t *len);
+void spiram_ring_consume(spiram_ring_t *r, size_t len);
+
+// byte at offset from the tail, offset < used
+uint8_t spiram_ring_peek(const spiram_ring_t *r, size_t offset);
+
+// copy as much as fits or is available; returns bytes copied
+size_t spiram_ring_write(spiram_ring_t *r, const void *src, size_t len);
+size_t spiram_ring_read(spiram_ring_t *r, void *dst, size_t len);
+#endif // __SPIRAM_RING_H__
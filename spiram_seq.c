@@ -0,0 +1,351 @@
+/*
+ * octospi command sequencer, batches of indirect spi ram commands run by mdma
+ */
+
+/* notes:
+ * an indirect command costs the cpu more than its bytes on the bus. HAL_OSPI_Command()
+ * writes the command registers and waits for busy, HAL_OSPI_Receive() or _Transmit()
+ * then sets the mode, rewrites the address, and polls the fifo and transfer complete.
+ * For 32 bytes of scattered records that is most of the time.
+ *
+ * In a batch all commands have the same instruction, dummy cycles and length, so the
+ * cpu writes CR, DLR, TCR, CCR and IR once; writing AR starts a command. The mdma runs
+ * a linked list of two nodes per command:
+ *   data node     waits for the fifo threshold, set to the command length, and moves
+ *                 the data between DR and the batch buffer
+ *   address node  waits for transfer complete of the command before, writes the next
+ *                 address to AR, which starts the next command, and clears the flag
+ * The cpu starts the first command, then the mdma. A last node waits for the last transfer complete
+ * and writes a done word, and the mdma interrupts once, at the end of the list.
+ * The flag is cleared just after the next command starts; a command takes far longer
+ * than the mdma needs for the clear.
+ *
+ * spi ram is memory-mapped and holds the heap, and indirect commands need mapping off.
+ * A batch copies the addresses and write data to internal ram, disables interrupts,
+ * cleans the data cache, leaves memory-mapped mode, runs, maps again, and drops the
+ * cached lines of what was written. The cpu sleeps in wfi until the mdma interrupt is
+ * pending. Batches of at most SPIRAM_SEQ_OPS commands bound the time with interrupts off.
+ * Other dma on spi ram must be idle: the background copies are checked, audio, logic
+ * capture and spi transfers to spi ram are up to the caller.
+ */
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "spiram.h"
+#include "spiram_seq.h"
+
+#include <stm32h7xx_hal_ospi.h>
+
+#if MICROPY_HW_ENABLE_SPIRAM_SEQ && defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+
+// octospi1 fifo threshold and transfer complete, mdma requests 22 and 23
+#define SPIRAM_SEQ_MDMA_REQUEST_FT (0x16)
+#define SPIRAM_SEQ_MDMA_REQUEST_TC (0x17)
+#define SPIRAM_SEQ_MDMA_PRIORITY (3)
+
+// a batch that takes longer has hung: 10 us per command, and 1 ms
+#define SPIRAM_SEQ_TIMEOUT_US(n) (10 * (n) + 1000)
+
+static uint32_t seq_addr[SPIRAM_SEQ_OPS];
+static uint8_t seq_data[SPIRAM_SEQ_OPS * SPIRAM_SEQ_SIZE_MAX] __attribute__((aligned(32)));
+static mdma_node_t seq_node[2 * SPIRAM_SEQ_OPS];
+static volatile uint32_t seq_done[8] __attribute__((aligned(32))); // a cache line of its own
+static const uint32_t seq_token = 1;
+static spiram_seq_stats_t seq_stats;
+
+static inline uint32_t seq_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+// node that moves the data of one command between DR and the batch buffer
+static void seq_node_data(mdma_node_t *node, uint8_t *data, size_t size, bool write) {
+    void *dr = (void *)&OCTOSPI1->DR;
+    if (write) {
+        mdma_node_memcpy(node, dr, data, size);
+        node->CTCR &= ~MDMA_CTCR_DINC_Msk;
+    } else {
+        mdma_node_memcpy(node, data, dr, size);
+        node->CTCR &= ~MDMA_CTCR_SINC_Msk;
+    }
+    // single beats on the data register
+    node->CTCR &= ~(MDMA_CTCR_SBURST_Msk | MDMA_CTCR_DBURST_Msk);
+    // the threshold flag follows the fifo level, nothing to clear
+    mdma_node_trigger(node, SPIRAM_SEQ_MDMA_REQUEST_FT, NULL, 0);
+}
+
+// node that waits for transfer complete, writes *value to reg, and clears the flag
+static void seq_node_tc(mdma_node_t *node, volatile uint32_t *reg, const uint32_t *value) {
+    mdma_node_memcpy(node, (void *)reg, value, sizeof(uint32_t));
+    mdma_node_trigger(node, SPIRAM_SEQ_MDMA_REQUEST_TC, &OCTOSPI1->FCR, OCTOSPI_FCR_CTCF);
+}
+
+static void seq_build(size_t n, size_t size, bool write) {
+    mdma_node_t *node = seq_node;
+    for (size_t i = 0; i < n; ++i) {
+        if (i > 0) {
+            seq_node_tc(node++, &OCTOSPI1->AR, &seq_addr[i]);
+        }
+        seq_node_data(node++, seq_data + i * size, size, write);
+    }
+    seq_node_tc(node++, seq_done, &seq_token);
+    for (mdma_node_t *p = seq_node; p + 1 < node; ++p) {
+        p->CLAR = (uint32_t)(p + 1);
+    }
+    seq_done[0] = 0;
+    mdma_dcache_clean(seq_node, (node - seq_node) * sizeof(mdma_node_t));
+    mdma_dcache_clean(seq_addr, n * sizeof(uint32_t));
+    mdma_dcache_clean_invalidate(seq_data, n * size);
+    mdma_dcache_clean_invalidate((void *)seq_done, sizeof(seq_done));
+}
+
+// the command registers, once per batch
+static void seq_config(size_t size, bool write) {
+    OCTOSPI_TypeDef *ospi = OCTOSPI1;
+    ospi->CR = (ospi->CR & ~(OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES))
+        | (write ? 0 : OCTOSPI_CR_FMODE_0) // indirect write or read
+        | (size - 1) << OCTOSPI_CR_FTHRES_Pos;
+    ospi->DLR = size - 1;
+    ospi->TCR = (ospi->TCR & ~OCTOSPI_TCR_DCYC)
+        | (write ? SPIRAM_QUAD_WRITE_DUMMY : SPIRAM_QUAD_READ_DUMMY) << OCTOSPI_TCR_DCYC_Pos;
+    ospi->CCR = HAL_OSPI_INSTRUCTION_4_LINES | HAL_OSPI_INSTRUCTION_8_BITS
+        | HAL_OSPI_ADDRESS_4_LINES | HAL_OSPI_ADDRESS_24_BITS
+        | HAL_OSPI_DATA_4_LINES
+        | (write ? HAL_OSPI_DQS_ENABLE : HAL_OSPI_DQS_DISABLE); // See errata
+    ospi->IR = write ? SRAM_CMD_QUAD_WRITE : SRAM_CMD_QUAD_READ;
+    ospi->FCR = OCTOSPI_FCR_CTCF;
+}
+
+static int seq_run_mdma(size_t n, size_t size, bool write) {
+    seq_config(size, write);
+    // the first command starts before the mdma; a write holds the clock until data is in the fifo
+    OCTOSPI1->AR = seq_addr[0];
+    mdma_start(MDMA_CHANNEL_OSPI_SEQ, seq_node, SPIRAM_SEQ_MDMA_PRIORITY);
+
+    // interrupts are off; a pending interrupt, the mdma one at the end, ends wfi
+    uint32_t start = seq_cycles();
+    uint32_t timeout = SPIRAM_SEQ_TIMEOUT_US(n) * (SystemCoreClock / 1000000);
+    while (mdma_busy(MDMA_CHANNEL_OSPI_SEQ)) {
+        if (seq_cycles() - start > timeout) {
+            break;
+        }
+        __WFI();
+    }
+    // stops the channel if it hung, and clears its flags before the irq handler runs
+    mdma_abort(MDMA_CHANNEL_OSPI_SEQ);
+    mdma_dcache_invalidate((void *)seq_done, sizeof(seq_done));
+    if (seq_done[0] != seq_token) {
+        return -MP_ETIMEDOUT;
+    }
+    if (!write) {
+        mdma_dcache_invalidate(seq_data, n * size);
+    }
+    return 0;
+}
+
+// waits for a status flag; false if the batch ran out of time
+static bool seq_wait(uint32_t flag, uint32_t start, uint32_t timeout) {
+    while (!(OCTOSPI1->SR & flag)) {
+        if (seq_cycles() - start > timeout) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// as spiram_read() and spiram_write(): one command per transfer, the command registers
+// written each time, and the cpu polls the fifo and transfer complete. Not the HAL calls:
+// their timeouts count HAL_GetTick(), which stands still with interrupts off.
+static int seq_run_percall(size_t n, size_t size, bool write) {
+    uint32_t start = seq_cycles();
+    uint32_t timeout = SPIRAM_SEQ_TIMEOUT_US(n) * (SystemCoreClock / 1000000);
+    for (size_t i = 0; i < n; ++i) {
+        while (OCTOSPI1->SR & OCTOSPI_SR_BUSY) {
+            if (seq_cycles() - start > timeout) {
+                return -MP_ETIMEDOUT;
+            }
+        }
+        seq_config(size, write);
+        OCTOSPI1->AR = seq_addr[i];
+        // the fifo threshold is the command length: one flag, then the whole command
+        if (!seq_wait(OCTOSPI_SR_FTF, start, timeout)) {
+            return -MP_ETIMEDOUT;
+        }
+        uint32_t *data = (uint32_t *)(seq_data + i * size);
+        for (size_t k = 0; k < size / 4; ++k) {
+            if (write) {
+                OCTOSPI1->DR = data[k];
+            } else {
+                data[k] = OCTOSPI1->DR;
+            }
+        }
+        if (!seq_wait(OCTOSPI_SR_TCF, start, timeout)) {
+            return -MP_ETIMEDOUT;
+        }
+        OCTOSPI1->FCR = OCTOSPI_FCR_CTCF;
+    }
+    return 0;
+}
+
+// one batch, addresses and write data in seq_addr and seq_data
+static int seq_batch(size_t n, size_t size, bool write, bool percall) {
+    if (!percall) {
+        seq_build(n, size, write);
+    }
+    uint32_t irq_state = disable_irq();
+    // dirty lines of spi ram go out while it is still mapped
+    SCB_CleanDCache();
+    uint32_t fthres = OCTOSPI1->CR & OCTOSPI_CR_FTHRES;
+    spiram_suspend();
+
+    int ret = percall ? seq_run_percall(n, size, write) : seq_run_mdma(n, size, write);
+    if (ret != 0) {
+        spiram_ospi_error();
+    }
+
+    if (OCTOSPI1->SR & OCTOSPI_SR_BUSY) {
+        OCTOSPI1->CR |= OCTOSPI_CR_ABORT;
+        while (OCTOSPI1->CR & OCTOSPI_CR_ABORT) {
+        }
+    }
+    OCTOSPI1->FCR = OCTOSPI_FCR_CTCF;
+    OCTOSPI1->CR = (OCTOSPI1->CR & ~OCTOSPI_CR_FTHRES) | fthres;
+    spiram_resume();
+    if (write) {
+        // the cache may hold lines of what was written; they are clean, so drop them
+        for (size_t i = 0; i < n; ++i) {
+            mdma_dcache_invalidate((void *)(SPIRAM_MAP_ADDR + seq_addr[i]), size);
+        }
+    }
+    enable_irq(irq_state);
+    return ret;
+}
+
+static int seq_run(const uint32_t *addr, size_t n, size_t size, uint8_t *rbuf, const uint8_t *wbuf, bool percall) {
+    bool write = wbuf != NULL;
+    if (size == 0 || size > SPIRAM_SEQ_SIZE_MAX || size % 4 != 0) {
+        return -MP_EINVAL;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (addr[i] > SPIRAM_SIZE - size) {
+            return -MP_EINVAL;
+        }
+    }
+    if (dma_memcpy_busy()) {
+        return -MP_EBUSY;
+    }
+    mdma_init();
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    uint32_t start = seq_cycles();
+    int ret = 0;
+    size_t done = 0;
+    uint32_t batches = 0;
+    while (done < n && ret == 0) {
+        size_t k = MIN(n - done, SPIRAM_SEQ_OPS);
+        memcpy(seq_addr, addr + done, k * sizeof(uint32_t));
+        if (write) {
+            memcpy(seq_data, wbuf + done * size, k * size);
+        }
+        ret = seq_batch(k, size, write, percall);
+        if (ret == 0 && !write) {
+            memcpy(rbuf + done * size, seq_data, k * size);
+        }
+        done += k;
+        ++batches;
+    }
+    seq_stats.batches += batches;
+    seq_stats.ops += n;
+    seq_stats.bytes += n * size;
+    seq_stats.us = (seq_cycles() - start) / (SystemCoreClock / 1000000);
+    seq_stats.ops_last = n;
+    return ret;
+}
+
+int spiram_seq_read(const uint32_t *addr, size_t n, size_t size, uint8_t *buf, bool percall) {
+    return seq_run(addr, n, size, buf, NULL, percall);
+}
+
+int spiram_seq_write(const uint32_t *addr, size_t n, size_t size, const uint8_t *buf, bool percall) {
+    return seq_run(addr, n, size, NULL, buf, percall);
+}
+
+void spiram_seq_get_stats(spiram_seq_stats_t *stats) {
+    *stats = seq_stats;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.seq_read(addrs, buf, size=32, percall=False)
+// spiram.seq_write(addrs, buf, size=32, percall=False)
+// addrs is an array('I') of offsets in spi ram; size bytes per offset, packed in buf.
+// Returns the number of commands.
+
+STATIC mp_obj_t spiram_seq_rw(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args, bool write) {
+    enum { ARG_addrs, ARG_buf, ARG_size, ARG_percall };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_addrs, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_size, MP_ARG_INT, {.u_int = SPIRAM_SEQ_SIZE_MAX} },
+        { MP_QSTR_percall, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t addrs;
+    mp_get_buffer_raise(args[ARG_addrs].u_obj, &addrs, MP_BUFFER_READ);
+    if (addrs.typecode != 'I' && addrs.typecode != 'L') {
+        mp_raise_ValueError(MP_ERROR_TEXT("addrs not array('I')"));
+    }
+    mp_int_t size = args[ARG_size].u_int;
+    if (size <= 0 || size > SPIRAM_SEQ_SIZE_MAX || size % 4 != 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("size"));
+    }
+    size_t n = addrs.len / sizeof(uint32_t);
+    mp_buffer_info_t buf;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &buf, write ? MP_BUFFER_READ : MP_BUFFER_WRITE);
+    if (buf.len < n * size) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+    int ret = write
+        ? spiram_seq_write(addrs.buf, n, size, buf.buf, args[ARG_percall].u_bool)
+        : spiram_seq_read(addrs.buf, n, size, buf.buf, args[ARG_percall].u_bool);
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return mp_obj_new_int_from_uint(n);
+}
+
+STATIC mp_obj_t spiram_seq_read_fn(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    return spiram_seq_rw(n_args, pos_args, kw_args, false);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_seq_read_obj, 2, spiram_seq_read_fn);
+
+STATIC mp_obj_t spiram_seq_write_fn(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    return spiram_seq_rw(n_args, pos_args, kw_args, true);
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_seq_write_obj, 2, spiram_seq_write_fn);
+
+// spiram.seq_stats()
+// returns (batches, commands, bytes, us of the last call, commands/s of the last call)
+
+STATIC mp_obj_t spiram_seq_stats_fn(void) {
+    mp_obj_t t[5] = {
+        mp_obj_new_int_from_uint(seq_stats.batches),
+        mp_obj_new_int_from_uint(seq_stats.ops),
+        mp_obj_new_int_from_uint(seq_stats.bytes),
+        mp_obj_new_int_from_uint(seq_stats.us),
+        mp_obj_new_int_from_uint(seq_stats.us ? (uint64_t)seq_stats.ops_last * 1000000 / seq_stats.us : 0),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(spiram_seq_stats_obj, spiram_seq_stats_fn);
+
+#endif // MICROPY_HW_ENABLE_SPIRAM_SEQ
+
+// not truncated
@@ -0,0 +1,41 @@
+/*
+ * octospi command sequencer, batches of indirect spi ram commands run by mdma
+ */
+#ifndef __SPIRAM_SEQ_H__
+#define __SPIRAM_SEQ_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+#include "mdma.h"
+#include "spiram_config.h"
+
+#ifndef MICROPY_HW_ENABLE_SPIRAM_SEQ
+#define MICROPY_HW_ENABLE_SPIRAM_SEQ (MICROPY_HW_ENABLE_MDMA)
+#endif
+
+// commands per batch. Interrupts are off for a batch: 128 commands of 32 bytes take about 150 us.
+#define SPIRAM_SEQ_OPS (128)
+
+// bytes per command, at most the octospi fifo
+#define SPIRAM_SEQ_SIZE_MAX (32)
+
+typedef struct _spiram_seq_stats_t {
+    uint32_t batches;
+    uint32_t ops;
+    uint32_t bytes;
+    uint32_t us;                // last call
+    uint32_t ops_last;          // commands in the last call
+} spiram_seq_stats_t;
+
+// n reads or writes of size bytes, at spi ram offsets addr[0 .. n - 1], data packed in buf.
+// addr and buf may be in spi ram. percall: the command registers written per command, and
+// the cpu polls, for comparison. Nothing else may use spi ram by dma meanwhile. Returns 0 or a negative MP_Exxx.
+int spiram_seq_read(const uint32_t *addr, size_t n, size_t size, uint8_t *buf, bool percall);
+int spiram_seq_write(const uint32_t *addr, size_t n, size_t size, const uint8_t *buf, bool percall);
+void spiram_seq_get_stats(spiram_seq_stats_t *stats);
+
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_seq_read_obj);
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_seq_write_obj);
+MP_DECLARE_CONST_FUN_OBJ_0(spiram_seq_stats_obj);
+#endif // __SPIRAM_SEQ_H__
@@ -0,0 +1,435 @@
+/*
+ * columnar time series in spi ram, with per-block summaries
+ */
+
+/* notes:
+ * rows are appended to blocks of block rows. In a block each column is a
+ * contiguous array of its type, so a scan of one column reads only that column,
+ * in long sequential bursts. Each block keeps min, max and sum per column.
+ *
+ * A query selects the rows where column where is between lo and hi:
+ * - blocks with where entirely outside [lo, hi] are skipped.
+ * - blocks with where entirely inside [lo, hi] are answered from the summary;
+ *   select() copies the column of such a block in one go.
+ * - the other blocks are scanned: the where column and the queried column are
+ *   copied to internal ram a chunk at a time, and compared there.
+ * For time series with a timestamp column, that leaves at most two blocks to scan.
+ *
+ * The summaries are doubles; all column types fit a double exactly.
+ * Append-only: rows are never changed, clear() drops them all.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/binary.h"
+#include "py/mperrno.h"
+#include "spiram_series.h"
+
+typedef struct _series_summary_t {
+    double min;
+    double max;
+    double sum;
+} series_summary_t;
+
+typedef struct _spiram_series_obj_t {
+    mp_obj_base_t base;
+    mp_obj_t buf;               // keeps the storage alive
+    uint8_t *mem;
+    series_summary_t *summary;  // per block, per column
+    size_t ncols;
+    char typecode[SPIRAM_SERIES_COLS_MAX];
+    uint8_t itemsize[SPIRAM_SERIES_COLS_MAX];
+    size_t col_off[SPIRAM_SERIES_COLS_MAX];
+    size_t block;               // rows per block
+    size_t block_bytes;
+    size_t nblocks;
+    size_t rows;
+    // blocks of the last query
+    uint32_t skipped;
+    uint32_t whole;
+    uint32_t scanned;
+} spiram_series_obj_t;
+
+// the query result
+typedef struct _series_acc_t {
+    size_t count;
+    double min;
+    double max;
+    double sum;
+    uint8_t *out;               // select: values are copied here
+    size_t out_len;             // in values
+} series_acc_t;
+
+static uint8_t series_chunk[2][MICROPY_HW_SPIRAM_SERIES_CHUNK] __attribute__((aligned(32)));
+
+static inline uint8_t *series_col(const spiram_series_obj_t *self, size_t b, size_t c) {
+    return self->mem + b * self->block_bytes + self->col_off[c];
+}
+
+static inline series_summary_t *series_summary(const spiram_series_obj_t *self, size_t b, size_t c) {
+    return &self->summary[b * self->ncols + c];
+}
+
+static double series_get(char typecode, const uint8_t *p, size_t i) {
+    switch (typecode) {
+        case 'b':
+            return ((const int8_t *)p)[i];
+        case 'B':
+            return ((const uint8_t *)p)[i];
+        case 'h':
+            return ((const int16_t *)p)[i];
+        case 'H':
+            return ((const uint16_t *)p)[i];
+        case 'i':
+        case 'l':
+            return ((const int32_t *)p)[i];
+        case 'I':
+        case 'L':
+            return ((const uint32_t *)p)[i];
+        default:
+            return (double)((const float *)p)[i];
+    }
+}
+
+static double series_to_double(mp_obj_t o) {
+    if (mp_obj_is_small_int(o)) {
+        return MP_OBJ_SMALL_INT_VALUE(o);
+    } else if (mp_obj_is_int(o)) {
+        // uint32 timestamps do not fit a small int
+        if (mp_obj_int_sign(o) >= 0) {
+            return mp_obj_int_get_uint_checked(o);
+        }
+        return mp_obj_int_get_checked(o);
+    }
+    return (double)mp_obj_get_float(o);
+}
+
+static mp_obj_t series_from_double(char typecode, double v) {
+    if (typecode == 'f') {
+        return mp_obj_new_float((mp_float_t)v);
+    }
+    return mp_obj_new_int_from_ll((long long)v);
+}
+
+static void series_acc_add(series_acc_t *acc, double v) {
+    if (acc->count == 0) {
+        acc->min = acc->max = v;
+    } else {
+        acc->min = MIN(acc->min, v);
+        acc->max = MAX(acc->max, v);
+    }
+    acc->sum += v;
+    acc->count++;
+}
+
+// the rows of block b that are in range, through internal ram
+static void series_scan(spiram_series_obj_t *self, size_t b, size_t n, size_t col, size_t where, double lo, double hi, series_acc_t *acc) {
+    char tc_w = self->typecode[where];
+    char tc_c = self->typecode[col];
+    size_t isz_w = self->itemsize[where];
+    size_t isz_c = self->itemsize[col];
+    size_t chunk_rows = MICROPY_HW_SPIRAM_SERIES_CHUNK / MAX(isz_w, isz_c);
+    for (size_t off = 0; off < n; off += chunk_rows) {
+        size_t m = MIN(chunk_rows, n - off);
+        memcpy(series_chunk[0], series_col(self, b, where) + off * isz_w, m * isz_w);
+        const uint8_t *vals = series_chunk[0];
+        if (col != where) {
+            memcpy(series_chunk[1], series_col(self, b, col) + off * isz_c, m * isz_c);
+            vals = series_chunk[1];
+        }
+        for (size_t i = 0; i < m; ++i) {
+            double w = series_get(tc_w, series_chunk[0], i);
+            if (w < lo || w > hi) {
+                continue;
+            }
+            if (acc->out != NULL) {
+                if (acc->count == acc->out_len) {
+                    return;
+                }
+                memcpy(acc->out + acc->count * isz_c, vals + i * isz_c, isz_c);
+                acc->count++;
+            } else {
+                series_acc_add(acc, series_get(tc_c, vals, i));
+            }
+        }
+    }
+}
+
+static void series_query(spiram_series_obj_t *self, size_t col, size_t where, double lo, double hi, series_acc_t *acc) {
+    size_t isz_c = self->itemsize[col];
+    self->skipped = self->whole = self->scanned = 0;
+    for (size_t b = 0; b * self->block < self->rows; ++b) {
+        if (acc->out != NULL && acc->count == acc->out_len) {
+            break;
+        }
+        size_t n = MIN(self->block, self->rows - b * self->block);
+        const series_summary_t *ws = series_summary(self, b, where);
+        if (ws->max < lo || ws->min > hi) {
+            self->skipped++;
+        } else if (ws->min >= lo && ws->max <= hi) {
+            self->whole++;
+            if (acc->out != NULL) {
+                size_t m = MIN(n, acc->out_len - acc->count);
+                memcpy(acc->out + acc->count * isz_c, series_col(self, b, col), m * isz_c);
+                acc->count += m;
+            } else {
+                const series_summary_t *cs = series_summary(self, b, col);
+                if (acc->count == 0) {
+                    acc->min = cs->min;
+                    acc->max = cs->max;
+                } else {
+                    acc->min = MIN(acc->min, cs->min);
+                    acc->max = MAX(acc->max, cs->max);
+                }
+                acc->sum += cs->sum;
+                acc->count += n;
+            }
+        } else {
+            self->scanned++;
+            series_scan(self, b, n, col, where, lo, hi, acc);
+        }
+    }
+}
+
+static size_t series_col_index(spiram_series_obj_t *self, mp_obj_t col_in) {
+    mp_int_t c = mp_obj_get_int(col_in);
+    if (c < 0 || c >= self->ncols) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad column"));
+    }
+    return c;
+}
+
+// spiram.Series(buf, columns, *, block=1024)
+// columns is a string of array typecodes, one per column, e.g. 'If' for a timestamp and a value.
+// buf is the storage, normally a large bytearray in spi ram.
+
+STATIC mp_obj_t spiram_series_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_buf, ARG_columns, ARG_block };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_columns, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_block, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1024} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    size_t ncols;
+    const char *columns = mp_obj_str_get_data(args[ARG_columns].u_obj, &ncols);
+    if (ncols == 0 || ncols > SPIRAM_SERIES_COLS_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad columns"));
+    }
+    // a multiple of 32 rows keeps every column on a cache line
+    mp_int_t block = args[ARG_block].u_int;
+    if (block < 32 || (block & 31) != 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bad block"));
+    }
+
+    spiram_series_obj_t *self = m_new_obj(spiram_series_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->ncols = ncols;
+    self->block = block;
+    for (size_t c = 0; c < ncols; ++c) {
+        if (strchr("bBhHiIlLf", columns[c]) == NULL) {
+            mp_raise_ValueError(MP_ERROR_TEXT("bad typecode"));
+        }
+        self->typecode[c] = columns[c];
+        self->itemsize[c] = mp_binary_get_size('@', columns[c], NULL);
+        self->col_off[c] = self->block_bytes;
+        self->block_bytes += self->itemsize[c] * block;
+    }
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_RW);
+    uint32_t start = ((uint32_t)bufinfo.buf + 31) & ~31;
+    uint32_t end = (uint32_t)bufinfo.buf + bufinfo.len;
+    self->nblocks = end > start ? (end - start) / self->block_bytes : 0;
+    if (self->nblocks == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf too small"));
+    }
+    self->buf = args[ARG_buf].u_obj;
+    self->mem = (uint8_t *)start;
+    self->summary = m_new(series_summary_t, self->nblocks * ncols);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_series_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "Series('%.*s', rows=%u, capacity=%u)", self->ncols, self->typecode, self->rows, self->nblocks * self->block);
+}
+
+STATIC mp_obj_t spiram_series_unary_op(mp_unary_op_t op, mp_obj_t self_in) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    switch (op) {
+        case MP_UNARY_OP_BOOL:
+            return mp_obj_new_bool(self->rows != 0);
+        case MP_UNARY_OP_LEN:
+            return MP_OBJ_NEW_SMALL_INT(self->rows);
+        default:
+            return MP_OBJ_NULL;
+    }
+}
+
+// series[i] is row i, as a tuple
+STATIC mp_obj_t spiram_series_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t value) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (value != MP_OBJ_SENTINEL) {
+        // append-only
+        return MP_OBJ_NULL;
+    }
+    size_t row = mp_get_index(self->base.type, self->rows, index, false);
+    size_t b = row / self->block;
+    size_t i = row % self->block;
+    mp_obj_t t[SPIRAM_SERIES_COLS_MAX];
+    for (size_t c = 0; c < self->ncols; ++c) {
+        t[c] = mp_binary_get_val_array(self->typecode[c], series_col(self, b, c), i);
+    }
+    return mp_obj_new_tuple(self->ncols, t);
+}
+
+// series.append(v0, v1, ...)
+// one value per column. OSError ENOSPC when buf is full.
+
+STATIC mp_obj_t spiram_series_append(size_t n_args, const mp_obj_t *args) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    if (n_args - 1 != self->ncols) {
+        mp_raise_TypeError(MP_ERROR_TEXT("one value per column"));
+    }
+    if (self->rows == self->nblocks * self->block) {
+        mp_raise_OSError(MP_ENOSPC);
+    }
+    size_t b = self->rows / self->block;
+    size_t i = self->rows % self->block;
+    // all values first, so a bad value leaves the summaries alone
+    for (size_t c = 0; c < self->ncols; ++c) {
+        mp_binary_set_val_array(self->typecode[c], series_col(self, b, c), i, args[c + 1]);
+    }
+    for (size_t c = 0; c < self->ncols; ++c) {
+        double v = series_get(self->typecode[c], series_col(self, b, c), i);
+        series_summary_t *s = series_summary(self, b, c);
+        if (i == 0) {
+            s->min = s->max = s->sum = v;
+        } else {
+            s->min = MIN(s->min, v);
+            s->max = MAX(s->max, v);
+            s->sum += v;
+        }
+    }
+    self->rows++;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(spiram_series_append_obj, 2, 1 + SPIRAM_SERIES_COLS_MAX, spiram_series_append);
+
+STATIC void series_parse_range(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args, mp_arg_val_t *args, size_t n_allowed, const mp_arg_t *allowed_args, double *lo, double *hi) {
+    mp_arg_parse_all(n_args, pos_args, kw_args, n_allowed, allowed_args, args);
+    *lo = args[1].u_obj == mp_const_none ? -HUGE_VAL : series_to_double(args[1].u_obj);
+    *hi = args[2].u_obj == mp_const_none ? HUGE_VAL : series_to_double(args[2].u_obj);
+}
+
+// series.aggregate(col, lo=None, hi=None, *, where=0)
+// (count, min, max, sum) of column col over the rows where column where is in [lo, hi].
+// None is no limit. min and max are None if no row matches.
+
+STATIC mp_obj_t spiram_series_aggregate(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_col, ARG_lo, ARG_hi, ARG_where };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_col, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_lo, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_hi, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_where, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_INT(0)} },
+    };
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    double lo, hi;
+    series_parse_range(n_args - 1, pos_args + 1, kw_args, args, MP_ARRAY_SIZE(allowed_args), allowed_args, &lo, &hi);
+    size_t col = series_col_index(self, args[ARG_col].u_obj);
+    size_t where = series_col_index(self, args[ARG_where].u_obj);
+
+    series_acc_t acc = {0};
+    series_query(self, col, where, lo, hi, &acc);
+    char tc = self->typecode[col];
+    mp_obj_t t[4] = {
+        mp_obj_new_int_from_uint(acc.count),
+        acc.count ? series_from_double(tc, acc.min) : mp_const_none,
+        acc.count ? series_from_double(tc, acc.max) : mp_const_none,
+        series_from_double(tc, acc.sum),
+    };
+    return mp_obj_new_tuple(4, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(spiram_series_aggregate_obj, 2, spiram_series_aggregate);
+
+// series.select(col, lo, hi, out, *, where=0)
+// copy the values of column col, of the rows where column where is in [lo, hi], into out,
+// an array of the type of col. Returns the number of values; stops when out is full.
+
+STATIC mp_obj_t spiram_series_select(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_col, ARG_lo, ARG_hi, ARG_out, ARG_where };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_col, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_lo, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_hi, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_out, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_where, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_INT(0)} },
+    };
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    double lo, hi;
+    series_parse_range(n_args - 1, pos_args + 1, kw_args, args, MP_ARRAY_SIZE(allowed_args), allowed_args, &lo, &hi);
+    size_t col = series_col_index(self, args[ARG_col].u_obj);
+    size_t where = series_col_index(self, args[ARG_where].u_obj);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_out].u_obj, &bufinfo, MP_BUFFER_WRITE);
+
+    series_acc_t acc = {0};
+    acc.out = bufinfo.buf;
+    acc.out_len = bufinfo.len / self->itemsize[col];
+    series_query(self, col, where, lo, hi, &acc);
+    return mp_obj_new_int_from_uint(acc.count);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(spiram_series_select_obj, 5, spiram_series_select);
+
+// series.stats()
+// (rows, capacity in rows, blocks skipped, blocks from summary, blocks scanned) of the last query
+
+STATIC mp_obj_t spiram_series_stats(mp_obj_t self_in) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t t[5] = {
+        mp_obj_new_int_from_uint(self->rows),
+        mp_obj_new_int_from_uint(self->nblocks * self->block),
+        mp_obj_new_int_from_uint(self->skipped),
+        mp_obj_new_int_from_uint(self->whole),
+        mp_obj_new_int_from_uint(self->scanned),
+    };
+    return mp_obj_new_tuple(5, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_series_stats_obj, spiram_series_stats);
+
+STATIC mp_obj_t spiram_series_clear(mp_obj_t self_in) {
+    spiram_series_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    self->rows = 0;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_series_clear_obj, spiram_series_clear);
+
+STATIC const mp_rom_map_elem_t spiram_series_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_append), MP_ROM_PTR(&spiram_series_append_obj) },
+    { MP_ROM_QSTR(MP_QSTR_aggregate), MP_ROM_PTR(&spiram_series_aggregate_obj) },
+    { MP_ROM_QSTR(MP_QSTR_select), MP_ROM_PTR(&spiram_series_select_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_series_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&spiram_series_clear_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_series_locals_dict, spiram_series_locals_dict_table);
+
+const mp_obj_type_t spiram_series_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Series,
+    .print = spiram_series_print,
+    .make_new = spiram_series_make_new,
+    .unary_op = spiram_series_unary_op,
+    .subscr = spiram_series_subscr,
+    .locals_dict = (mp_obj_dict_t *)&spiram_series_locals_dict,
+};
+
+// not truncated
@@ -0,0 +1,17 @@
+/*
+ * columnar time series in spi ram, with per-block summaries
+ */
+#ifndef __SPIRAM_SERIES_H__
+#define __SPIRAM_SERIES_H__
+#include "py/obj.h"
+
+// most columns in a series
+#define SPIRAM_SERIES_COLS_MAX (8)
+
+// internal ram a scan copies a chunk of a column into
+#ifndef MICROPY_HW_SPIRAM_SERIES_CHUNK
+#define MICROPY_HW_SPIRAM_SERIES_CHUNK (2048)
+#endif
+
+extern const mp_obj_type_t spiram_series_type;
+#endif // __SPIRAM_SERIES_H__
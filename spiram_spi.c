@@ -0,0 +1,195 @@
+/*
+ * spi dma straight from and to spi ram buffers
+ */
+
+/* notes:
+ * the dma streams of the spi reach the memory-mapped spi ram over axi,
+ * so large buffers, like a frame for an spi lcd, need no copy to internal ram.
+ *
+ * - transfers are cut in chunks below the 65535 frame limit of the spi and the dma,
+ *   multiples of a cache line.
+ * - word aligned 8-bit transfers use 32-bit dma accesses with 16 byte memory bursts,
+ *   and spi data packing. This is four times fewer accesses on the qspi bus.
+ * - data cache: source cleaned, destination invalidated, whole cache above 16 kbyte.
+ * - dma stream priority and byte count go through spiram qos, client display.
+ *
+ * the dma stream is reconfigured, so the stream is invalidated afterwards,
+ * and the next machine.SPI transfer initializes it again.
+ *
+ * the patch sends machine.SPI transfers of MICROPY_HW_SPIRAM_SPI_MIN bytes and more
+ * here when a buffer is in spi ram, the frames are 8 bit and irqs are on. While the
+ * dma runs the scheduler runs, as in spiram.spi_write(); the stock spi_transfer()
+ * waits with wfi only.
+ */
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "irq.h"
+#include "dma.h"
+#include "spi.h"
+#include "mdma.h"
+#include "spiram.h"
+#include "spiram_qos.h"
+#include "spiram_spi.h"
+
+#if defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+
+#define SPIRAM_SPI_CHUNK (65504)
+
+// 32-bit memory and peripheral accesses, memory bursts of 4 words
+static void spiram_spi_dma_words(DMA_HandleTypeDef *dma) {
+    dma->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    dma->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    dma->Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    dma->Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    dma->Init.MemBurst = DMA_MBURST_INC4;
+    dma->Init.PeriphBurst = DMA_PBURST_SINGLE;
+    HAL_DMA_Init(dma);
+}
+
+static int spiram_spi_wait(SPI_HandleTypeDef *hspi, uint32_t timeout_ms) {
+    uint32_t start = mp_hal_ticks_ms();
+    while (HAL_SPI_GetState(hspi) != HAL_SPI_STATE_READY) {
+        if (mp_hal_ticks_ms() - start >= timeout_ms) {
+            HAL_SPI_Abort(hspi);
+            return -MP_ETIMEDOUT;
+        }
+        MICROPY_EVENT_POLL_HOOK
+    }
+    return hspi->ErrorCode == HAL_SPI_ERROR_NONE ? 0 : -MP_EIO;
+}
+
+int spiram_spi_transfer(const spi_t *spi, const uint8_t *src, uint8_t *dest, size_t len, uint32_t timeout_ms) {
+    SPI_HandleTypeDef *hspi = spi->spi;
+    if (len == 0) {
+        return 0;
+    }
+    if (hspi->Init.DataSize != SPI_DATASIZE_8BIT) {
+        return -MP_EINVAL;
+    }
+    bool words = (len & 3) == 0
+        && ((uint32_t)src & 3) == 0
+        && ((uint32_t)dest & 3) == 0;
+
+    DMA_HandleTypeDef tx_dma;
+    DMA_HandleTypeDef rx_dma;
+    hspi->hdmatx = NULL;
+    hspi->hdmarx = NULL;
+    if (src != NULL) {
+        dma_init(&tx_dma, spi->tx_dma_descr, DMA_MEMORY_TO_PERIPH, hspi);
+        if (words) {
+            spiram_spi_dma_words(&tx_dma);
+        }
+        spiram_qos_apply_dma(tx_dma.Instance, SPIRAM_QOS_DISPLAY);
+        hspi->hdmatx = &tx_dma;
+        mdma_dcache_clean(src, len);
+    }
+    if (dest != NULL) {
+        dma_init(&rx_dma, spi->rx_dma_descr, DMA_PERIPH_TO_MEMORY, hspi);
+        if (words) {
+            spiram_spi_dma_words(&rx_dma);
+        }
+        spiram_qos_apply_dma(rx_dma.Instance, SPIRAM_QOS_DISPLAY);
+        hspi->hdmarx = &rx_dma;
+        mdma_dcache_clean_invalidate(dest, len);
+    }
+    uint32_t fifo = hspi->Instance->CFG1 & SPI_CFG1_FTHLV;
+    if (words) {
+        // data packing: four frames per fifo access
+        MODIFY_REG(hspi->Instance->CFG1, SPI_CFG1_FTHLV, SPI_FIFO_THRESHOLD_04DATA);
+    }
+
+    int ret = 0;
+    for (size_t pos = 0; pos < len && ret == 0; pos += SPIRAM_SPI_CHUNK) {
+        uint16_t n = MIN(len - pos, SPIRAM_SPI_CHUNK);
+        HAL_StatusTypeDef status;
+        if (dest == NULL) {
+            status = HAL_SPI_Transmit_DMA(hspi, (uint8_t *)src + pos, n);
+        } else if (src == NULL) {
+            status = HAL_SPI_Receive_DMA(hspi, dest + pos, n);
+        } else {
+            status = HAL_SPI_TransmitReceive_DMA(hspi, (uint8_t *)src + pos, dest + pos, n);
+        }
+        ret = status == HAL_OK ? spiram_spi_wait(hspi, timeout_ms) : -MP_EIO;
+        if (ret == 0) {
+            spiram_qos_account(SPIRAM_QOS_DISPLAY, n);
+        }
+    }
+
+    MODIFY_REG(hspi->Instance->CFG1, SPI_CFG1_FTHLV, fifo);
+    if (src != NULL) {
+        dma_deinit(spi->tx_dma_descr);
+        dma_invalidate_channel(spi->tx_dma_descr);
+    }
+    if (dest != NULL) {
+        dma_deinit(spi->rx_dma_descr);
+        dma_invalidate_channel(spi->rx_dma_descr);
+        mdma_dcache_invalidate(dest, len);
+    }
+    hspi->hdmatx = NULL;
+    hspi->hdmarx = NULL;
+    return ret;
+}
+
+static inline bool spiram_spi_in_spiram(const uint8_t *p) {
+    return p != NULL && (void *)p >= spiram_start() && (void *)p < spiram_end();
+}
+
+bool spiram_spi_route(const spi_t *spi, const uint8_t *src, const uint8_t *dest, size_t len) {
+    return len >= MICROPY_HW_SPIRAM_SPI_MIN
+           && spi->spi->Init.DataSize == SPI_DATASIZE_8BIT
+           && (src == NULL || spi->tx_dma_descr != NULL)
+           && (dest == NULL || spi->rx_dma_descr != NULL)
+           && query_irq() == IRQ_STATE_ENABLED
+           && (spiram_spi_in_spiram(src) || spiram_spi_in_spiram(dest));
+}
+
+// -----------------------------------------------------------------------------
+
+static void spiram_spi_call(mp_obj_t spi_in, const uint8_t *src, uint8_t *dest, size_t len) {
+    int ret = spiram_spi_transfer(spi_from_mp_obj(spi_in), src, dest, len, 1000);
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+}
+
+// spiram.spi_write(spi, buf)
+// spi is a machine.SPI or pyb.SPI; buf can be in spi ram.
+
+STATIC mp_obj_t spiram_spi_write(mp_obj_t spi_in, mp_obj_t buf_in) {
+    mp_buffer_info_t src;
+    mp_get_buffer_raise(buf_in, &src, MP_BUFFER_READ);
+    spiram_spi_call(spi_in, src.buf, NULL, src.len);
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_2(spiram_spi_write_obj, spiram_spi_write);
+
+// spiram.spi_readinto(spi, buf)
+
+STATIC mp_obj_t spiram_spi_readinto(mp_obj_t spi_in, mp_obj_t buf_in) {
+    mp_buffer_info_t dest;
+    mp_get_buffer_raise(buf_in, &dest, MP_BUFFER_WRITE);
+    spiram_spi_call(spi_in, NULL, dest.buf, dest.len);
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_2(spiram_spi_readinto_obj, spiram_spi_readinto);
+
+// spiram.spi_write_readinto(spi, write_buf, read_buf)
+
+STATIC mp_obj_t spiram_spi_write_readinto(mp_obj_t spi_in, mp_obj_t wr_in, mp_obj_t rd_in) {
+    mp_buffer_info_t src;
+    mp_buffer_info_t dest;
+    mp_get_buffer_raise(wr_in, &src, MP_BUFFER_READ);
+    mp_get_buffer_raise(rd_in, &dest, MP_BUFFER_WRITE);
+    if (src.len != dest.len) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buffers must be the same length"));
+    }
+    spiram_spi_call(spi_in, src.buf, dest.buf, src.len);
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_3(spiram_spi_write_readinto_obj, spiram_spi_write_readinto);
+
+#endif
+
+// not truncated
@@ -0,0 +1,26 @@
+/*
+ * spi dma straight from and to spi ram buffers
+ */
+#ifndef __SPIRAM_SPI_H__
+#define __SPIRAM_SPI_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "py/obj.h"
+#include "spi.h"
+
+// src or dest may be NULL. Returns 0 or negative errno.
+int spiram_spi_transfer(const spi_t *spi, const uint8_t *src, uint8_t *dest, size_t len, uint32_t timeout_ms);
+
+// machine.SPI transfers from this many bytes on, with a buffer in spi ram, go to spiram_spi_transfer()
+#ifndef MICROPY_HW_SPIRAM_SPI_MIN
+#define MICROPY_HW_SPIRAM_SPI_MIN (1024)
+#endif
+
+// for spi_transfer() of the patch: true if spiram_spi_transfer() should do this transfer
+bool spiram_spi_route(const spi_t *spi, const uint8_t *src, const uint8_t *dest, size_t len);
+
+MP_DECLARE_CONST_FUN_OBJ_2(spiram_spi_write_obj);
+MP_DECLARE_CONST_FUN_OBJ_2(spiram_spi_readinto_obj);
+MP_DECLARE_CONST_FUN_OBJ_3(spiram_spi_write_readinto_obj);
+#endif // __SPIRAM_SPI_H__
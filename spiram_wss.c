@@ -0,0 +1,339 @@
+/*
+ * working set estimator for spi ram, mpu sub-region access tracking
+ */
+
+/* notes:
+ * mpu regions of 1 Mbyte, eight for 8 Mbyte, cover the spi ram mapping, at a higher
+ * region number than the mapping itself, so they take priority. They are no-access
+ * regions. A sub-region that is enabled traps the first access to its 128 kbyte;
+ * the memmanage handler records the block and disables the sub-region, so the
+ * access is retried through the normal mapping and later accesses run at full speed.
+ *
+ * every window, lptim2 closes the window and enables all sub-regions again.
+ * The cost is one fault per touched block per window.
+ *
+ * micropython owns the fault handlers, so ram_vectors replaces the memmanage
+ * and hardfault entries with handlers that check for a tracked block first;
+ * other faults go to the original handlers. A fault with irq disabled escalates
+ * to hardfault, and is handled there the same way.
+ * A data access has its address in MMFAR. Native and viper code can be on the heap
+ * in spi ram, and an instruction fetch from a trapped block faults with IACCVIOL and
+ * no address; the stacked pc is the instruction, and the second half of a 32 bit
+ * instruction can be in the next block. A fault in a block that is not trapped is
+ * not ours, and goes to the original handler.
+ * The mpu only checks the cpu; dma traffic is not counted.
+ */
+
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/objlist.h"
+#include "irq.h"
+#include "ram_vectors.h"
+#include "spiram_wss.h"
+
+#if MICROPY_HW_ENABLE_SPIRAM_WSS
+
+// first of eight regions, above the regions micropython uses
+#ifndef MICROPY_HW_SPIRAM_WSS_MPU_REGION
+#define MICROPY_HW_SPIRAM_WSS_MPU_REGION (8)
+#endif
+
+// one bit per block in wss_hit, and the regions must fit the mpu
+_Static_assert(SPIRAM_WSS_BLOCKS <= 64 && SPIRAM_WSS_REGIONS >= 1, "spi ram size not supported by wss");
+_Static_assert(MICROPY_HW_SPIRAM_WSS_MPU_REGION + SPIRAM_WSS_REGIONS <= 16, "not enough mpu regions");
+
+#define WSS_BASE (SPIRAM_MAP_ADDR)
+#define WSS_REGIONS (SPIRAM_WSS_REGIONS)
+#define WSS_TICK_HZ (100)
+
+#define WSS_RASR_TRAP ( \
+    MPU_INSTRUCTION_ACCESS_DISABLE << MPU_RASR_XN_Pos \
+        | MPU_REGION_NO_ACCESS << MPU_RASR_AP_Pos \
+        | MPU_REGION_SIZE_1MB << MPU_RASR_SIZE_Pos \
+        | MPU_REGION_ENABLE << MPU_RASR_ENABLE_Pos \
+    )
+
+static volatile bool wss_running = false;
+static volatile uint64_t wss_hit;           // blocks accessed in this window
+static volatile uint32_t wss_ticks;
+static uint32_t wss_window_ticks;
+static volatile uint32_t wss_windows;
+static volatile uint32_t wss_faults;
+static volatile uint32_t wss_last;          // blocks in the last window
+static volatile uint32_t wss_max;
+static uint32_t wss_heat[SPIRAM_WSS_BLOCKS];
+
+static void wss_arm(void) {
+    uint32_t rnr = MPU->RNR;
+    for (uint32_t r = 0; r < WSS_REGIONS; ++r) {
+        MPU->RNR = MICROPY_HW_SPIRAM_WSS_MPU_REGION + r;
+        MPU->RBAR = WSS_BASE + r * (1024 * 1024);
+        MPU->RASR = WSS_RASR_TRAP;
+    }
+    MPU->RNR = rnr;
+    __DSB();
+    __ISB();
+}
+
+static void wss_disarm(void) {
+    uint32_t rnr = MPU->RNR;
+    for (uint32_t r = 0; r < WSS_REGIONS; ++r) {
+        MPU->RNR = MICROPY_HW_SPIRAM_WSS_MPU_REGION + r;
+        MPU->RASR = 0;
+    }
+    MPU->RNR = rnr;
+    __DSB();
+    __ISB();
+}
+
+// a block was touched: record it, and let the access through
+static bool wss_fault(uint32_t addr) {
+    if (!wss_running || addr < WSS_BASE || addr >= WSS_BASE + SPIRAM_WSS_BLOCKS * SPIRAM_WSS_BLOCK_SIZE) {
+        return false;
+    }
+    uint32_t block = (addr - WSS_BASE) / SPIRAM_WSS_BLOCK_SIZE;
+    uint32_t srd = 1 << (MPU_RASR_SRD_Pos + block % 8);
+    uint32_t rnr = MPU->RNR;
+    MPU->RNR = MICROPY_HW_SPIRAM_WSS_MPU_REGION + block / 8;
+    if (MPU->RASR & srd) {
+        // not trapped
+        MPU->RNR = rnr;
+        return false;
+    }
+    MPU->RASR |= srd;
+    MPU->RNR = rnr;
+    wss_hit |= 1ull << block;
+    wss_faults += 1;
+    __DSB();
+    __ISB();
+    return true;
+}
+
+// called from the fault handlers, with the exception frame. Returns 1 if the fault was a tracked block.
+int spiram_wss_fault_check(const uint32_t *frame) {
+    uint32_t cfsr = SCB->CFSR;
+    uint32_t clear = 0;
+    if ((cfsr & SCB_CFSR_MMARVALID_Msk) && (cfsr & SCB_CFSR_DACCVIOL_Msk)) {
+        if (wss_fault(SCB->MMFAR)) {
+            clear = SCB_CFSR_MMARVALID_Msk | SCB_CFSR_DACCVIOL_Msk;
+        }
+    } else if (cfsr & SCB_CFSR_IACCVIOL_Msk) {
+        uint32_t pc = frame[6];
+        bool hit = wss_fault(pc);
+        if ((pc + 2) / SPIRAM_WSS_BLOCK_SIZE != pc / SPIRAM_WSS_BLOCK_SIZE) {
+            hit = wss_fault(pc + 2) || hit;
+        }
+        if (hit) {
+            clear = SCB_CFSR_IACCVIOL_Msk;
+        }
+    }
+    if (clear == 0) {
+        return 0;
+    }
+    SCB->CFSR = clear;
+    // escalated to hardfault, e.g. with irq disabled
+    SCB->HFSR = SCB_HFSR_FORCED_Msk;
+    return 1;
+}
+
+// fault handler entries: return to retry the access, else tail-call the original
+// handler, with the exception frame as it was. r0 is the exception frame, on msp or psp.
+uint32_t spiram_wss_memmanage_saved;
+uint32_t spiram_wss_hardfault_saved;
+
+__attribute__((naked)) static void wss_memmanage(void) {
+    __asm volatile (
+        "tst lr, #4\n"
+        "ite eq\n"
+        "mrseq r0, msp\n"
+        "mrsne r0, psp\n"
+        "push {r4, lr}\n"
+        "bl spiram_wss_fault_check\n"
+        "pop {r4, lr}\n"
+        "cbz r0, 1f\n"
+        "bx lr\n"
+        "1: ldr r0, =spiram_wss_memmanage_saved\n"
+        "ldr r0, [r0]\n"
+        "bx r0\n"
+        );
+}
+
+__attribute__((naked)) static void wss_hardfault(void) {
+    __asm volatile (
+        "tst lr, #4\n"
+        "ite eq\n"
+        "mrseq r0, msp\n"
+        "mrsne r0, psp\n"
+        "push {r4, lr}\n"
+        "bl spiram_wss_fault_check\n"
+        "pop {r4, lr}\n"
+        "cbz r0, 1f\n"
+        "bx lr\n"
+        "1: ldr r0, =spiram_wss_hardfault_saved\n"
+        "ldr r0, [r0]\n"
+        "bx r0\n"
+        );
+}
+
+void LPTIM2_IRQHandler(void) {
+    IRQ_ENTER(LPTIM2_IRQn);
+    LPTIM2->ICR = LPTIM_ICR_ARRMCF;
+    if (wss_running && ++wss_ticks >= wss_window_ticks) {
+        wss_ticks = 0;
+        uint32_t irq_state = disable_irq();
+        uint64_t hit = wss_hit;
+        wss_hit = 0;
+        enable_irq(irq_state);
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < SPIRAM_WSS_BLOCKS; ++i) {
+            if (hit & (1ull << i)) {
+                wss_heat[i] += 1;
+                n += 1;
+            }
+        }
+        wss_last = n;
+        wss_max = MAX(wss_max, n);
+        wss_windows += 1;
+        wss_arm();
+    }
+    IRQ_EXIT(LPTIM2_IRQn);
+}
+
+static void wss_timer_start(void) {
+    __HAL_RCC_LPTIM2_CLK_ENABLE();
+    __HAL_RCC_LPTIM2_FORCE_RESET();
+    __HAL_RCC_LPTIM2_RELEASE_RESET();
+    // pclk4, divided by 128
+    uint32_t freq = HAL_RCCEx_GetD3PCLK1Freq() / 128;
+    LPTIM2->CFGR = 7 << LPTIM_CFGR_PRESC_Pos;
+    LPTIM2->IER = LPTIM_IER_ARRMIE;
+    LPTIM2->CR = LPTIM_CR_ENABLE;
+    LPTIM2->ARR = freq / WSS_TICK_HZ - 1;
+    while (!(LPTIM2->ISR & LPTIM_ISR_ARROK)) {
+    }
+    LPTIM2->ICR = LPTIM_ICR_ARROKCF;
+    NVIC_SetPriority(LPTIM2_IRQn, IRQ_PRI_TIMX);
+    HAL_NVIC_EnableIRQ(LPTIM2_IRQn);
+    LPTIM2->CR |= LPTIM_CR_CNTSTRT;
+}
+
+static void wss_timer_stop(void) {
+    HAL_NVIC_DisableIRQ(LPTIM2_IRQn);
+    LPTIM2->CR = 0;
+    __HAL_RCC_LPTIM2_CLK_DISABLE();
+}
+
+int spiram_wss_start(uint32_t window_ms) {
+    if (window_ms < 1000 / WSS_TICK_HZ) {
+        return -MP_EINVAL;
+    }
+    spiram_wss_stop();
+    wss_window_ticks = window_ms * WSS_TICK_HZ / 1000;
+    wss_ticks = 0;
+    wss_hit = 0;
+    wss_windows = 0;
+    wss_faults = 0;
+    wss_last = 0;
+    wss_max = 0;
+    memset(wss_heat, 0, sizeof(wss_heat));
+
+    spiram_wss_hardfault_saved = ram_vector_set(HardFault_IRQn, (uint32_t)wss_hardfault);
+    spiram_wss_memmanage_saved = ram_vector_set(MemoryManagement_IRQn, (uint32_t)wss_memmanage);
+    uint32_t irq_state = disable_irq();
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
+    wss_running = true;
+    wss_arm();
+    enable_irq(irq_state);
+
+    wss_timer_start();
+    return 0;
+}
+
+void spiram_wss_stop(void) {
+    if (!wss_running) {
+        return;
+    }
+    wss_timer_stop();
+    uint32_t irq_state = disable_irq();
+    wss_running = false;
+    wss_disarm();
+    enable_irq(irq_state);
+    ram_vector_set(HardFault_IRQn, spiram_wss_hardfault_saved);
+    ram_vector_set(MemoryManagement_IRQn, spiram_wss_memmanage_saved);
+}
+
+bool spiram_wss_running(void) {
+    return wss_running;
+}
+
+uint32_t spiram_wss_windows(void) {
+    return wss_windows;
+}
+
+void spiram_wss_heatmap(uint32_t *heat) {
+    uint32_t irq_state = disable_irq();
+    memcpy(heat, wss_heat, sizeof(wss_heat));
+    enable_irq(irq_state);
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// spiram.wss_start(window_ms=1000)
+
+STATIC mp_obj_t spiram_wss_start_fn(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_window_ms };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_window_ms, MP_ARG_INT, {.u_int = 1000} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    int ret = spiram_wss_start(args[ARG_window_ms].u_int);
+    if (ret != 0) {
+        mp_raise_OSError(-ret);
+    }
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_KW(spiram_wss_start_obj, 0, spiram_wss_start_fn);
+
+STATIC mp_obj_t spiram_wss_stop_fn(void) {
+    spiram_wss_stop();
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(spiram_wss_stop_obj, spiram_wss_stop_fn);
+
+// spiram.wss_stats()
+// returns (windows, faults, bytes touched in the last window, max bytes touched in a window)
+
+STATIC mp_obj_t spiram_wss_stats_fn(void) {
+    mp_obj_t t[4] = {
+        mp_obj_new_int_from_uint(wss_windows),
+        mp_obj_new_int_from_uint(wss_faults),
+        mp_obj_new_int_from_uint(wss_last * SPIRAM_WSS_BLOCK_SIZE),
+        mp_obj_new_int_from_uint(wss_max * SPIRAM_WSS_BLOCK_SIZE),
+    };
+    return mp_obj_new_tuple(4, t);
+}
+MP_DEFINE_CONST_FUN_OBJ_0(spiram_wss_stats_obj, spiram_wss_stats_fn);
+
+// spiram.wss_heatmap()
+// returns a list with, for each 128 kbyte block of spi ram, the number of windows it was accessed in
+
+STATIC mp_obj_t spiram_wss_heatmap_fn(void) {
+    uint32_t heat[SPIRAM_WSS_BLOCKS];
+    spiram_wss_heatmap(heat);
+    mp_obj_t list = mp_obj_new_list(SPIRAM_WSS_BLOCKS, NULL);
+    mp_obj_list_t *l = MP_OBJ_TO_PTR(list);
+    for (uint32_t i = 0; i < SPIRAM_WSS_BLOCKS; ++i) {
+        l->items[i] = mp_obj_new_int_from_uint(heat[i]);
+    }
+    return list;
+}
+MP_DEFINE_CONST_FUN_OBJ_0(spiram_wss_heatmap_obj, spiram_wss_heatmap_fn);
+
+#endif // MICROPY_HW_ENABLE_SPIRAM_WSS
+
+// not truncated
@@ -0,0 +1,33 @@
+/*
+ * working set estimator for spi ram, mpu sub-region access tracking
+ */
+#ifndef __SPIRAM_WSS_H__
+#define __SPIRAM_WSS_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include "py/obj.h"
+#include "spiram_config.h"
+
+#ifndef MICROPY_HW_ENABLE_SPIRAM_WSS
+#define MICROPY_HW_ENABLE_SPIRAM_WSS (0)
+#endif
+
+// mpu regions of 1 Mbyte, 8 sub-regions each: blocks of 128 kbyte,
+// 64 blocks for 8 Mbyte
+#define SPIRAM_WSS_BLOCK_SIZE (128 * 1024)
+#define SPIRAM_WSS_REGIONS (SPIRAM_SIZE / (1024 * 1024))
+#define SPIRAM_WSS_BLOCKS (SPIRAM_SIZE / SPIRAM_WSS_BLOCK_SIZE)
+
+int spiram_wss_start(uint32_t window_ms);
+void spiram_wss_stop(void);
+bool spiram_wss_running(void);
+
+// windows seen, and for each block the number of windows it was accessed in
+uint32_t spiram_wss_windows(void);
+void spiram_wss_heatmap(uint32_t *heat);
+
+MP_DECLARE_CONST_FUN_OBJ_KW(spiram_wss_start_obj);
+MP_DECLARE_CONST_FUN_OBJ_0(spiram_wss_stop_obj);
+MP_DECLARE_CONST_FUN_OBJ_0(spiram_wss_stats_obj);
+MP_DECLARE_CONST_FUN_OBJ_0(spiram_wss_heatmap_obj);
+#endif // __SPIRAM_WSS_H__
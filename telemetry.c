@@ -0,0 +1,255 @@
+/*
+ * binary telemetry stream, e.g. on the second usb vcp
+ */
+
+/* notes:
+ * the boards have two usb vcps; the repl is on the first, the second is idle.
+ * spiram.Telemetry(stream, period_ms) writes a snapshot of the counters to a stream
+ * every period: dma bytes to and from spi ram per qos client, bytes of the octospi
+ * sequencer and crc peripheral, gc pauses, the heap, and octospi errors. The frame
+ * is 84 bytes, binary, little-endian, with a magic, a length and a crc32, so a reader
+ * finds the start of the next frame after lost bytes. See telemetry.h for the layout.
+ *
+ * A periodic soft timer schedules the snapshot in the interpreter, between bytecodes,
+ * as the idle flush of sd_stage.c. The stream is polled for room first; a frame that
+ * does not fit is counted and dropped, so a vcp without a reader never blocks.
+ * Nothing is written to the repl.
+ *
+ * The heap numbers come from gc_info(), which reads the whole allocation table:
+ * 128 kbyte in spi ram for an 8 Mbyte heap, about a millisecond. Hence a period of
+ * a second by default, and heap=False leaves them out.
+ *
+ * gc pauses are timed in gc_collect(); the patch adds the call.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "py/mphal.h"
+#include "py/runtime.h"
+#include "py/stream.h"
+#include "py/gc.h"
+#include "lib/uzlib/tinf.h"
+#include "softtimer.h"
+#include "spiram.h"
+#include "spiram_qos.h"
+#include "spiram_seq.h"
+#include "spiram_heap.h"
+#include "crc_dma.h"
+#include "telemetry.h"
+
+#if MICROPY_HW_ENABLE_TELEMETRY && defined(MICROPY_HW_SPIRAM_SIZE_BITS_LOG2)
+
+_Static_assert(sizeof(telemetry_frame_t) <= 255, "telemetry frame length does not fit a byte");
+
+typedef struct _spiram_telemetry_obj_t {
+    soft_timer_entry_t timer;   // first, its base is the object base
+    mp_obj_t stream;
+    uint32_t period_ms;
+    bool heap;
+    bool running;
+    uint32_t seq;
+    uint32_t dropped;
+    uint32_t bytes;
+} spiram_telemetry_obj_t;
+
+static uint32_t telemetry_gc_count;
+static uint32_t telemetry_gc_last_us;
+static uint32_t telemetry_gc_max_us;
+static uint32_t telemetry_gc_total_us;
+
+void telemetry_gc_pause(uint32_t us) {
+    ++telemetry_gc_count;
+    telemetry_gc_last_us = us;
+    telemetry_gc_max_us = MAX(telemetry_gc_max_us, us);
+    telemetry_gc_total_us += us;
+}
+
+static void telemetry_snapshot(spiram_telemetry_obj_t *self, telemetry_frame_t *f) {
+    memset(f, 0, sizeof(*f));
+    f->magic = TELEMETRY_MAGIC;
+    f->version = TELEMETRY_VERSION;
+    f->len = sizeof(*f);
+    f->seq = self->seq;
+    f->ms = mp_hal_ticks_ms();
+    f->dropped = self->dropped;
+
+    uint64_t bytes[SPIRAM_QOS_NUM_CLIENTS];
+    spiram_qos_stats(bytes);
+    for (size_t i = 0; i < SPIRAM_QOS_NUM_CLIENTS; ++i) {
+        f->dma_bytes[i] = bytes[i];
+    }
+    #if MICROPY_HW_ENABLE_SPIRAM_SEQ
+    spiram_seq_stats_t seq;
+    spiram_seq_get_stats(&seq);
+    f->seq_bytes = seq.bytes;
+    #endif
+    #if MICROPY_HW_ENABLE_CRC_DMA
+    crc_dma_stats_t crc;
+    crc_dma_get_stats(&crc);
+    f->crc_bytes = crc.bytes_dma;
+    #endif
+
+    f->gc_count = telemetry_gc_count;
+    f->gc_last_us = telemetry_gc_last_us;
+    f->gc_max_us = telemetry_gc_max_us;
+    f->gc_total_us = telemetry_gc_total_us;
+
+    #if MICROPY_HW_SPIRAM_HEAP_GROW
+    spiram_heap_info_t info;
+    spiram_heap_get_info(&info);
+    f->heap_flags = (info.in_spiram ? TELEMETRY_HEAP_IN_SPIRAM : 0) | (info.failed ? TELEMETRY_HEAP_GROW_FAILED : 0);
+    f->spiram_tested = info.tested;
+    #else
+    f->heap_flags = (void *)MP_STATE_MEM(gc_pool_start) >= spiram_start() ? TELEMETRY_HEAP_IN_SPIRAM : 0;
+    f->spiram_tested = SPIRAM_SIZE;
+    #endif
+    if (self->heap) {
+        gc_info_t gc;
+        gc_info(&gc);
+        f->heap_total = gc.total;
+        f->heap_used = gc.used;
+        f->heap_max_free = gc.max_free * MICROPY_BYTES_PER_GC_BLOCK;
+    }
+
+    f->ospi_errors = spiram_ospi_error_count();
+    f->crc = uzlib_crc32(f, offsetof(telemetry_frame_t, crc), 0xffffffff) ^ 0xffffffff;
+}
+
+// -----------------------------------------------------------------------------
+// python interface
+
+// scheduled by the soft timer
+STATIC mp_obj_t spiram_telemetry_tick(mp_obj_t self_in) {
+    spiram_telemetry_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->running) {
+        return mp_const_none;
+    }
+    const mp_stream_p_t *stream = mp_get_stream(self->stream);
+    int err;
+    // only when the whole frame fits; never wait for the reader
+    mp_uint_t ret = stream->ioctl(self->stream, MP_STREAM_POLL, MP_STREAM_POLL_WR, &err);
+    if (ret == MP_STREAM_ERROR || !(ret & MP_STREAM_POLL_WR)) {
+        ++self->dropped;
+        ++self->seq;
+        return mp_const_none;
+    }
+    telemetry_frame_t frame;
+    telemetry_snapshot(self, &frame);
+    telemetry_gc_max_us = 0;
+    ++self->seq;
+    ret = stream->write(self->stream, &frame, sizeof(frame), &err);
+    if (ret == MP_STREAM_ERROR || ret != sizeof(frame)) {
+        ++self->dropped;
+    } else {
+        self->bytes += ret;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_telemetry_tick_obj, spiram_telemetry_tick);
+
+STATIC void spiram_telemetry_start(spiram_telemetry_obj_t *self) {
+    if (self->running) {
+        return;
+    }
+    soft_timer_insert(&self->timer, self->period_ms);
+    self->running = true;
+}
+
+// spiram.Telemetry(stream, period_ms=1000, *, heap=True)
+// e.g. spiram.Telemetry(pyb.USB_VCP(1)), with pyb.usb_mode('VCP+VCP') in boot.py.
+// Keep a reference; the stream stops when the object is collected.
+
+STATIC mp_obj_t spiram_telemetry_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    enum { ARG_stream, ARG_period_ms, ARG_heap };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_stream, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_period_ms, MP_ARG_INT, {.u_int = 1000} },
+        { MP_QSTR_heap, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_get_stream_raise(args[ARG_stream].u_obj, MP_STREAM_OP_WRITE | MP_STREAM_OP_IOCTL);
+    if (args[ARG_period_ms].u_int <= 0) {
+        mp_raise_ValueError(NULL);
+    }
+
+    spiram_telemetry_obj_t *self = m_new_obj_with_finaliser(spiram_telemetry_obj_t);
+    memset(self, 0, sizeof(*self));
+    self->timer.pairheap.base.type = type;
+    self->stream = args[ARG_stream].u_obj;
+    self->period_ms = args[ARG_period_ms].u_int;
+    self->timer.flags = SOFT_TIMER_FLAG_PY_CALLBACK | SOFT_TIMER_FLAG_GC_ALLOCATED;
+    self->timer.mode = SOFT_TIMER_MODE_PERIODIC;
+    self->timer.delta_ms = self->period_ms;
+    self->timer.py_callback = MP_OBJ_FROM_PTR(&spiram_telemetry_tick_obj);
+    self->heap = args[ARG_heap].u_bool;
+    spiram_telemetry_start(self);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC void spiram_telemetry_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    spiram_telemetry_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_printf(print, "Telemetry(period_ms=%u, %s)", self->period_ms, self->running ? "running" : "stopped");
+}
+
+// snapshot() returns the frame that would be sent now, as bytes
+STATIC mp_obj_t spiram_telemetry_snapshot(mp_obj_t self_in) {
+    spiram_telemetry_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    telemetry_frame_t frame;
+    telemetry_snapshot(self, &frame);
+    return mp_obj_new_bytes((const byte *)&frame, sizeof(frame));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_telemetry_snapshot_obj, spiram_telemetry_snapshot);
+
+// stats() returns (frames, frames dropped, bytes sent)
+STATIC mp_obj_t spiram_telemetry_stats(mp_obj_t self_in) {
+    spiram_telemetry_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t t[3] = {
+        mp_obj_new_int_from_uint(self->seq),
+        mp_obj_new_int_from_uint(self->dropped),
+        mp_obj_new_int_from_uint(self->bytes),
+    };
+    return mp_obj_new_tuple(3, t);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_telemetry_stats_obj, spiram_telemetry_stats);
+
+STATIC mp_obj_t spiram_telemetry_resume(mp_obj_t self_in) {
+    spiram_telemetry_start(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_telemetry_resume_obj, spiram_telemetry_resume);
+
+// take the timer off the soft timer heap before the object is freed
+STATIC mp_obj_t spiram_telemetry_deinit(mp_obj_t self_in) {
+    spiram_telemetry_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->running) {
+        soft_timer_remove(&self->timer);
+        self->running = false;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(spiram_telemetry_deinit_obj, spiram_telemetry_deinit);
+
+STATIC const mp_rom_map_elem_t spiram_telemetry_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_snapshot), MP_ROM_PTR(&spiram_telemetry_snapshot_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&spiram_telemetry_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_start), MP_ROM_PTR(&spiram_telemetry_resume_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&spiram_telemetry_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&spiram_telemetry_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&spiram_telemetry_deinit_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(spiram_telemetry_locals_dict, spiram_telemetry_locals_dict_table);
+
+const mp_obj_type_t spiram_telemetry_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Telemetry,
+    .print = spiram_telemetry_print,
+    .make_new = spiram_telemetry_make_new,
+    .locals_dict = (mp_obj_dict_t *)&spiram_telemetry_locals_dict,
+};
+
+#endif // MICROPY_HW_ENABLE_TELEMETRY
+
+// not truncated
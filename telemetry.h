@@ -0,0 +1,49 @@
+/*
+ * binary telemetry stream, e.g. on the second usb vcp
+ */
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+#include <stdint.h>
+#include "py/obj.h"
+#include "spiram_qos.h"
+
+#ifndef MICROPY_HW_ENABLE_TELEMETRY
+#define MICROPY_HW_ENABLE_TELEMETRY (0)
+#endif
+
+#define TELEMETRY_MAGIC (0x4d54)        // "TM"
+#define TELEMETRY_VERSION (2)
+
+// heap_flags
+#define TELEMETRY_HEAP_IN_SPIRAM (1 << 0)
+#define TELEMETRY_HEAP_GROW_FAILED (1 << 1)
+
+// one snapshot, little-endian. Byte counters are totals modulo 2^32; the reader takes differences.
+typedef struct __attribute__((packed)) _telemetry_frame_t {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t len;                // bytes of the frame, crc included
+    uint32_t seq;               // frame number; a gap is a frame lost
+    uint32_t ms;                // mp_hal_ticks_ms()
+    uint32_t dropped;           // frames not sent, the stream was full
+    uint32_t dma_bytes[SPIRAM_QOS_NUM_CLIENTS]; // dma bytes to and from spi ram per qos client
+    uint32_t seq_bytes;         // bytes of the octospi sequencer
+    uint32_t crc_bytes;         // bytes fed to the crc peripheral by mdma
+    uint32_t gc_count;          // collections
+    uint32_t gc_last_us;        // pause of the last collection
+    uint32_t gc_max_us;         // longest pause since the frame before
+    uint32_t gc_total_us;       // all pauses, modulo 2^32
+    uint32_t heap_flags;
+    uint32_t heap_total;        // gc heap bytes
+    uint32_t heap_used;
+    uint32_t heap_max_free;     // largest free run
+    uint32_t spiram_tested;     // spi ram bytes tested and usable for the heap
+    uint32_t ospi_errors;
+    uint32_t crc;               // crc32 of zlib, of the bytes before
+} telemetry_frame_t;
+
+// gc_collect() reports each pause
+void telemetry_gc_pause(uint32_t us);
+
+extern const mp_obj_type_t spiram_telemetry_type;
+#endif // __TELEMETRY_H__